@@ -1,7 +1,9 @@
 #ifndef MEM_ALLOCATOR_H
 #define MEM_ALLOCATOR_H
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 
 namespace mem {
 
@@ -19,8 +21,71 @@ public:
     virtual void* allocate(size_t size, size_t alignment = DefaultAlignment, size_t offset = 0) = 0;
     virtual void release(void* addr) = 0;
     virtual size_t getAllocationSize(void* mem) const = 0;
+
+    /**
+     * Allocates count blocks of size bytes each into out, returns the number of blocks
+     * allocated. Allocators which can do better than one allocate() per block override
+     * these.
+     */
+    virtual size_t allocateBatch(size_t size, size_t alignment, size_t count, void** out, size_t offset = 0);
+    virtual void releaseBatch(void** ptrs, size_t count);
+
+    /**
+     * Resizes the allocation at addr to size bytes, keeping its contents up to the smaller
+     * of the two sizes. The allocation is moved if it can't be resized where it is, a null
+     * addr allocates.
+     */
+    virtual void* reallocate(void* addr, size_t size, size_t alignment = DefaultAlignment, size_t offset = 0);
+
+    /**
+     * Grows the allocation at addr to at least size bytes without moving it, returns false
+     * if that isn't possible.
+     */
+    virtual bool tryExpandInPlace(void* addr, size_t size) { return false; }
+
+    /**
+     * Gives memory past the first size bytes of the allocation back to the allocator, if
+     * it's able to. The allocation never moves.
+     */
+    virtual void shrinkInPlace(void* addr, size_t size) { }
 };
 
+inline size_t Allocator::allocateBatch(size_t size, size_t alignment, size_t count, void** out, size_t offset)
+{
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = allocate(size, alignment, offset);
+        if (!out[i]) {
+            return i;
+        }
+    }
+    return count;
+}
+
+inline void Allocator::releaseBatch(void** ptrs, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        release(ptrs[i]);
+    }
+}
+
+inline void* Allocator::reallocate(void* addr, size_t size, size_t alignment, size_t offset)
+{
+    if (!addr) {
+        return allocate(size, alignment, offset);
+    }
+
+    if (tryExpandInPlace(addr, size)) {
+        return addr;
+    }
+
+    void* mem = allocate(size, alignment, offset);
+    if (mem) {
+        memcpy(mem, addr, std::min(getAllocationSize(addr), size));
+        release(addr);
+    }
+    return mem;
+}
+
 } 
 
 #endif
@@ -0,0 +1,34 @@
+#include "mem/area.h"
+using namespace mem;
+
+#include <sys/mman.h>
+
+#include "mem/util.h"
+
+PageArea::PageArea(size_t size, unsigned flags, util::PageBacking pageBacking) :
+    _size(mem::align(size, util::getPageSize(pageBacking))),
+    _isLocked(false)
+{
+    _start = (char*)util::pageAllocate(_size, pageBacking);
+    assert(_start);
+
+    if (flags & Lock) {
+        // Faults the pages in as well
+        _isLocked = mlock(_start, _size) == 0;
+    }
+
+    if ((flags & Prefault) && !_isLocked) {
+        size_t pageSize = util::getPageSize();
+        for (char* page = _start; page < _start + _size; page += pageSize) {
+            *(volatile char*)page = 0;
+        }
+    }
+}
+
+PageArea::~PageArea()
+{
+    if (_isLocked) {
+        munlock(_start, _size);
+    }
+    util::pageRelease(_start, _size);
+}
@@ -0,0 +1,134 @@
+#ifndef MEM_AREA_H
+#define MEM_AREA_H
+
+#include <cassert>
+#include <cstddef>
+
+#include "util/memory.h"
+#include "mem/mallocAllocator.h"
+
+namespace mem {
+
+// Areas provide the memory an allocator works in, Region passes their start() and end() on
+// to its AllocationPolicy. An area has to outlive the allocator using it.
+
+/**
+ * Memory held inline, on the stack when the area is a local. Costs nothing to set up.
+ *
+ * Implemented AreaPolicy.
+ */
+template <size_t Size, size_t Alignment = alignof(std::max_align_t)>
+class StackArea
+{
+public:
+    static_assert(Size > 0, "Area can't be empty");
+
+    void* start() const { return const_cast<char*>(_memory); }
+    void* end() const { return const_cast<char*>(_memory) + Size; }
+
+private:
+    alignas(Alignment) char _memory[Size];
+};
+
+/**
+ * Memory owned by someone else, e.g. a global buffer.
+ *
+ * Implemented AreaPolicy.
+ */
+class StaticArea
+{
+public:
+    StaticArea(void* start, size_t size) :
+        _start((char*)start),
+        _end((char*)start + size)
+    {
+    }
+
+    StaticArea(void* start, void* end) :
+        _start((char*)start),
+        _end((char*)end)
+    {
+        assert(_start <= _end);
+    }
+
+    void* start() const { return _start; }
+    void* end() const { return _end; }
+
+private:
+    char* _start;
+    char* _end;
+};
+
+/**
+ * Memory allocated from a MallocAllocator for as long as the area lives.
+ *
+ * Implemented AreaPolicy.
+ */
+class HeapArea
+{
+public:
+    explicit HeapArea(size_t size, size_t alignment = alignof(std::max_align_t)) :
+        _start((char*)_allocator.allocate(size, alignment)),
+        _end(_start + size)
+    {
+        assert(_start);
+    }
+
+    ~HeapArea()
+    {
+        _allocator.release(_start);
+    }
+
+    void* start() const { return _start; }
+    void* end() const { return _end; }
+
+private:
+    HeapArea(const HeapArea&);
+    HeapArea& operator=(const HeapArea&);
+
+    MallocAllocator _allocator;
+    char* _start;
+    char* _end;
+};
+
+/**
+ * Pages allocated from the OS for as long as the area lives, size is rounded up to the page
+ * size of the backing.
+ *
+ * Prefault touches every page up front so the allocator never takes a page fault. Lock also
+ * keeps the pages from being swapped out, which can fail when it would exceed
+ * RLIMIT_MEMLOCK, isLocked() tells if it worked.
+ *
+ * Implemented AreaPolicy.
+ */
+class PageArea
+{
+public:
+    enum Flags
+    {
+        Prefault = 1 << 0,
+        Lock = 1 << 1
+    };
+
+public:
+    explicit PageArea(size_t size, unsigned flags = 0, util::PageBacking pageBacking = util::RegularPages);
+    ~PageArea();
+
+    void* start() const { return _start; }
+    void* end() const { return _start + _size; }
+
+    size_t getSize() const { return _size; }
+    bool isLocked() const { return _isLocked; }
+
+private:
+    PageArea(const PageArea&);
+    PageArea& operator=(const PageArea&);
+
+    char* _start;
+    size_t _size;
+    bool _isLocked;
+};
+
+} // namespace mem
+
+#endif
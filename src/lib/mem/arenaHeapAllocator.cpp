@@ -0,0 +1,279 @@
+#include "mem/arenaHeapAllocator.h"
+using namespace mem;
+
+#include <algorithm>
+#include <new>
+#include <thread>
+
+const size_t ArenaHeapAllocator::MaxArenas;
+const size_t ArenaHeapAllocator::GrowthContentionCount;
+
+namespace {
+
+// Threads are numbered in the order they first use any ArenaHeapAllocator
+std::atomic<size_t> nextThreadTicket(0);
+thread_local size_t threadTicket = nextThreadTicket++;
+
+size_t clampArenaCount(size_t numArenas)
+{
+    return std::max(std::min(numArenas, ArenaHeapAllocator::MaxArenas), static_cast<size_t>(1));
+}
+
+}
+
+ArenaHeapAllocator::ArenaHeapAllocator(
+        size_t initialAllocSize,
+        size_t alignment,
+        size_t initialArenas,
+        size_t maxArenas) :
+    _numArenas(0),
+    _initialAllocSize(initialAllocSize),
+    _alignment(alignment),
+    _maxArenas(clampArenaCount(std::max(
+        maxArenas ? maxArenas : 2*static_cast<size_t>(std::thread::hardware_concurrency()),
+        initialArenas)))
+{
+    static_assert(MaxArenas <= HeapAllocator::MaxArenaIndex + 1,
+            "Arena index doesn't fit in the segment header");
+
+    initialArenas = clampArenaCount(initialArenas);
+    for (size_t i = 0; i < initialArenas; ++i) {
+        _addArena();
+    }
+}
+
+ArenaHeapAllocator::~ArenaHeapAllocator()
+{
+    size_t numArenas = getNumArenas();
+    for (size_t i = 0; i < numArenas; ++i) {
+        _getArena(i)->~Arena();
+    }
+}
+
+void* ArenaHeapAllocator::allocate(size_t numBytes, size_t alignment, size_t offset)
+{
+    Arena* arena = _lockThreadArena();
+    std::lock_guard<std::mutex> guard(arena->lock, std::adopt_lock);
+    return arena->heap.allocate(numBytes, alignment, offset);
+}
+
+void ArenaHeapAllocator::release(void* addr)
+{
+    if (!addr) {
+        return;
+    }
+
+    Arena* arena = _findOwningArena(addr);
+    assert(arena && "Address doesn't belong to this allocator");
+
+    std::lock_guard<std::mutex> guard(arena->lock);
+    arena->heap.release(addr);
+}
+
+size_t ArenaHeapAllocator::allocateBatch(size_t numBytes, size_t alignment, size_t count, void** out, size_t offset)
+{
+    Arena* arena = _lockThreadArena();
+    std::lock_guard<std::mutex> guard(arena->lock, std::adopt_lock);
+    return arena->heap.allocateBatch(numBytes, alignment, count, out, offset);
+}
+
+void ArenaHeapAllocator::releaseBatch(void** ptrs, size_t count)
+{
+    // Batches usually come from a single arena, only switch locks when the owner changes
+    Arena* lockedArena = nullptr;
+    for (size_t i = 0; i < count; ++i) {
+        if (!ptrs[i]) {
+            continue;
+        }
+
+        Arena* arena = _findOwningArena(ptrs[i]);
+        assert(arena && "Address doesn't belong to this allocator");
+
+        if (arena != lockedArena) {
+            if (lockedArena) {
+                lockedArena->lock.unlock();
+            }
+            arena->lock.lock();
+            lockedArena = arena;
+        }
+        arena->heap.release(ptrs[i]);
+    }
+
+    if (lockedArena) {
+        lockedArena->lock.unlock();
+    }
+}
+
+void* ArenaHeapAllocator::reallocate(void* addr, size_t numBytes, size_t alignment, size_t offset)
+{
+    if (!addr) {
+        return allocate(numBytes, alignment, offset);
+    }
+
+    Arena* arena = _findOwningArena(addr);
+    assert(arena && "Address doesn't belong to this allocator");
+
+    std::lock_guard<std::mutex> guard(arena->lock);
+    return arena->heap.reallocate(addr, numBytes, alignment, offset);
+}
+
+bool ArenaHeapAllocator::tryExpandInPlace(void* addr, size_t numBytes)
+{
+    Arena* arena = _findOwningArena(addr);
+    assert(arena && "Address doesn't belong to this allocator");
+
+    std::lock_guard<std::mutex> guard(arena->lock);
+    return arena->heap.tryExpandInPlace(addr, numBytes);
+}
+
+void ArenaHeapAllocator::shrinkInPlace(void* addr, size_t numBytes)
+{
+    Arena* arena = _findOwningArena(addr);
+    assert(arena && "Address doesn't belong to this allocator");
+
+    std::lock_guard<std::mutex> guard(arena->lock);
+    arena->heap.shrinkInPlace(addr, numBytes);
+}
+
+size_t ArenaHeapAllocator::getAllocationSize(void* addr) const
+{
+    Arena* arena = _findOwningArena(addr);
+    assert(arena && "Address doesn't belong to this allocator");
+
+    return arena->heap._getOwnedAllocationSize(addr);
+}
+
+size_t ArenaHeapAllocator::getThreadArenaIndex() const
+{
+    return threadTicket%getNumArenas();
+}
+
+typename ArenaHeapAllocator::Stats ArenaHeapAllocator::getStats() const
+{
+    Stats stats;
+    stats.numArenas = getNumArenas();
+    stats.contentions = 0;
+    stats.heap.allocatedBytes = 0;
+    stats.heap.freeBytes = 0;
+    stats.heap.overheadBytes = 0;
+    stats.heap.allocatedBlocks = 0;
+    stats.heap.freeBlocks = 0;
+    stats.heap.numRegularSegments = 0;
+    stats.heap.numExternalSegments = 0;
+    stats.heap.releasedBytes = 0;
+    stats.heap.externalCacheHits = 0;
+    stats.heap.externalCacheBytes = 0;
+
+    for (size_t i = 0; i < stats.numArenas; ++i) {
+        Arena* arena = _getArena(i);
+        stats.contentions += arena->contentions.load(std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> guard(arena->lock);
+        HeapAllocator::Stats heapStats = arena->heap.getStats();
+        stats.heap.allocatedBytes += heapStats.allocatedBytes;
+        stats.heap.freeBytes += heapStats.freeBytes;
+        stats.heap.overheadBytes += heapStats.overheadBytes;
+        stats.heap.allocatedBlocks += heapStats.allocatedBlocks;
+        stats.heap.freeBlocks += heapStats.freeBlocks;
+        stats.heap.numRegularSegments += heapStats.numRegularSegments;
+        stats.heap.numExternalSegments += heapStats.numExternalSegments;
+        stats.heap.releasedBytes += heapStats.releasedBytes;
+        stats.heap.externalCacheHits += heapStats.externalCacheHits;
+        stats.heap.externalCacheBytes += heapStats.externalCacheBytes;
+    }
+
+    return stats;
+}
+
+size_t ArenaHeapAllocator::trim(size_t keepBytes)
+{
+    size_t releasedBytes = 0;
+
+    size_t numArenas = getNumArenas();
+    for (size_t i = 0; i < numArenas; ++i) {
+        Arena* arena = _getArena(i);
+        std::lock_guard<std::mutex> guard(arena->lock);
+
+        // Earlier arenas get to keep their memory first
+        size_t arenaKeepBytes = std::min(keepBytes, arena->heap.getResidentFreeBytes());
+        releasedBytes += arena->heap.trim(arenaKeepBytes);
+        keepBytes -= arenaKeepBytes;
+    }
+
+    return releasedBytes;
+}
+
+size_t ArenaHeapAllocator::getResidentFreeBytes() const
+{
+    size_t freeBytes = 0;
+
+    size_t numArenas = getNumArenas();
+    for (size_t i = 0; i < numArenas; ++i) {
+        Arena* arena = _getArena(i);
+        std::lock_guard<std::mutex> guard(arena->lock);
+        freeBytes += arena->heap.getResidentFreeBytes();
+    }
+
+    return freeBytes;
+}
+
+ArenaHeapAllocator::Arena* ArenaHeapAllocator::_getArena(size_t arenaIndex) const
+{
+    assert(arenaIndex < getNumArenas());
+    return reinterpret_cast<Arena*>(const_cast<ArenaStorage*>(&_arenas[arenaIndex]));
+}
+
+ArenaHeapAllocator::Arena* ArenaHeapAllocator::_lockThreadArena()
+{
+    Arena* arena = _getArena(getThreadArenaIndex());
+
+    if (!arena->lock.try_lock()) {
+        size_t contentions = ++arena->contentions;
+        if (contentions%GrowthContentionCount == 0 && getNumArenas() < _maxArenas) {
+            // Adding an arena changes which arena this thread maps to
+            _addArena();
+            arena = _getArena(getThreadArenaIndex());
+        }
+        arena->lock.lock();
+    }
+
+    return arena;
+}
+
+ArenaHeapAllocator::Arena* ArenaHeapAllocator::_addArena()
+{
+    std::lock_guard<std::mutex> guard(_growLock);
+
+    // Another thread may have grown the arenas while we waited
+    size_t numArenas = _numArenas.load(std::memory_order_relaxed);
+    if (numArenas >= _maxArenas) {
+        return nullptr;
+    }
+
+    Arena* arena = new (&_arenas[numArenas]) Arena(_initialAllocSize, _alignment);
+    arena->heap.setArenaIndex(numArenas);
+
+    // Publish only once the arena is fully constructed
+    _numArenas.store(numArenas + 1, std::memory_order_release);
+    return arena;
+}
+
+ArenaHeapAllocator::Arena* ArenaHeapAllocator::_findOwningArena(void* addr) const
+{
+    // Blocks are most often released by the thread which allocated them so start with
+    // the calling thread's arena. Only the owning arena maps the block's segment.
+    size_t numArenas = getNumArenas();
+    size_t firstIndex = getThreadArenaIndex();
+
+    for (size_t i = 0; i < numArenas; ++i) {
+        Arena* arena = _getArena((firstIndex + i)%numArenas);
+
+        // The segment of an allocated block can't go away, so its page map entries can
+        // be read without the arena lock
+        if (arena->heap._findSegment(addr)) {
+            return arena;
+        }
+    }
+
+    return nullptr;
+}
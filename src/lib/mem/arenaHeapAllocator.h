@@ -0,0 +1,132 @@
+#ifndef MEM_ARENAHEAPALLOCATOR_H
+#define MEM_ARENAHEAPALLOCATOR_H
+
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+
+#include "util/units.h"
+#include "mem/alignment.h"
+#include "mem/allocator.h"
+#include "mem/heapAllocator.h"
+
+namespace mem {
+
+/**
+ * Thread-safe allocator which spreads threads over a number of independent HeapAllocator
+ * arenas.
+ *
+ * Each arena has its own bins, reserve, segments and lock. Threads are assigned to arenas
+ * round-robin in the order they first use the allocator, so threads only serialize with
+ * the other threads sharing their arena. Every segment records the index of the arena it
+ * belongs to, a release is routed to the arena owning the block's segment no matter which
+ * thread makes it.
+ *
+ * The allocator starts with initialArenas arenas. A thread which finds its arena locked
+ * counts it as contention, once an arena has seen enough contention a new arena is added
+ * (up to maxArenas) and threads are redistributed over all the arenas.
+ *
+ * Since the allocator does its own locking, a Region using it can use the SingleThreaded
+ * policy as long as the rest of its policies don't need protecting (e.g. NoTracking).
+ *
+ * Implemented AllocatorPolicy.
+ */
+class ArenaHeapAllocator : public mem::Allocator
+{
+public:
+    static const size_t MaxArenas = 32;
+
+    struct Stats
+    {
+        size_t numArenas;
+
+        // Number of times a thread found its arena already locked
+        size_t contentions;
+
+        // Summed over all arenas
+        HeapAllocator::Stats heap;
+    };
+
+public:
+    /**
+     * A maxArenas of 0 uses twice the number of hardware threads.
+     */
+    ArenaHeapAllocator(
+            size_t initialAllocSize = util::kilobytes(64),
+            size_t alignment = util::bytes(4),
+            size_t initialArenas = 1,
+            size_t maxArenas = 0);
+    ~ArenaHeapAllocator();
+
+    virtual void* allocate(size_t size, size_t alignment = DefaultAlignment, size_t offset = 0) override;
+    virtual void release(void* addr) override;
+    virtual size_t getAllocationSize(void* addr) const override;
+
+    // The arena lock is taken once for the whole batch
+    virtual size_t allocateBatch(size_t size, size_t alignment, size_t count, void** out, size_t offset = 0) override;
+    virtual void releaseBatch(void** ptrs, size_t count) override;
+
+    // Resized within the arena owning the allocation
+    virtual void* reallocate(void* addr, size_t size, size_t alignment = DefaultAlignment, size_t offset = 0) override;
+    virtual bool tryExpandInPlace(void* addr, size_t size) override;
+    virtual void shrinkInPlace(void* addr, size_t size) override;
+
+    size_t getNumArenas() const { return _numArenas.load(std::memory_order_acquire); }
+    size_t getMaxArenas() const { return _maxArenas; }
+
+    /**
+     * Arena the calling thread allocates from.
+     */
+    size_t getThreadArenaIndex() const;
+
+    Stats getStats() const;
+
+    /**
+     * See HeapAllocator::trim(), keepBytes is shared between all arenas.
+     */
+    size_t trim(size_t keepBytes = 0);
+    size_t getResidentFreeBytes() const;
+
+protected:
+    // Number of times an arena has to be found locked before another arena is added
+    static const size_t GrowthContentionCount = 16;
+
+    struct Arena
+    {
+        Arena(size_t initialAllocSize, size_t alignment) :
+            heap(initialAllocSize, alignment),
+            contentions(0)
+        {}
+
+        HeapAllocator heap;
+        std::mutex lock;
+        std::atomic<size_t> contentions;
+    };
+
+    Arena* _getArena(size_t arenaIndex) const;
+
+    // Returns the calling thread's arena locked, growing the arenas if it's contended
+    Arena* _lockThreadArena();
+    Arena* _addArena();
+
+    // Returns the arena owning addr, nullptr if it doesn't belong to this allocator
+    Arena* _findOwningArena(void* addr) const;
+
+private:
+    // Arenas are constructed in place as they are added and live until the allocator is
+    // destroyed. Only the first _numArenas entries are valid.
+    typedef std::aligned_storage<sizeof(Arena), alignof(Arena)>::type ArenaStorage;
+    ArenaStorage _arenas[MaxArenas];
+    std::atomic<size_t> _numArenas;
+
+    // Serializes adding arenas
+    std::mutex _growLock;
+
+    const size_t _initialAllocSize;
+    const size_t _alignment;
+    const size_t _maxArenas;
+};
+
+} // namespace mem
+
+#endif
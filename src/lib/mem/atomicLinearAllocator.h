@@ -0,0 +1,149 @@
+#ifndef MEM_ATOMICLINEARALLOCATOR_H
+#define MEM_ATOMICLINEARALLOCATOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+
+#include "mem/alignment.h"
+#include "mem/allocator.h"
+#include "mem/util.h"
+
+namespace mem {
+
+/**
+ * LinearAllocator which any number of threads can allocate from at once.
+ *
+ * The current offset is an atomic. A request aligned no stricter than the allocator is
+ * sized so the offset stays a multiple of the allocator's alignment and claims its bytes
+ * with a single fetch_add. Stricter requests depend on where the offset is and retry a
+ * compare-and-swap until they claim a correctly aligned range. Sizes are stored in front
+ * of each block as in LinearAllocator.
+ *
+ * Once the memory runs out the offset is left past the end and every later request fails
+ * until the allocator is cleared.
+ *
+ * clear() isn't synchronized with allocate(), it is meant to be called between phases once
+ * every thread has finished allocating (e.g. after a join or barrier). The synchronization
+ * that starts the next phase makes the reset visible to the other threads.
+ *
+ * Since the allocator does its own synchronization a Region using it can use the
+ * SingleThreaded policy as long as the rest of its policies don't need protecting.
+ */
+class AtomicLinearAllocator : public mem::Allocator
+{
+public:
+    struct Stats
+    {
+        size_t allocatedBytes;
+        size_t freeBytes;
+    };
+
+    static const size_t MaxAllocationSize = 0xffffffff;
+
+public:
+    AtomicLinearAllocator(void* mem, size_t size, size_t alignment = 4) :
+        _startAddr((char*)mem::align(mem, alignment)),
+        _size(size - (_startAddr - (char*)mem)),
+        _alignment(alignment),
+        _offset(0)
+    {
+        assert(util::isPowerOfTwo(alignment) && "Power of two alignment required");
+        assert(alignment <= size && "Memory too small for its alignment");
+    }
+
+    AtomicLinearAllocator(void* start, void* end, size_t alignment = 4) :
+        AtomicLinearAllocator(start, (char*)end - (char*)start, alignment)
+    {
+    }
+
+    virtual void* allocate(size_t numBytes, size_t alignment = DefaultAlignment, size_t offset = 0) override
+    {
+        if (numBytes > MaxAllocationSize) {
+            return nullptr;
+        }
+        if (alignment != DefaultAlignment && alignment > _alignment) {
+            return _allocateAligned(numBytes, alignment, offset);
+        }
+
+        // The block starts at an aligned offset, the header and offset are padded up to
+        // the alignment and the end rounded up again
+        size_t front = mem::align(SizeHeaderSize + offset, _alignment) - offset;
+        size_t blockSize = mem::align(front + numBytes, _alignment);
+
+        size_t start = _offset.fetch_add(blockSize, std::memory_order_relaxed);
+        if (start + blockSize > _size || start + blockSize < start) {
+            return nullptr;
+        }
+
+        char* addr = _startAddr + start + front;
+        setSizeHeader(addr, numBytes);
+        return addr;
+    }
+
+    virtual void release(void* addr) override
+    {
+        // Noop
+    }
+
+    virtual size_t getAllocationSize(void* addr) const override
+    {
+        return getSizeHeader(addr);
+    }
+
+    /**
+     * Must not be called while other threads allocate.
+     */
+    void clear()
+    {
+        _offset.store(0, std::memory_order_relaxed);
+    }
+
+    Stats getStats() const
+    {
+        size_t allocated = std::min(_offset.load(std::memory_order_relaxed), _size);
+
+        Stats stats;
+        stats.allocatedBytes = allocated;
+        stats.freeBytes = _size - allocated;
+        return stats;
+    }
+
+protected:
+    void* _allocateAligned(size_t numBytes, size_t alignment, size_t offset)
+    {
+        size_t start = _offset.load(std::memory_order_relaxed);
+        for (;;) {
+            if (start > _size) {
+                return nullptr;
+            }
+
+            char* addr = (char*)mem::align(_startAddr + start + SizeHeaderSize + offset, alignment) - offset;
+            size_t end = mem::align(static_cast<size_t>(addr - _startAddr) + numBytes, _alignment);
+            if (end > _size) {
+                return nullptr;
+            }
+
+            if (_offset.compare_exchange_weak(start, end, std::memory_order_relaxed)) {
+                setSizeHeader(addr, numBytes);
+                return addr;
+            }
+        }
+    }
+
+private:
+    AtomicLinearAllocator(const AtomicLinearAllocator&);
+    AtomicLinearAllocator& operator=(const AtomicLinearAllocator&);
+
+    char* const _startAddr;
+    const size_t _size;
+    const size_t _alignment;
+
+    // Keep the contended offset on a cache line of its own, being the last member the
+    // alignment also pads out the rest of the line
+    alignas(64) std::atomic<size_t> _offset;
+};
+
+} // namespace mem
+
+#endif
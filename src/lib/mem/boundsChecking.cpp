@@ -0,0 +1,12 @@
+#include "mem/boundsChecking.h"
+using namespace mem;
+
+const size_t NoBoundsChecking::SizeFront;
+const size_t NoBoundsChecking::SizeBack;
+
+const int BoundsChecking::FrontSequence;
+const int BoundsChecking::BackSequence;
+const size_t BoundsChecking::SizeFront;
+const size_t BoundsChecking::SizeBack;
+
+const size_t GuardPageBoundsChecking::SizeBack;
@@ -1,7 +1,14 @@
 #ifndef MEM_BOUNDSCHECKING_H
 #define MEM_BOUNDSCHECKING_H
 
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace mem {
 
@@ -18,28 +25,41 @@ public:
     inline void guardBack(void* mem) const { }
     inline bool checkFront(void* mem) const { return true; } 
     inline bool checkBack(void* mem) const { return true; }
+    inline void setAllocationSize(void* mem, size_t size) const { }
+    inline size_t getAllocationSize(const void* mem) const { return 0; }
+
+    inline size_t checkAll(void* const* fronts, void* const* backs, size_t count, bool* isIntact) const 
+    { 
+        std::fill(isIntact, isIntact + count, true);
+        return 0; 
+    }
 };
 
 /**
  * Inserts a specific byte sequence at the start and end of the memory region to help
  * check for bounds overruns.
  *
+ * Allocators may round a block up, so the size requested for it is kept in the front guard
+ * to find the back guard again. The size sits between two copies of the front sequence,
+ * an underrun reaches one of them before it can change the size.
+ *
  * Fulfills the BoundsCheckingPolicy concept.
  */
 class BoundsChecking
 {
-private:
+protected:
     static const int FrontSequence = 0x01234567;
     static const int BackSequence = 0x89ABCDEF;
 
 public:
-    static const size_t SizeFront = sizeof(FrontSequence);
+    static const size_t SizeFront = 2*sizeof(FrontSequence) + sizeof(size_t);
     static const size_t SizeBack = sizeof(BackSequence);
 
     inline void guardFront(void* mem)
     { 
         int* intMem = static_cast<int*>(mem); 
         *intMem = FrontSequence;
+        _storeSequence((char*)mem + SizeFront - sizeof(FrontSequence), FrontSequence);
     }
 
     inline void guardBack(void* mem)
@@ -52,7 +72,8 @@ public:
     { 
         int* intMem = static_cast<int*>(mem); 
 
-        if (*intMem != FrontSequence) {
+        if (*intMem != FrontSequence || 
+            _loadSequence((char*)mem + SizeFront - sizeof(FrontSequence)) != FrontSequence) {
             //assert(false && "Front bounds check failed");
             return false;
         }
@@ -69,9 +90,102 @@ public:
         }
         return true;
     }
+
+    /**
+     * Size requested for the allocation whose front guard is at mem.
+     */
+    inline void setAllocationSize(void* mem, size_t size)
+    {
+        memcpy((char*)mem + sizeof(FrontSequence), &size, sizeof(size));
+    }
+
+    inline size_t getAllocationSize(const void* mem) const
+    {
+        size_t size;
+        memcpy(&size, (const char*)mem + sizeof(FrontSequence), sizeof(size));
+        return size;
+    }
+
+    /**
+     * Checks the guards of count allocations at once, fronts[i] and backs[i] being where
+     * checkFront() and checkBack() would look. Sets isIntact[i] to whether both guards of
+     * an allocation are unchanged and returns the number which aren't.
+     */
+    inline size_t checkAll(void* const* fronts, void* const* backs, size_t count, bool* isIntact)
+    {
+        std::fill(isIntact, isIntact + count, true);
+        _checkSequences(fronts, count, 0, FrontSequence, isIntact);
+        _checkSequences(fronts, count, SizeFront - sizeof(FrontSequence), FrontSequence, isIntact);
+        _checkSequences(backs, count, 0, BackSequence, isIntact);
+        return std::count(isIntact, isIntact + count, false);
+    }
+
+protected:
+    // Guards can be anywhere, back ones in particular are rarely aligned
+    static inline int _loadSequence(const void* mem)
+    {
+        int sequence;
+        memcpy(&sequence, mem, sizeof(sequence));
+        return sequence;
+    }
+
+    static inline void _storeSequence(void* mem, int sequence)
+    {
+        memcpy(mem, &sequence, sizeof(sequence));
+    }
+
+    // Clears isIntact for the addresses not holding the sequence offset bytes in. The
+    // sequences are only as large as an int, so the comparison is vectorised across
+    // allocations.
+    static inline void _checkSequences(void* const* addrs, size_t count, size_t offset, int sequence, bool* isIntact)
+    {
+        size_t i = 0;
+#ifdef __SSE2__
+        const __m128i expected = _mm_set1_epi32(sequence);
+        for (; i + 4 <= count; i += 4) {
+            __m128i sequences = _mm_set_epi32(
+                    _loadSequence((char*)addrs[i + 3] + offset), 
+                    _loadSequence((char*)addrs[i + 2] + offset), 
+                    _loadSequence((char*)addrs[i + 1] + offset), 
+                    _loadSequence((char*)addrs[i] + offset));
+            int isEqual = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(sequences, expected)));
+            if (isEqual != 0xf) {
+                for (size_t j = 0; j < 4; ++j) {
+                    isIntact[i + j] = isIntact[i + j] && (isEqual & (1 << j));
+                }
+            }
+        }
+#endif
+        for (; i < count; ++i) {
+            isIntact[i] = isIntact[i] && _loadSequence((char*)addrs[i] + offset) == sequence;
+        }
+    }
 };
 
-// TODO: a way to check every allocation
+/**
+ * Bounds checking for allocations from a GuardPageAllocator, whose guard pages catch an
+ * overrun past the end as it happens. Only the front gets a sequence, which catches
+ * underruns when the memory is released, so the end of the memory stays flush against the
+ * guard page.
+ *
+ * Fulfills the BoundsCheckingPolicy concept.
+ */
+class GuardPageBoundsChecking : public BoundsChecking
+{
+public:
+    static const size_t SizeBack = 0;
+
+    inline void guardBack(void* mem) const { }
+    inline bool checkBack(void* mem) const { return true; }
+
+    inline size_t checkAll(void* const* fronts, void* const* backs, size_t count, bool* isIntact)
+    {
+        std::fill(isIntact, isIntact + count, true);
+        _checkSequences(fronts, count, 0, FrontSequence, isIntact);
+        _checkSequences(fronts, count, SizeFront - sizeof(FrontSequence), FrontSequence, isIntact);
+        return std::count(isIntact, isIntact + count, false);
+    }
+};
 
 } // namespace mem
 
@@ -0,0 +1,323 @@
+#include "mem/buddyAllocator.h"
+using namespace mem;
+
+#include <algorithm>
+#include <cstring>
+
+#include "util/math.h"
+
+const size_t BuddyAllocator::MaxOrders;
+const size_t BuddyAllocator::BitsPerWord;
+const size_t BuddyAllocator::MaxMapLevels;
+const size_t BuddyAllocator::NotFound;
+
+BuddyAllocator::BuddyAllocator(size_t size, size_t minBlockSize, util::PageBacking pageBacking) :
+    _minBlockSize(util::nextPowerOfTwo(minBlockSize)),
+    _minBlockShift(util::findLastSet(_minBlockSize) - 1),
+    _numOrders(util::findLastSet(util::nextPowerOfTwo(std::max(size, _minBlockSize))) - _minBlockShift),
+    _maxAlignment(util::getPageSize(pageBacking)),
+    _pageAllocator(pageBacking),
+    _allocatedBytes(0),
+    _allocatedBlocks(0)
+{
+    _initMaps();
+
+    _base = (char*)_pageAllocator.allocate(getSize(), _maxAlignment);
+    assert(_base);
+
+    // Everything starts out as a single free block
+    _setFree(_numOrders - 1, 0);
+}
+
+BuddyAllocator::BuddyAllocator(void* start, void* end, size_t minBlockSize) :
+    _minBlockSize(util::nextPowerOfTwo(minBlockSize)),
+    _minBlockShift(util::findLastSet(_minBlockSize) - 1),
+    _numOrders(util::findLastSet(static_cast<size_t>((char*)end - (char*)start)) - _minBlockShift),
+    _maxAlignment(std::min(util::getPageSize(), (uintptr_t)start & -(uintptr_t)start)),
+    _base((char*)start),
+    _allocatedBytes(0),
+    _allocatedBlocks(0)
+{
+    assert(static_cast<size_t>((char*)end - (char*)start) >= _minBlockSize && "Memory smaller than a block");
+    _initMaps();
+    _setFree(_numOrders - 1, 0);
+}
+
+void BuddyAllocator::_initMaps()
+{
+    assert(_numOrders <= MaxOrders && "Too many orders, use a larger minimum block size");
+
+    // All bitmaps share one allocation kept apart from the range so it stays aligned
+    size_t numWords = 0;
+    for (size_t order = 0; order < _numOrders; ++order) {
+        size_t numLevels;
+        numWords += _getMapWords(_getNumBlocks(order), &numLevels);
+        numWords += (_getNumBlocks(order) + BitsPerWord - 1)/BitsPerWord;
+    }
+    uint64_t* words = (uint64_t*)_pageAllocator.allocate(numWords*sizeof(uint64_t), alignof(uint64_t));
+    assert(words);
+    memset(words, 0, numWords*sizeof(uint64_t));
+
+    for (size_t order = 0; order < _numOrders; ++order) {
+        size_t numLevels;
+        _initFreeMap(&_freeMaps[order], words, _getNumBlocks(order));
+        words += _getMapWords(_getNumBlocks(order), &numLevels);
+        _splitMaps[order] = words;
+        words += (_getNumBlocks(order) + BitsPerWord - 1)/BitsPerWord;
+        _freeBlocks[order] = 0;
+    }
+}
+
+BuddyAllocator::~BuddyAllocator()
+{
+    // The range and bitmaps are released along with the PageAllocator
+}
+
+void* BuddyAllocator::allocate(size_t numBytes, size_t alignment, size_t offset)
+{
+    if (alignment > _maxAlignment || !util::isPowerOfTwo(alignment)) {
+        return nullptr;
+    }
+
+    // Blocks are aligned to their size so any alignment up to the block size comes for
+    // free, only an offset needs padding
+    size_t padding = (alignment - offset%alignment)%alignment;
+    size_t order = _getOrder(std::max(numBytes + padding, alignment));
+    if (order >= _numOrders) {
+        return nullptr;
+    }
+
+    size_t freeOrder = order;
+    size_t index = NotFound;
+    for (; freeOrder < _numOrders; ++freeOrder) {
+        index = _findFree(freeOrder);
+        if (index != NotFound) {
+            break;
+        }
+    }
+    if (index == NotFound) {
+        return nullptr;
+    }
+
+    // Halve the free block down to the order asked for, freeing the upper halves
+    _clearFree(freeOrder, index);
+    for (; freeOrder > order; --freeOrder) {
+        _setBit(_splitMaps[freeOrder], index, true);
+        index *= 2;
+        _setFree(freeOrder - 1, index + 1);
+    }
+
+    _allocatedBytes += _getBlockSize(order);
+    _allocatedBlocks++;
+    return _base + (index << (_minBlockShift + order)) + padding;
+}
+
+void BuddyAllocator::release(void* addr)
+{
+    if (!addr) {
+        return;
+    }
+
+    size_t order, index;
+    _findBlock(addr, &order, &index);
+    _allocatedBytes -= _getBlockSize(order);
+    _allocatedBlocks--;
+
+    // Merge with the buddy for as long as it's free, the merged block is no longer split
+    while (order + 1 < _numOrders && _isFree(order, index ^ 1)) {
+        _clearFree(order, index ^ 1);
+        index /= 2;
+        order++;
+        _setBit(_splitMaps[order], index, false);
+    }
+    _setFree(order, index);
+}
+
+size_t BuddyAllocator::getAllocationSize(void* addr) const
+{
+    size_t order, index;
+    _findBlock(addr, &order, &index);
+    char* blockEnd = _base + ((index + 1) << (_minBlockShift + order));
+    return blockEnd - (char*)addr;
+}
+
+BuddyAllocator::Stats BuddyAllocator::getStats() const
+{
+    Stats stats;
+    stats.allocatedBytes = _allocatedBytes;
+    stats.freeBytes = getSize() - _allocatedBytes;
+    stats.allocatedBlocks = _allocatedBlocks;
+    stats.freeBlocks = 0;
+    stats.largestFreeBlock = 0;
+
+    for (size_t order = 0; order < MaxOrders; ++order) {
+        stats.freeBlocksPerOrder[order] = order < _numOrders ? _freeBlocks[order] : 0;
+        stats.freeBlocks += stats.freeBlocksPerOrder[order];
+        if (stats.freeBlocksPerOrder[order] > 0) {
+            stats.largestFreeBlock = _getBlockSize(order);
+        }
+    }
+    stats.fragmentedBytes = stats.freeBytes - stats.largestFreeBlock;
+
+    return stats;
+}
+
+bool BuddyAllocator::check() const
+{
+    size_t allocatedBytes = 0;
+    size_t allocatedBlocks = 0;
+
+    for (size_t order = 0; order < _numOrders; ++order) {
+        const FreeMap& map = _freeMaps[order];
+        size_t numFree = 0;
+
+        for (size_t index = 0; index < _getNumBlocks(order); ++index) {
+            bool isFree = _isFree(order, index);
+            bool isSplit = order > 0 && _testBit(_splitMaps[order], index);
+            bool isTop = order + 1 == _numOrders;
+
+            // Only halves of a split block exist
+            if (!isTop && !_testBit(_splitMaps[order + 1], index/2)) {
+                if (isFree || isSplit) {
+                    return false;
+                }
+                continue;
+            }
+
+            if (isFree && isSplit) {
+                return false;
+            }
+
+            // Free buddies are always merged
+            if (isFree && !isTop && _isFree(order, index ^ 1)) {
+                return false;
+            }
+
+            if (isFree) {
+                numFree++;
+            } else if (!isSplit) {
+                allocatedBytes += _getBlockSize(order);
+                allocatedBlocks++;
+            }
+        }
+
+        if (numFree != _freeBlocks[order]) {
+            return false;
+        }
+
+        // Summary bits are set exactly for the words below which aren't empty
+        size_t numWords = (_getNumBlocks(order) + BitsPerWord - 1)/BitsPerWord;
+        for (size_t level = 1; level < map.numLevels; ++level) {
+            for (size_t word = 0; word < numWords; ++word) {
+                if (_testBit(map.levels[level], word) != (map.levels[level - 1][word] != 0)) {
+                    return false;
+                }
+            }
+            numWords = (numWords + BitsPerWord - 1)/BitsPerWord;
+        }
+    }
+
+    return allocatedBytes == _allocatedBytes && allocatedBlocks == _allocatedBlocks;
+}
+
+size_t BuddyAllocator::_getOrder(size_t numBytes) const
+{
+    if (numBytes <= _minBlockSize) {
+        return 0;
+    }
+
+    size_t order = util::findLastSet(numBytes - 1) - _minBlockShift;
+    return std::min(order, _numOrders);
+}
+
+void BuddyAllocator::_findBlock(const void* addr, size_t* order, size_t* index) const
+{
+    assert(addr >= _base && (const char*)addr < _base + getSize() && "Address doesn't belong to this allocator");
+    size_t offset = (const char*)addr - _base;
+
+    // The allocated block is the first one on the way down which isn't split
+    size_t blockOrder = _numOrders - 1;
+    while (blockOrder > 0 && _testBit(_splitMaps[blockOrder], offset >> (_minBlockShift + blockOrder))) {
+        blockOrder--;
+    }
+
+    *order = blockOrder;
+    *index = offset >> (_minBlockShift + blockOrder);
+    assert(!_isFree(*order, *index) && "Address isn't allocated");
+}
+
+size_t BuddyAllocator::_getMapWords(size_t numBits, size_t* numLevels) const
+{
+    size_t numWords = 0;
+    *numLevels = 0;
+    do {
+        numBits = (numBits + BitsPerWord - 1)/BitsPerWord;
+        numWords += numBits;
+        (*numLevels)++;
+    } while (numBits > 1);
+
+    assert(*numLevels <= MaxMapLevels);
+    return numWords;
+}
+
+void BuddyAllocator::_initFreeMap(FreeMap* map, uint64_t* words, size_t numBits)
+{
+    map->numLevels = 0;
+    do {
+        numBits = (numBits + BitsPerWord - 1)/BitsPerWord;
+        map->levels[map->numLevels++] = words;
+        words += numBits;
+    } while (numBits > 1);
+}
+
+void BuddyAllocator::_setFree(size_t order, size_t index)
+{
+    FreeMap& map = _freeMaps[order];
+    for (size_t level = 0; level < map.numLevels; ++level) {
+        uint64_t& word = map.levels[level][index/BitsPerWord];
+        bool wasEmpty = word == 0;
+        word = util::setBit(word, index%BitsPerWord);
+
+        // The levels above already know about this word
+        if (!wasEmpty) {
+            break;
+        }
+        index /= BitsPerWord;
+    }
+    _freeBlocks[order]++;
+}
+
+void BuddyAllocator::_clearFree(size_t order, size_t index)
+{
+    FreeMap& map = _freeMaps[order];
+    for (size_t level = 0; level < map.numLevels; ++level) {
+        uint64_t& word = map.levels[level][index/BitsPerWord];
+        word = util::resetBit(word, index%BitsPerWord);
+
+        // The levels above only change once the word is empty
+        if (word != 0) {
+            break;
+        }
+        index /= BitsPerWord;
+    }
+    _freeBlocks[order]--;
+}
+
+bool BuddyAllocator::_isFree(size_t order, size_t index) const
+{
+    return _testBit(_freeMaps[order].levels[0], index);
+}
+
+size_t BuddyAllocator::_findFree(size_t order) const
+{
+    const FreeMap& map = _freeMaps[order];
+    if (map.levels[map.numLevels - 1][0] == 0) {
+        return NotFound;
+    }
+
+    size_t index = 0;
+    for (size_t level = map.numLevels; level-- > 0;) {
+        index = index*BitsPerWord + util::findFirstSet(map.levels[level][index]) - 1;
+    }
+    return index;
+}
@@ -0,0 +1,154 @@
+#ifndef MEM_BUDDYALLOCATOR_H
+#define MEM_BUDDYALLOCATOR_H
+
+#include <cassert>
+#include <climits>
+#include <cstdint>
+
+#include "util/bit.h"
+#include "util/memory.h"
+#include "util/units.h"
+#include "mem/alignment.h"
+#include "mem/allocator.h"
+#include "mem/pageAllocator.h"
+
+namespace mem {
+
+/**
+ * Binary buddy allocator over a single power of two sized range.
+ *
+ * Every block is a power of two multiple of minBlockSize and aligned to its size within
+ * the range. A request is rounded up to the smallest block holding it, larger free blocks
+ * are halved until one of that size is split off. Releasing a block merges it with its
+ * buddy, the other half of the block it was split from, for as long as the buddy is free.
+ *
+ * No bookkeeping is kept in the blocks themselves, free or allocated. Each order (block
+ * size) has a bitmap of its free blocks and one of the blocks split into smaller ones. The
+ * free bitmaps have a summary level for every 64 words below so the first free block of
+ * an order is found with a find-first-set per level. Allocating and releasing touch each
+ * order at most once, and the size of an allocation is found by following the split
+ * bitmaps down to the block holding it.
+ *
+ * The range comes from a PageAllocator and is aligned to the page size, which is the
+ * strictest alignment an allocation can ask for. Given memory instead (e.g. from an
+ * AreaPolicy) the range is the largest power of two fitting at its start, and the
+ * strictest alignment is whatever the start is aligned to, up to the page size. The
+ * bitmaps are still allocated separately.
+ *
+ * The allocator does no locking of its own.
+ *
+ * Implemented AllocatorPolicy.
+ */
+class BuddyAllocator : public mem::Allocator
+{
+public:
+    static const size_t MaxOrders = 40;
+
+    struct Stats
+    {
+        size_t allocatedBytes;
+        size_t freeBytes;
+        size_t allocatedBlocks;
+        size_t freeBlocks;
+
+        // Free bytes outside of the largest free block can't be handed out in one
+        // allocation of that size, i.e. external fragmentation
+        size_t largestFreeBlock;
+        size_t fragmentedBytes;
+
+        // Free blocks of minBlockSize << order
+        size_t freeBlocksPerOrder[MaxOrders];
+    };
+
+public:
+    /**
+     * size is rounded up to a power of two.
+     */
+    BuddyAllocator(
+            size_t size = util::megabytes(64),
+            size_t minBlockSize = util::bytes(256),
+            util::PageBacking pageBacking = util::RegularPages);
+    BuddyAllocator(void* start, void* end, size_t minBlockSize = util::bytes(256));
+    ~BuddyAllocator();
+
+    virtual void* allocate(size_t size, size_t alignment = DefaultAlignment, size_t offset = 0) override;
+    virtual void release(void* addr) override;
+    virtual size_t getAllocationSize(void* addr) const override;
+
+    size_t getSize() const { return _minBlockSize << (_numOrders - 1); }
+    size_t getMinBlockSize() const { return _minBlockSize; }
+    size_t getNumOrders() const { return _numOrders; }
+
+    Stats getStats() const;
+
+    /**
+     * Checks the bitmaps are consistent with each other. This is a slow operation and only
+     * meant for debugging.
+     */
+    bool check() const;
+
+protected:
+    static const size_t BitsPerWord = sizeof(uint64_t)*CHAR_BIT;
+    static const size_t MaxMapLevels = 8;
+    static const size_t NotFound = ~static_cast<size_t>(0);
+
+    // Bitmap of the free blocks of an order. Each level above the first has a bit for
+    // every word of the level below which isn't zero, the top level is a single word.
+    struct FreeMap
+    {
+        uint64_t* levels[MaxMapLevels];
+        size_t numLevels;
+    };
+
+    size_t _getNumBlocks(size_t order) const { return static_cast<size_t>(1) << (_numOrders - 1 - order); }
+    size_t _getBlockSize(size_t order) const { return _minBlockSize << order; }
+
+    // Smallest order whose blocks hold numBytes, _numOrders if none does
+    size_t _getOrder(size_t numBytes) const;
+
+    // Order and index of the allocated block holding addr
+    void _findBlock(const void* addr, size_t* order, size_t* index) const;
+
+    // Allocates and clears the bitmaps of every order
+    void _initMaps();
+
+    size_t _getMapWords(size_t numBits, size_t* numLevels) const;
+    void _initFreeMap(FreeMap* map, uint64_t* words, size_t numBits);
+    void _setFree(size_t order, size_t index);
+    void _clearFree(size_t order, size_t index);
+    bool _isFree(size_t order, size_t index) const;
+    size_t _findFree(size_t order) const;
+
+    static bool _testBit(const uint64_t* words, size_t index)
+    {
+        return (words[index/BitsPerWord] >> (index%BitsPerWord)) & 1;
+    }
+    static void _setBit(uint64_t* words, size_t index, bool value)
+    {
+        words[index/BitsPerWord] = util::setBit(words[index/BitsPerWord], index%BitsPerWord, value);
+    }
+
+private:
+    BuddyAllocator(const BuddyAllocator&);
+    BuddyAllocator& operator=(const BuddyAllocator&);
+
+    const size_t _minBlockSize;
+    const size_t _minBlockShift;
+    const size_t _numOrders;
+    const size_t _maxAlignment;
+
+    PageAllocator _pageAllocator;
+    char* _base;
+
+    // Per order, the split bitmaps of order 0 are never used
+    FreeMap _freeMaps[MaxOrders];
+    uint64_t* _splitMaps[MaxOrders];
+
+    size_t _allocatedBytes;
+    size_t _allocatedBlocks;
+    size_t _freeBlocks[MaxOrders];
+};
+
+} // namespace mem
+
+#endif
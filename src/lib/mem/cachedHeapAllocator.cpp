@@ -0,0 +1,386 @@
+#include "mem/cachedHeapAllocator.h"
+using namespace mem;
+
+#include <algorithm>
+#include <new>
+#include <set>
+
+const size_t CachedHeapAllocator::NumCacheBins;
+const size_t CachedHeapAllocator::MinCacheBin;
+
+struct CachedHeapAllocator::ThreadCache
+{
+    // Singly-linked lists of cached blocks. The link is stored in the first word of
+    // each block.
+    void* bins[NumCacheBins];
+    size_t depth[NumCacheBins];
+
+    // Counters are only ever written by the owning thread, they are atomic so that
+    // getStats() can read them from any thread.
+    std::atomic<size_t> hits;
+    std::atomic<size_t> misses;
+    std::atomic<size_t> flushes;
+    std::atomic<size_t> numBlocks;
+
+    // Set once the owning thread has exited, the cache can then be reclaimed
+    std::atomic<bool> orphaned;
+
+    ThreadCache* next;
+};
+
+namespace {
+
+typedef CachedHeapAllocator::ThreadCache ThreadCache;
+
+std::atomic<size_t> nextAllocatorId(1);
+
+/**
+ * Ids of the CachedHeapAllocators which haven't been destroyed yet.
+ *
+ * An exiting thread uses this to only orphan caches whose allocator is still alive.
+ */
+std::mutex& getLiveAllocatorsLock()
+{
+    static std::mutex lock;
+    return lock;
+}
+
+std::set<size_t>& getLiveAllocators()
+{
+    static std::set<size_t> ids;
+    return ids;
+}
+
+/**
+ * The caches of the current thread keyed by allocator id.
+ *
+ * A thread using more than MaxEntries allocators at once falls back to the locked path
+ * for the extra allocators.
+ */
+struct ThreadCacheTable
+{
+    static const size_t MaxEntries = 8;
+
+    ~ThreadCacheTable()
+    {
+        std::lock_guard<std::mutex> guard(getLiveAllocatorsLock());
+        for (size_t i = 0; i < numEntries; ++i) {
+            if (getLiveAllocators().count(ids[i])) {
+                caches[i]->orphaned.store(true, std::memory_order_release);
+            }
+        }
+    }
+
+    size_t ids[MaxEntries];
+    ThreadCache* caches[MaxEntries];
+    size_t numEntries;
+};
+
+thread_local ThreadCacheTable threadCaches;
+
+inline void increment(std::atomic<size_t>& counter, size_t n = 1)
+{
+    // Only the owning thread writes to the counters, no need for a locked add
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline void decrement(std::atomic<size_t>& counter, size_t n = 1)
+{
+    counter.store(counter.load(std::memory_order_relaxed) - n, std::memory_order_relaxed);
+}
+
+inline void* popBlock(void** bin)
+{
+    void* block = *bin;
+    *bin = *static_cast<void**>(block);
+    return block;
+}
+
+inline void pushBlock(void** bin, void* block)
+{
+    *static_cast<void**>(block) = *bin;
+    *bin = block;
+}
+
+}
+
+CachedHeapAllocator::CachedHeapAllocator(
+        size_t initialAllocSize,
+        size_t alignment,
+        size_t maxCacheDepth,
+        size_t batchSize) :
+    _heap(initialAllocSize, alignment),
+    _caches(nullptr),
+    _id(nextAllocatorId++),
+    _alignment(alignment),
+    _maxCacheDepth(std::max(maxCacheDepth, static_cast<size_t>(1))),
+    _batchSize(std::max(batchSize, static_cast<size_t>(1)))
+{
+    _reclaimedStats.hits = 0;
+    _reclaimedStats.misses = 0;
+    _reclaimedStats.flushes = 0;
+    _reclaimedStats.cachedBlocks = 0;
+    _reclaimedStats.numThreadCaches = 0;
+
+    std::lock_guard<std::mutex> guard(getLiveAllocatorsLock());
+    getLiveAllocators().insert(_id);
+}
+
+CachedHeapAllocator::~CachedHeapAllocator()
+{
+    // The caches themselves live in the heap and go away with it
+    std::lock_guard<std::mutex> guard(getLiveAllocatorsLock());
+    getLiveAllocators().erase(_id);
+}
+
+void* CachedHeapAllocator::allocate(size_t numBytes, size_t alignment, size_t offset)
+{
+    size_t allocSize = std::max(numBytes, HeapAllocator::MinAllocationSize);
+    bool isCacheable =
+        allocSize <= HeapAllocator::MaxSmallBinSize &&
+        alignment <= _alignment &&
+        offset%alignment == 0;
+
+    ThreadCache* cache = isCacheable ? _getThreadCache() : nullptr;
+    if (!cache) {
+        std::lock_guard<std::mutex> guard(_lock);
+        return _heap.allocate(numBytes, alignment, offset);
+    }
+
+    size_t binIndex = _getCacheBinIndex(allocSize);
+    if (cache->bins[binIndex]) {
+        increment(cache->hits);
+    } else {
+        increment(cache->misses);
+
+        std::lock_guard<std::mutex> guard(_lock);
+        _reclaimOrphanedCaches();
+        _refill(cache, binIndex);
+
+        if (!cache->bins[binIndex]) {
+            return nullptr;
+        }
+    }
+
+    cache->depth[binIndex]--;
+    decrement(cache->numBlocks);
+    return popBlock(&cache->bins[binIndex]);
+}
+
+void CachedHeapAllocator::release(void* addr)
+{
+    if (!addr) {
+        return;
+    }
+
+    // The size is read without the lock, see HeapAllocator::_getOwnedAllocationSize(). Cache
+    // it in the largest bin whose blocks it can stand in for. Blocks from aligned allocations
+    // may not satisfy the default alignment and go back to the heap.
+    size_t blockSize = _heap._getOwnedAllocationSize(addr);
+    size_t binIndex = (blockSize + 1)/8 - 1;
+    bool isCacheable =
+        blockSize <= HeapAllocator::MaxSmallBinSize &&
+        binIndex >= MinCacheBin &&
+        (size_t)addr%_alignment == 0;
+
+    ThreadCache* cache = isCacheable ? _getThreadCache() : nullptr;
+    if (!cache) {
+        std::lock_guard<std::mutex> guard(_lock);
+        _heap.release(addr);
+        return;
+    }
+
+    pushBlock(&cache->bins[binIndex], addr);
+    cache->depth[binIndex]++;
+    increment(cache->numBlocks);
+
+    if (cache->depth[binIndex] > _maxCacheDepth) {
+        increment(cache->flushes);
+
+        std::lock_guard<std::mutex> guard(_lock);
+        _flush(cache, binIndex, cache->depth[binIndex]/2);
+    }
+}
+
+size_t CachedHeapAllocator::getAllocationSize(void* addr) const
+{
+    return _heap._getOwnedAllocationSize(addr);
+}
+
+void* CachedHeapAllocator::reallocate(void* addr, size_t numBytes, size_t alignment, size_t offset)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _heap.reallocate(addr, numBytes, alignment, offset);
+}
+
+bool CachedHeapAllocator::tryExpandInPlace(void* addr, size_t numBytes)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _heap.tryExpandInPlace(addr, numBytes);
+}
+
+void CachedHeapAllocator::shrinkInPlace(void* addr, size_t numBytes)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    _heap.shrinkInPlace(addr, numBytes);
+}
+
+size_t CachedHeapAllocator::allocateBatch(size_t numBytes, size_t alignment, size_t count, void** out, size_t offset)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _heap.allocateBatch(numBytes, alignment, count, out, offset);
+}
+
+void CachedHeapAllocator::flushThreadCache()
+{
+    ThreadCacheTable& table = threadCaches;
+    for (size_t i = 0; i < table.numEntries; ++i) {
+        if (table.ids[i] == _id) {
+            ThreadCache* cache = table.caches[i];
+
+            std::lock_guard<std::mutex> guard(_lock);
+            for (size_t binIndex = 0; binIndex < NumCacheBins; ++binIndex) {
+                _flush(cache, binIndex, cache->depth[binIndex]);
+            }
+            return;
+        }
+    }
+}
+
+typename CachedHeapAllocator::Stats CachedHeapAllocator::getStats() const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    Stats stats = _reclaimedStats;
+    for (ThreadCache* cache = _caches; cache; cache = cache->next) {
+        stats.hits += cache->hits.load(std::memory_order_relaxed);
+        stats.misses += cache->misses.load(std::memory_order_relaxed);
+        stats.flushes += cache->flushes.load(std::memory_order_relaxed);
+        stats.cachedBlocks += cache->numBlocks.load(std::memory_order_relaxed);
+        stats.numThreadCaches++;
+    }
+    return stats;
+}
+
+size_t CachedHeapAllocator::trim(size_t keepBytes)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    _reclaimOrphanedCaches();
+    return _heap.trim(keepBytes);
+}
+
+size_t CachedHeapAllocator::getResidentFreeBytes() const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _heap.getResidentFreeBytes();
+}
+
+CachedHeapAllocator::ThreadCache* CachedHeapAllocator::_getThreadCache()
+{
+    ThreadCacheTable& table = threadCaches;
+    for (size_t i = 0; i < table.numEntries; ++i) {
+        if (table.ids[i] == _id) {
+            return table.caches[i];
+        }
+    }
+    return _createThreadCache();
+}
+
+CachedHeapAllocator::ThreadCache* CachedHeapAllocator::_createThreadCache()
+{
+    ThreadCacheTable& table = threadCaches;
+
+    // Make room by dropping entries of allocators which have been destroyed
+    if (table.numEntries == ThreadCacheTable::MaxEntries) {
+        std::lock_guard<std::mutex> guard(getLiveAllocatorsLock());
+
+        size_t numLive = 0;
+        for (size_t i = 0; i < table.numEntries; ++i) {
+            if (getLiveAllocators().count(table.ids[i])) {
+                table.ids[numLive] = table.ids[i];
+                table.caches[numLive] = table.caches[i];
+                numLive++;
+            }
+        }
+        table.numEntries = numLive;
+
+        if (table.numEntries == ThreadCacheTable::MaxEntries) {
+            return nullptr;
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(_lock);
+
+    void* mem = _heap.allocate(sizeof(ThreadCache));
+    if (!mem) {
+        return nullptr;
+    }
+
+    ThreadCache* cache = new (mem) ThreadCache;
+    std::fill(std::begin(cache->bins), std::end(cache->bins), nullptr);
+    std::fill(std::begin(cache->depth), std::end(cache->depth), 0);
+    cache->hits.store(0);
+    cache->misses.store(0);
+    cache->flushes.store(0);
+    cache->numBlocks.store(0);
+    cache->orphaned.store(false);
+    cache->next = _caches;
+    _caches = cache;
+
+    table.ids[table.numEntries] = _id;
+    table.caches[table.numEntries] = cache;
+    table.numEntries++;
+    return cache;
+}
+
+void CachedHeapAllocator::_refill(ThreadCache* cache, size_t binIndex)
+{
+    assert(cache && binIndex < NumCacheBins);
+
+    size_t blockSize = _getCacheBinSize(binIndex);
+    for (size_t i = 0; i < _batchSize; ++i) {
+        void* block = _heap.allocate(blockSize);
+        if (!block) {
+            break;
+        }
+        pushBlock(&cache->bins[binIndex], block);
+        cache->depth[binIndex]++;
+        increment(cache->numBlocks);
+    }
+}
+
+void CachedHeapAllocator::_flush(ThreadCache* cache, size_t binIndex, size_t numBlocks)
+{
+    assert(cache && binIndex < NumCacheBins);
+    assert(numBlocks <= cache->depth[binIndex]);
+
+    for (size_t i = 0; i < numBlocks; ++i) {
+        _heap.release(popBlock(&cache->bins[binIndex]));
+    }
+    cache->depth[binIndex] -= numBlocks;
+    decrement(cache->numBlocks, numBlocks);
+}
+
+void CachedHeapAllocator::_reclaimOrphanedCaches()
+{
+    ThreadCache** link = &_caches;
+    while (*link) {
+        ThreadCache* cache = *link;
+        if (!cache->orphaned.load(std::memory_order_acquire)) {
+            link = &cache->next;
+            continue;
+        }
+
+        for (size_t binIndex = 0; binIndex < NumCacheBins; ++binIndex) {
+            _flush(cache, binIndex, cache->depth[binIndex]);
+        }
+
+        _reclaimedStats.hits += cache->hits.load(std::memory_order_relaxed);
+        _reclaimedStats.misses += cache->misses.load(std::memory_order_relaxed);
+        _reclaimedStats.flushes += cache->flushes.load(std::memory_order_relaxed);
+
+        *link = cache->next;
+        cache->~ThreadCache();
+        _heap.release(cache);
+    }
+}
@@ -0,0 +1,127 @@
+#ifndef MEM_CACHEDHEAPALLOCATOR_H
+#define MEM_CACHEDHEAPALLOCATOR_H
+
+#include <atomic>
+#include <mutex>
+
+#include "util/units.h"
+#include "mem/alignment.h"
+#include "mem/allocator.h"
+#include "mem/heapAllocator.h"
+
+namespace mem {
+
+/**
+ * Thread-safe HeapAllocator which keeps a per-thread cache of small blocks in front of it.
+ *
+ * Every thread using the allocator gets its own set of free lists, one for each of the
+ * HeapAllocator small bins. Small allocations and releases are served from the calling
+ * thread's lists without taking the shared lock. An empty list is refilled with a batch of
+ * blocks from the shared HeapAllocator and a list which grows past the maximum depth has half
+ * of its blocks flushed back, both under the lock. Large and over-aligned requests go
+ * straight to the shared HeapAllocator under the lock.
+ *
+ * All blocks in a list are allocated with the largest size of their bin so any cached block
+ * can satisfy any request in that bin. Cached blocks are still allocated as far as the shared
+ * HeapAllocator is concerned, a thread which exits leaves its cache behind until the next
+ * refill or flush reclaims it.
+ *
+ * Since the allocator does its own locking, a Region using it can use the SingleThreaded
+ * policy as long as the rest of its policies don't need protecting (e.g. NoTracking).
+ *
+ * Implemented AllocatorPolicy.
+ */
+class CachedHeapAllocator : public mem::Allocator
+{
+public:
+    struct Stats
+    {
+        // Small allocations served from a thread cache
+        size_t hits;
+
+        // Small allocations which had to refill a thread cache from the shared heap
+        size_t misses;
+
+        // Number of times a thread cache was over its depth and returned blocks to the heap
+        size_t flushes;
+
+        size_t cachedBlocks;
+        size_t numThreadCaches;
+    };
+
+    // Opaque per-thread cache, see cachedHeapAllocator.cpp
+    struct ThreadCache;
+
+public:
+    CachedHeapAllocator(
+            size_t initialAllocSize = util::kilobytes(64),
+            size_t alignment = util::bytes(4),
+            size_t maxCacheDepth = 64,
+            size_t batchSize = 16);
+    ~CachedHeapAllocator();
+
+    virtual void* allocate(size_t size, size_t alignment = DefaultAlignment, size_t offset = 0) override;
+    virtual void release(void* addr) override;
+    virtual size_t getAllocationSize(void* addr) const override;
+
+    // Batches skip the thread cache and are carved straight from the shared heap
+    virtual size_t allocateBatch(size_t size, size_t alignment, size_t count, void** out, size_t offset = 0) override;
+
+    virtual void* reallocate(void* addr, size_t size, size_t alignment = DefaultAlignment, size_t offset = 0) override;
+    virtual bool tryExpandInPlace(void* addr, size_t size) override;
+    virtual void shrinkInPlace(void* addr, size_t size) override;
+
+    /**
+     * Returns every block cached by the calling thread to the shared heap.
+     */
+    void flushThreadCache();
+
+    Stats getStats() const;
+
+    /**
+     * See HeapAllocator::trim(). Blocks sitting in thread caches are not free as far as
+     * the shared heap is concerned and aren't released.
+     */
+    size_t trim(size_t keepBytes = 0);
+    size_t getResidentFreeBytes() const;
+
+protected:
+    static const size_t NumCacheBins = HeapAllocator::NumSmallBins;
+
+    // The smallest bin a request can map to given the heap's minimum allocation size
+    static const size_t MinCacheBin = HeapAllocator::MinAllocationSize/8;
+
+    // Cache bins share their indices with the heap's small bins. Blocks in a cache
+    // bin are always at least _getCacheBinSize() bytes.
+    size_t _getCacheBinIndex(size_t numBytes) const { return numBytes/8; }
+    size_t _getCacheBinSize(size_t binIndex) const { return binIndex*8 + 7; }
+
+    ThreadCache* _getThreadCache();
+    ThreadCache* _createThreadCache();
+
+    // These must all be called with _lock held
+    void _refill(ThreadCache* cache, size_t binIndex);
+    void _flush(ThreadCache* cache, size_t binIndex, size_t numBlocks);
+    void _reclaimOrphanedCaches();
+
+private:
+    HeapAllocator _heap;
+    mutable std::mutex _lock;
+
+    // All caches created for this allocator, including those of exited threads
+    ThreadCache* _caches;
+
+    // Counters of caches which have since been reclaimed
+    Stats _reclaimedStats;
+
+    // Unique for the lifetime of the process, used to key the per-thread caches
+    const size_t _id;
+
+    const size_t _alignment;
+    const size_t _maxCacheDepth;
+    const size_t _batchSize;
+};
+
+} // namespace mem
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef MEM_DOUBLEENDEDLINEARALLOCATOR_H
+#define MEM_DOUBLEENDEDLINEARALLOCATOR_H
+
+#include <cassert>
+#include <cstdint>
+
+#include "mem/alignment.h"
+#include "mem/allocator.h"
+#include "mem/util.h"
+
+namespace mem {
+
+/**
+ * LinearAllocator which allocates from both ends of its memory.
+ *
+ * allocate() bumps up from the bottom and allocateTop() bumps down from the top, the two
+ * meet when the memory runs out. Alignment and sizes are handled as in LinearAllocator.
+ * Typically long-lived data goes at the bottom and scratch data at the top, so the scratch
+ * data can be thrown away with clearTop() or a marker while the rest is kept.
+ *
+ * Markers are taken from either end and rewound with the same rewind(), which end a
+ * marker belongs to follows from where it lies relative to the two cursors.
+ */
+class DoubleEndedLinearAllocator : public mem::Allocator
+{
+public:
+    struct Stats
+    {
+        // Both ends together
+        size_t allocatedBytes;
+        size_t topAllocatedBytes;
+        size_t freeBytes;
+    };
+
+    typedef void* Marker;
+
+    static const size_t MaxAllocationSize = 0xffffffff;
+
+public:
+    DoubleEndedLinearAllocator(void* mem, size_t size, size_t alignment = 4) :
+        _startAddr((char*)mem),
+        _endAddr((char*)mem + size),
+        _bottomAddr(_startAddr),
+        _topAddr(_endAddr),
+        _alignment(alignment)
+    {
+        assert(util::isPowerOfTwo(alignment) && "Power of two alignment required");
+    }
+
+    DoubleEndedLinearAllocator(void* start, void* end, size_t alignment = 4) :
+        DoubleEndedLinearAllocator(start, (char*)end - (char*)start, alignment)
+    {
+    }
+
+    /**
+     * Allocates from the bottom.
+     */
+    virtual void* allocate(size_t numBytes, size_t alignment = DefaultAlignment, size_t offset = 0) override
+    {
+        alignment = _getAlignment(alignment);
+        char* addr = (char*)mem::align(_bottomAddr + SizeHeaderSize + offset, alignment) - offset;
+        if (addr > _topAddr || numBytes > static_cast<size_t>(_topAddr - addr) || numBytes > MaxAllocationSize) {
+            return nullptr;
+        }
+
+        setSizeHeader(addr, numBytes);
+        _bottomAddr = addr + numBytes;
+        return addr;
+    }
+
+    /**
+     * Allocates from the top, the size of the allocation sits below it.
+     */
+    void* allocateTop(size_t numBytes, size_t alignment = DefaultAlignment, size_t offset = 0)
+    {
+        if (numBytes > static_cast<size_t>(_topAddr - _bottomAddr) || numBytes > MaxAllocationSize) {
+            return nullptr;
+        }
+
+        alignment = _getAlignment(alignment);
+        char* addr = _alignDown(_topAddr - numBytes + offset, alignment) - offset;
+        if (addr < _bottomAddr + SizeHeaderSize) {
+            return nullptr;
+        }
+
+        setSizeHeader(addr, numBytes);
+        _topAddr = addr - SizeHeaderSize;
+        return addr;
+    }
+
+    virtual void release(void* addr) override
+    {
+        // Noop
+    }
+
+    virtual size_t getAllocationSize(void* addr) const override
+    {
+        return getSizeHeader(addr);
+    }
+
+    Marker getMarker() const { return _bottomAddr; }
+    Marker getTopMarker() const { return _topAddr; }
+
+    /**
+     * Rewinds whichever end the marker was taken from.
+     */
+    void rewind(Marker marker)
+    {
+        char* addr = (char*)marker;
+        if (addr <= _bottomAddr) {
+            assert(addr >= _startAddr && "Marker doesn't belong to this allocator");
+            _bottomAddr = addr;
+        } else {
+            assert(addr >= _topAddr && addr <= _endAddr && "Marker is newer than the allocator");
+            _topAddr = addr;
+        }
+    }
+
+    void clear()
+    {
+        _bottomAddr = _startAddr;
+        _topAddr = _endAddr;
+    }
+
+    void clearTop()
+    {
+        _topAddr = _endAddr;
+    }
+
+    Stats getStats() const
+    {
+        Stats stats;
+        stats.topAllocatedBytes = _endAddr - _topAddr;
+        stats.allocatedBytes = (_bottomAddr - _startAddr) + stats.topAllocatedBytes;
+        stats.freeBytes = _topAddr - _bottomAddr;
+        return stats;
+    }
+
+private:
+    static char* _alignDown(char* addr, size_t alignment)
+    {
+        return (char*)((uintptr_t)addr & ~(uintptr_t)(alignment - 1));
+    }
+
+    size_t _getAlignment(size_t alignment) const
+    {
+        return alignment == DefaultAlignment || alignment < _alignment ? _alignment : alignment;
+    }
+
+    char* const _startAddr;
+    char* const _endAddr;
+    char* _bottomAddr;
+    char* _topAddr;
+    const size_t _alignment;
+};
+
+} // namespace mem
+
+#endif
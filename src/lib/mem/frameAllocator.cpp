@@ -0,0 +1,166 @@
+#include "mem/frameAllocator.h"
+using namespace mem;
+
+#include <algorithm>
+#include <new>
+
+#include "mem/util.h"
+
+const size_t FrameAllocator::MaxBuffers;
+const size_t FrameAllocator::HistorySize;
+
+FrameAllocator::FrameAllocator(
+        size_t bufferSize,
+        size_t numBuffers,
+        size_t alignment,
+        util::PageBacking pageBacking) :
+    _numBuffers(numBuffers),
+    _alignment(alignment),
+    _pageBacking(pageBacking),
+    _bufferSize(bufferSize),
+    _autoTune(false),
+    _currentFrame(0),
+    _numRecordedFrames(0),
+    _pageAllocator(pageBacking)
+{
+    assert(numBuffers > 0 && numBuffers <= MaxBuffers);
+
+    // Only frame 0 is live, the other buffers are created as they're first used
+    for (size_t i = 0; i < _numBuffers; ++i) {
+        _buffers[i].allocator = nullptr;
+        _buffers[i].size = 0;
+        _buffers[i].failedBytes = 0;
+        _buffers[i].retired.store(i != 0, std::memory_order_relaxed);
+    }
+    _createAllocator(_buffers[0]);
+}
+
+FrameAllocator::~FrameAllocator()
+{
+    // Buffers are released along with the PageAllocator
+}
+
+void* FrameAllocator::allocate(size_t numBytes, size_t alignment, size_t offset)
+{
+    Buffer& buffer = _getBuffer(_currentFrame.load(std::memory_order_relaxed));
+    void* addr = buffer.allocator->allocate(numBytes, alignment, offset);
+    if (!addr) {
+        buffer.failedBytes += numBytes;
+    }
+    return addr;
+}
+
+void FrameAllocator::release(void* addr)
+{
+    // Noop
+}
+
+size_t FrameAllocator::getAllocationSize(void* addr) const
+{
+    // Sizes are kept in front of each block so any of the allocators can read them
+    return _buffers[0].allocator->getAllocationSize(addr);
+}
+
+bool FrameAllocator::beginFrame()
+{
+    size_t currentFrame = _currentFrame.load(std::memory_order_relaxed);
+    Buffer& next = _getBuffer(currentFrame + 1);
+
+    // Pairs with retireFrame() so whatever the retiring thread did with the frame's data
+    // is done before it is overwritten
+    if (!next.retired.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    _recordFrame(currentFrame, _getBuffer(currentFrame));
+    if (_autoTune) {
+        _bufferSize = getSuggestedBufferSize();
+    }
+
+    if (!next.allocator || next.size != _bufferSize) {
+        _createAllocator(next);
+    } else {
+        next.allocator->clear();
+    }
+    next.failedBytes = 0;
+    next.retired.store(false, std::memory_order_relaxed);
+
+    _currentFrame.store(currentFrame + 1, std::memory_order_relaxed);
+    return true;
+}
+
+void FrameAllocator::retireFrame(size_t frame)
+{
+    size_t currentFrame = _currentFrame.load(std::memory_order_relaxed);
+    assert(frame <= currentFrame && frame + _numBuffers > currentFrame && "Frame isn't live");
+    _getBuffer(frame).retired.store(true, std::memory_order_release);
+}
+
+size_t FrameAllocator::getFrameHistory(FrameStats* history, size_t maxFrames) const
+{
+    size_t numFrames = std::min(std::min(maxFrames, _numRecordedFrames), HistorySize);
+    for (size_t i = 0; i < numFrames; ++i) {
+        history[i] = _history[(_numRecordedFrames - 1 - i)%HistorySize];
+    }
+    return numFrames;
+}
+
+size_t FrameAllocator::getSuggestedBufferSize() const
+{
+    size_t numFrames = std::min(_numRecordedFrames, HistorySize);
+    if (numFrames == 0) {
+        return _bufferSize;
+    }
+
+    size_t peakBytes = 1;
+    for (size_t i = 0; i < numFrames; ++i) {
+        peakBytes = std::max(peakBytes, _history[i].allocatedBytes + _history[i].failedBytes);
+    }
+    return mem::align(peakBytes, util::getPageSize(_pageBacking));
+}
+
+FrameAllocator::Stats FrameAllocator::getStats() const
+{
+    LinearAllocator::Stats current = _getBuffer(_currentFrame.load(std::memory_order_relaxed)).allocator->getStats();
+
+    Stats stats;
+    stats.allocatedBytes = current.allocatedBytes;
+    stats.freeBytes = current.freeBytes;
+    stats.numLiveFrames = 0;
+    for (size_t i = 0; i < _numBuffers; ++i) {
+        if (!_buffers[i].retired.load(std::memory_order_relaxed)) {
+            stats.numLiveFrames++;
+        }
+    }
+    return stats;
+}
+
+void FrameAllocator::_createAllocator(Buffer& buffer)
+{
+    if (buffer.allocator) {
+        buffer.allocator->~LinearAllocator();
+        _pageAllocator.release(buffer.allocator);
+    }
+
+    // Round the buffer out to fill its pages
+    size_t pageOverhead = PageAllocator::getOverhead(alignof(LinearAllocator));
+    size_t numBytes = mem::align(
+            _bufferSize + sizeof(LinearAllocator) + pageOverhead,
+            util::getPageSize(_pageBacking)) - pageOverhead;
+
+    char* mem = (char*)_pageAllocator.allocate(numBytes, alignof(LinearAllocator));
+    assert(mem);
+    size_t usableBytes = _pageAllocator.getAllocationSize(mem) - sizeof(LinearAllocator);
+
+    buffer.allocator = new (mem) LinearAllocator(mem + sizeof(LinearAllocator), usableBytes, _alignment);
+    buffer.size = _bufferSize;
+}
+
+void FrameAllocator::_recordFrame(size_t frame, const Buffer& buffer)
+{
+    FrameStats& stats = _history[_numRecordedFrames%HistorySize];
+    stats.frame = frame;
+    stats.allocatedBytes = buffer.allocator->getStats().allocatedBytes;
+    stats.failedBytes = buffer.failedBytes;
+    _numRecordedFrames++;
+}
@@ -0,0 +1,142 @@
+#ifndef MEM_FRAMEALLOCATOR_H
+#define MEM_FRAMEALLOCATOR_H
+
+#include <atomic>
+#include <cassert>
+
+#include "util/memory.h"
+#include "mem/alignment.h"
+#include "mem/allocator.h"
+#include "mem/linearAllocator.h"
+#include "mem/pageAllocator.h"
+
+namespace mem {
+
+/**
+ * Rotates between several LinearAllocators so data from earlier frames stays valid while
+ * later frames are allocated, e.g. when one pipeline stage still reads frame N while the
+ * next one builds frame N+1.
+ *
+ * Frames are numbered from 0, which starts when the allocator is created. beginFrame()
+ * ends the current frame and starts the next in the buffer of the oldest frame, which
+ * is only recycled once that frame has been retired with retireFrame(). Until then
+ * beginFrame() fails and allocation continues in the current frame. With numBuffers
+ * buffers there can be that many frames live at once.
+ *
+ * The peak usage of each finished frame, including requests which didn't fit, is kept for
+ * the last HistorySize frames. getSuggestedBufferSize() is the largest of them, with auto
+ * tuning enabled buffers are resized to it as they are recycled.
+ *
+ * Only retireFrame() may be called from another thread, everything else must stay on the
+ * thread allocating.
+ *
+ * Implemented AllocatorPolicy.
+ */
+class FrameAllocator : public mem::Allocator
+{
+public:
+    static const size_t MaxBuffers = 8;
+    static const size_t HistorySize = 64;
+
+    struct FrameStats
+    {
+        size_t frame;
+        size_t allocatedBytes;
+
+        // Bytes of the requests which didn't fit
+        size_t failedBytes;
+    };
+
+    struct Stats
+    {
+        size_t allocatedBytes;
+        size_t freeBytes;
+        size_t numLiveFrames;
+    };
+
+public:
+    FrameAllocator(
+            size_t bufferSize,
+            size_t numBuffers = 2,
+            size_t alignment = 4,
+            util::PageBacking pageBacking = util::RegularPages);
+    ~FrameAllocator();
+
+    virtual void* allocate(size_t size, size_t alignment = DefaultAlignment, size_t offset = 0) override;
+    virtual void release(void* addr) override;
+    virtual size_t getAllocationSize(void* addr) const override;
+
+    /**
+     * Starts the next frame, returns false if the oldest frame hasn't been retired yet.
+     */
+    bool beginFrame();
+
+    /**
+     * Marks a live frame as no longer in use so its buffer can be recycled. Can be called
+     * from any thread.
+     */
+    void retireFrame(size_t frame);
+
+    size_t getCurrentFrame() const { return _currentFrame.load(std::memory_order_relaxed); }
+    size_t getNumBuffers() const { return _numBuffers; }
+    size_t getBufferSize() const { return _bufferSize; }
+
+    /**
+     * Takes effect for each buffer the next time it is recycled.
+     */
+    void setBufferSize(size_t bufferSize) { _bufferSize = bufferSize; }
+    void setAutoTuning(bool autoTune) { _autoTune = autoTune; }
+
+    /**
+     * Copies the stats of up to maxFrames finished frames, newest first, and returns how many
+     * were copied.
+     */
+    size_t getFrameHistory(FrameStats* history, size_t maxFrames) const;
+
+    /**
+     * Buffer size the frames in the history would have fit in, rounded up to the page size.
+     */
+    size_t getSuggestedBufferSize() const;
+
+    Stats getStats() const;
+
+protected:
+    struct Buffer
+    {
+        LinearAllocator* allocator;
+        size_t size;
+        size_t failedBytes;
+        std::atomic<bool> retired;
+    };
+
+    Buffer& _getBuffer(size_t frame) { return _buffers[frame%_numBuffers]; }
+    const Buffer& _getBuffer(size_t frame) const { return _buffers[frame%_numBuffers]; }
+
+    // The LinearAllocator sits at the start of the memory it allocates from
+    void _createAllocator(Buffer& buffer);
+    void _recordFrame(size_t frame, const Buffer& buffer);
+
+private:
+    FrameAllocator(const FrameAllocator&);
+    FrameAllocator& operator=(const FrameAllocator&);
+
+    const size_t _numBuffers;
+    const size_t _alignment;
+    const util::PageBacking _pageBacking;
+    size_t _bufferSize;
+    bool _autoTune;
+
+    Buffer _buffers[MaxBuffers];
+
+    // Only written by the allocating thread, atomic so retireFrame() can check against it
+    std::atomic<size_t> _currentFrame;
+
+    FrameStats _history[HistorySize];
+    size_t _numRecordedFrames;
+
+    PageAllocator _pageAllocator;
+};
+
+} // namespace mem
+
+#endif
@@ -0,0 +1,120 @@
+#include "mem/growableLinearAllocator.h"
+using namespace mem;
+
+#include <algorithm>
+
+#include "util/math.h"
+
+const size_t GrowableLinearAllocator::MaxAllocationSize;
+
+GrowableLinearAllocator::GrowableLinearAllocator(
+        size_t initialChunkSize,
+        size_t maxChunkSize,
+        size_t alignment,
+        util::PageBacking pageBacking) :
+    _curAddr(nullptr),
+    _endAddr(nullptr),
+    _alignment(alignment),
+    _nextChunkSize(std::max(initialChunkSize, util::getPageSize(pageBacking))),
+    _maxChunkSize(std::max(_nextChunkSize, maxChunkSize)),
+    _chunks(nullptr),
+    _numChunks(0),
+    _prevAllocatedBytes(0),
+    _pageAllocator(pageBacking)
+{
+    assert(util::isPowerOfTwo(alignment) && "Power of two alignment required");
+}
+
+GrowableLinearAllocator::~GrowableLinearAllocator()
+{
+    // Chunks are released along with the PageAllocator
+}
+
+void GrowableLinearAllocator::clear()
+{
+    if (!_chunks) {
+        return;
+    }
+
+    Chunk* largest = _chunks;
+    for (Chunk* chunk = _chunks->prev; chunk; chunk = chunk->prev) {
+        if (chunk->size > largest->size) {
+            largest = chunk;
+        }
+    }
+
+    Chunk* chunk = _chunks;
+    while (chunk) {
+        Chunk* prev = chunk->prev;
+        if (chunk != largest) {
+            _pageAllocator.release(chunk);
+        }
+        chunk = prev;
+    }
+
+    largest->prev = nullptr;
+    _chunks = largest;
+    _numChunks = 1;
+    _prevAllocatedBytes = 0;
+    _useChunk(largest);
+}
+
+GrowableLinearAllocator::Stats GrowableLinearAllocator::getStats() const
+{
+    Stats stats;
+    stats.allocatedBytes = _prevAllocatedBytes;
+    stats.freeBytes = 0;
+    stats.numChunks = _numChunks;
+    stats.chunkBytes = 0;
+
+    if (_chunks) {
+        stats.allocatedBytes += _curAddr - _getChunkStart(_chunks);
+        stats.freeBytes = _endAddr - _curAddr;
+    }
+    for (Chunk* chunk = _chunks; chunk; chunk = chunk->prev) {
+        stats.chunkBytes += chunk->size;
+    }
+
+    return stats;
+}
+
+void* GrowableLinearAllocator::_allocateSlow(size_t numBytes, size_t alignment, size_t offset)
+{
+    if (numBytes > MaxAllocationSize || !_addChunk(numBytes, alignment)) {
+        return nullptr;
+    }
+    return allocate(numBytes, alignment, offset);
+}
+
+bool GrowableLinearAllocator::_addChunk(size_t numBytes, size_t alignment)
+{
+    // Room for the chunk and size headers and the worst case padding in front of the
+    // allocation, the offset is part of the padding
+    size_t padding = SizeHeaderSize + _getAlignment(alignment);
+    size_t chunkSize = std::max(
+            _nextChunkSize - PageAllocator::getOverhead(alignof(Chunk)),
+            sizeof(Chunk) + padding + numBytes);
+
+    Chunk* chunk = (Chunk*)_pageAllocator.allocate(chunkSize, alignof(Chunk));
+    if (!chunk) {
+        return false;
+    }
+    chunk->size = _pageAllocator.getAllocationSize(chunk);
+    chunk->prev = _chunks;
+
+    if (_chunks) {
+        _prevAllocatedBytes += _curAddr - _getChunkStart(_chunks);
+    }
+    _chunks = chunk;
+    _numChunks++;
+    _nextChunkSize = std::min(_nextChunkSize*2, _maxChunkSize);
+
+    _useChunk(chunk);
+    return true;
+}
+
+void GrowableLinearAllocator::_useChunk(Chunk* chunk)
+{
+    _curAddr = _getChunkStart(chunk);
+    _endAddr = _getChunkEnd(chunk);
+}
@@ -0,0 +1,122 @@
+#ifndef MEM_GROWABLELINEARALLOCATOR_H
+#define MEM_GROWABLELINEARALLOCATOR_H
+
+#include "util/memory.h"
+#include "util/units.h"
+#include "mem/alignment.h"
+#include "mem/allocator.h"
+#include "mem/pageAllocator.h"
+#include "mem/util.h"
+
+namespace mem {
+
+/**
+ * LinearAllocator which grows instead of running out of memory.
+ *
+ * Allocations are bumped out of the current chunk exactly like LinearAllocator. When it
+ * is exhausted a new chunk is taken from a PageAllocator and chained to the old ones,
+ * each twice the size of the last up to maxChunkSize. A request larger than that gets a
+ * chunk of its own. Whatever remains at the end of a chunk when the next one is started
+ * is not used.
+ *
+ * Clearing keeps only the largest chunk so an arena reused for similar workloads settles
+ * into a single chunk big enough for all of them.
+ *
+ * Implemented AllocatorPolicy.
+ */
+class GrowableLinearAllocator : public mem::Allocator
+{
+public:
+    static const size_t MaxAllocationSize = 0xffffffff;
+
+    struct Stats
+    {
+        size_t allocatedBytes;
+        size_t freeBytes;
+        size_t numChunks;
+        size_t chunkBytes;
+    };
+
+public:
+    GrowableLinearAllocator(
+            size_t initialChunkSize = util::kilobytes(64),
+            size_t maxChunkSize = util::megabytes(4),
+            size_t alignment = 4,
+            util::PageBacking pageBacking = util::RegularPages);
+    ~GrowableLinearAllocator();
+
+    virtual void* allocate(size_t size, size_t alignment = DefaultAlignment, size_t offset = 0) override
+    {
+        char* addr = (char*)mem::align(_curAddr + SizeHeaderSize + offset, _getAlignment(alignment)) - offset;
+        if (addr > _endAddr || size > static_cast<size_t>(_endAddr - addr)) {
+            return _allocateSlow(size, alignment, offset);
+        }
+
+        setSizeHeader(addr, size);
+        _curAddr = addr + size;
+        return addr;
+    }
+
+    virtual void release(void* addr) override
+    {
+        // Noop
+    }
+
+    virtual size_t getAllocationSize(void* addr) const override
+    {
+        return getSizeHeader(addr);
+    }
+
+    /**
+     * Releases every chunk but the largest, which allocation starts over in.
+     */
+    void clear();
+
+    Stats getStats() const;
+
+protected:
+    // Start of every chunk, chunks are chained from the newest to the oldest
+    struct Chunk
+    {
+        Chunk* prev;
+        size_t size;
+    };
+
+    void* _allocateSlow(size_t size, size_t alignment, size_t offset);
+
+    // Adds a chunk able to hold size bytes at the given alignment
+    bool _addChunk(size_t size, size_t alignment);
+    void _useChunk(Chunk* chunk);
+
+    char* _getChunkStart(Chunk* chunk) const { return (char*)chunk + sizeof(Chunk); }
+    char* _getChunkEnd(Chunk* chunk) const { return (char*)chunk + chunk->size; }
+
+
+    size_t _getAlignment(size_t alignment) const
+    {
+        return alignment == DefaultAlignment || alignment < _alignment ? _alignment : alignment;
+    }
+
+private:
+    GrowableLinearAllocator(const GrowableLinearAllocator&);
+    GrowableLinearAllocator& operator=(const GrowableLinearAllocator&);
+
+    char* _curAddr;
+    char* _endAddr;
+    const size_t _alignment;
+
+    size_t _nextChunkSize;
+    const size_t _maxChunkSize;
+
+    Chunk* _chunks;
+    size_t _numChunks;
+
+    // Bytes allocated from the chunks before the current one
+    size_t _prevAllocatedBytes;
+
+    PageAllocator _pageAllocator;
+};
+
+} // namespace mem
+
+#endif
@@ -0,0 +1,316 @@
+#include "mem/guardedSlotPool.h"
+using namespace mem;
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <execinfo.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mem/util.h"
+#include "util/memory.h"
+
+const size_t GuardedSlotPool::DefaultNumSlots;
+const size_t GuardedSlotPool::MaxStackFrames;
+
+namespace {
+
+/**
+ * Pools the fault handler looks through. A pool which doesn't find room here is never
+ * reported on.
+ */
+const size_t MaxPools = 64;
+std::atomic<GuardedSlotPool*> pools[MaxPools];
+
+std::once_flag installFlag;
+struct sigaction previousSegvAction;
+struct sigaction previousBusAction;
+
+void writeString(const char* str)
+{
+    ssize_t result = write(STDERR_FILENO, str, strlen(str));
+    (void)result;
+}
+
+/**
+ * Hands the fault on to whoever had the signal before, or to the default action by
+ * returning into the faulting instruction.
+ */
+void chainFault(int signal, siginfo_t* info, void* context)
+{
+    struct sigaction& previous = signal == SIGSEGV ? previousSegvAction : previousBusAction;
+    if (previous.sa_flags & SA_SIGINFO) {
+        previous.sa_sigaction(signal, info, context);
+        return;
+    }
+    if (previous.sa_handler == SIG_DFL || previous.sa_handler == SIG_IGN) {
+        struct sigaction defaultAction;
+        memset(&defaultAction, 0, sizeof(defaultAction));
+        defaultAction.sa_handler = SIG_DFL;
+        sigaction(signal, &defaultAction, nullptr);
+        return;
+    }
+    previous.sa_handler(signal);
+}
+
+}
+
+GuardedSlotPool::GuardedSlotPool(size_t numSlots) :
+    _numSlots(numSlots),
+    _slotSize(util::getPageSize()),
+    _freeHead(0),
+    _numFree(numSlots),
+    _numAllocations(0)
+{
+    assert(numSlots > 0);
+
+    size_t mappedSize = (2*numSlots + 1)*_slotSize;
+    _start = (char*)util::pageAllocate(mappedSize);
+    _end = _start + mappedSize;
+    int err = mprotect(_start, mappedSize, PROT_NONE);
+    assert(err == 0);
+    (void)err;
+
+    _metadataSize = mem::align(numSlots*(sizeof(Slot) + sizeof(size_t)), util::getPageSize());
+    _slots = (Slot*)util::pageAllocate(_metadataSize);
+    _freeQueue = (size_t*)(_slots + numSlots);
+    for (size_t i = 0; i < numSlots; ++i) {
+        _slots[i].mem = nullptr;
+        _slots[i].isAllocated = false;
+        _freeQueue[i] = i;
+    }
+
+    std::call_once(installFlag, []() {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = &GuardedSlotPool::_handleFault;
+        action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &previousSegvAction);
+        sigaction(SIGBUS, &action, &previousBusAction);
+    });
+
+    bool isRegistered = false;
+    for (size_t i = 0; i < MaxPools && !isRegistered; ++i) {
+        GuardedSlotPool* empty = nullptr;
+        isRegistered = pools[i].compare_exchange_strong(empty, this);
+    }
+    assert(isRegistered && "Too many GuardedSlotPools to report faults for");
+}
+
+GuardedSlotPool::~GuardedSlotPool()
+{
+    for (size_t i = 0; i < MaxPools; ++i) {
+        GuardedSlotPool* self = this;
+        if (pools[i].compare_exchange_strong(self, nullptr)) {
+            break;
+        }
+    }
+
+    util::pageRelease(_start, _end - _start);
+    util::pageRelease(_slots, _metadataSize);
+}
+
+void* GuardedSlotPool::allocate(size_t size, size_t alignment, const SourceInfo& sourceInfo)
+{
+    if (size > _slotSize || alignment > _slotSize) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> guard(_lock);
+    if (_numFree == 0) {
+        return nullptr;
+    }
+
+    size_t index = _freeQueue[_freeHead];
+    _freeHead = (_freeHead + 1)%_numSlots;
+    --_numFree;
+
+    char* slotStart = _getSlotStart(index);
+    int err = mprotect(slotStart, _slotSize, PROT_READ | PROT_WRITE);
+    assert(err == 0);
+    (void)err;
+
+    // A zero byte allocation still needs an address inside its slot
+    char* mem = slotStart;
+    if (_numAllocations++%2 == 0) {
+        mem = slotStart + _slotSize - std::max<size_t>(size, 1);
+        mem -= (size_t)mem%alignment;
+    }
+
+    Slot& slot = _slots[index];
+    slot.mem = mem;
+    slot.size = size;
+    slot.isAllocated = true;
+
+    const std::string& filename = sourceInfo.filename;
+    size_t filenameStart = filename.size() < sizeof(slot.filename) ? 0 : filename.size() - sizeof(slot.filename) + 1;
+    strncpy(slot.filename, filename.c_str() + filenameStart, sizeof(slot.filename) - 1);
+    slot.filename[sizeof(slot.filename) - 1] = '\0';
+    slot.lineNumber = sourceInfo.lineNumber;
+
+    slot.allocationStackSize = backtrace(slot.allocationStack, MaxStackFrames);
+    slot.releaseStackSize = 0;
+
+    return mem;
+}
+
+void GuardedSlotPool::release(void* addr)
+{
+    assert(contains(addr));
+    std::lock_guard<std::mutex> guard(_lock);
+
+    size_t index = _getSlotIndex(addr);
+    if (index == _numSlots || _slots[index].mem != addr) {
+        _reportSlot("Invalid free", addr, _findSlot(addr));
+        abort();
+    }
+
+    Slot& slot = _slots[index];
+    if (!slot.isAllocated) {
+        _reportSlot("Double free", addr, &slot);
+        abort();
+    }
+
+    slot.isAllocated = false;
+    slot.releaseStackSize = backtrace(slot.releaseStack, MaxStackFrames);
+
+    // Whatever was in the slot is gone by the time it is reused
+    char* slotStart = _getSlotStart(index);
+    int err = mprotect(slotStart, _slotSize, PROT_NONE);
+    assert(err == 0);
+    (void)err;
+    madvise(slotStart, _slotSize, MADV_DONTNEED);
+
+    _freeQueue[(_freeHead + _numFree)%_numSlots] = index;
+    ++_numFree;
+}
+
+size_t GuardedSlotPool::getAllocationSize(const void* addr) const
+{
+    assert(contains(addr));
+    std::lock_guard<std::mutex> guard(_lock);
+
+    size_t index = _getSlotIndex(addr);
+    assert(index < _numSlots && _slots[index].isAllocated && "Not an allocation");
+    return _slots[index].size;
+}
+
+size_t GuardedSlotPool::getNumAllocated() const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _numSlots - _numFree;
+}
+
+int GuardedSlotPool::getSampleInterval(size_t sampleRate)
+{
+    assert(sampleRate > 0);
+
+    // xorshift, seeded by where the state of the thread lives
+    static thread_local uint64_t state = 0;
+    if (!state) {
+        state = ((uintptr_t)&state*0x9e3779b97f4a7c15ull) | 1;
+    }
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+
+    uint64_t interval = 1 + state%(2*static_cast<uint64_t>(sampleRate) - 1);
+    return interval < INT_MAX ? static_cast<int>(interval) : INT_MAX;
+}
+
+size_t GuardedSlotPool::_getSlotIndex(const void* addr) const
+{
+    size_t page = ((const char*)addr - _start)/_slotSize;
+    return page%2 == 0 ? _numSlots : page/2;
+}
+
+const GuardedSlotPool::Slot* GuardedSlotPool::_findSlot(const void* addr) const
+{
+    size_t index = _getSlotIndex(addr);
+    if (index < _numSlots) {
+        return _slots[index].mem ? &_slots[index] : nullptr;
+    }
+
+    // A guard page, pick the closer of the allocations on either side
+    size_t guard = ((const char*)addr - _start)/_slotSize/2;
+    const Slot* before = guard > 0 && _slots[guard - 1].mem ? &_slots[guard - 1] : nullptr;
+    const Slot* after = guard < _numSlots && _slots[guard].mem ? &_slots[guard] : nullptr;
+    if (!before || !after) {
+        return before ? before : after;
+    }
+
+    size_t distanceBefore = (const char*)addr - ((const char*)before->mem + before->size);
+    size_t distanceAfter = (const char*)after->mem - (const char*)addr;
+    return distanceBefore <= distanceAfter ? before : after;
+}
+
+bool GuardedSlotPool::_report(const void* addr) const
+{
+    if (!contains(addr)) {
+        return false;
+    }
+
+    const Slot* slot = _findSlot(addr);
+    const char* error = "Invalid access";
+    if (slot && !slot->isAllocated) {
+        error = "Use after free";
+    } else if (slot && addr < slot->mem) {
+        error = "Buffer underflow";
+    } else if (slot && addr >= (const char*)slot->mem + slot->size) {
+        error = "Buffer overflow";
+    }
+    _reportSlot(error, addr, slot);
+    return true;
+}
+
+void GuardedSlotPool::_reportSlot(const char* error, const void* addr, const Slot* slot) const
+{
+    // Called from the fault handler, so no allocating
+    char buffer[512];
+    if (!slot) {
+        snprintf(buffer, sizeof(buffer), "GuardedSlotPool: %s at %p\n", error, addr);
+        writeString(buffer);
+        return;
+    }
+
+    const char* mem = (const char*)slot->mem;
+    const char* where = "into";
+    size_t distance = (const char*)addr - mem;
+    if ((const char*)addr < mem) {
+        where = "before";
+        distance = mem - (const char*)addr;
+    } else if ((const char*)addr >= mem + slot->size) {
+        where = "after";
+        distance = (const char*)addr - (mem + slot->size);
+    }
+
+    snprintf(buffer, sizeof(buffer),
+            "GuardedSlotPool: %s at %p, %zu bytes %s the %zu byte allocation at %p\n"
+            "Allocated at %s:%zu by:\n",
+            error, addr, distance, where, slot->size, mem, slot->filename, slot->lineNumber);
+    writeString(buffer);
+    backtrace_symbols_fd(const_cast<void**>(slot->allocationStack), slot->allocationStackSize, STDERR_FILENO);
+
+    if (!slot->isAllocated) {
+        writeString("Released by:\n");
+        backtrace_symbols_fd(const_cast<void**>(slot->releaseStack), slot->releaseStackSize, STDERR_FILENO);
+    }
+}
+
+void GuardedSlotPool::_handleFault(int signal, siginfo_t* info, void* context)
+{
+    for (size_t i = 0; i < MaxPools; ++i) {
+        GuardedSlotPool* pool = pools[i].load();
+        if (pool && pool->_report(info->si_addr)) {
+            break;
+        }
+    }
+    chainFault(signal, info, context);
+}
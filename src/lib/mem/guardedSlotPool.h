@@ -0,0 +1,113 @@
+#ifndef MEM_GUARDEDSLOTPOOL_H
+#define MEM_GUARDEDSLOTPOOL_H
+
+#include <csignal>
+#include <cstddef>
+#include <mutex>
+
+#include "mem/sourceInfo.h"
+
+namespace mem {
+
+/**
+ * A small, fixed number of page sized slots for sampled allocations, see SamplingRegion.
+ *
+ * Every slot sits between two PROT_NONE pages and is itself PROT_NONE while free. An
+ * allocation takes a whole slot and alternates between being flush against the guard page
+ * after it and the one before it, so both overruns and underruns fault on the spot. A
+ * released slot goes to the back of the free queue, the slot reused next is always the one
+ * released longest ago which gives a use after free as long as possible to fault.
+ *
+ * The first pool installs a SIGSEGV/SIGBUS handler. A fault in any live pool is reported
+ * to stderr with the allocation's SourceInfo and the call stacks of its allocation and
+ * release, after which the previous handler gets the fault. Releasing memory twice or
+ * releasing an address which isn't an allocation is reported and aborts.
+ *
+ * Allocations larger than a page or aligned to more than one don't fit a slot and are
+ * refused, as are all allocations while every slot is in use.
+ */
+class GuardedSlotPool
+{
+public:
+    static const size_t DefaultNumSlots = 16;
+    static const size_t MaxStackFrames = 16;
+
+public:
+    explicit GuardedSlotPool(size_t numSlots = DefaultNumSlots);
+    ~GuardedSlotPool();
+
+    /**
+     * Returns null if the allocation doesn't fit a slot or none is free.
+     */
+    void* allocate(size_t size, size_t alignment, const SourceInfo& sourceInfo);
+    void release(void* addr);
+
+    bool contains(const void* addr) const { return addr >= _start && addr < _end; }
+    size_t getAllocationSize(const void* addr) const;
+
+    size_t getSlotSize() const { return _slotSize; }
+    size_t getNumSlots() const { return _numSlots; }
+    size_t getNumAllocated() const;
+
+    /**
+     * Number of allocations until the next sample for the calling thread. Random so that
+     * a repeating pattern of allocations doesn't keep sampling the same ones, sampleRate on
+     * average.
+     */
+    static int getSampleInterval(size_t sampleRate);
+
+protected:
+    struct Slot
+    {
+        void* mem;
+        size_t size;
+        bool isAllocated;
+
+        // Tail of the file name, it is reported from the fault handler which can't
+        // allocate
+        char filename[128];
+        size_t lineNumber;
+
+        void* allocationStack[MaxStackFrames];
+        int allocationStackSize;
+        void* releaseStack[MaxStackFrames];
+        int releaseStackSize;
+    };
+
+    // Guard pages come before every slot and after the last
+    char* _getSlotStart(size_t index) const { return _start + _slotSize + index*2*_slotSize; }
+    size_t _getSlotIndex(const void* addr) const;
+
+    // Slot whose allocation addr most likely belongs to, null if none is near
+    const Slot* _findSlot(const void* addr) const;
+    bool _report(const void* addr) const;
+    void _reportSlot(const char* error, const void* addr, const Slot* slot) const;
+
+    static void _handleFault(int signal, siginfo_t* info, void* context);
+
+private:
+    GuardedSlotPool(const GuardedSlotPool&);
+    GuardedSlotPool& operator=(const GuardedSlotPool&);
+
+    size_t _numSlots;
+    size_t _slotSize;
+
+    char* _start;
+    char* _end;
+
+    // Slot bookkeeping lives outside of the protected pages
+    Slot* _slots;
+    size_t* _freeQueue;
+    size_t _freeHead;
+    size_t _numFree;
+    size_t _metadataSize;
+
+    // Decides which end of its slot an allocation goes to
+    size_t _numAllocations;
+
+    mutable std::mutex _lock;
+};
+
+} // namespace mem
+
+#endif
@@ -1,11 +1,14 @@
 #include "mem/heapAllocator.h"
 using namespace mem;
 
+#include <cstring>
+
 #include "mem/util.h"
 #include "util/bit.h"
 #include "util/forever.h"
 #include "util/stl.h"
 #include "util/string.h"
+#include "util/unused.h"
 
 const size_t HeapAllocator::MinAllocationSize;
 const size_t HeapAllocator::MaxAllocationSize;
@@ -19,35 +22,102 @@ const size_t HeapAllocator::BlockOverheadSize;
 const size_t HeapAllocator::BlockAllocatedBitMask;
 const size_t HeapAllocator::BlockFencePostBitMask;
 const size_t HeapAllocator::BlockExternalBitMask;
+const size_t HeapAllocator::BlockTrimmedBitMask;
 const size_t HeapAllocator::BlockFlagsBitMask;
 const size_t HeapAllocator::BlockSizeBitMask;
 const size_t HeapAllocator::SegmentExternalBitMask;
+const size_t HeapAllocator::SegmentArenaBitShift;
+const size_t HeapAllocator::SegmentArenaBitMask;
+const size_t HeapAllocator::MaxArenaIndex;
 const size_t HeapAllocator::SegmentFlagsBitMask;
 const size_t HeapAllocator::SegmentOffsetBitMask;
+const size_t HeapAllocator::NumSegmentCacheClasses;
+const size_t HeapAllocator::DefaultSegmentCacheSize;
+const int HeapAllocator::DefaultSegmentCacheAge;
+
+HeapAllocator::HeapAllocator(size_t initialAllocSize, size_t alignment, util::PageBacking pageBacking) :
+    HeapAllocator(initialAllocSize, alignment, pageBacking, nullptr, nullptr, nullptr)
+{
+}
+
+HeapAllocator::HeapAllocator(VirtualArea& area, size_t initialAllocSize, size_t alignment) :
+    HeapAllocator(initialAllocSize, alignment, area.getPageBacking(), &area, nullptr, nullptr)
+{
+}
+
+HeapAllocator::HeapAllocator(void* start, void* end, size_t alignment) :
+    HeapAllocator(util::kilobytes(64), alignment, util::RegularPages, nullptr, start, end)
+{
+}
 
-HeapAllocator::HeapAllocator(size_t initialAllocSize, size_t alignment) :
+HeapAllocator::HeapAllocator(
+        size_t initialAllocSize, 
+        size_t alignment, 
+        util::PageBacking pageBacking, 
+        VirtualArea* area,
+        void* borrowedStart,
+        void* borrowedEnd) :
     _reserve(nullptr),
     _binMap(0),
     _headSegment(nullptr),
+    _tailSegment(nullptr),
     _newSegmentSize(initialAllocSize),
     _alignment(alignment),
+    _pageBacking(pageBacking),
+    _area(area),
+    _borrowedStart((char*)borrowedStart),
+    _borrowedEnd((char*)borrowedEnd),
+    _arenaIndex(0),
+    _releasedBytes(0),
+    _allocatedBytes(0),
+    _allocatedBlocks(0),
+    _numBlocks(0),
+    _blockBytes(0),
+    _segmentOverheadBytes(0),
+    _numRegularSegments(0),
+    _numExternalSegments(0),
+    _segmentCacheBytes(0),
+    _segmentCacheMaxBytes(DefaultSegmentCacheSize),
+    _segmentCacheMaxAge(DefaultSegmentCacheAge),
+    _segmentCacheHits(0),
     _doSystemAllocation(true),
     _doBlockMerging(true),
     _doSegmentMerging(true)
 {
     //Log::debug("Initializing allocator to size %zu, alignment %zu", initialAllocSize, alignment);
     std::fill(std::begin(_bins), std::end(_bins), nullptr);
+    std::fill(std::begin(_segmentCache), std::end(_segmentCache), nullptr);
 
-    BlockHeader* block = _allocNewSegment(initialAllocSize, false);
+    BlockHeader* block = _borrowedStart ? 
+        _linkBorrowedSegment() : 
+        _allocNewSegment(initialAllocSize, false, _alignment, 0);
     _linkBlock(block);
 }
 
 HeapAllocator::~HeapAllocator()
 {
-    // Nothing to do
+    // Newest first, so each segment taken from an area is the last one committed when it
+    // is released and the area is decommitted as it goes
+    while (_tailSegment) {
+        _releaseSegment(_tailSegment);
+    }
+    _evictCachedSegments(0);
 }
 
-void* HeapAllocator::allocate(size_t numBytes, size_t, size_t)
+void* HeapAllocator::allocate(size_t numBytes, size_t alignment, size_t offset)
+{
+    assert(util::isPowerOfTwo(alignment) && "Power of two alignment required");
+
+    // Every block is already aligned to the allocator alignment, only stricter requests
+    // need to be carved out specially
+    size_t blockSize = _getRequestBlockSize(numBytes);
+    if (_isDefaultAligned(alignment, offset)) {
+        return _allocate(blockSize);
+    }
+    return _allocAligned(blockSize, alignment, offset);
+}
+
+void* HeapAllocator::_allocate(size_t numBytes)
 {
     // Force a minimum allocation size. This ensures a zero byte
     // allocation actually returns something valid and that we
@@ -106,6 +176,229 @@ void* HeapAllocator::allocate(size_t numBytes, size_t, size_t)
     return nullptr;
 }
 
+size_t HeapAllocator::allocateBatch(size_t numBytes, size_t alignment, size_t count, void** out, size_t offset)
+{
+    size_t allocSize = _getRequestBlockSize(numBytes);
+
+    // Blocks are laid out back to back, each has to start aligned
+    size_t stride = mem::align(allocSize + BlockOverheadSize, _alignment);
+    size_t maxChunkCount = LargeAllocBoundary/stride;
+
+    if (!_isDefaultAligned(alignment, offset) || maxChunkCount < 2) {
+        return Allocator::allocateBatch(numBytes, alignment, count, out, offset);
+    }
+
+    size_t numAllocated = 0;
+    while (numAllocated < count) {
+        // One block big enough for the rest of the batch, which is then cut into pieces
+        size_t chunkCount = std::min(count - numAllocated, maxChunkCount);
+        void* chunk = _allocate(chunkCount*stride - BlockOverheadSize);
+        if (!chunk) {
+            break;
+        }
+
+        BlockHeader* block = _getDataHeader(chunk);
+        size_t chunkSize = _getBlockSize(block) + BlockOverheadSize;
+
+        // Every extra piece takes a block overhead out of the chunk
+        _numBlocks += chunkCount - 1;
+        _allocatedBlocks += chunkCount - 1;
+        _allocatedBytes -= (chunkCount - 1)*BlockOverheadSize;
+
+        // The first piece keeps the flags of the chunk, the last gets any excess
+        for (size_t i = 0; i < chunkCount; ++i) {
+            BlockHeader* piece = (BlockHeader*)((char*)block + i*stride);
+            size_t pieceSize = i + 1 < chunkCount ? stride : chunkSize - i*stride;
+
+            if (i > 0) {
+                piece->head = 0;
+                _setPrevBlockAllocated(piece, true);
+            }
+            _setBlockState(piece, pieceSize - BlockOverheadSize, true);
+
+            out[numAllocated++] = _getBlockData(piece);
+        }
+    }
+
+    return numAllocated;
+}
+
+void* HeapAllocator::_allocAligned(size_t numBytes, size_t alignment, size_t offset)
+{
+    size_t allocSize = std::max(numBytes, MinAllocationSize);
+
+    // Over-allocate enough that the start of the block can be moved forward to an aligned
+    // address while still leaving a valid free block in front of it
+    size_t minSplitSize = MinAllocationSize + BlockOverheadSize;
+    size_t paddedSize = allocSize + alignment + minSplitSize;
+
+    // External segments are aligned as a whole
+    if (_isLargeAlloc(paddedSize)) {
+        void* mem = nullptr;
+        if (_doSystemAllocation) {
+            mem = _allocExternal(allocSize, alignment, offset);
+        }
+        assert(mem && "Out of memory");
+        return mem;
+    }
+
+    char* data = (char*)_allocate(paddedSize);
+    if (!data) {
+        return nullptr;
+    }
+
+    BlockHeader* block = _getDataHeader(data);
+    size_t blockSize = _getBlockSize(block);
+
+    char* alignedData = (char*)mem::align(data + offset, alignment) - offset;
+    while (alignedData != data && (size_t)(alignedData - data) < minSplitSize) {
+        alignedData += alignment;
+    }
+
+    if (alignedData != data) {
+        // The leading slack becomes a block of its own. It keeps the original header and so
+        // its flags (e.g. fencepost), the aligned block starts right after its footer.
+        size_t leadSize = alignedData - data;
+        BlockHeader* aligned = _getDataHeader(alignedData);
+        aligned->head = 0;
+        _setBlockState(aligned, blockSize - leadSize, true);
+
+        _setBlockSize(block, leadSize - BlockOverheadSize);
+        _reconcileFooter(block);
+        _numBlocks++;
+
+        if ((size_t)alignedData%_alignment == 0) {
+            // Returned to the bins
+            _setBlockInUse(block, false);
+            block->next = nullptr;
+            block->prev = nullptr;
+            _allocatedBytes -= leadSize;
+            _linkBlock(block);
+        } else {
+            // A misaligned block can't be returned to the bins as is when it's released,
+            // it's merged into the block in front of it instead. That block stays
+            // allocated until then so its footer can be relied on to find it.
+            _setPrevBlockAllocated(aligned, true);
+            _allocatedBlocks++;
+            _allocatedBytes -= BlockOverheadSize;
+        }
+
+        block = aligned;
+        blockSize -= leadSize;
+    }
+
+    // Return the trailing slack too
+    _splitBlockTail(block, allocSize);
+
+    assert((size_t)(alignedData + offset)%alignment == 0 && "Alignment incorrect");
+    return alignedData;
+}
+
+void* HeapAllocator::reallocate(void* addr, size_t numBytes, size_t alignment, size_t offset)
+{
+    if (!addr) {
+        return allocate(numBytes, alignment, offset);
+    }
+
+    BlockHeader* header = _getDataHeader(addr);
+    assert(_blockBelongsToAllocator(header) && "Address doesn't belong to this allocator");
+    assert(_isBlockAllocated(header) && "Address is not allocated");
+
+    // The block can only stay where it is if it already has the alignment asked for
+    bool isAligned = 
+        _isDefaultAligned(alignment, offset) || 
+        ((size_t)addr + offset)%alignment == 0;
+
+    if (isAligned) {
+        if (numBytes <= getAllocationSize(addr)) {
+            shrinkInPlace(addr, numBytes);
+            return addr;
+        }
+
+        if (tryExpandInPlace(addr, numBytes)) {
+            return addr;
+        }
+
+        // Let the OS move the pages rather than copying them
+        if (_isBlockExternal(header)) {
+            Segment* segment = _resizeExternalSegment(_getSegment(header), numBytes, true);
+            if (segment) {
+                return _getBlockData(_getFirstSegmentBlock(segment));
+            }
+        }
+    }
+
+    size_t copySize = std::min(getAllocationSize(addr), numBytes);
+    void* mem = allocate(numBytes, alignment, offset);
+    if (mem) {
+        memcpy(mem, addr, copySize);
+        release(addr);
+    }
+    return mem;
+}
+
+bool HeapAllocator::tryExpandInPlace(void* addr, size_t numBytes)
+{
+    assert(addr);
+    BlockHeader* header = _getDataHeader(addr);
+    assert(_blockBelongsToAllocator(header) && "Address doesn't belong to this allocator");
+    assert(_isBlockAllocated(header) && "Address is not allocated");
+
+    size_t allocSize = _getRequestBlockSize(numBytes);
+    size_t blockSize = _getBlockSize(header);
+    if (allocSize <= blockSize) {
+        return true;
+    }
+
+    if (_isBlockExternal(header)) {
+        return _resizeExternalSegment(_getSegment(header), allocSize, false) != nullptr;
+    }
+
+    // Absorb the free block following this one, then give back what isn't needed
+    BlockHeader* next = _getNextBlock(header);
+    if (!next || _isBlockAllocated(next)) {
+        return false;
+    }
+
+    size_t nextSize = _getBlockSize(next);
+    if (blockSize + BlockOverheadSize + nextSize < allocSize) {
+        return false;
+    }
+
+    _unlinkBlock(next);
+    _untrimBlock(next);
+
+    _setBlockSize(header, blockSize + BlockOverheadSize + nextSize);
+    _setBlockInUse(header, true);
+    _numBlocks--;
+    _allocatedBytes += BlockOverheadSize + nextSize;
+
+    _splitBlockTail(header, allocSize);
+    return true;
+}
+
+void HeapAllocator::shrinkInPlace(void* addr, size_t numBytes)
+{
+    assert(addr);
+    BlockHeader* header = _getDataHeader(addr);
+    assert(_blockBelongsToAllocator(header) && "Address doesn't belong to this allocator");
+    assert(_isBlockAllocated(header) && "Address is not allocated");
+
+    size_t allocSize = _getRequestBlockSize(numBytes);
+    if (allocSize >= _getBlockSize(header)) {
+        return;
+    }
+
+    if (_isBlockExternal(header)) {
+        // Only pages past the end can go back, shrinking in place never fails
+        Segment* segment = _resizeExternalSegment(_getSegment(header), allocSize, false);
+        assert(segment);
+        UNUSED(segment);
+    } else {
+        _splitBlockTail(header, allocSize);
+    }
+}
+
 void HeapAllocator::release(void* addr)
 {
     if (addr) {
@@ -116,33 +409,156 @@ void HeapAllocator::release(void* addr)
         assert(_blockBelongsToAllocator(header) && "Address doesn't belong to this allocator");
         assert(_isBlockAllocated(header) && "Double free on address");
 
-        _setBlockAllocated(header, false);
+        _setBlockInUse(header, false);
+        _allocatedBlocks--;
+        _allocatedBytes -= _getBlockSize(header);
+
+        // The free list links and footer overlap the user data, don't let whatever was
+        // last written there look like a link.
+        header->next = nullptr;
+        header->prev = nullptr;
+        _reconcileFooter(header);
 
         if (_isBlockExternal(header)) {
             Segment* segment = _getSegment(header); 
             _releaseExternalSegment(segment);
         } else {
-            _linkBlock(header);
+            header = _realignBlock(header);
+            if (header) {
+                _linkBlock(header);
+            }
         }
     }
 }
 
+size_t HeapAllocator::getAllocationSize(void* addr) const
+{
+    assert(addr);
+    BlockHeader* header = _getDataHeader(addr);
+    assert(_blockBelongsToAllocator(header) && "Address doesn't belong to this allocator");
+    assert(_isBlockAllocated(header) && "Address is not allocated");
+    return _getBlockSize(header) + sizeof(BlockFooter);
+}
+
+void HeapAllocator::setArenaIndex(size_t arenaIndex)
+{
+    assert(arenaIndex <= MaxArenaIndex);
+    _arenaIndex = arenaIndex;
+
+    Segment* segment = _headSegment;
+    while (segment) {
+        _setSegmentArena(segment, arenaIndex);
+        segment = segment->next;
+    }
+}
+
 void HeapAllocator::clear() 
 {
-    // Reset the first block of each segment to be the maximum size and not in use.
+    std::fill(std::begin(_bins), std::end(_bins), nullptr);
+    _binMap = 0;
+    _reserve = nullptr;
+
+    // Reset each segment to a single free block spanning it, laid out the same as
+    // _linkSegment() does
     Segment* segment = _headSegment;
     while (segment) {
+        Segment* next = segment->next;
         if (_isSegmentExternal(segment)) {
             _releaseExternalSegment(segment);
         } else {
+            _uncountSegmentBlocks(segment);
+
             BlockHeader* block = _getFirstSegmentBlock(segment);    
-            _setBlockAllocated(block, false);
+            size_t blockSize = segment->size - BlockOverheadSize - _getSegmentOffset(segment) - sizeof(BlockFooter);
+            _initBlock(block, blockSize, false);
             _setBlockFencePost(block, true);
-            _setBlockSize(block, segment->size - sizeof(Segment));
-            _reconcileFooter(block);
+            _setPrevBlockAllocated(block, true);
+
+            BlockHeader* rightFence = _splitBlock(block, MinAllocationSize);
+            _setBlockFencePost(rightFence, true);
+
+            _numBlocks++;
+            _blockBytes += _getBlockSize(block) + BlockOverheadSize;
+            _linkBlock(block);
+        }
+        segment = next;
+    }
+    _releasedBytes = 0;
+}
+
+size_t HeapAllocator::trim(size_t keepBytes)
+{
+    size_t releasedBytes = 0;
+    size_t keptBytes = 0;
+
+    Segment* segment = _headSegment;
+    while (segment) {
+        Segment* next = segment->next;
+        if (_isSegmentExternal(segment) || _isSegmentBorrowed(segment)) {
+            segment = next;
+            continue;
+        }
+
+        // A free segment in the middle of an area is kept, its pages are released like
+        // those of any other free block
+        BlockHeader* block = _getFirstSegmentBlock(segment);
+        bool isSegmentFree = !_isBlockAllocated(block) && !_getNextBlock(block) && 
+            !_isInteriorAreaSegment(segment);
+
+        while (block) {
+            char* trimStart = nullptr;
+            size_t trimBytes = _getTrimRange(block, &trimStart);
+            size_t residentBytes = _getBlockSize(block) - (_isBlockTrimmed(block) ? trimBytes : 0);
+
+            if (_isBlockAllocated(block)) {
+                // Nothing to release
+            } else if (keptBytes + residentBytes <= keepBytes) {
+                keptBytes += residentBytes;
+            } else if (isSegmentFree) {
+                // The whole segment goes back, not just the block
+                _unlinkBlock(block);
+                _untrimBlock(block);
+                releasedBytes += segment->size + sizeof(Segment) - (_getBlockSize(block) - residentBytes);
+                _releaseSegment(segment);
+                break;
+            } else {
+                releasedBytes += _trimBlock(block);
+            }
+            block = _getNextBlock(block);
+        }
+        segment = next;
+    }
+
+    // Cached external segments get whatever is left of keepBytes
+    releasedBytes += _evictCachedSegments(keepBytes - std::min(keptBytes, keepBytes));
+
+    return releasedBytes;
+}
+
+size_t HeapAllocator::getResidentFreeBytes() const
+{
+    size_t freeBytes = 0;
+
+    Segment* segment = _headSegment;
+    while (segment) {
+        BlockHeader* block = _isSegmentExternal(segment) ? nullptr : _getFirstSegmentBlock(segment);
+        while (block) {
+            if (!_isBlockAllocated(block)) {
+                freeBytes += _getBlockSize(block);
+            }
+            block = _getNextBlock(block);
         }
         segment = segment->next;
     }
+
+    return freeBytes - _releasedBytes + _segmentCacheBytes;
+}
+
+void HeapAllocator::setExternalSegmentCache(size_t maxBytes, std::chrono::milliseconds maxAge)
+{
+    _segmentCacheMaxBytes = maxBytes;
+    _segmentCacheMaxAge = maxAge;
+    _evictCachedSegments(_segmentCacheMaxBytes);
 }
 
 bool HeapAllocator::check(std::vector<HeapAllocator::Block>* corruptBlocks) 
@@ -153,7 +569,16 @@ bool HeapAllocator::check(std::vector<HeapAllocator::Block>* corruptBlocks)
     while (segment) {
         BlockHeader* block = _getFirstSegmentBlock(segment);
         while (block) {
-            if (!_checkBlock(block)) {
+            // Allocated blocks can only be checked through the block following them, which
+            // has to agree on whether they're allocated. The fencepost ending the segment
+            // is checked along with the last block.
+            BlockHeader* adjacent = _getAdjacentBlock(block);
+            bool isCorrupt = 
+                !_checkBlock(block) ||
+                _isPrevBlockAllocated(adjacent) != _isBlockAllocated(block) ||
+                (_isBlockFencePost(adjacent) && !_checkBlock(adjacent));
+
+            if (isCorrupt) {
                 foundCorrupt = true;
                 if (corruptBlocks) {
                     Block b;    
@@ -174,6 +599,25 @@ bool HeapAllocator::check(std::vector<HeapAllocator::Block>* corruptBlocks)
 }
 
 typename HeapAllocator::Stats HeapAllocator::getStats() const
+{
+    HeapAllocator::Stats stats;
+    stats.allocatedBytes = _allocatedBytes + _allocatedBlocks*sizeof(BlockFooter);
+    stats.freeBytes = _blockBytes - _numBlocks*BlockOverheadSize - _allocatedBytes;
+    stats.allocatedBlocks = _allocatedBlocks;
+    stats.freeBlocks = _numBlocks - _allocatedBlocks;
+    stats.overheadBytes = 
+        _segmentOverheadBytes + 
+        _numBlocks*BlockOverheadSize - 
+        _allocatedBlocks*sizeof(BlockFooter);
+    stats.numRegularSegments = _numRegularSegments;
+    stats.numExternalSegments = _numExternalSegments;
+    stats.releasedBytes = _releasedBytes;
+    stats.externalCacheHits = _segmentCacheHits;
+    stats.externalCacheBytes = _segmentCacheBytes;
+    return stats;
+}
+
+typename HeapAllocator::Stats HeapAllocator::computeStatsSlow() const
 {
     HeapAllocator::Stats stats;
     stats.allocatedBytes = 0;
@@ -183,6 +627,9 @@ typename HeapAllocator::Stats HeapAllocator::getStats() const
     stats.overheadBytes = 0;
     stats.numRegularSegments = 0;
     stats.numExternalSegments = 0;
+    stats.releasedBytes = _releasedBytes;
+    stats.externalCacheHits = _segmentCacheHits;
+    stats.externalCacheBytes = _segmentCacheBytes;
 
     Segment* segment = _headSegment;
     while (segment) {
@@ -197,13 +644,14 @@ typename HeapAllocator::Stats HeapAllocator::getStats() const
         BlockHeader* block = _getFirstSegmentBlock(segment);
         while (block) {
             if (_isBlockAllocated(block)) {
-                stats.allocatedBytes += _getBlockSize(block);
+                stats.allocatedBytes += _getBlockSize(block) + sizeof(BlockFooter);
                 stats.allocatedBlocks++;
+                stats.overheadBytes += BlockHeaderSize;
             } else {
                 stats.freeBytes += _getBlockSize(block);
                 stats.freeBlocks++;
+                stats.overheadBytes += BlockOverheadSize;
             }
-            stats.overheadBytes += BlockOverheadSize;
             block = _getNextBlock(block);
         }
         segment = segment->next;
@@ -227,6 +675,9 @@ std::vector<typename HeapAllocator::Block> HeapAllocator::getBlocks() const
             b.size = _getBlockSize(block);
             b.bin = _getBinIndex(b.size);
             b.isAllocated = _isBlockAllocated(block);
+            if (b.isAllocated) {
+                b.size += sizeof(BlockFooter);
+            }
             blocks.push_back(b);
 
             block = _getNextBlock(block);
@@ -244,6 +695,12 @@ void* HeapAllocator::_allocFromSmallBin(size_t numBytes)
 
     //Log::debug("Attempting to allocate %zu bytes from small bins", numBytes);
 
+    // A bin holds 8 different sizes, if the first block is too small move on to the
+    // next bin which is guaranteed to fit
+    if (_bins[binIndex] && _getBlockSize(_bins[binIndex]) < numBytes) {
+        binIndex++;
+    }
+
     // Be sure to only include small bins in the bin map
     BinMap binMap = _binMap;
     binMap &= 
@@ -273,12 +730,15 @@ void* HeapAllocator::_allocFromSmallBin(size_t numBytes)
         // Have to set this before linking again to prevent it from being merged right back in
         _setBlockAllocated(split, true);
         if (split != block) {
+            _numBlocks++;
             _linkBlock(block);
         }
         block = split;
     }
 
-    _setBlockAllocated(block, true);
+    _setBlockInUse(block, true);
+    _allocatedBlocks++;
+    _allocatedBytes += _getBlockSize(block);
 
     //Log::debug("Allocated block %p from small bin %zu", block, binIndex);
     return _getBlockData(block);
@@ -319,6 +779,7 @@ void* HeapAllocator::_allocFromTreeBin(size_t numBytes)
     // Test if a split is in order. We must unlink the block before splitting
     //Log::debug("... Found (%p,%zu) in bin %zu", treeBlock, blockSize, binIndex);
     _unlinkTreeBlock(treeBlock, binIndex);
+    _untrimBlock(block);
     assert(!_isBlockAllocated(block));
 
     if (blockSize > numBytes + BlockOverheadSize) {
@@ -328,12 +789,14 @@ void* HeapAllocator::_allocFromTreeBin(size_t numBytes)
         // Have to set this before linking again to prevent it from being merged right back in
         _setBlockAllocated(split, true);
         if (split != block) {
+            _numBlocks++;
             _linkBlock(block);
         }
         block = split;
-    } else {
-        _setBlockAllocated(block, true);
-    } 
+    }
+    _setBlockInUse(block, true);
+    _allocatedBlocks++;
+    _allocatedBytes += _getBlockSize(block);
 
     //Log::debug("Allocated block %p from bin %zu", block, binIndex);
     return _getBlockData(block);
@@ -354,7 +817,9 @@ void* HeapAllocator::_allocFromReserve(size_t numBytes)
     BlockHeader* split = _splitReserveBlock(numBytes);
     //Log::debug("Allocated block %p from reserve", split);
 
-    _setBlockAllocated(split, true);
+    _setBlockInUse(split, true);
+    _allocatedBlocks++;
+    _allocatedBytes += _getBlockSize(split);
     return _getBlockData(split);
 }
 
@@ -369,7 +834,7 @@ void* HeapAllocator::_allocFromSystem(size_t numBytes)
     newSegmentSize = std::min(newSegmentSize, MaxAllocationSize - BlockOverheadSize);
     _newSegmentSize *= 2;
 
-    BlockHeader* block = _allocNewSegment(newSegmentSize, isExternalSegment);
+    BlockHeader* block = _allocNewSegment(newSegmentSize, isExternalSegment, _alignment, 0);
 
     BlockHeader* split = block;
     if (!isExternalSegment) {
@@ -379,17 +844,34 @@ void* HeapAllocator::_allocFromSystem(size_t numBytes)
         if (split != block) {
             // Have to set this before linking again to prevent it from being merged right back in
             _setBlockAllocated(split, true);
+            _numBlocks++;
             _linkBlock(block);
         }
     }
 
     // Do this again, it doesn't hurt 
-    _setBlockAllocated(split, true); 
+    _setBlockInUse(split, true); 
+    _allocatedBlocks++;
+    _allocatedBytes += _getBlockSize(split);
 
     //Log::debug("Allocated block %p from new segment", split);
     return _getBlockData(split);
 }
 
+void* HeapAllocator::_allocExternal(size_t numBytes, size_t alignment, size_t offset)
+{
+    assert(_doSystemAllocation);
+
+    // Room to slide the block forward to the requested alignment
+    BlockHeader* block = _allocNewSegment(numBytes + alignment, true, alignment, offset);
+    _setBlockInUse(block, true);
+    _allocatedBlocks++;
+    _allocatedBytes += _getBlockSize(block);
+
+    //Log::debug("Allocated block %p from new external segment", block);
+    return _getBlockData(block);
+}
+
 size_t HeapAllocator::_getBinIndex(size_t numBytes) const
 {
     assert(numBytes > 0);
@@ -422,6 +904,7 @@ void HeapAllocator::_initBlock(BlockHeader* block, size_t numBytes, bool isExter
     _setBlockSize(block, numBytes);
     _setBlockAllocated(block, false);
     _setBlockExternal(block, isExternal);
+    _setBlockTrimmed(block, false);
     _reconcileFooter(block);
     block->next = nullptr;
     block->prev = nullptr;
@@ -591,6 +1074,7 @@ BlockHeader* HeapAllocator::_mergeBlocks(BlockHeader** blocks, size_t numBlocks)
     for (size_t i = 0; i < numBlocks; ++i) {
         assert(blocks[i]);
         assert(_getSegment(blocks[i]) == _getSegment(blocks[0]));
+        _untrimBlock(blocks[i]);
 
         size_t blockSize = _getBlockSize(blocks[i]);
         //Log::debug("... Block (%p,%zu)", blocks[i], blockSize);
@@ -602,12 +1086,64 @@ BlockHeader* HeapAllocator::_mergeBlocks(BlockHeader** blocks, size_t numBlocks)
     BlockHeader* merged = blocks[0];
     _setBlockSize(merged, totalSize - BlockOverheadSize);
     _reconcileFooter(merged);
+    _numBlocks -= numBlocks - 1;
 
     // The merged block is returned unlinked
     //Log::debug("New merged block (%p,%zu)", merged, totalSize - BlockOverheadSize);
     return merged;
 }
 
+void HeapAllocator::_splitBlockTail(BlockHeader* block, size_t numBytes)
+{
+    assert(block && _isBlockAllocated(block));
+    assert(numBytes >= MinAllocationSize && numBytes <= _getBlockSize(block));
+
+    // The tail has to be aligned to the allocator alignment like any other free block
+    char* data = (char*)_getBlockData(block);
+    char* tailData = (char*)mem::align(data + numBytes + BlockOverheadSize, _alignment);
+    char* blockEnd = (char*)_getBlockFooter(block) + sizeof(BlockFooter);
+    if (tailData + MinAllocationSize + sizeof(BlockFooter) > blockEnd) {
+        return;
+    }
+
+    BlockHeader* tail = _getDataHeader(tailData);
+    _setBlockSize(block, (char*)tail - sizeof(BlockFooter) - data);
+    _numBlocks++;
+    _allocatedBytes -= blockEnd - (char*)tail;
+
+    tail->head = 0;
+    _initBlock(tail, blockEnd - tailData - sizeof(BlockFooter), false);
+    _setPrevBlockAllocated(tail, true);
+    _setBlockInUse(tail, false);
+    _linkBlock(tail);
+}
+
+BlockHeader* HeapAllocator::_realignBlock(BlockHeader* block)
+{
+    assert(block && !_isBlockAllocated(block));
+
+    size_t misalignment = ((size_t)_getBlockData(block))%_alignment;
+    if (misalignment == 0) {
+        return block;
+    }
+
+    // Only aligned allocations with an offset the allocator alignment can't satisfy end
+    // up here. Those are always preceded by an allocated block which kept its footer.
+    BlockHeader* prevBlock = _getPrevBlockFromFooter(block);
+    size_t prevSize = _getBlockSize(prevBlock);
+    assert(_isBlockAllocated(prevBlock) && _getBlockSize(_getBlockFooter(prevBlock)) == prevSize);
+    _setBlockSize(prevBlock, prevSize + _getBlockSize(block) + BlockOverheadSize);
+    _setBlockInUse(prevBlock, false);
+    _reconcileFooter(prevBlock);
+    prevBlock->next = nullptr;
+    prevBlock->prev = nullptr;
+
+    _numBlocks--;
+    _allocatedBlocks--;
+    _allocatedBytes -= prevSize;
+    return prevBlock;
+}
+
 BlockHeader* HeapAllocator::_unlinkReserveBlock()
 {
     //Log::debug("Unlinking reserve %p", _reserve);
@@ -621,12 +1157,16 @@ BlockHeader* HeapAllocator::_unlinkReserveBlock()
 
 BlockHeader* HeapAllocator::_splitReserveBlock(size_t numBytes)
 {
+    // The reserve is split in place so it has to be untrimmed first
+    _untrimBlock(_reserve);
+
     BlockHeader* block = _splitBlock(_reserve, numBytes);
 
     if (block == _reserve) {
         //Log::debug("Remainder smaller than min allocation size, returning whole reserve");
         return _unlinkReserveBlock();
     }
+    _numBlocks++;
 
     if (_isSmallAlloc(_getBlockSize(_reserve))) {
         //Log::debug("Reserve is small enough, adding to small bins");
@@ -671,6 +1211,7 @@ BlockHeader* HeapAllocator::_splitBlock(BlockHeader* block, size_t numBytes) con
     BlockHeader* split = (BlockHeader*)(((char*)block) + totalSplitSize);
     _initBlock(split, numBytes, _isBlockExternal(block));
     _setBlockFencePost(split, false);
+    _setPrevBlockAllocated(split, false);
 
     //Log::debug("Split %p into blocks (%p,%zu) and (%p,%zu)", 
             //block, block, remainder, split, numBytes);
@@ -678,21 +1219,36 @@ BlockHeader* HeapAllocator::_splitBlock(BlockHeader* block, size_t numBytes) con
     return split;
 }
 
-BlockHeader* HeapAllocator::_allocNewSegment(size_t numBytes, bool isExternal)
+BlockHeader* HeapAllocator::_allocNewSegment(
+        size_t numBytes, 
+        bool isExternal, 
+        size_t alignment, 
+        size_t alignmentOffset)
 {
-    size_t pageSize = getpagesize();
+    size_t pageSize = util::getPageSize(_pageBacking);
     numBytes = mem::align(numBytes + sizeof(Segment) + BlockOverheadSize, pageSize);
 
     //Log::debug("Allocating %zu bytes from mmap as new segment", numBytes);
 
-    Segment* segment = 
-        (Segment*)mmap(0, numBytes, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    Segment* segment = isExternal ? _takeCachedSegment(&numBytes) : nullptr;
+    if (!segment && !isExternal && _area) {
+        // Right after the last segment committed from the area, _linkSegment() merges them
+        size_t committedSize = _area->getCommittedSize();
+        if (_area->commit(committedSize + numBytes)) {
+            segment = (Segment*)((char*)_area->start() + committedSize);
+        }
+    }
+    if (!segment) {
+        segment = (Segment*)util::pageAllocate(numBytes, _pageBacking);
+    }
 
     // Size includes header
     segment->prev = nullptr;
     segment->next = nullptr;
     segment->size = numBytes - sizeof(Segment);
+    segment->flags = 0;
     _setSegmentExternal(segment, isExternal);
+    _setSegmentArena(segment, _arenaIndex);
     _setSegmentOffset(segment, 0);
 
     //Log::debug("... New segment [%p,%zu] external=%zu", segment, segment->size, (size_t)isExternal);
@@ -700,10 +1256,30 @@ BlockHeader* HeapAllocator::_allocNewSegment(size_t numBytes, bool isExternal)
     // Still link the segment even if it is external since
     // we want to keep track of it for the purposes of determining
     // what segment a block belongs to.
-    return _linkSegment(segment);
+    return _linkSegment(segment, alignment, alignmentOffset);
 }
 
-BlockHeader* HeapAllocator::_linkSegment(Segment* segment)
+BlockHeader* HeapAllocator::_linkBorrowedSegment()
+{
+    // Mapped segments are page aligned, keep the header and the segment size aligned as
+    // if this one was too
+    const size_t segmentAlignment = 16;
+    Segment* segment = (Segment*)mem::align(_borrowedStart, segmentAlignment);
+    char* end = (char*)((uintptr_t)_borrowedEnd & ~(uintptr_t)(segmentAlignment - 1));
+    assert(end >= (char*)segment + sizeof(Segment) + 2*BlockOverheadSize + MinAllocationSize + _alignment && 
+            "Memory too small for a segment");
+
+    segment->prev = nullptr;
+    segment->next = nullptr;
+    segment->size = end - (char*)segment - sizeof(Segment);
+    segment->flags = 0;
+    _setSegmentArena(segment, _arenaIndex);
+    _setSegmentOffset(segment, 0);
+
+    return _linkSegment(segment, _alignment, 0);
+}
+
+BlockHeader* HeapAllocator::_linkSegment(Segment* segment, size_t alignment, size_t alignmentOffset)
 {
     assert(segment);
     //Log::debug("Linking segment [%p,%zu] into segments list", segment, segment->size);
@@ -711,18 +1287,13 @@ BlockHeader* HeapAllocator::_linkSegment(Segment* segment)
     bool doMerge = false;
     bool isExternal = _isSegmentExternal(segment);
 
-    Segment* segIter = _headSegment;
-    while (segIter) {
-        // It's so unlikely that this new segment will be adjacent to two segments
-        // we don't even check
-        if (_doSegmentMerging && !isExternal && _areSegmentsAdjacent(segIter, segment)) {
-            doMerge = true;
-            break;
-        }
-
-        if (!segIter->next)
-            break;
-        segIter = segIter->next;
+    // Only a segment ending right where this one starts can be merged with. It's so
+    // unlikely that this new segment will be adjacent to two segments we don't even
+    // check the one following it.
+    Segment* segIter = _segmentMap.get((char*)segment - 1);
+    if (segIter && _doSegmentMerging && !isExternal && !_isSegmentBorrowed(segIter) && 
+            _areSegmentsAdjacent(segIter, segment)) {
+        doMerge = true;
     }
 
     BlockHeader* block = nullptr;
@@ -735,6 +1306,7 @@ BlockHeader* HeapAllocator::_linkSegment(Segment* segment)
 
         size_t numBytes = segment->size + sizeof(Segment);
         segIter->size = segIter->size + numBytes;
+        _segmentMap.set(segment, numBytes, segIter);
 
         // The first block of the merged segment is no longer a fencepost
         // and neither is the last block of the allocated segment
@@ -743,15 +1315,17 @@ BlockHeader* HeapAllocator::_linkSegment(Segment* segment)
         // Merging is going to leave a fence post block at the end of segIter which
         // causes problems since it is a fencepost in the middle of the segment. We'll 
         // re-purpose it by making it the return block of the new segment
-        block = _getPrevBlock((BlockHeader*)segment);
+        block = _getPrevBlockFromFooter((BlockHeader*)segment);
         assert(_checkBlock(block));
 
         blockSize = numBytes - BlockOverheadSize + BlockOverheadSize + _getBlockSize(block);
         _setBlockFencePost(block, false); 
     } else {
-        // Determine correct offset to account for alignment
+        // Determine correct offset to account for alignment. The data of the first block
+        // plus alignmentOffset has to land on an alignment boundary.
         block = _getFirstSegmentBlock(segment);
-        size_t offset = ((size_t)_getBlockData(block))%_alignment;
+        size_t misalignment = ((size_t)_getBlockData(block) + alignmentOffset)%alignment;
+        size_t offset = (alignment - misalignment)%alignment;
         _setSegmentOffset(segment, offset);
 
         //Log::debug("... Segment alignment offset %zu", offset);
@@ -759,19 +1333,31 @@ BlockHeader* HeapAllocator::_linkSegment(Segment* segment)
         block = _getFirstSegmentBlock(segment);
         blockSize = segment->size - BlockOverheadSize - offset - sizeof(BlockFooter);
 
-        // block is only a fence post if it's not merged
+        // block is only a fence post if it's not merged. There's nothing before it to
+        // merge with, which is the same as the previous block being allocated.
         _setBlockFencePost(block, true); 
+        _setPrevBlockAllocated(block, true);
 
-        if (!segIter) {
+        _segmentOverheadBytes += _getSegmentOverhead(segment);
+        if (isExternal) {
+            _numExternalSegments++;
+        } else {
+            _numRegularSegments++;
+        }
+
+        if (!_tailSegment) {
             //Log::debug("... No existing segments, adding %p", segment);
             _headSegment = segment;
+            segment->prev = nullptr;
             segment->next = nullptr;
         } else {
-            //Log::debug("... Adding %p to segment list following %p", segment, segIter);
-            segIter->next = segment;
-            segment->prev = segIter;
+            //Log::debug("... Adding %p to segment list following %p", segment, _tailSegment);
+            _tailSegment->next = segment;
+            segment->prev = _tailSegment;
             segment->next = nullptr;
         }
+        _tailSegment = segment;
+        _segmentMap.set(segment, segment->size + sizeof(Segment), segment);
 
     }
 
@@ -787,47 +1373,353 @@ BlockHeader* HeapAllocator::_linkSegment(Segment* segment)
     _setBlockAllocated(rightFence, false);
     _setBlockFencePost(rightFence, true); 
 
+    // When merging the fencepost which ended the previous segment is now counted too
+    _numBlocks++;
+    _blockBytes += _getBlockSize(block) + BlockOverheadSize;
+
     //Log::debug("... New block %p created for segment", block);
     return block;
 }
 
-void HeapAllocator::_releaseExternalSegment(Segment* segment)
+Segment* HeapAllocator::_resizeExternalSegment(Segment* segment, size_t numBytes, bool mayMove)
 {
     assert(segment && _isSegmentExternal(segment));
-    //Log::debug("Releasing external segment [%p,%zu]", segment, segment->size);
+
+#ifdef __linux__
+    // Same layout _allocNewSegment() and _linkSegment() create, the offset is kept so the
+    // data stays aligned wherever it ends up
+    size_t pageSize = util::getPageSize(_pageBacking);
+    size_t offset = _getSegmentOffset(segment);
+    size_t oldBytes = segment->size + sizeof(Segment);
+    size_t oldBlockSize = _getBlockSize(_getFirstSegmentBlock(segment));
+    size_t newBytes = mem::align(
+            _getSegmentOverhead(segment) + numBytes + 2*BlockOverheadSize + MinAllocationSize + _alignment, 
+            pageSize);
+
+    if (newBytes != oldBytes) {
+        void* mem = mremap(segment, oldBytes, newBytes, mayMove ? MREMAP_MAYMOVE : 0);
+        if (mem == MAP_FAILED) {
+            return nullptr;
+        }
+
+        if (mem != segment) {
+            _segmentMap.clear(segment, oldBytes);
+            segment = (Segment*)mem;
+
+            if (segment->prev) {
+                segment->prev->next = segment;
+            } else {
+                _headSegment = segment;
+            }
+            if (segment->next) {
+                segment->next->prev = segment;
+            } else {
+                _tailSegment = segment;
+            }
+            _segmentMap.set(segment, newBytes, segment);
+        } else if (newBytes < oldBytes) {
+            _segmentMap.clear((char*)segment + newBytes, oldBytes - newBytes);
+        } else {
+            _segmentMap.set((char*)segment + oldBytes, newBytes - oldBytes, segment);
+        }
+
+        segment->size = newBytes - sizeof(Segment);
+    }
+
+    // Rebuild the block and its right fencepost to span the new segment
+    BlockHeader* block = _getFirstSegmentBlock(segment);
+    _setBlockSize(block, segment->size - BlockOverheadSize - offset - sizeof(BlockFooter));
+    _setBlockAllocated(block, false);
+    _reconcileFooter(block);
+
+    BlockHeader* rightFence = _splitBlock(block, MinAllocationSize);
+    assert(rightFence != block);
+    _setBlockAllocated(rightFence, false);
+    _setBlockFencePost(rightFence, true); 
+
+    _setBlockInUse(block, true);
+    assert(_getBlockSize(block) >= numBytes);
+
+    _blockBytes += _getBlockSize(block) - oldBlockSize;
+    _allocatedBytes += _getBlockSize(block) - oldBlockSize;
+    return segment;
+#else
+    // No mremap, the caller falls back to allocating and copying
+    UNUSED(segment);
+    UNUSED(numBytes);
+    UNUSED(mayMove);
+    return nullptr;
+#endif
+}
+
+void HeapAllocator::_releaseSegment(Segment* segment)
+{
+    assert(segment);
+    //Log::debug("Releasing segment [%p,%zu]", segment, segment->size);
+
+    size_t numBytes = segment->size + sizeof(Segment);
+    _unlinkSegment(segment);
+
+    if (_isSegmentBorrowed(segment)) {
+        return;
+    }
+    if (_area && _area->contains(segment)) {
+        _releaseAreaSegment(segment, numBytes);
+        return;
+    }
+
+    int err = munmap((void*)segment, numBytes);
+    assert(err == 0);
+    UNUSED(err);
+}
+
+void HeapAllocator::_releaseAreaSegment(Segment* segment, size_t numBytes)
+{
+    if (!_isInteriorAreaSegment(segment)) {
+        _area->decommit((char*)segment - (char*)_area->start());
+        return;
+    }
+
+    // Area segments are released newest first so this isn't expected. The range stays
+    // committed but its pages are still given back.
+    int err = madvise((void*)segment, numBytes, MADV_DONTNEED);
+    assert(err == 0);
+    UNUSED(err);
+}
+
+void HeapAllocator::_unlinkSegment(Segment* segment)
+{
+    assert(segment);
+
+    // Only ever a single block left here, other than when the allocator is destroyed
+    _uncountSegmentBlocks(segment);
+
+    _segmentOverheadBytes -= _getSegmentOverhead(segment);
+    if (_isSegmentExternal(segment)) {
+        _numExternalSegments--;
+    } else {
+        _numRegularSegments--;
+    }
 
     if (segment == _headSegment) {
         _headSegment = segment->next;
     } else {
         segment->prev->next = segment->next;
     }
+    if (segment->next) {
+        segment->next->prev = segment->prev;
+    }
+    if (segment == _tailSegment) {
+        _tailSegment = segment->prev;
+    }
 
-    int err = munmap((void*)segment, segment->size + sizeof(Segment));
-    assert(err == 0);
+    _segmentMap.clear(segment, segment->size + sizeof(Segment));
 }
 
+void HeapAllocator::_uncountSegmentBlocks(Segment* segment)
+{
+    BlockHeader* block = _getFirstSegmentBlock(segment);
+    while (block) {
+        if (_isBlockAllocated(block)) {
+            _allocatedBlocks--;
+            _allocatedBytes -= _getBlockSize(block);
+        }
+        _numBlocks--;
+        _blockBytes -= _getBlockSize(block) + BlockOverheadSize;
+        block = _getNextBlock(block);
+    }
+}
 
+void HeapAllocator::_releaseExternalSegment(Segment* segment)
+{
+    assert(segment && _isSegmentExternal(segment));
 
-Segment* HeapAllocator::_getSegment(BlockHeader* block) const
+    size_t numBytes = segment->size + sizeof(Segment);
+    if (numBytes > _segmentCacheMaxBytes) {
+        _releaseSegment(segment);
+        return;
+    }
+
+    _unlinkSegment(segment);
+
+    CachedSegment* cached = (CachedSegment*)segment;
+    cached->numBytes = numBytes;
+    cached->releaseTime = std::chrono::steady_clock::now();
+
+    size_t cacheClass = _getSegmentCacheClass(numBytes);
+    cached->prev = nullptr;
+    cached->next = _segmentCache[cacheClass];
+    if (cached->next) {
+        cached->next->prev = cached;
+    }
+    _segmentCache[cacheClass] = cached;
+    _segmentCacheBytes += numBytes;
+
+    //Log::debug("Cached external segment [%p,%zu]", cached, numBytes);
+    _evictCachedSegments(_segmentCacheMaxBytes);
+}
+
+size_t HeapAllocator::_getSegmentCacheClass(size_t numBytes) const
 {
-    while (block) {
-        BlockHeader* prevBlock = _getPrevBlock(block);
-        if (prevBlock) {
-            block = prevBlock;
-        } else {
+    size_t firstBit = util::findLastSet(LargeAllocBoundary);
+    size_t bit = util::findLastSet(numBytes);
+    return std::min(bit - std::min(bit, firstBit), NumSegmentCacheClasses - 1);
+}
+
+Segment* HeapAllocator::_takeCachedSegment(size_t* numBytes)
+{
+    assert(numBytes);
+    _evictCachedSegments(_segmentCacheMaxBytes);
+
+    // Best fit from the request's class and the one above it, which is where anything
+    // up to a quarter larger lives
+    size_t maxBytes = *numBytes + *numBytes/4;
+    size_t cacheClass = _getSegmentCacheClass(*numBytes);
+    size_t lastClass = std::min(cacheClass + 1, NumSegmentCacheClasses - 1);
+
+    CachedSegment* best = nullptr;
+    for (size_t i = cacheClass; i <= lastClass; ++i) {
+        for (CachedSegment* cached = _segmentCache[i]; cached; cached = cached->next) {
+            if (cached->numBytes >= *numBytes && cached->numBytes <= maxBytes &&
+                (!best || cached->numBytes < best->numBytes)) {
+                best = cached;
+            }
+        }
+    }
+
+    if (!best) {
+        return nullptr;
+    }
+
+    _unlinkCachedSegment(best);
+    _segmentCacheHits++;
+    *numBytes = best->numBytes;
+
+    //Log::debug("Reusing cached external segment [%p,%zu]", best, best->numBytes);
+    return (Segment*)best;
+}
+
+void HeapAllocator::_unlinkCachedSegment(CachedSegment* cached)
+{
+    assert(cached);
+
+    if (cached->prev) {
+        cached->prev->next = cached->next;
+    } else {
+        _segmentCache[_getSegmentCacheClass(cached->numBytes)] = cached->next;
+    }
+    if (cached->next) {
+        cached->next->prev = cached->prev;
+    }
+    _segmentCacheBytes -= cached->numBytes;
+}
+
+size_t HeapAllocator::_evictCachedSegments(size_t maxBytes)
+{
+    size_t releasedBytes = 0;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    FOREVER {
+        // There are only ever a handful of cached segments, just search all of them
+        CachedSegment* oldest = nullptr;
+        for (size_t i = 0; i < NumSegmentCacheClasses; ++i) {
+            for (CachedSegment* cached = _segmentCache[i]; cached; cached = cached->next) {
+                if (!oldest || cached->releaseTime < oldest->releaseTime) {
+                    oldest = cached;
+                }
+            }
+        }
+
+        if (!oldest) {
+            break;
+        }
+
+        bool isExpired = now - oldest->releaseTime > _segmentCacheMaxAge;
+        if (!isExpired && _segmentCacheBytes <= maxBytes) {
             break;
         }
+
+        _unlinkCachedSegment(oldest);
+
+        size_t numBytes = oldest->numBytes;
+        int err = munmap((void*)oldest, numBytes);
+        assert(err == 0);
+        UNUSED(err);
+
+        releasedBytes += numBytes;
     }
 
-    // Segments have a hidden footer right before the first block
-    // which specifies the alignment offset.
-    BlockFooter* alignFooter = (BlockFooter*)((char*)block - sizeof(BlockFooter));
-    size_t offset = alignFooter->foot;
+    return releasedBytes;
+}
+
+
 
-    Segment* segment = (Segment*)(((char*)block) - sizeof(BlockFooter) - offset - sizeof(Segment));
+size_t HeapAllocator::_trimBlock(BlockHeader* block)
+{
+    assert(block && !_isBlockAllocated(block));
+
+    char* start = nullptr;
+    size_t numBytes = _getTrimRange(block, &start);
+    if (numBytes == 0 || _isBlockTrimmed(block)) {
+        return 0;
+    }
+
+    // MADV_DONTNEED is a no-op on Darwin, MADV_FREE is what actually releases pages there
+#ifdef __APPLE__
+    int err = madvise(start, numBytes, MADV_FREE);
+#else
+    int err = madvise(start, numBytes, MADV_DONTNEED);
+#endif
+    if (err != 0) {
+        return 0;
+    }
+
+    _setBlockTrimmed(block, true);
+    _releasedBytes += numBytes;
+    return numBytes;
+}
+
+void HeapAllocator::_untrimBlock(BlockHeader* block)
+{
+    assert(block);
+    if (_isBlockTrimmed(block)) {
+        // Pages come back as they're touched, assume they all will
+        char* start = nullptr;
+        _releasedBytes -= _getTrimRange(block, &start);
+        _setBlockTrimmed(block, false);
+    }
+}
+
+size_t HeapAllocator::_getTrimRange(BlockHeader* block, char** start) const
+{
+    assert(block && start);
+
+    // The free block's links and footer have to stay resident
+    size_t pageSize = getpagesize();
+    size_t first = mem::align((size_t)block + sizeof(BlockTreeHeader), pageSize);
+    size_t last = ((size_t)_getBlockFooter(block)) & ~(pageSize - 1);
+
+    if (last <= first) {
+        return 0;
+    }
+    *start = (char*)first;
+    return last - first;
+}
+
+Segment* HeapAllocator::_getSegment(BlockHeader* block) const
+{
+    Segment* segment = _segmentMap.get(block);
+    assert(segment && "Block doesn't belong to this allocator");
     return segment;
 }
 
+Segment* HeapAllocator::_findSegment(void* addr) const
+{
+    // Unlike _getSegment() addr may be anything. Safe to call from any thread for an
+    // address whose segment isn't being created or released concurrently.
+    return _segmentMap.get(addr);
+}
+
 BlockHeader* HeapAllocator::_getNextBlock(BlockHeader* block) const
 {
     assert(block);
@@ -843,9 +1735,15 @@ BlockHeader* HeapAllocator::_getNextBlock(BlockHeader* block) const
 BlockHeader* HeapAllocator::_getPrevBlock(BlockHeader* block) const
 {
     assert(block);
-    if (_isBlockFencePost(block)) {
+    if (_isBlockFencePost(block) || _isPrevBlockAllocated(block)) {
         return nullptr;
     }
+    return _getPrevBlockFromFooter(block);
+}
+
+BlockHeader* HeapAllocator::_getPrevBlockFromFooter(BlockHeader* block) const
+{
+    assert(block);
     BlockFooter* prevFooter = (BlockFooter*)(((char*)block) - sizeof(BlockFooter));
     BlockHeader* prevBlock = (BlockHeader*)(((char*)prevFooter) - _getBlockSize(prevFooter) - BlockHeaderSize);
     return prevBlock;
@@ -871,6 +1769,11 @@ size_t HeapAllocator::_getSegmentOverhead(Segment* segment) const
 
 bool HeapAllocator::_checkBlock(BlockHeader* block) const
 {
+    // An allocated block's footer belongs to the allocation, there's nothing to compare
+    if (_isBlockAllocated(block)) {
+        return true;
+    }
+
     // The header/footer being out of sync indicates corruption
     BlockFooter* footer = _getBlockFooter(block);
     if (_getBlockSize(block) != _getBlockSize(footer)) {
@@ -881,18 +1784,7 @@ bool HeapAllocator::_checkBlock(BlockHeader* block) const
 
 bool HeapAllocator::_blockBelongsToAllocator(BlockHeader* block) const
 {
-    Segment* blockSegment = _getSegment(block);
-    assert(blockSegment);
-
-    Segment* segment = _headSegment;
-    while (segment) {
-        if (segment == blockSegment) {
-            return true;
-        }
-        segment = segment->next;
-    }
-
-    return false;
+    return _segmentMap.get(block) != nullptr;
 }
 
 BlockTreeHeader* HeapAllocator::_linkTreeBlock(BlockHeader* block, size_t binIndex)
@@ -951,6 +1843,12 @@ BlockTreeHeader* HeapAllocator::_linkTreeBlock(BlockHeader* block, size_t binInd
         if (_getBlockSize(child) == blockSize) {
             assert(treeBlock != child);
             //Log::debug("... Adding %p to a chain with head block %p", treeBlock, child);
+
+            // Only the head of a chain is part of the tree, the rest are identified
+            // by their null parent.
+            treeBlock->parent = nullptr;
+            treeBlock->child[0] = nullptr;
+            treeBlock->child[1] = nullptr;
             treeBlock->next = child->next;
             treeBlock->prev = child;
             child->next->prev = treeBlock;
@@ -984,7 +1882,7 @@ BlockTreeHeader* HeapAllocator::_findTreeBlock(size_t binIndex, size_t numBytes)
     BlockTreeHeader* treeRoot = (BlockTreeHeader*)root;
 
     size_t shift = _getTreeBinShift(binIndex);
-    size_t bits = _getBlockSize(treeRoot) << shift;
+    size_t bits = numBytes << shift;
     size_t error = std::numeric_limits<size_t>::max();
     BlockTreeHeader* bestFitBlock = NULL;
 
@@ -1003,8 +1901,9 @@ BlockTreeHeader* HeapAllocator::_findTreeBlock(size_t binIndex, size_t numBytes)
             }
         }
 
-        // Follow the right child if we can
-        BlockTreeHeader* rightChild = iter->child[0];
+        // Follow the child matching the requested size. The right child is remembered
+        // whenever we go left since everything in it is larger than the request.
+        BlockTreeHeader* rightChild = iter->child[1];
         iter = iter->child[util::msb(bits)];
 
         if (rightChild && rightChild != iter) {
@@ -1020,16 +1919,17 @@ BlockTreeHeader* HeapAllocator::_findTreeBlock(size_t binIndex, size_t numBytes)
     // iter is now the first block in a subtree which is all just larger
     // than the desired size. No other block larger than size exists in
     // any other subtree. 
-    if (iter) {
-        BlockTreeHeader* candidate = _getSmallestTreeBlock(iter);
-        if (candidate) {
-            size_t candErr = _getBlockSize(candidate) - numBytes;
-            if (candErr < error) {
-                bestFitBlock = candidate;
-            }
+    // Sizes in a trie are only ordered by their bit prefix, so every block along the
+    // left-most path of the subtree has to be considered.
+    while (iter) {
+        size_t size = _getBlockSize(iter);
+        if (size >= numBytes && size - numBytes < error) {
+            error = size - numBytes;
+            bestFitBlock = iter;
         }
+        iter = iter->child[0] ? iter->child[0] : iter->child[1];
     }
-    
+
     return bestFitBlock;
 }
 
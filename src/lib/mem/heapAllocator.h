@@ -1,7 +1,9 @@
 #ifndef MEM_HEAPALLOCATOR_H
 #define MEM_HEAPALLOCATOR_H
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cinttypes>
 #include <cmath>
 #include <cstdint>
@@ -9,9 +11,12 @@
 #include <unistd.h>
 #include <vector>
 
+#include "util/memory.h"
 #include "util/units.h"
 #include "mem/alignment.h"
 #include "mem/allocator.h"
+#include "mem/pageMap.h"
+#include "mem/virtualArea.h"
 
 struct BlockHeader
 {
@@ -86,6 +91,30 @@ namespace mem {
  *
  * Allocations are made using a cascading search strategy which hopes to minimize search
  * time while finding the closest fit. 
+ *
+ * Every block is aligned to the alignment given to the constructor. Allocations asking for
+ * a stricter alignment (or an offset from it) are carved out of a larger free block and
+ * the slack on either side is returned to the bins. mem::DefaultAlignment always means
+ * the allocator's own alignment.
+ *
+ * Like dlmalloc, only free blocks keep a footer. An allocated block's footer is handed out
+ * as part of the allocation and the block following it records that it's allocated
+ * instead, so an allocation costs a single header word. Blocks with an alignment offset
+ * the allocator alignment can't satisfy are the exception, they keep a small allocated
+ * block in front of them which is released along with them.
+ *
+ * Segments can be backed by huge pages (see util::PageBacking) which greatly reduces TLB
+ * misses for large heaps. Segments are then aligned to and sized in multiples of
+ * util::getHugePageSize().
+ *
+ * Given a VirtualArea regular segments are committed one after another from it, so they
+ * always end up adjacent and merge into a single segment. Segments are only mapped
+ * separately once the area is used up. A released segment at the end of the area is
+ * decommitted. The area must not be shared with anything else.
+ *
+ * Given the start and end of some memory (e.g. from an AreaPolicy) that memory becomes the
+ * first segment. It is never released, trimmed or merged with, once it is full segments are
+ * mapped as usual unless system allocation is disabled.
  */
 class HeapAllocator : public mem::Allocator
 {
@@ -109,21 +138,59 @@ public:
         size_t freeBlocks;
         size_t numRegularSegments;
         size_t numExternalSegments;
+
+        // Part of freeBytes whose pages have been handed back to the OS by trim()
+        size_t releasedBytes;
+
+        // Large allocations which reused a cached external segment, and the bytes
+        // of released external segments currently held in the cache
+        size_t externalCacheHits;
+        size_t externalCacheBytes;
     };
 
 public:
     HeapAllocator(
+            size_t initialAllocSize = util::kilobytes(64), 
+            size_t alignment = util::bytes(4),
+            util::PageBacking pageBacking = util::RegularPages);
+    explicit HeapAllocator(
+            VirtualArea& area,
             size_t initialAllocSize = util::kilobytes(64), 
             size_t alignment = util::bytes(4));
+    HeapAllocator(void* start, void* end, size_t alignment = util::bytes(4));
     ~HeapAllocator();
 
+protected:
+    // The public constructors all delegate here. Segments come from the area if there is
+    // one and are mapped otherwise, a borrowed range becomes the first segment.
+    HeapAllocator(
+            size_t initialAllocSize, 
+            size_t alignment, 
+            util::PageBacking pageBacking, 
+            VirtualArea* area,
+            void* borrowedStart,
+            void* borrowedEnd);
+
+public:
+
     virtual void* allocate(size_t size, size_t alignment = DefaultAlignment, size_t offset = 0) override;
     virtual void release(void* addr) override;
-    virtual size_t getAllocationSize(void* addr) const override
-    {
-        // Not implemented
-        return 0;
-    }
+    virtual size_t getAllocationSize(void* addr) const override;
+
+    /**
+     * Carves the whole batch out of a single free block found with one search of the
+     * bins/reserve, each block is split off it in turn.
+     */
+    virtual size_t allocateBatch(size_t size, size_t alignment, size_t count, void** out, size_t offset = 0) override;
+
+    /**
+     * Resizing grows into a free block following the allocation or gives back the end of
+     * it before falling back to allocating and copying. External segments are resized
+     * with mremap, which may move them without copying.
+     */
+    virtual void* reallocate(void* addr, size_t size, size_t alignment = DefaultAlignment, size_t offset = 0) override;
+    virtual bool tryExpandInPlace(void* addr, size_t size) override;
+    virtual void shrinkInPlace(void* addr, size_t size) override;
 
     virtual void clear();
 
@@ -136,9 +203,36 @@ public:
      */
     bool check(std::vector<Block>* corruptBlocks = nullptr);
 
+    /**
+     * The counters are kept up to date as blocks are allocated, split and merged so this
+     * is cheap enough to call at any time.
+     */
     Stats getStats() const;
+
+    /**
+     * Computes the same stats by walking every block of every segment. Only meant for
+     * checking the counters getStats() reports.
+     */
+    Stats computeStatsSlow() const;
+
     std::vector<Block> getBlocks() const;
 
+    /**
+     * Returns unused memory to the OS, keeping free blocks totalling at most keepBytes
+     * resident.
+     *
+     * Segments which are entirely free are unmapped and the pages in the interior of large
+     * free blocks are released with madvise. Blocks in older segments are kept first.
+     * Released pages stay mapped and come back zero-filled the next time they're used.
+     * Returns the number of bytes released.
+     */
+    size_t trim(size_t keepBytes = 0);
+
+    /**
+     * Free bytes which are still backed by memory, i.e. those trim() could release.
+     */
+    size_t getResidentFreeBytes() const;
+
     /**
      * Options for changing the behaviour of the allocator.
      */
@@ -146,16 +240,37 @@ public:
     void enableBlockMerging(bool enable) { _doSegmentMerging = enable; }
     void enableSegmentMerging(bool enable) { _doSegmentMerging = enable; }
 
+    /**
+     * Released external segments are kept to be reused by later large allocations, saving
+     * the mmap/munmap and page faults. At most maxBytes are held and segments unused for
+     * longer than maxAge are unmapped. A maxBytes of 0 disables the cache.
+     */
+    void setExternalSegmentCache(size_t maxBytes, std::chrono::milliseconds maxAge);
+
+    /**
+     * Index of this allocator within an ArenaHeapAllocator. The index is stored in the
+     * header of every segment so a block can be routed back to its owning arena.
+     */
+    void setArenaIndex(size_t arenaIndex);
+    size_t getArenaIndex() const { return _arenaIndex; }
+
 protected:
     static const size_t BlockAllocatedBitMask = static_cast<size_t>(1) << (sizeof(size_t)*CHAR_BIT - 1);
     static const size_t BlockFencePostBitMask = static_cast<size_t>(1) << (sizeof(size_t)*CHAR_BIT - 2);
     static const size_t BlockExternalBitMask = static_cast<size_t>(1) << (sizeof(size_t)*CHAR_BIT - 3);
-    static const size_t BlockFlagsBitMask = (BlockAllocatedBitMask|BlockFencePostBitMask|BlockExternalBitMask);
+    static const size_t BlockTrimmedBitMask = static_cast<size_t>(1) << (sizeof(size_t)*CHAR_BIT - 4);
+    static const size_t BlockPrevAllocatedBitMask = static_cast<size_t>(1) << (sizeof(size_t)*CHAR_BIT - 5);
+    static const size_t BlockFlagsBitMask = 
+        (BlockAllocatedBitMask|BlockFencePostBitMask|BlockExternalBitMask|BlockTrimmedBitMask|
+         BlockPrevAllocatedBitMask);
     static const size_t BlockSizeBitMask = ~BlockFlagsBitMask;
 
     static const size_t SegmentExternalBitMask = static_cast<size_t>(1) << (sizeof(size_t)*CHAR_BIT - 1);
-    static const size_t SegmentFlagsBitMask = SegmentExternalBitMask;
+    static const size_t SegmentArenaBitShift = sizeof(size_t)*CHAR_BIT - 8;
+    static const size_t SegmentArenaBitMask = static_cast<size_t>(0x7f) << SegmentArenaBitShift;
+    static const size_t SegmentFlagsBitMask = SegmentExternalBitMask|SegmentArenaBitMask;
     static const size_t SegmentOffsetBitMask = ~SegmentFlagsBitMask;
+    static const size_t MaxArenaIndex = SegmentArenaBitMask >> SegmentArenaBitShift;
 
     // Min size is to account for next/prev pointers in free blocks
     static const size_t MinAllocationSize = 2*sizeof(BlockHeader*);
@@ -167,13 +282,38 @@ protected:
     static const size_t NumTreeBins = 32;
     static const size_t NumBins = NumSmallBins + NumTreeBins;
 
+    // External segment cache. Size classes are powers of two starting at the large
+    // allocation boundary, a cached segment is only reused for a request it's no more
+    // than a quarter larger than.
+    static const size_t NumSegmentCacheClasses = 8;
+    static const size_t DefaultSegmentCacheSize = util::megabytes(256);
+    static const int DefaultSegmentCacheAge = 2000;
+
     static const size_t BlockHeaderSize = sizeof(BlockHeader) - 2*sizeof(BlockHeader*);
     static const size_t BlockOverheadSize = BlockHeaderSize + sizeof(BlockFooter);
 
+    // Size of the block needed to hold numBytes, the footer is part of an allocation
+    size_t _getRequestBlockSize(size_t numBytes) const;
+
+    // allocate() once alignment has been taken care of
+    void* _allocate(size_t numBytes);
+
+    // Carves a block with a stricter alignment than the allocator's out of a larger one,
+    // the leading and trailing slack are returned to the bins
+    void* _allocAligned(size_t numBytes, size_t alignment, size_t offset);
+
     void* _allocFromSmallBin(size_t numBytes);
     void* _allocFromTreeBin(size_t numBytes);
     void* _allocFromReserve(size_t numBytes);
     void* _allocFromSystem(size_t numBytes);
+    void* _allocExternal(size_t numBytes, size_t alignment, size_t offset);
+
+    // Whether the alignment is already met by every block, mem::DefaultAlignment defers
+    // to the allocator's alignment
+    bool _isDefaultAligned(size_t alignment, size_t offset) const
+    {
+        return (alignment <= _alignment || alignment == DefaultAlignment) && offset%alignment == 0;
+    }
 
     bool _isSmallAlloc(size_t numBytes) const { return numBytes <= MaxSmallBinSize; }
     bool _isLargeAlloc(size_t numBytes) const { return numBytes > LargeAllocBoundary; }
@@ -190,6 +330,11 @@ protected:
     BlockHeader* _coalesceAdjacentBlocks(BlockHeader* block);
     BlockHeader* _mergeBlocks(BlockHeader** blocks, size_t numBlocks);
 
+    // A released block made by _allocAligned() may not start on an aligned address, it's
+    // then merged into the allocated block _allocAligned() left in front of it, which is
+    // released with it. Returns the block to link.
+    BlockHeader* _realignBlock(BlockHeader* block);
+
     // Returns a block of given size split off the given block. Rest of the split
     // is added to appropriately sized bin or from the system. If the remainder is of a 
     // sufficiently small size, no split may occur and the whole block will be 
@@ -197,18 +342,77 @@ protected:
     BlockHeader* _splitReserveBlock(size_t numBytes);
     BlockHeader* _splitBlock(BlockHeader* block, size_t numBytes) const;
 
+    // Shrinks an allocated block to numBytes (plus alignment), the rest becomes a free
+    // block which is linked. Nothing happens if the rest is too small to be a block.
+    void _splitBlockTail(BlockHeader* block, size_t numBytes);
+
     // Creates the minimum segment to store numBytes and returns a block
     // for the new segment. External blocks are not managed by the bin
-    // structure and are freed as whole.
-    BlockHeader* _allocNewSegment(size_t numBytes, bool isExternal); 
-    BlockHeader* _linkSegment(Segment* segment);
+    // structure and are freed as whole. The data of the first block plus alignmentOffset
+    // is aligned to alignment, numBytes must have room for the offset this needs.
+    BlockHeader* _allocNewSegment(size_t numBytes, bool isExternal, size_t alignment, size_t alignmentOffset); 
+    BlockHeader* _linkSegment(Segment* segment, size_t alignment, size_t alignmentOffset);
+    void _releaseSegment(Segment* segment);
+    void _releaseAreaSegment(Segment* segment, size_t numBytes);
+
+    // Makes the memory the allocator was given into a segment
+    BlockHeader* _linkBorrowedSegment();
+    void _unlinkSegment(Segment* segment);
+
+    // Takes the segment's blocks out of the stats counters
+    void _uncountSegmentBlocks(Segment* segment);
+
+    // Caches the segment if it fits, unmaps it otherwise
     void _releaseExternalSegment(Segment* segment);
 
+    // Written over the memory of a cached segment
+    struct CachedSegment
+    {
+        size_t numBytes;
+        std::chrono::steady_clock::time_point releaseTime;
+        CachedSegment* next;
+        CachedSegment* prev;
+    };
+
+    size_t _getSegmentCacheClass(size_t numBytes) const;
+
+    // Returns the raw memory of a cached segment of at least numBytes, nullptr if there
+    // isn't one. numBytes is updated to the size of the segment.
+    Segment* _takeCachedSegment(size_t* numBytes);
+    void _unlinkCachedSegment(CachedSegment* cached);
+
+    // Unmaps expired segments, then the oldest ones until at most maxBytes are cached.
+    // Returns the number of bytes unmapped.
+    size_t _evictCachedSegments(size_t maxBytes);
+
+    // Resizes an external segment so its block holds numBytes. Returns the segment, which
+    // has moved if mayMove is set, or nullptr if it couldn't be resized.
+    Segment* _resizeExternalSegment(Segment* segment, size_t numBytes, bool mayMove);
+
+    // A trimmed block is a free block whose interior pages have been released. The block
+    // keeps the flag until it is allocated, split or merged, which untrims it.
+    size_t _trimBlock(BlockHeader* block);
+    void _untrimBlock(BlockHeader* block);
+    size_t _getTrimRange(BlockHeader* block, char** start) const;
+
     // Retrieves next contiguous block header in a segment
     // This is not fast, only call for time-insensitive operations
     BlockHeader* _getNextBlock(BlockHeader* block) const;
+
+    // Only free blocks keep a footer, returns nullptr when the previous block is allocated
     BlockHeader* _getPrevBlock(BlockHeader* block) const;
 
+    // Reads the previous block's footer no matter whether it's allocated, the caller has
+    // to know it's valid
+    BlockHeader* _getPrevBlockFromFooter(BlockHeader* block) const;
+
+    // Next block including the fencepost ending a segment
+    BlockHeader* _getAdjacentBlock(BlockHeader* block) const;
+
+    // Sets whether the block is allocated and keeps the prev-allocated flag of the block
+    // following it in sync
+    void _setBlockInUse(BlockHeader* block, bool isAllocated) const;
+
     // Retrieve various portions of a block given a pointer to someplace in that block
     void* _getBlockData(BlockHeader* block) const;
     BlockFooter* _getBlockFooter(BlockHeader* block) const;
@@ -217,25 +421,44 @@ protected:
     size_t _getBlockSize(BlockTreeHeader* block) const;
     size_t _getBlockSize(BlockFooter* block) const;
     void _setBlockSize(BlockHeader* block, size_t size) const;
+
+    // Same as getAllocationSize() but safe without the lock while the caller owns the block.
+    // Only the prev-allocated flag of an allocated block changes under it, when the block
+    // before it is allocated or released, so the header word is loaded once and the flags
+    // masked off.
+    size_t _getOwnedAllocationSize(void* addr) const;
+
     bool _isBlockAllocated(BlockHeader* block) const;
     void _setBlockAllocated(BlockHeader* block, bool isAllocated) const;
     bool _isBlockFencePost(BlockHeader* block) const;
     void _setBlockFencePost(BlockHeader* block, bool isFencePost) const;
     bool _isBlockExternal(BlockHeader* block) const;
     void _setBlockExternal(BlockHeader* block, bool isExternal) const;
+    bool _isBlockTrimmed(BlockHeader* block) const;
+    void _setBlockTrimmed(BlockHeader* block, bool isTrimmed) const;
+    bool _isPrevBlockAllocated(BlockHeader* block) const;
+    void _setPrevBlockAllocated(BlockHeader* block, bool isAllocated) const;
     void _setBlockState(BlockHeader* block, size_t size, bool isAllocated) const;
 
     void _reconcileFooter(BlockHeader* block) const;
 
     BlockHeader* _getFirstSegmentBlock(Segment* segment) const;
     Segment* _getSegment(BlockHeader* block) const;
+    Segment* _findSegment(void* addr) const;
     bool _isInSegment(BlockHeader* block, Segment* segment) const;
     bool _areSegmentsAdjacent(Segment* prev, Segment* next) const;
     size_t _getSegmentOverhead(Segment* segment) const;
     bool _isSegmentExternal(Segment* segment) const;
+    bool _isSegmentBorrowed(Segment* segment) const;
+
+    // Only the last segment committed from the area can be decommitted, the address range
+    // of any other segment would never be committed again
+    bool _isInteriorAreaSegment(Segment* segment) const;
     void _setSegmentExternal(Segment* segment, bool isExternal) const;
     size_t _getSegmentOffset(Segment* segment) const;
     void _setSegmentOffset(Segment* segment, size_t offset) const;
+    size_t _getSegmentArena(Segment* segment) const;
+    void _setSegmentArena(Segment* segment, size_t arenaIndex) const;
 
     bool _checkBlock(BlockHeader* block) const;
     bool _blockBelongsToAllocator(BlockHeader* block) const;
@@ -254,6 +477,12 @@ protected:
     bool _isHeadTreeBinBlock(BlockTreeHeader* block) { assert(block); return block->parent; }
 
 private:
+    // Wraps a HeapAllocator and needs to know its small bin layout
+    friend class CachedHeapAllocator;
+
+    // Routes releases to the arena owning a segment
+    friend class ArenaHeapAllocator;
+
     // Bins are a circular linked list of blocks. The _bins pointer points to the last
     // accessed block. This attempts to speed up searching of the large bins due to the
     // fact that similar allocation sizes are more likely appear one after another in time.
@@ -266,15 +495,54 @@ private:
     typedef int64_t BinMap;
     BinMap _binMap;
 
-    // The segment list tracks the raw memory blocks returned from mmap. This is a singly-linked list which
+    // The segment list tracks the raw memory blocks returned from mmap. This is a doubly-linked list which
     // ends in a nullptr.
     Segment* _headSegment;
+    Segment* _tailSegment;
+
+    // Maps every page of every segment to its Segment, segments merged into another map to the
+    // segment they were merged into. Used to find the segment of a block without walking.
+    PageMap<Segment> _segmentMap;
 
     // Size to allocate the next time a segment needs to be created. Initialized by the constructor.
     size_t _newSegmentSize;
 
     size_t _alignment;
 
+    // How segments are backed by the OS
+    util::PageBacking _pageBacking;
+
+    // Regular segments are committed from here while it lasts, may be null
+    VirtualArea* _area;
+
+    // Memory given to the constructor which isn't the allocator's to release, may be null
+    char* _borrowedStart;
+    char* _borrowedEnd;
+
+    // Stamped into each new segment, see setArenaIndex()
+    size_t _arenaIndex;
+
+    // Bytes currently released from trimmed blocks
+    size_t _releasedBytes;
+
+    // Counters behind getStats(). Every block (fenceposts ending a segment aside) is
+    // counted in _numBlocks and its size plus overhead in _blockBytes, which only changes
+    // as segments come and go. Free bytes and blocks are whatever isn't allocated.
+    size_t _allocatedBytes;
+    size_t _allocatedBlocks;
+    size_t _numBlocks;
+    size_t _blockBytes;
+    size_t _segmentOverheadBytes;
+    size_t _numRegularSegments;
+    size_t _numExternalSegments;
+
+    // Released external segments by size class, most recently released first
+    CachedSegment* _segmentCache[NumSegmentCacheClasses];
+    size_t _segmentCacheBytes;
+    size_t _segmentCacheMaxBytes;
+    std::chrono::milliseconds _segmentCacheMaxAge;
+    size_t _segmentCacheHits;
+
     // Allocator behaviour options
     bool _doSystemAllocation;
     bool _doBlockMerging;
@@ -326,6 +594,14 @@ inline void HeapAllocator::_setBlockSize(BlockHeader* block, size_t size) const
     block->head= (block->head & BlockFlagsBitMask) | size;
 }
 
+inline size_t HeapAllocator::_getOwnedAllocationSize(void* addr) const
+{
+    BlockHeader* header = _getDataHeader(addr);
+    size_t head = __atomic_load_n(&header->head, __ATOMIC_RELAXED);
+    assert((head & BlockAllocatedBitMask) && "Address is not allocated");
+    return (head & BlockSizeBitMask) + sizeof(BlockFooter);
+}
+
 inline bool HeapAllocator::_isBlockAllocated(BlockHeader* block) const
 {
     assert(block);
@@ -366,6 +642,51 @@ inline void HeapAllocator::_setBlockExternal(BlockHeader* block, bool isAllocate
         (BlockExternalBitMask*static_cast<size_t>(isAllocated));
 }
 
+inline bool HeapAllocator::_isBlockTrimmed(BlockHeader* block) const
+{
+    assert(block);
+    return (block->head & BlockTrimmedBitMask) == BlockTrimmedBitMask;
+}
+
+inline void HeapAllocator::_setBlockTrimmed(BlockHeader* block, bool isTrimmed) const
+{
+    assert(block);
+    block->head = 
+        (block->head & ~BlockTrimmedBitMask) | 
+        (BlockTrimmedBitMask*static_cast<size_t>(isTrimmed));
+}
+
+inline bool HeapAllocator::_isPrevBlockAllocated(BlockHeader* block) const
+{
+    assert(block);
+    return (block->head & BlockPrevAllocatedBitMask) == BlockPrevAllocatedBitMask;
+}
+
+inline void HeapAllocator::_setPrevBlockAllocated(BlockHeader* block, bool isAllocated) const
+{
+    assert(block);
+    block->head = 
+        (block->head & ~BlockPrevAllocatedBitMask) | 
+        (BlockPrevAllocatedBitMask*static_cast<size_t>(isAllocated));
+}
+
+inline BlockHeader* HeapAllocator::_getAdjacentBlock(BlockHeader* block) const
+{
+    assert(block);
+    return (BlockHeader*)(((char*)block) + _getBlockSize(block) + BlockOverheadSize);
+}
+
+inline void HeapAllocator::_setBlockInUse(BlockHeader* block, bool isAllocated) const
+{
+    _setBlockAllocated(block, isAllocated);
+    _setPrevBlockAllocated(_getAdjacentBlock(block), isAllocated);
+}
+
+inline size_t HeapAllocator::_getRequestBlockSize(size_t numBytes) const
+{
+    return std::max(numBytes, MinAllocationSize + sizeof(BlockFooter)) - sizeof(BlockFooter);
+}
+
 inline void HeapAllocator::_setBlockState(BlockHeader* block, size_t size, bool isAllocated) const
 {
     _setBlockSize(block, size);
@@ -399,6 +720,19 @@ inline void HeapAllocator::_setSegmentExternal(Segment* segment, bool isExternal
         (SegmentExternalBitMask*static_cast<size_t>(isExternal));
 }
 
+inline bool HeapAllocator::_isSegmentBorrowed(Segment* segment) const
+{
+    assert(segment);
+    return (char*)segment >= _borrowedStart && (char*)segment < _borrowedEnd;
+}
+
+inline bool HeapAllocator::_isInteriorAreaSegment(Segment* segment) const
+{
+    assert(segment);
+    return _area && _area->contains(segment) && 
+        (char*)segment + sizeof(Segment) + segment->size != (char*)_area->end();
+}
+
 inline size_t HeapAllocator::_getSegmentOffset(Segment* segment) const
 {
     assert(segment);
@@ -418,6 +752,19 @@ inline void HeapAllocator::_setSegmentOffset(Segment* segment, size_t offset) co
     footer->foot = offset;
 }
 
+inline size_t HeapAllocator::_getSegmentArena(Segment* segment) const
+{
+    assert(segment);
+    return (segment->flags & SegmentArenaBitMask) >> SegmentArenaBitShift;
+}
+
+inline void HeapAllocator::_setSegmentArena(Segment* segment, size_t arenaIndex) const
+{
+    assert(segment);
+    assert(arenaIndex <= MaxArenaIndex);
+    segment->flags = (segment->flags & ~SegmentArenaBitMask) | (arenaIndex << SegmentArenaBitShift);
+}
+
 inline size_t HeapAllocator::_getTreeBinShift(size_t binIndex) const
 {
     // Each bin has a maximum size stored within it. This number is number of
@@ -1,19 +1,32 @@
 #ifndef MEM_LINEARALLOCATOR_H
 #define MEM_LINEARALLOCATOR_H
 
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
 #include "mem/alignment.h"
 #include "mem/allocator.h"
 #include "mem/util.h"
+#include "mem/virtualArea.h"
 
 namespace mem {
 
 /**
  * Fast allocator which doesn't allow for releasing of individual blocks.
  *
- * Allocations are very cheap and fast since no per-block metadata is kept. Because of this 
- * individual blocks can't be released, only the entire allocator can be cleared. This is most 
- * useful for transient memory data such as information which is allocated and then cleared per 
- * frame.
+ * Allocations are very cheap and fast since the only per-block metadata kept is the size of
+ * the block, stored in the 4 bytes in front of it. Because of this individual blocks can't be
+ * released, only the entire allocator can be cleared. This is most useful for transient memory
+ * data such as information which is allocated and then cleared per frame.
+ *
+ * Every allocation is aligned to the larger of the alignment asked for and the allocator's own
+ * alignment, which DefaultAlignment stands for, with the offset placed before the aligned
+ * address.
+ *
+ * Built on a VirtualArea the allocator commits more of the area as it runs out of committed
+ * memory, growing in place up to the area's reserved size. Clearing or rewinding keeps the
+ * memory committed for reuse, trim() hands what lies past the current position back.
  */
 class LinearAllocator : public mem::Allocator
 {
@@ -24,70 +37,232 @@ public:
         size_t freeBytes;
     };
 
+    typedef void* Marker;
+
+    // Sizes are stored in 32 bits
+    static const size_t MaxAllocationSize = 0xffffffff;
+
 public:
     LinearAllocator(void *mem, size_t size, size_t alignment = 4);
+    LinearAllocator(void* start, void* end, size_t alignment = 4);
+    explicit LinearAllocator(VirtualArea& area, size_t alignment = 4);
     ~LinearAllocator();
 
     virtual void* allocate(size_t size, size_t alignment = DefaultAlignment, size_t offset = 0) override;
     virtual void release(void* addr) override;
-    virtual size_t getAllocationSize(void* addr) const override
-    {
-        // Not implemented
-        return 0;
-    }
+    virtual size_t getAllocationSize(void* addr) const override { return getSizeHeader(addr); }
+
+    /**
+     * Everything allocated since a marker was taken can be released at once by rewinding
+     * to it. Rewinding to an older marker discards newer ones.
+     */
+    Marker getMarker() const { return _curAddr; }
+    void rewind(Marker marker);
 
     void clear();
 
+    /**
+     * Decommits the area memory past the current position, keeping at least keepBytes of
+     * the area committed. Does nothing if the allocator isn't built on a VirtualArea.
+     */
+    void trim(size_t keepBytes = 0);
+
     Stats getStats() const;
 
-private:
-    void* _startAddr;
-    void* _endAddr;
-    void* _curAddr;
+protected:
+    // Commits enough of the area to fit the block at addr and retries
+    void* _grow(char* addr, size_t numBytes, size_t alignment, size_t offset);
+
+    char* _startAddr;
+    char* _endAddr;
+    char* _curAddr;
     const size_t _alignment;
+    VirtualArea* _area;
 };
 
-LinearAllocator::LinearAllocator(void* mem, size_t size, size_t alignment) :
-    _startAddr(mem),
-    _endAddr((char*)_startAddr + size),
-    _curAddr(mem::align(_startAddr, alignment)),
-    _alignment(alignment)
+inline LinearAllocator::LinearAllocator(void* mem, size_t size, size_t alignment) :
+    _startAddr((char*)mem),
+    _endAddr(_startAddr + size),
+    _curAddr(_startAddr),
+    _alignment(alignment),
+    _area(nullptr)
 {
+    assert(util::isPowerOfTwo(alignment) && "Power of two alignment required");
 }
 
-LinearAllocator::~LinearAllocator()
+inline LinearAllocator::LinearAllocator(void* start, void* end, size_t alignment) :
+    LinearAllocator(start, (char*)end - (char*)start, alignment)
 {
 }
 
-void* LinearAllocator::allocate(size_t numBytes, size_t, size_t)
+inline LinearAllocator::LinearAllocator(VirtualArea& area, size_t alignment) :
+    _startAddr((char*)area.start()),
+    _endAddr((char*)area.end()),
+    _curAddr(_startAddr),
+    _alignment(alignment),
+    _area(&area)
 {
-    void* addr = _curAddr;
-    if (static_cast<char*>(addr) + numBytes > static_cast<char*>(_endAddr)) {
-        return nullptr;
+    assert(util::isPowerOfTwo(alignment) && "Power of two alignment required");
+}
+
+inline LinearAllocator::~LinearAllocator()
+{
+}
+
+inline void* LinearAllocator::allocate(size_t numBytes, size_t alignment, size_t offset)
+{
+    if (alignment == DefaultAlignment || alignment < _alignment) {
+        alignment = _alignment;
+    }
+
+    char* addr = (char*)mem::align(_curAddr + SizeHeaderSize + offset, alignment) - offset;
+    if (addr > _endAddr || numBytes > static_cast<size_t>(_endAddr - addr) || numBytes > MaxAllocationSize) {
+        return _area ? _grow(addr, numBytes, alignment, offset) : nullptr;
     }
 
-    _curAddr = mem::align(static_cast<char*>(_curAddr) + numBytes, _alignment);
+    setSizeHeader(addr, numBytes);
+    _curAddr = addr + numBytes;
     return addr; 
 }
 
-void LinearAllocator::release(void* addr)
+inline void* LinearAllocator::_grow(char* addr, size_t numBytes, size_t alignment, size_t offset)
+{
+    size_t reservedSize = _area->getReservedSize();
+    if (numBytes > MaxAllocationSize || addr > _startAddr + reservedSize ||
+            numBytes > static_cast<size_t>(_startAddr + reservedSize - addr)) {
+        return nullptr;
+    }
+
+    // At least double what's committed so a steadily growing allocator only commits a
+    // logarithmic number of times
+    size_t committedSize = _endAddr - _startAddr;
+    size_t neededSize = addr + numBytes - _startAddr;
+    size_t commitSize = std::min(std::max(neededSize, 2*committedSize), reservedSize);
+    if (!_area->commit(commitSize) && !_area->commit(neededSize)) {
+        return nullptr;
+    }
+
+    _endAddr = (char*)_area->end();
+    return allocate(numBytes, alignment, offset);
+}
+
+inline void LinearAllocator::release(void* addr)
 {
     // Noop
 }
 
-void LinearAllocator::clear() 
+inline void LinearAllocator::rewind(Marker marker)
+{
+    assert(marker >= _startAddr && marker <= _curAddr && "Marker is newer than the allocator");
+    _curAddr = (char*)marker;
+}
+
+inline void LinearAllocator::clear() 
 {
     _curAddr = _startAddr;
 }
 
-LinearAllocator::Stats LinearAllocator::getStats() const
+inline void LinearAllocator::trim(size_t keepBytes)
+{
+    if (!_area) {
+        return;
+    }
+
+    _area->decommit(std::max(static_cast<size_t>(_curAddr - _startAddr), keepBytes));
+    _endAddr = (char*)_area->end();
+}
+
+inline LinearAllocator::Stats LinearAllocator::getStats() const
 {
     LinearAllocator::Stats stats;
-    stats.allocatedBytes = (size_t)_curAddr - (size_t)_startAddr;
-    stats.freeBytes = (size_t)_endAddr - (size_t)_curAddr;
+    stats.allocatedBytes = _curAddr - _startAddr;
+    stats.freeBytes = _endAddr - _curAddr;
     return stats;
 }
 
+/**
+ * LinearAllocator whose alignment is known at compile time.
+ *
+ * Requests no stricter than Alignment, which is all of them when the allocator is picked to
+ * suit its data, are aligned with a mask of constants and the allocate call folds down to a
+ * handful of instructions. Stricter requests take the LinearAllocator path.
+ */
+template <size_t Alignment>
+class AlignedLinearAllocator : public LinearAllocator
+{
+public:
+    static_assert(Alignment > 0 && (Alignment & (Alignment - 1)) == 0, "Power of two alignment required");
+
+    AlignedLinearAllocator(void* mem, size_t size) :
+        LinearAllocator(mem, size, Alignment)
+    {
+    }
+
+    AlignedLinearAllocator(void* start, void* end) :
+        LinearAllocator(start, end, Alignment)
+    {
+    }
+
+    explicit AlignedLinearAllocator(VirtualArea& area) :
+        LinearAllocator(area, Alignment)
+    {
+    }
+
+    virtual void* allocate(size_t numBytes, size_t alignment = DefaultAlignment, size_t offset = 0) override
+    {
+        if (alignment > Alignment && alignment != DefaultAlignment) {
+            return LinearAllocator::allocate(numBytes, alignment, offset);
+        }
+
+        uintptr_t alignedAddr = ((uintptr_t)_curAddr + SizeHeaderSize + offset + Alignment - 1) & ~(uintptr_t)(Alignment - 1);
+        char* addr = (char*)alignedAddr - offset;
+        if (addr > _endAddr || numBytes > static_cast<size_t>(_endAddr - addr) || numBytes > MaxAllocationSize) {
+            return _area ? LinearAllocator::allocate(numBytes, alignment, offset) : nullptr;
+        }
+
+        setSizeHeader(addr, numBytes);
+        _curAddr = addr + numBytes;
+        return addr;
+    }
+};
+
+/**
+ * Takes a marker from a linear allocator and rewinds to it when it goes out of scope, releasing
+ * the temporaries of a nested phase without touching the outer one.
+ */
+template <typename LinearAllocatorType>
+class ScopedMarker
+{
+public:
+    typedef typename LinearAllocatorType::Marker Marker;
+
+    explicit ScopedMarker(LinearAllocatorType& allocator) :
+        _allocator(allocator),
+        _marker(allocator.getMarker())
+    {
+    }
+
+    ScopedMarker(LinearAllocatorType& allocator, Marker marker) :
+        _allocator(allocator),
+        _marker(marker)
+    {
+    }
+
+    ~ScopedMarker()
+    {
+        _allocator.rewind(_marker);
+    }
+
+    Marker getMarker() const { return _marker; }
+
+private:
+    ScopedMarker(const ScopedMarker&);
+    ScopedMarker& operator=(const ScopedMarker&);
+
+    LinearAllocatorType& _allocator;
+    const Marker _marker;
+};
+
 } // namespace mem
 
 #endif
@@ -0,0 +1,165 @@
+#include "mem/lockFreePoolAllocator.h"
+using namespace mem;
+
+#include <algorithm>
+#include <new>
+
+#include "mem/util.h"
+#include "util/math.h"
+
+const size_t LockFreePoolAllocator::SlotBits;
+const size_t LockFreePoolAllocator::MaxSlots;
+const size_t LockFreePoolAllocator::MaxChunks;
+const size_t LockFreePoolAllocator::ChunkTableSize;
+const uint32_t LockFreePoolAllocator::NullIndex;
+
+LockFreePoolAllocator::LockFreePoolAllocator(
+        size_t elementSize,
+        size_t elementAlignment,
+        size_t chunkSize,
+        util::PageBacking pageBacking) :
+    // Released elements hold the index of the next free element
+    _elementAlignment(std::max(elementAlignment, alignof(std::atomic<uint32_t>))),
+    _elementSize(mem::align(std::max(elementSize, sizeof(std::atomic<uint32_t>)), _elementAlignment)),
+    _chunkSize(util::nextPowerOfTwo(std::max(
+        std::max(chunkSize, util::getPageSize(pageBacking)),
+        _elementAlignment + _elementSize))),
+    _freeHead(NullIndex),
+    _chunks((std::atomic<char*>*)util::pageAllocate(ChunkTableSize)),
+    _numChunks(0),
+    _pageAllocator(pageBacking)
+{
+    assert(util::isPowerOfTwo(_elementAlignment) && "Power of two alignment required");
+    static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "Head must be a single word");
+
+    _firstElementOffset = mem::align(sizeof(ChunkHeader), _elementAlignment);
+    _elementsPerChunk = std::min((_chunkSize - _firstElementOffset)/_elementSize, MaxSlots);
+}
+
+LockFreePoolAllocator::~LockFreePoolAllocator()
+{
+    // Chunks are released along with the PageAllocator
+    util::pageRelease(_chunks, ChunkTableSize);
+}
+
+void* LockFreePoolAllocator::allocate(size_t numBytes, size_t alignment, size_t offset)
+{
+    if (numBytes > _elementSize || !_isAligned(alignment, offset)) {
+        return nullptr;
+    }
+
+    char* element = _pop();
+    return element ? element : _allocChunk();
+}
+
+void LockFreePoolAllocator::release(void* addr)
+{
+    if (!addr) {
+        return;
+    }
+
+    char* element = (char*)addr;
+    new (element) std::atomic<uint32_t>(NullIndex);
+    _push(_getIndex(element), element);
+}
+
+size_t LockFreePoolAllocator::getNumFreeElements() const
+{
+    size_t numFree = 0;
+    uint32_t index = _getHeadIndex(_freeHead.load(std::memory_order_acquire));
+    while (index != NullIndex) {
+        numFree++;
+        index = _getNextIndex(_getElement(index))->load(std::memory_order_relaxed);
+    }
+    return numFree;
+}
+
+char* LockFreePoolAllocator::_pop()
+{
+    uint64_t head = _freeHead.load(std::memory_order_acquire);
+    for (;;) {
+        uint32_t index = _getHeadIndex(head);
+        if (index == NullIndex) {
+            return nullptr;
+        }
+
+        // The element may be popped and handed out by another thread after the head is
+        // read, its next index is then garbage but the exchange below fails on the tag.
+        // Chunks are never unmapped so the read itself is always safe.
+        char* element = _getElement(index);
+        uint32_t nextIndex = _getNextIndex(element)->load(std::memory_order_relaxed);
+
+        if (_freeHead.compare_exchange_weak(head, _makeHead(head, nextIndex),
+                    std::memory_order_acquire, std::memory_order_acquire)) {
+            return element;
+        }
+    }
+}
+
+char* LockFreePoolAllocator::_getElement(uint32_t index) const
+{
+    char* chunk = _chunks[index >> SlotBits].load(std::memory_order_relaxed);
+    assert(chunk);
+    return chunk + _firstElementOffset + (index & (MaxSlots - 1))*_elementSize;
+}
+
+uint32_t LockFreePoolAllocator::_getIndex(void* element) const
+{
+    char* chunk = (char*)((uintptr_t)element & ~(_chunkSize - 1));
+    size_t slot = ((char*)element - chunk - _firstElementOffset)/_elementSize;
+    assert(slot < _elementsPerChunk && "Address doesn't belong to this allocator");
+
+    uint32_t chunkIndex = ((ChunkHeader*)chunk)->chunkIndex;
+    assert(_chunks[chunkIndex].load(std::memory_order_relaxed) == chunk);
+    return static_cast<uint32_t>((chunkIndex << SlotBits) | slot);
+}
+
+void LockFreePoolAllocator::_push(uint32_t first, char* last)
+{
+    uint64_t head = _freeHead.load(std::memory_order_relaxed);
+    do {
+        _getNextIndex(last)->store(_getHeadIndex(head), std::memory_order_relaxed);
+    } while (!_freeHead.compare_exchange_weak(head, _makeHead(head, first),
+                std::memory_order_release, std::memory_order_relaxed));
+}
+
+char* LockFreePoolAllocator::_allocChunk()
+{
+    std::lock_guard<std::mutex> guard(_growLock);
+
+    // Another thread may have added a chunk, or elements may have been released, while
+    // we waited
+    char* element = _pop();
+    if (element) {
+        return element;
+    }
+
+    size_t chunkIndex = _numChunks.load(std::memory_order_relaxed);
+    if (chunkIndex >= MaxChunks) {
+        return nullptr;
+    }
+
+    // Aligning the chunk to its size lets an element find its chunk header
+    char* chunk = (char*)_pageAllocator.allocate(_chunkSize, _chunkSize);
+    if (!chunk) {
+        return nullptr;
+    }
+
+    ((ChunkHeader*)chunk)->chunkIndex = static_cast<uint32_t>(chunkIndex);
+    _chunks[chunkIndex].store(chunk, std::memory_order_relaxed);
+    _numChunks.store(chunkIndex + 1, std::memory_order_release);
+
+    // The first element goes to the caller, the rest are linked in order and pushed
+    // at once. Pushing releases the chunk pointer to threads which pop them.
+    uint32_t baseIndex = static_cast<uint32_t>(chunkIndex << SlotBits);
+    if (_elementsPerChunk > 1) {
+        for (uint32_t slot = 1; slot + 1 < _elementsPerChunk; ++slot) {
+            new (_getElement(baseIndex | slot)) std::atomic<uint32_t>(baseIndex | (slot + 1));
+        }
+        char* last = _getElement(baseIndex | static_cast<uint32_t>(_elementsPerChunk - 1));
+        new (last) std::atomic<uint32_t>(NullIndex);
+        _push(baseIndex | 1, last);
+    }
+
+    return _getElement(baseIndex);
+}
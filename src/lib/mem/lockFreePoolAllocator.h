@@ -0,0 +1,130 @@
+#ifndef MEM_LOCKFREEPOOLALLOCATOR_H
+#define MEM_LOCKFREEPOOLALLOCATOR_H
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+
+#include "util/memory.h"
+#include "util/units.h"
+#include "mem/alignment.h"
+#include "mem/allocator.h"
+#include "mem/pageAllocator.h"
+
+namespace mem {
+
+/**
+ * Thread-safe pool of fixed-size elements which never takes a lock to allocate or
+ * release, elements can be released by any thread.
+ *
+ * Free elements form a Treiber stack. To rule out ABA the stack doesn't link elements
+ * by address: every element has a 32 bit index (its chunk and slot in the chunk) and the
+ * head of the stack is the index of the top element next to a 32 bit tag which changes
+ * with every update, both swapped with a single 64 bit compare-and-swap. A thread which
+ * read the head before another thread popped and pushed the same element fails its
+ * compare-and-swap since the tag has moved on.
+ *
+ * Chunks come from a PageAllocator and are aligned to their size, so the chunk holding
+ * an element is found by masking its address. Only adding a chunk, when the stack is
+ * empty, takes a lock. Chunks are held until the allocator is destroyed. There can be
+ * at most 65535 chunks of at most 65536 elements.
+ *
+ * Since the allocator does its own synchronization a Region using it can use the
+ * SingleThreaded policy as long as the rest of its policies don't need protecting (e.g.
+ * NoTracking).
+ *
+ * Implemented AllocatorPolicy.
+ */
+class LockFreePoolAllocator : public mem::Allocator
+{
+public:
+    LockFreePoolAllocator(
+            size_t elementSize,
+            size_t elementAlignment = sizeof(void*),
+            size_t chunkSize = util::kilobytes(64),
+            util::PageBacking pageBacking = util::RegularPages);
+    ~LockFreePoolAllocator();
+
+    virtual void* allocate(size_t size, size_t alignment = DefaultAlignment, size_t offset = 0) override;
+    virtual void release(void* addr) override;
+    virtual size_t getAllocationSize(void* addr) const override { return _elementSize; }
+
+    size_t getElementSize() const { return _elementSize; }
+    size_t getNumChunks() const { return _numChunks.load(std::memory_order_acquire); }
+
+    /**
+     * Walks the free stack, the count is only exact while no other thread is using the
+     * allocator.
+     */
+    size_t getNumFreeElements() const;
+
+protected:
+    static const size_t SlotBits = 16;
+    static const size_t MaxSlots = static_cast<size_t>(1) << SlotBits;
+    static const uint32_t NullIndex = ~static_cast<uint32_t>(0);
+
+    // The last slot of the last chunk would be NullIndex
+    static const size_t MaxChunks = (static_cast<size_t>(1) << (32 - SlotBits)) - 1;
+    static const size_t ChunkTableSize = (MaxChunks + 1)*sizeof(std::atomic<char*>);
+
+    // Start of every chunk
+    struct ChunkHeader
+    {
+        uint32_t chunkIndex;
+    };
+
+    // Head of the free stack, the index of the top element in the low half and the tag
+    // in the high half
+    static uint32_t _getHeadIndex(uint64_t head) { return static_cast<uint32_t>(head); }
+    static uint64_t _makeHead(uint64_t prevHead, uint32_t index)
+    {
+        return (((prevHead >> 32) + 1) << 32) | index;
+    }
+
+    char* _getElement(uint32_t index) const;
+    uint32_t _getIndex(void* element) const;
+
+    // A free element holds the index of the element below it on the stack
+    static std::atomic<uint32_t>* _getNextIndex(char* element) { return (std::atomic<uint32_t>*)element; }
+
+    // Returns nullptr if the stack is empty
+    char* _pop();
+
+    // Pushes a chain of elements already linked from first to last
+    void _push(uint32_t first, char* last);
+
+    // Adds a chunk, keeping one of its elements for the caller. Returns nullptr if no
+    // chunk can be added.
+    char* _allocChunk();
+
+    bool _isAligned(size_t alignment, size_t offset) const
+    {
+        return (alignment <= _elementAlignment || alignment == DefaultAlignment) && offset%alignment == 0;
+    }
+
+private:
+    LockFreePoolAllocator(const LockFreePoolAllocator&);
+    LockFreePoolAllocator& operator=(const LockFreePoolAllocator&);
+
+    const size_t _elementAlignment;
+    const size_t _elementSize;
+    const size_t _chunkSize;
+    size_t _firstElementOffset;
+    size_t _elementsPerChunk;
+
+    std::atomic<uint64_t> _freeHead;
+
+    // Chunks are published in order and never removed, only the first _numChunks entries
+    // are valid. The table is mapped from the OS, only the pages in use are backed.
+    std::atomic<char*>* const _chunks;
+    std::atomic<size_t> _numChunks;
+
+    // Serializes adding chunks, the PageAllocator isn't thread-safe
+    std::mutex _growLock;
+    PageAllocator _pageAllocator;
+};
+
+} // namespace mem
+
+#endif
@@ -53,6 +53,9 @@ public:
         // offset is already included in size
         const size_t newSize = size + (alignment - 1) + sizeof(SizeField) + sizeof(AlignOffsetField);
         char* alloc = static_cast<char*>(malloc(newSize));
+        if (!alloc) {
+            return nullptr;
+        }
 
         char* preAlignedMem = alloc + sizeof(AlignOffsetField) + sizeof(SizeField) + offset;
         // TODO: align func
@@ -83,6 +86,26 @@ public:
         char* sizeMem = static_cast<char*>(mem) - sizeof(SizeField);
         return *(size_t*)(sizeMem);
     }
+
+    virtual void* reallocate(void* mem, size_t size, size_t alignment = DefaultAlignment, size_t offset = 0) override
+    {
+        if (!mem) {
+            return allocate(size, alignment, offset);
+        }
+
+        // getAllocationSize() includes the bookkeeping, only copy what follows mem
+        char* alignOffsetMem = static_cast<char*>(mem) - sizeof(SizeField) - sizeof(AlignOffsetField);
+        char* originalMem = alignOffsetMem - *alignOffsetMem;
+        size_t usableSize = originalMem + getAllocationSize(mem) - static_cast<char*>(mem);
+
+        void* newMem = allocate(size, alignment, offset);
+        if (!newMem) {
+            return nullptr;
+        }
+        memcpy(newMem, mem, std::min(usableSize, size));
+        release(mem);
+        return newMem;
+    }
 };
 
 } // namespace mem
@@ -1,12 +1,20 @@
 #include "mem/pageAllocator.h"
 using namespace mem;
 
+#include <sys/mman.h>
+
 #include "util/align.h"
 #include "util/math.h"
 #include "util/memory.h"
 
-PageAllocator::PageAllocator() :
-    _segmentList(nullptr)
+const size_t PageAllocator::QuarantineSize;
+
+PageAllocator::PageAllocator(util::PageBacking pageBacking, unsigned flags) :
+    _segmentList(nullptr),
+    _pageBacking(pageBacking),
+    _flags(flags),
+    _quarantineHead(0),
+    _numQuarantined(0)
 {
 }
 
@@ -18,6 +26,11 @@ PageAllocator::~PageAllocator()
         _releaseSegment(ptr);
         ptr = next;
     }
+
+    for (size_t i = 0; i < _numQuarantined; ++i) {
+        QuarantinedPages& pages = _quarantine[(_quarantineHead + i)%QuarantineSize];
+        util::pageRelease(pages.mem, pages.size);
+    }
 }
 
 /**
@@ -32,23 +45,43 @@ PageAllocator::~PageAllocator()
  *                    +-------------------------+
  *                    | Aligned memory          | 
  *                    +-------------------------+
+ *
+ * With GuardPages the alignOffset grows to push the memory up against a PROT_NONE page
+ * mapped right after it.
  */
 void* PageAllocator::allocate(size_t size, size_t alignment, size_t offset)
 {
     // The offset should already be accounted for in the size
     size_t allocSize = size + (alignment - 1) + sizeof(Segment);
+    size_t pageSize = util::getPageSize(_pageBacking);
     // TODO: alignment function
-    size_t pageAlignedSize = util::nextPowerOfTwoMultiple(allocSize, util::getPageSize());
-    char* allocMem = (char*)util::pageAllocate(pageAlignedSize);
-
-    // TODO: alignment function
-    char* preAlignedMem = (char*)allocMem + sizeof(Segment) + offset;
-    size_t alignOffset = (alignment - ((size_t)preAlignedMem%alignment))%alignment;
-    assert((size_t)(preAlignedMem + alignOffset)%alignment == 0);
+    size_t pageAlignedSize = util::nextPowerOfTwoMultiple(allocSize, pageSize);
+    size_t guardSize = (_flags & GuardPages) ? pageSize : 0;
+    char* allocMem = (char*)util::pageAllocate(pageAlignedSize + guardSize, _pageBacking);
+
+    size_t alignOffset;
+    if (_flags & GuardPages) {
+        char* guard = allocMem + pageAlignedSize;
+        int err = mprotect(guard, guardSize, PROT_NONE);
+        assert(err == 0);
+        (void)err;
+
+        // The end of the memory lands as close to the guard as the alignment allows
+        char* preAlignedMem = guard - size + offset;
+        char* mem = preAlignedMem - (size_t)preAlignedMem%alignment - offset;
+        alignOffset = mem - sizeof(Segment) - allocMem;
+        assert((size_t)(mem + offset)%alignment == 0 && mem + size <= guard);
+    } else {
+        // TODO: alignment function
+        char* preAlignedMem = (char*)allocMem + sizeof(Segment) + offset;
+        alignOffset = (alignment - ((size_t)preAlignedMem%alignment))%alignment;
+        assert((size_t)(preAlignedMem + alignOffset)%alignment == 0);
+    }
 
     Segment* segment = (Segment*)(allocMem + alignOffset);
     segment->size = pageAlignedSize - offset - alignOffset - sizeof(Segment);
     segment->alignOffset = alignOffset;
+    segment->offset = offset;
     _linkSegment(segment);
 
     return _getMemFromSegment(segment);
@@ -60,6 +93,11 @@ void PageAllocator::release(void* mem)
 
     Segment* segment = _getSegmentFromMem(mem);
     _unlinkSegment(segment);
+
+    if (_flags & Quarantine) {
+        _quarantineSegment(segment);
+        return;
+    }
     _releaseSegment(segment);
 }
 
@@ -73,26 +111,14 @@ size_t PageAllocator::getAllocationSize(void* mem) const
 void PageAllocator::_linkSegment(Segment* segment)
 {
     assert(segment);
-    if (!_segmentList) {
-        segment->next = nullptr;
-        segment->prev = nullptr;
-        _segmentList = segment;
-        return;
-    }
 
-    Segment* ptr = _segmentList;
-    while (ptr) {
-        Segment* nextPtr = ptr->next;
-        if (!nextPtr) {
-            break;
-        }
-        ptr = nextPtr;
+    // Order doesn't matter, linking at the head keeps this constant time
+    segment->next = _segmentList;
+    segment->prev = nullptr;
+    if (_segmentList) {
+        _segmentList->prev = segment;
     }
-
-    Segment* lastSegment = ptr;
-    lastSegment->next = segment;
-    segment->next = nullptr;
-    segment->prev = lastSegment;
+    _segmentList = segment;
 }
 
 void PageAllocator::_unlinkSegment(Segment* segment)
@@ -113,7 +139,32 @@ void PageAllocator::_releaseSegment(Segment* segment)
 {
     assert(segment);
     void* pageMem = (char*)(segment) - segment->alignOffset;
-    util::pageRelease(pageMem, _getPageSize(segment));
+    util::pageRelease(pageMem, _getMappedSize(segment));
+}
+
+void PageAllocator::_quarantineSegment(Segment* segment)
+{
+    assert(segment);
+    char* pageMem = (char*)(segment) - segment->alignOffset;
+    size_t mappedSize = _getMappedSize(segment);
+
+    // Holds on to the addresses so nothing else is mapped there, but not to the memory
+    int err = mprotect(pageMem, mappedSize, PROT_NONE);
+    assert(err == 0);
+    (void)err;
+    madvise(pageMem, mappedSize, MADV_DONTNEED);
+
+    if (_numQuarantined == QuarantineSize) {
+        QuarantinedPages& oldest = _quarantine[_quarantineHead];
+        util::pageRelease(oldest.mem, oldest.size);
+        _quarantineHead = (_quarantineHead + 1)%QuarantineSize;
+        --_numQuarantined;
+    }
+
+    QuarantinedPages& pages = _quarantine[(_quarantineHead + _numQuarantined)%QuarantineSize];
+    pages.mem = pageMem;
+    pages.size = mappedSize;
+    ++_numQuarantined;
 }
 
 PageAllocator::Segment* PageAllocator::_getSegmentFromMem(void* mem) const
@@ -134,3 +185,10 @@ size_t PageAllocator::_getPageSize(Segment* segment) const
     return segment->size + segment->alignOffset + segment->offset + sizeof(Segment);
 }
 
+size_t PageAllocator::_getMappedSize(Segment* segment) const
+{
+    assert(segment);
+    size_t guardSize = (_flags & GuardPages) ? util::getPageSize(_pageBacking) : 0;
+    return _getPageSize(segment) + guardSize;
+}
+
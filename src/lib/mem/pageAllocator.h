@@ -1,32 +1,60 @@
-#ifndef MEM_LINEARALLOCATOR_H
-#define MEM_LINEARALLOCATOR_H
+#ifndef MEM_PAGEALLOCATOR_H
+#define MEM_PAGEALLOCATOR_H
 
 #include "mem/alignment.h"
 #include "mem/allocator.h"
+#include "util/memory.h"
 
 namespace mem {
 
 /**
  * Allocates pages of memory from the operating system.
  *
+ * With huge page backing every allocation is rounded up to a multiple of
+ * util::getHugePageSize() so this is only worthwhile for large allocations.
+ *
+ * GuardPages ends every allocation flush against a trailing PROT_NONE page so an overrun
+ * faults on the spot instead of corrupting whatever comes next. Only the alignment can leave
+ * a few bytes of slack before the guard, allocate with an alignment of 1 to leave none.
+ * Quarantine keeps released pages mapped PROT_NONE, with their physical memory given back,
+ * for the next QuarantineSize releases so a use after free faults as well. Both cost a
+ * mapping per allocation and are meant for debugging, see GuardPageBoundsChecking.
+ *
  * Fulfills the AllocatorPolicy concept.
  * TODO: noncopyable
  */
 class PageAllocator : public mem::Allocator
 {
 public:
-    PageAllocator();
+    enum Flags
+    {
+        GuardPages = 1 << 0,
+        Quarantine = 1 << 1
+    };
+
+    static const size_t QuarantineSize = 64;
+
+public:
+    PageAllocator(util::PageBacking pageBacking = util::RegularPages, unsigned flags = 0);
     ~PageAllocator();
 
     /**
      * _allocate_ returns a number of bytes a multiple of the system page size which in practice is
-     * usually 4096 bytes.
+     * usually 4096 bytes, or of the huge page size.
      */
     virtual void* allocate(size_t size, size_t alignment, size_t offset = 0) override;
     virtual void release(void* addr) override;
 
     virtual size_t getAllocationSize(void* mem) const override;
 
+    /**
+     * Bytes of each allocation's pages used for bookkeeping and alignment. Asking for a
+     * page multiple less this makes the allocation fit its pages exactly.
+     */
+    static size_t getOverhead(size_t alignment) { return sizeof(Segment) + alignment - 1; }
+
+    unsigned getFlags() const { return _flags; }
+
 protected:
     struct Segment
     {
@@ -40,13 +68,42 @@ protected:
     void _linkSegment(Segment* segment);
     void _unlinkSegment(Segment* segment);
     void _releaseSegment(Segment* segment);
+    void _quarantineSegment(Segment* segment);
 
     Segment* _getSegmentFromMem(void* mem) const;
     void* _getMemFromSegment(Segment* segment) const;
     size_t _getPageSize(Segment* segment) const;
 
+    // Bytes mapped for the segment, its pages plus the guard page
+    size_t _getMappedSize(Segment* segment) const;
+
 private:
+    struct QuarantinedPages
+    {
+        void* mem;
+        size_t size;
+    };
+
     Segment* _segmentList;
+    util::PageBacking _pageBacking;
+    unsigned _flags;
+
+    // Ring of released mappings, oldest at _quarantineHead
+    QuarantinedPages _quarantine[QuarantineSize];
+    size_t _quarantineHead;
+    size_t _numQuarantined;
+};
+
+/**
+ * PageAllocator with GuardPages and Quarantine, default constructible so a Region can use it.
+ */
+class GuardPageAllocator : public PageAllocator
+{
+public:
+    GuardPageAllocator() :
+        PageAllocator(util::RegularPages, GuardPages | Quarantine)
+    {
+    }
 };
 
 } // namespace mem
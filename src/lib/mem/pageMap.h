@@ -0,0 +1,198 @@
+#ifndef MEM_PAGEMAP_H
+#define MEM_PAGEMAP_H
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+
+#include "util/memory.h"
+
+namespace mem {
+
+/**
+ * Maps every page of the address space to a T*, defaulting to nullptr.
+ *
+ * The map is a three level radix tree indexed by page number. The root is allocated with
+ * the map, interior nodes and leaves are allocated from the OS the first time a page under
+ * them is set. Nothing is released until the map is destroyed. Lookups are a fixed three
+ * loads no matter how many ranges are stored.
+ *
+ * A single thread may modify the map at a time, but any number of threads may call get()
+ * concurrently with it. A get() of a page which is being set or cleared returns either
+ * the old or new value.
+ *
+ * Pages are always 4096 bytes here. A range which isn't aligned to this, unlike any range
+ * returned by mmap, maps every page it touches so it can't share a page with another range.
+ */
+template <class T>
+class PageMap
+{
+public:
+    static const size_t PageShift = 12;
+    static const size_t PageSize = static_cast<size_t>(1) << PageShift;
+
+    PageMap();
+    ~PageMap();
+
+    T* get(const void* addr) const;
+
+    /**
+     * Maps every page in [start, start + numBytes) to value.
+     */
+    void set(const void* start, size_t numBytes, T* value);
+    void clear(const void* start, size_t numBytes) { set(start, numBytes, nullptr); }
+
+private:
+    PageMap(const PageMap&);
+    PageMap& operator=(const PageMap&);
+
+    // 48 bit addresses, the page number is split evenly between the three levels
+    static const size_t AddressBits = 48;
+    static const size_t LevelBits = (AddressBits - PageShift)/3;
+    static const size_t NodeSize = static_cast<size_t>(1) << LevelBits;
+
+    struct Leaf
+    {
+        std::atomic<T*> values[NodeSize];
+    };
+
+    struct Node
+    {
+        std::atomic<Leaf*> leaves[NodeSize];
+    };
+
+    size_t _getPage(const void* addr) const;
+    size_t _getRootIndex(size_t page) const { return page >> 2*LevelBits; }
+    size_t _getNodeIndex(size_t page) const { return (page >> LevelBits) & (NodeSize - 1); }
+    size_t _getLeafIndex(size_t page) const { return page & (NodeSize - 1); }
+
+    // Return nullptr only when the node doesn't exist and create is false
+    Leaf* _getLeaf(size_t page, bool create);
+
+    template <class U> U* _allocNode();
+    template <class U> void _releaseNode(U* node);
+
+    std::atomic<Node*>* const _root;
+};
+
+template <class T>
+const size_t PageMap<T>::PageShift;
+
+template <class T>
+const size_t PageMap<T>::PageSize;
+
+template <class T>
+PageMap<T>::PageMap() :
+    _root((std::atomic<Node*>*)util::pageAllocate(NodeSize*sizeof(std::atomic<Node*>)))
+{
+    // Pages come back zeroed, which is the nullptr state of every entry
+}
+
+template <class T>
+PageMap<T>::~PageMap()
+{
+    for (size_t i = 0; i < NodeSize; ++i) {
+        Node* node = _root[i].load(std::memory_order_relaxed);
+        if (node) {
+            for (size_t j = 0; j < NodeSize; ++j) {
+                Leaf* leaf = node->leaves[j].load(std::memory_order_relaxed);
+                if (leaf) {
+                    _releaseNode(leaf);
+                }
+            }
+            _releaseNode(node);
+        }
+    }
+    util::pageRelease(_root, NodeSize*sizeof(std::atomic<Node*>));
+}
+
+template <class T>
+inline T* PageMap<T>::get(const void* addr) const
+{
+    size_t page = _getPage(addr);
+
+    Node* node = _root[_getRootIndex(page)].load(std::memory_order_acquire);
+    if (!node) {
+        return nullptr;
+    }
+
+    Leaf* leaf = node->leaves[_getNodeIndex(page)].load(std::memory_order_acquire);
+    if (!leaf) {
+        return nullptr;
+    }
+
+    return leaf->values[_getLeafIndex(page)].load(std::memory_order_acquire);
+}
+
+template <class T>
+void PageMap<T>::set(const void* start, size_t numBytes, T* value)
+{
+    size_t firstPage = _getPage(start);
+    size_t lastPage = _getPage((const char*)start + numBytes - 1);
+
+    size_t page = firstPage;
+    while (page <= lastPage) {
+        // Clearing never needs to create nodes
+        Leaf* leaf = _getLeaf(page, value != nullptr);
+        size_t leafEnd = (page | (NodeSize - 1)) + 1;
+
+        if (leaf) {
+            for (; page <= lastPage && page < leafEnd; ++page) {
+                leaf->values[_getLeafIndex(page)].store(value, std::memory_order_release);
+            }
+        } else {
+            page = leafEnd;
+        }
+    }
+}
+
+template <class T>
+inline size_t PageMap<T>::_getPage(const void* addr) const
+{
+    assert((uintptr_t)addr < (static_cast<uintptr_t>(1) << AddressBits));
+    return (uintptr_t)addr >> PageShift;
+}
+
+template <class T>
+typename PageMap<T>::Leaf* PageMap<T>::_getLeaf(size_t page, bool create)
+{
+    std::atomic<Node*>& nodeSlot = _root[_getRootIndex(page)];
+    Node* node = nodeSlot.load(std::memory_order_relaxed);
+    if (!node) {
+        if (!create) {
+            return nullptr;
+        }
+        node = _allocNode<Node>();
+        nodeSlot.store(node, std::memory_order_release);
+    }
+
+    std::atomic<Leaf*>& leafSlot = node->leaves[_getNodeIndex(page)];
+    Leaf* leaf = leafSlot.load(std::memory_order_relaxed);
+    if (!leaf) {
+        if (!create) {
+            return nullptr;
+        }
+        leaf = _allocNode<Leaf>();
+        leafSlot.store(leaf, std::memory_order_release);
+    }
+
+    return leaf;
+}
+
+template <class T>
+template <class U>
+U* PageMap<T>::_allocNode()
+{
+    return (U*)util::pageAllocate(sizeof(U));
+}
+
+template <class T>
+template <class U>
+void PageMap<T>::_releaseNode(U* node)
+{
+    util::pageRelease(node, sizeof(U));
+}
+
+} // namespace mem
+
+#endif
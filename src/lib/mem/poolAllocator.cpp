@@ -0,0 +1,95 @@
+#include "mem/poolAllocator.h"
+using namespace mem;
+
+#include <algorithm>
+
+#include "mem/util.h"
+#include "util/math.h"
+
+PoolAllocator::PoolAllocator(
+        size_t elementSize,
+        size_t elementAlignment,
+        size_t chunkSize,
+        util::PageBacking pageBacking) :
+    // Released elements hold the free list link
+    _elementAlignment(std::max(elementAlignment, alignof(FreeElement))),
+    _elementSize(mem::align(std::max(elementSize, sizeof(FreeElement)), _elementAlignment)),
+    _chunkSize(chunkSize),
+    _freeList(nullptr),
+    _chunkCursor(nullptr),
+    _chunkEnd(nullptr),
+    _numChunks(0),
+    _numElements(0),
+    _allocatedElements(0),
+    _pageAllocator(pageBacking)
+{
+    assert(util::isPowerOfTwo(_elementAlignment) && "Power of two alignment required");
+}
+
+PoolAllocator::~PoolAllocator()
+{
+    // Chunks are released along with the PageAllocator
+}
+
+void* PoolAllocator::allocate(size_t numBytes, size_t alignment, size_t offset)
+{
+    if (numBytes > _elementSize || !_isAligned(alignment, offset)) {
+        return nullptr;
+    }
+
+    void* element;
+    if (_freeList) {
+        element = _freeList;
+        _freeList = _freeList->next;
+    } else {
+        if (_chunkCursor == _chunkEnd && !_allocChunk()) {
+            return nullptr;
+        }
+        element = _chunkCursor;
+        _chunkCursor += _elementSize;
+    }
+
+    _allocatedElements++;
+    return element;
+}
+
+void PoolAllocator::release(void* addr)
+{
+    if (!addr) {
+        return;
+    }
+
+    assert(_allocatedElements > 0 && "More elements released than allocated");
+    FreeElement* element = (FreeElement*)addr;
+    element->next = _freeList;
+    _freeList = element;
+    _allocatedElements--;
+}
+
+PoolAllocator::Stats PoolAllocator::getStats() const
+{
+    Stats stats;
+    stats.allocatedElements = _allocatedElements;
+    stats.freeElements = _numElements - _allocatedElements;
+    stats.numChunks = _numChunks;
+    return stats;
+}
+
+bool PoolAllocator::_allocChunk()
+{
+    // A chunk always has room for at least one element
+    size_t chunkSize = std::max(_chunkSize, _elementSize);
+    char* start = (char*)_pageAllocator.allocate(chunkSize, _elementAlignment);
+    if (!start) {
+        return false;
+    }
+
+    // The PageAllocator rounds up to whole pages, all of which can be used
+    size_t numElements = _pageAllocator.getAllocationSize(start)/_elementSize;
+    _numChunks++;
+    _numElements += numElements;
+
+    _chunkCursor = start;
+    _chunkEnd = start + numElements*_elementSize;
+    return true;
+}
@@ -0,0 +1,126 @@
+#ifndef MEM_POOLALLOCATOR_H
+#define MEM_POOLALLOCATOR_H
+
+#include <cassert>
+#include <cstdint>
+
+#include "util/memory.h"
+#include "util/units.h"
+#include "mem/alignment.h"
+#include "mem/allocator.h"
+#include "mem/pageAllocator.h"
+
+namespace mem {
+
+/**
+ * Allocates elements of a single fixed size.
+ *
+ * Released elements are kept in an intrusive free list threaded through the elements
+ * themselves, so an element has no per-element overhead and allocating or releasing one
+ * is a couple of pointer moves. Memory comes from a PageAllocator in chunks of chunkSize
+ * bytes, the newest chunk is handed out in order before its elements ever reach the
+ * free list so its pages are only touched as they're needed. Chunks are held until the
+ * allocator is destroyed.
+ *
+ * Every element is aligned to elementAlignment. A request for more than the element
+ * size, or for an alignment and offset the elements don't meet, fails. When used by a
+ * Region the element size has to include the space bounds checking adds to a request.
+ *
+ * The allocator does no locking of its own.
+ *
+ * Implemented AllocatorPolicy.
+ */
+class PoolAllocator : public mem::Allocator
+{
+public:
+    struct Stats
+    {
+        size_t allocatedElements;
+
+        // Elements which have been handed out before and released, plus those never
+        // handed out yet
+        size_t freeElements;
+        size_t numChunks;
+    };
+
+public:
+    PoolAllocator(
+            size_t elementSize,
+            size_t elementAlignment = sizeof(void*),
+            size_t chunkSize = util::kilobytes(64),
+            util::PageBacking pageBacking = util::RegularPages);
+    ~PoolAllocator();
+
+    virtual void* allocate(size_t size, size_t alignment = DefaultAlignment, size_t offset = 0) override;
+    virtual void release(void* addr) override;
+
+    // Every element has the same size, nothing needs to be looked up
+    virtual size_t getAllocationSize(void* addr) const override { return _elementSize; }
+
+    /**
+     * Elements never change size, resizing in place only works within the element.
+     */
+    virtual bool tryExpandInPlace(void* addr, size_t size) override { return size <= _elementSize; }
+
+    size_t getElementSize() const { return _elementSize; }
+    size_t getElementAlignment() const { return _elementAlignment; }
+
+    Stats getStats() const;
+
+protected:
+    // Written over a released element
+    struct FreeElement
+    {
+        FreeElement* next;
+    };
+
+    // Whether the elements meet the alignment an allocation asks for, mem::DefaultAlignment
+    // defers to the element alignment
+    bool _isAligned(size_t alignment, size_t offset) const
+    {
+        return (alignment <= _elementAlignment || alignment == DefaultAlignment) && offset%alignment == 0;
+    }
+
+    bool _allocChunk();
+
+private:
+    PoolAllocator(const PoolAllocator&);
+    PoolAllocator& operator=(const PoolAllocator&);
+
+    const size_t _elementAlignment;
+    const size_t _elementSize;
+    const size_t _chunkSize;
+
+    FreeElement* _freeList;
+
+    // Part of the newest chunk which hasn't been handed out yet
+    char* _chunkCursor;
+    char* _chunkEnd;
+
+    size_t _numChunks;
+    size_t _numElements;
+    size_t _allocatedElements;
+
+    PageAllocator _pageAllocator;
+};
+
+/**
+ * PoolAllocator with the element size and alignment fixed at compile time, so it can be
+ * default constructed as the AllocationPolicy of a Region.
+ */
+template <size_t ElementSize, size_t ElementAlignment = sizeof(void*)>
+class FixedPoolAllocator : public PoolAllocator
+{
+public:
+    static_assert(ElementSize > 0, "Elements can't be empty");
+    static_assert((ElementAlignment & (ElementAlignment - 1)) == 0, "Power of two alignment required");
+
+    explicit FixedPoolAllocator(size_t chunkSize = util::kilobytes(64)) :
+        PoolAllocator(ElementSize, ElementAlignment, chunkSize)
+    {
+    }
+};
+
+} // namespace mem
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef MEM_REGION_H
 #define MEM_REGION_H
 
+#include <algorithm>
+#include <cassert>
+
 #include "mem/sourceInfo.h"
 
 namespace mem {
@@ -15,6 +18,20 @@ public:
     virtual ~RegionBase() {};
     virtual void* allocate(size_t size, size_t alignment, SourceInfo sourceInfo) = 0;
     virtual void release(void* mem) = 0;
+
+    /**
+     * Same as calling allocate()/release() for each block, but the policies are only
+     * entered once for the whole batch.
+     */
+    virtual size_t allocateBatch(size_t size, size_t alignment, size_t count, void** out, SourceInfo sourceInfo) = 0;
+    virtual void releaseBatch(void** ptrs, size_t count) = 0;
+
+    /**
+     * See Allocator::reallocate(), tryExpandInPlace() and shrinkInPlace().
+     */
+    virtual void* reallocate(void* mem, size_t size, size_t alignment, SourceInfo sourceInfo) = 0;
+    virtual bool tryExpandInPlace(void* mem, size_t size) = 0;
+    virtual void shrinkInPlace(void* mem, size_t size) = 0;
 };
 
 /**
@@ -67,7 +84,7 @@ public:
         char* memc = static_cast<char*>(mem);
 
         _boundsChecker.guardFront(memc);
-        _boundsChecker.guardBack(memc + BoundsCheckingPolicy::SizeFront + originalSize);
+        _guardBack(memc, originalSize);
         _marker.onAllocation(memc + BoundsCheckingPolicy::SizeFront, originalSize);
         _tracker.onAllocation(memc, newSize, alignment, sourceInfo);
 
@@ -80,20 +97,243 @@ public:
         _threadGuard.begin();
 
         char* origMem = (char*)addr - BoundsCheckingPolicy::SizeFront;
-        const size_t allocSize = _allocator.getAllocationSize(addr);
+        const size_t allocSize = _allocator.getAllocationSize(origMem);
 
-        _boundsChecker.checkFront(origMem);
-        _boundsChecker.checkBack(origMem + BoundsCheckingPolicy::SizeFront + allocSize);
+        bool isIntact = _checkGuards(origMem);
+        assert(isIntact && "Bounds check failed");
+        (void)isIntact;
 
         _tracker.onRelease(origMem);
         _marker.onRelease(origMem, allocSize);
 
-        _allocator.release(addr);
+        _allocator.release(origMem);
+
+        _threadGuard.end();
+    }
+
+    size_t allocateBatch(size_t size, size_t alignment, size_t count, void** out, SourceInfo sourceInfo)
+    {
+        _threadGuard.begin();
+
+        const size_t originalSize = size;
+        const size_t newSize = size + BoundsCheckingPolicy::SizeFront + BoundsCheckingPolicy::SizeBack;
+
+        size_t numAllocated = _allocator.allocateBatch(
+                newSize, alignment, count, out, BoundsCheckingPolicy::SizeFront);
+
+        for (size_t i = 0; i < numAllocated; ++i) {
+            char* memc = static_cast<char*>(out[i]);
+
+            _boundsChecker.guardFront(memc);
+            _guardBack(memc, originalSize);
+            _marker.onAllocation(memc + BoundsCheckingPolicy::SizeFront, originalSize);
+            _tracker.onAllocation(memc, newSize, alignment, sourceInfo);
+
+            out[i] = memc + BoundsCheckingPolicy::SizeFront;
+        }
+
+        _threadGuard.end();
+        return numAllocated;
+    }
+
+    void releaseBatch(void** ptrs, size_t count)
+    {
+        _threadGuard.begin();
+
+        // The allocator needs the original addresses, translate them a chunk at a time
+        // rather than writing over the caller's array
+        const size_t ChunkSize = 64;
+        void* origPtrs[ChunkSize];
+
+        for (size_t first = 0; first < count; first += ChunkSize) {
+            size_t chunkCount = std::min(count - first, ChunkSize);
+
+            for (size_t i = 0; i < chunkCount; ++i) {
+                char* origMem = (char*)ptrs[first + i] - BoundsCheckingPolicy::SizeFront;
+                const size_t allocSize = _allocator.getAllocationSize(origMem);
+
+                bool isIntact = _checkGuards(origMem);
+                assert(isIntact && "Bounds check failed");
+                (void)isIntact;
+
+                _tracker.onRelease(origMem);
+                _marker.onRelease(origMem, allocSize);
+
+                origPtrs[i] = origMem;
+            }
+
+            _allocator.releaseBatch(origPtrs, chunkCount);
+        }
 
         _threadGuard.end();
     }
 
+    void* reallocate(void* addr, size_t size, size_t alignment, SourceInfo sourceInfo)
+    {
+        if (!addr) {
+            return allocate(size, alignment, sourceInfo);
+        }
+
+        _threadGuard.begin();
+
+        char* origMem = (char*)addr - BoundsCheckingPolicy::SizeFront;
+        const size_t newSize = size + BoundsCheckingPolicy::SizeFront + BoundsCheckingPolicy::SizeBack;
+
+        // The front guard moves along with the contents
+        bool isIntact = _checkGuards(origMem);
+        assert(isIntact && "Bounds check failed");
+        (void)isIntact;
+        void* mem = _allocator.reallocate(origMem, newSize, alignment, BoundsCheckingPolicy::SizeFront);
+        if (!mem) {
+            // The old block and its guards are left as they were
+            _threadGuard.end();
+            return nullptr;
+        }
+        char* memc = static_cast<char*>(mem);
+
+        _guardBack(memc, size);
+        _tracker.onReallocation(origMem, memc, newSize);
+
+        _threadGuard.end();
+        return memc + BoundsCheckingPolicy::SizeFront;
+    }
+
+    bool tryExpandInPlace(void* addr, size_t size)
+    {
+        _threadGuard.begin();
+
+        char* origMem = (char*)addr - BoundsCheckingPolicy::SizeFront;
+        const size_t newSize = size + BoundsCheckingPolicy::SizeFront + BoundsCheckingPolicy::SizeBack;
+
+        bool isExpanded = _allocator.tryExpandInPlace(origMem, newSize);
+        if (isExpanded) {
+            _guardBack(origMem, size);
+            _tracker.onReallocation(origMem, origMem, newSize);
+        }
+
+        _threadGuard.end();
+        return isExpanded;
+    }
+
+    void shrinkInPlace(void* addr, size_t size)
+    {
+        _threadGuard.begin();
+
+        char* origMem = (char*)addr - BoundsCheckingPolicy::SizeFront;
+        const size_t newSize = size + BoundsCheckingPolicy::SizeFront + BoundsCheckingPolicy::SizeBack;
+
+        _allocator.shrinkInPlace(origMem, newSize);
+        _guardBack(origMem, size);
+        _tracker.onReallocation(origMem, origMem, newSize);
+
+        _threadGuard.end();
+    }
+
+    /**
+     * Checks the guards of every live allocation rather than waiting for them to be
+     * released. Returns the number of allocations whose guards have been overwritten, the
+     * first maxCorrupted of which are stored in corrupted.
+     *
+     * Needs a TrackingPolicy which keeps a list of allocations, e.g. SourceTracking.
+     */
+    size_t verifyAllGuards(void** corrupted = nullptr, size_t maxCorrupted = 0)
+    {
+        _threadGuard.begin();
+
+        const size_t ChunkSize = 64;
+        decltype(_tracker.getAllocations()) entries[ChunkSize];
+
+        size_t numCorrupted = 0;
+        auto entry = _tracker.getAllocations();
+        while (entry) {
+            size_t count = 0;
+            for (; entry && count < ChunkSize; entry = entry->next) {
+                entries[count++] = entry;
+            }
+            size_t numStored = std::min(numCorrupted, maxCorrupted);
+            numCorrupted += _verifyGuards(entries, count, corrupted + numStored, maxCorrupted - numStored);
+        }
+
+        _threadGuard.end();
+        return numCorrupted;
+    }
+
+    /**
+     * Same as verifyAllGuards() but only checks up to maxAllocations allocations, continuing
+     * where the last call stopped. A call stops at the last allocation and the next one
+     * starts over. Spreads the checking out over e.g. idle time.
+     */
+    size_t verifyGuards(size_t maxAllocations, void** corrupted = nullptr, size_t maxCorrupted = 0)
+    {
+        _threadGuard.begin();
+
+        const size_t ChunkSize = 64;
+        decltype(_tracker.getAllocations()) entries[ChunkSize];
+
+        size_t numCorrupted = 0;
+        size_t numChecked = 0;
+        while (numChecked < maxAllocations) {
+            size_t chunkSize = std::min(maxAllocations - numChecked, ChunkSize);
+            bool isEnd;
+            size_t count = _tracker.getNextAllocations(entries, chunkSize, &isEnd);
+            size_t numStored = std::min(numCorrupted, maxCorrupted);
+            numCorrupted += _verifyGuards(entries, count, corrupted + numStored, maxCorrupted - numStored);
+            numChecked += count;
+
+            // Each allocation is checked at most once per call
+            if (isEnd) {
+                break;
+            }
+        }
+
+        _threadGuard.end();
+        return numCorrupted;
+    }
+
 protected:
+    // The allocator may have rounded the block up, the back guard goes right after the
+    // size asked for which the bounds checker keeps to find it again
+    void _guardBack(char* mem, size_t size)
+    {
+        _boundsChecker.setAllocationSize(mem, size);
+        _boundsChecker.guardBack(mem + BoundsCheckingPolicy::SizeFront + size);
+    }
+
+    // The size is only trusted once the front guard around it is known to be intact
+    bool _checkGuards(char* mem)
+    {
+        if (!_boundsChecker.checkFront(mem)) {
+            return false;
+        }
+        size_t size = _boundsChecker.getAllocationSize(mem);
+        return _boundsChecker.checkBack(mem + BoundsCheckingPolicy::SizeFront + size);
+    }
+
+    // Checks the guards of count tracked allocations
+    template <class Entry>
+    size_t _verifyGuards(Entry* const* entries, size_t count, void** corrupted, size_t maxCorrupted)
+    {
+        const size_t MaxCount = 64;
+        assert(count <= MaxCount);
+        void* fronts[MaxCount];
+        void* backs[MaxCount];
+        bool isIntact[MaxCount];
+
+        for (size_t i = 0; i < count; ++i) {
+            char* origMem = (char*)entries[i]->mem;
+            fronts[i] = origMem;
+            backs[i] = origMem + entries[i]->size - BoundsCheckingPolicy::SizeBack;
+        }
+
+        size_t numCorrupted = _boundsChecker.checkAll(fronts, backs, count, isIntact);
+        for (size_t i = 0, numStored = 0; i < count && numStored < maxCorrupted; ++i) {
+            if (!isIntact[i]) {
+                corrupted[numStored++] = (char*)entries[i]->mem + BoundsCheckingPolicy::SizeFront;
+            }
+        }
+        return numCorrupted;
+    }
+
     AllocationPolicy _allocator;
     ThreadingPolicy _threadGuard;
     BoundsCheckingPolicy _boundsChecker;
@@ -0,0 +1,151 @@
+#ifndef MEM_SAMPLINGREGION_H
+#define MEM_SAMPLINGREGION_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <utility>
+
+#include "mem/guardedSlotPool.h"
+#include "mem/sourceInfo.h"
+
+namespace mem {
+
+/**
+ * Wraps a Region to send a sample of its allocations to a GuardedSlotPool, cheap enough to
+ * leave on in production to catch overruns, underruns and uses after free where they
+ * happen.
+ *
+ * Roughly one in sampleRate allocations is sampled. Each thread counts down to its next
+ * sample, so an allocation which isn't sampled costs a thread-local decrement on top of the
+ * wrapped Region. The countdown is shared by all SamplingRegions wrapping the same Region
+ * type. A sampled allocation which doesn't fit a slot, or finds them all in use, is left
+ * to the Region like any other.
+ *
+ * Sampled allocations skip the wrapped Region's policies. Batch allocations are never
+ * sampled.
+ */
+template <class RegionType>
+class SamplingRegion : public RegionType
+{
+public:
+    static const size_t DefaultSampleRate = 1000;
+
+public:
+    SamplingRegion() :
+        SamplingRegion(DefaultSampleRate, GuardedSlotPool::DefaultNumSlots)
+    {
+    }
+
+    /**
+     * Any arguments after numSlots construct the wrapped Region.
+     */
+    template <class... Args>
+    SamplingRegion(size_t sampleRate, size_t numSlots, Args&&... args) :
+        RegionType(std::forward<Args>(args)...),
+        _pool(numSlots),
+        _sampleRate(sampleRate)
+    {
+        assert(sampleRate > 0);
+    }
+
+    void* allocate(size_t size, size_t alignment, SourceInfo sourceInfo)
+    {
+        if (--_countdown > 0) {
+            return RegionType::allocate(size, alignment, sourceInfo);
+        }
+        return _allocateSample(size, alignment, sourceInfo);
+    }
+
+    void release(void* addr)
+    {
+        if (_pool.contains(addr)) {
+            _pool.release(addr);
+            return;
+        }
+        RegionType::release(addr);
+    }
+
+    void releaseBatch(void** ptrs, size_t count)
+    {
+        // Sampled blocks are rare, they are released on their own and the runs of
+        // blocks between them passed on
+        size_t first = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (_pool.contains(ptrs[i])) {
+                RegionType::releaseBatch(ptrs + first, i - first);
+                _pool.release(ptrs[i]);
+                first = i + 1;
+            }
+        }
+        RegionType::releaseBatch(ptrs + first, count - first);
+    }
+
+    void* reallocate(void* addr, size_t size, size_t alignment, SourceInfo sourceInfo)
+    {
+        if (!addr || !_pool.contains(addr)) {
+            return RegionType::reallocate(addr, size, alignment, sourceInfo);
+        }
+
+        // The old block is left alone if there's no room for the new one
+        void* mem = allocate(size, alignment, sourceInfo);
+        if (mem) {
+            memcpy(mem, addr, std::min(size, _pool.getAllocationSize(addr)));
+            _pool.release(addr);
+        }
+        return mem;
+    }
+
+    bool tryExpandInPlace(void* addr, size_t size)
+    {
+        if (_pool.contains(addr)) {
+            return false;
+        }
+        return RegionType::tryExpandInPlace(addr, size);
+    }
+
+    void shrinkInPlace(void* addr, size_t size)
+    {
+        // A sampled block keeps its guard where it is
+        if (_pool.contains(addr)) {
+            return;
+        }
+        RegionType::shrinkInPlace(addr, size);
+    }
+
+    const GuardedSlotPool& getPool() const { return _pool; }
+    size_t getSampleRate() const { return _sampleRate; }
+
+protected:
+    void* _allocateSample(size_t size, size_t alignment, SourceInfo& sourceInfo)
+    {
+        // The countdown only goes below 0 the first time a thread allocates, don't sample
+        // every thread's first allocation
+        bool isFirst = _countdown < 0;
+        _countdown = GuardedSlotPool::getSampleInterval(_sampleRate);
+
+        if (!isFirst) {
+            void* mem = _pool.allocate(size, alignment, sourceInfo);
+            if (mem) {
+                return mem;
+            }
+        }
+        return RegionType::allocate(size, alignment, sourceInfo);
+    }
+
+private:
+    static thread_local int _countdown;
+
+    GuardedSlotPool _pool;
+    size_t _sampleRate;
+};
+
+template <class RegionType>
+const size_t SamplingRegion<RegionType>::DefaultSampleRate;
+
+template <class RegionType>
+thread_local int SamplingRegion<RegionType>::_countdown = 0;
+
+} // namespace mem
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef MEM_SCAVENGER_H
+#define MEM_SCAVENGER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace mem {
+
+/**
+ * Background thread which gradually returns an allocator's free memory to the OS.
+ *
+ * Every interval the scavenger trims the allocator down to at most (1 - decayRate) of its
+ * resident free memory, but doesn't trim it below minKeepBytes, so resident free memory
+ * decays geometrically while nothing is freed. The fraction is taken from whatever is
+ * free at the tick, how long it has been free isn't tracked. Memory freed just before a
+ * tick can be released and refaulted on its next use, a lower decayRate or a longer
+ * interval makes that rarer.
+ *
+ * Trimmable must provide thread-safe trim(size_t keepBytes) and getResidentFreeBytes()
+ * methods, e.g. ArenaHeapAllocator and CachedHeapAllocator. A plain HeapAllocator can't be
+ * used since it does no locking of its own.
+ */
+template <class Trimmable>
+class Scavenger
+{
+public:
+    Scavenger(
+            Trimmable& allocator,
+            std::chrono::milliseconds interval = std::chrono::milliseconds(1000),
+            double decayRate = 0.5,
+            size_t minKeepBytes = 0);
+    ~Scavenger();
+
+    /**
+     * Runs a single tick on the calling thread. Returns the number of bytes released.
+     */
+    size_t scavenge();
+
+    // Total over the lifetime of the scavenger
+    size_t getReleasedBytes() const { return _releasedBytes.load(std::memory_order_relaxed); }
+
+private:
+    Scavenger(const Scavenger&);
+    Scavenger& operator=(const Scavenger&);
+
+    void _run();
+
+    Trimmable& _allocator;
+    const std::chrono::milliseconds _interval;
+    const double _decayRate;
+    const size_t _minKeepBytes;
+
+    std::atomic<size_t> _releasedBytes;
+
+    std::mutex _lock;
+    std::condition_variable _wake;
+    bool _stop;
+    std::thread _thread;
+};
+
+template <class Trimmable>
+Scavenger<Trimmable>::Scavenger(
+        Trimmable& allocator,
+        std::chrono::milliseconds interval,
+        double decayRate,
+        size_t minKeepBytes) :
+    _allocator(allocator),
+    _interval(interval),
+    _decayRate(std::min(std::max(decayRate, 0.0), 1.0)),
+    _minKeepBytes(minKeepBytes),
+    _releasedBytes(0),
+    _stop(false),
+    _thread(&Scavenger::_run, this)
+{
+}
+
+template <class Trimmable>
+Scavenger<Trimmable>::~Scavenger()
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stop = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+}
+
+template <class Trimmable>
+size_t Scavenger<Trimmable>::scavenge()
+{
+    size_t residentBytes = _allocator.getResidentFreeBytes();
+    size_t keepBytes = std::max(
+            static_cast<size_t>(residentBytes*(1.0 - _decayRate)),
+            _minKeepBytes);
+
+    size_t releasedBytes = 0;
+    if (keepBytes < residentBytes) {
+        releasedBytes = _allocator.trim(keepBytes);
+        _releasedBytes.fetch_add(releasedBytes, std::memory_order_relaxed);
+    }
+    return releasedBytes;
+}
+
+template <class Trimmable>
+void Scavenger<Trimmable>::_run()
+{
+    std::unique_lock<std::mutex> guard(_lock);
+    while (!_stop) {
+        if (!_wake.wait_for(guard, _interval, [this]() { return _stop; })) {
+            guard.unlock();
+            scavenge();
+            guard.lock();
+        }
+    }
+}
+
+} // namespace mem
+
+#endif
@@ -2,6 +2,7 @@
 #define MEM_STL_ADAPTER_H
 
 #include <limits>
+#include <type_traits>
 
 #include "mem/alignment.h"
 #include "mem/region.h"
@@ -87,6 +88,27 @@ public:
         _region.release(obj);
     }
 
+    /**
+     * Not part of the STL allocator requirements, these are for containers which can make
+     * use of resizing in place. reallocate() moves the objects with memcpy so T must be 
+     * trivially copyable.
+     */
+    pointer reallocate(pointer obj, size_type num)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Objects are moved with memcpy");
+        return (pointer)_region.reallocate(obj, num*sizeof(T), mem::DefaultAlignment, mem::SourceInfo("stl_internal", 0));
+    }
+
+    bool tryExpandInPlace(pointer obj, size_type num)
+    {
+        return _region.tryExpandInPlace(obj, num*sizeof(T));
+    }
+
+    void shrinkInPlace(pointer obj, size_type num)
+    {
+        _region.shrinkInPlace(obj, num*sizeof(T));
+    }
+
     mem::RegionBase& region() const
     {
         return _region;
@@ -0,0 +1,592 @@
+#include "mem/tlsfAllocator.h"
+using namespace mem;
+
+#include <algorithm>
+
+#include "mem/util.h"
+#include "util/bit.h"
+#include "util/math.h"
+
+const size_t TlsfAllocator::MaxAllocationSize;
+const size_t TlsfAllocator::AlignSizeLog2;
+const size_t TlsfAllocator::AlignSize;
+const size_t TlsfAllocator::SlIndexCountLog2;
+const size_t TlsfAllocator::SlIndexCount;
+const size_t TlsfAllocator::FlIndexMax;
+const size_t TlsfAllocator::FlIndexShift;
+const size_t TlsfAllocator::FlIndexCount;
+const size_t TlsfAllocator::SmallBlockSize;
+const size_t TlsfAllocator::BlockFreeBit;
+const size_t TlsfAllocator::BlockPrevFreeBit;
+const size_t TlsfAllocator::BlockSizeMask;
+const size_t TlsfAllocator::BlockOverhead;
+const size_t TlsfAllocator::BlockDataOffset;
+const size_t TlsfAllocator::MinBlockSize;
+const size_t TlsfAllocator::MaxBlockSize;
+const size_t TlsfAllocator::PoolOverhead;
+
+TlsfAllocator::TlsfAllocator(size_t initialPoolSize, size_t growSize, util::PageBacking pageBacking) :
+    _flBitmap(0),
+    _pools(nullptr),
+    _pageAllocator(pageBacking),
+    _growSize(growSize)
+{
+    _initLists();
+    if (initialPoolSize > 0) {
+        _addPagePool(initialPoolSize);
+    }
+}
+
+TlsfAllocator::TlsfAllocator(void* start, void* end) :
+    _flBitmap(0),
+    _pools(nullptr),
+    _growSize(0)
+{
+    assert(start < end);
+    _initLists();
+
+    // The pool has to start on a block boundary
+    char* poolStart = (char*)mem::align(start, AlignSize);
+    if (poolStart < (char*)end) {
+        addPool(poolStart, (char*)end - poolStart);
+    }
+}
+
+TlsfAllocator::~TlsfAllocator()
+{
+    // Pools from the PageAllocator are released with it, the rest belong to the caller
+}
+
+void* TlsfAllocator::allocate(size_t numBytes, size_t alignment, size_t offset)
+{
+    if (numBytes > MaxAllocationSize || alignment > MaxAllocationSize) {
+        return nullptr;
+    }
+
+    if (alignment <= AlignSize) {
+        // Every block's data meets the alignment, the offset is met by starting the
+        // allocation a few bytes into the block
+        size_t padding = (alignment - offset%alignment)%alignment;
+        size_t blockSize = _adjustRequestSize(numBytes + padding);
+
+        Block* block = _locateFreeBlock(blockSize);
+        if (!block && _growPool(blockSize)) {
+            block = _locateFreeBlock(blockSize);
+        }
+        if (!block) {
+            return nullptr;
+        }
+        return (char*)_prepareUsedBlock(block, blockSize) + padding;
+    }
+
+    assert(util::isPowerOfTwo(alignment) && "Power of two alignment required");
+
+    // The slack in front of the aligned address has to be large enough to be a block of
+    // its own so it can be given back
+    const size_t MinGap = sizeof(Block);
+    size_t searchSize = _adjustRequestSize(numBytes + 2*alignment + MinGap);
+    if (searchSize > MaxAllocationSize) {
+        return nullptr;
+    }
+
+    Block* block = _locateFreeBlock(searchSize);
+    if (!block && _growPool(searchSize)) {
+        block = _locateFreeBlock(searchSize);
+    }
+    if (!block) {
+        return nullptr;
+    }
+
+    char* data = (char*)_getBlockData(block);
+    char* aligned = (char*)mem::align(data + offset, alignment) - offset;
+    size_t gap = ((uintptr_t)aligned & ~(AlignSize - 1)) - (uintptr_t)data;
+    if (gap > 0 && gap < MinGap) {
+        aligned += mem::align(MinGap - gap, alignment);
+        gap = ((uintptr_t)aligned & ~(AlignSize - 1)) - (uintptr_t)data;
+    }
+
+    if (gap > 0) {
+        block = _splitBlockHead(block, gap);
+    }
+
+    size_t padding = aligned - (char*)_getBlockData(block);
+    size_t blockSize = _adjustRequestSize(numBytes + padding);
+    assert(padding < AlignSize);
+    assert(_getBlockSize(block) >= blockSize);
+
+    return (char*)_prepareUsedBlock(block, blockSize) + padding;
+}
+
+void TlsfAllocator::release(void* addr)
+{
+    if (!addr) {
+        return;
+    }
+
+    Block* block = _getDataBlock(addr);
+    assert(!_isBlockFree(block) && "Block released twice");
+
+    _markBlockFree(block);
+    block = _mergePrevBlock(block);
+    block = _mergeNextBlock(block);
+    _insertBlock(block);
+}
+
+size_t TlsfAllocator::getAllocationSize(void* addr) const
+{
+    assert(addr);
+    Block* block = _getDataBlock(addr);
+    return (char*)_getBlockData(block) + _getBlockSize(block) - (char*)addr;
+}
+
+bool TlsfAllocator::tryExpandInPlace(void* addr, size_t numBytes)
+{
+    assert(addr);
+    if (numBytes > MaxAllocationSize) {
+        return false;
+    }
+
+    Block* block = _getDataBlock(addr);
+    size_t padding = (char*)addr - (char*)_getBlockData(block);
+    size_t blockSize = _adjustRequestSize(numBytes + padding);
+    if (blockSize <= _getBlockSize(block)) {
+        return true;
+    }
+
+    Block* next = _getNextBlock(block);
+    if (!_isBlockFree(next) || _getBlockSize(block) + _getBlockSize(next) + BlockOverhead < blockSize) {
+        return false;
+    }
+
+    _removeBlock(next);
+    _absorbBlock(block, next);
+    _markBlockUsed(block);
+    _trimUsedBlock(block, blockSize);
+    return true;
+}
+
+void TlsfAllocator::shrinkInPlace(void* addr, size_t numBytes)
+{
+    assert(addr);
+    Block* block = _getDataBlock(addr);
+    size_t padding = (char*)addr - (char*)_getBlockData(block);
+    size_t blockSize = _adjustRequestSize(numBytes + padding);
+    if (blockSize < _getBlockSize(block)) {
+        _trimUsedBlock(block, blockSize);
+    }
+}
+
+void TlsfAllocator::addPool(void* mem, size_t numBytes)
+{
+    assert(mem);
+    assert((uintptr_t)mem%AlignSize == 0 && "Pool memory must be aligned to 8 bytes");
+
+    // Block sizes have to fit the first level, larger ranges are split into several pools
+    const size_t MaxPoolSize = MaxBlockSize - AlignSize + PoolOverhead;
+    numBytes -= numBytes%AlignSize;
+
+    while (numBytes >= PoolOverhead + MinBlockSize) {
+        size_t poolBytes = std::min(numBytes, MaxPoolSize);
+
+        Pool* pool = (Pool*)mem;
+        pool->next = _pools;
+        pool->numBytes = poolBytes;
+        _pools = pool;
+
+        // The first block never has a free block in front of it, its link is never used
+        Block* block = _getPoolFirstBlock(pool);
+        block->size = poolBytes - PoolOverhead;
+        _setBlockFree(block, true);
+        _insertBlock(block);
+
+        Block* last = _linkNextBlock(block);
+        last->size = 0;
+        _setPrevBlockFree(last, true);
+
+        mem = (char*)mem + poolBytes;
+        numBytes -= poolBytes;
+    }
+}
+
+bool TlsfAllocator::check() const
+{
+    size_t numFreeBlocks = 0;
+
+    for (Pool* pool = _pools; pool; pool = pool->next) {
+        Block* block = _getPoolFirstBlock(pool);
+        bool prevFree = false;
+
+        while (!_isBlockLast(block)) {
+            size_t size = _getBlockSize(block);
+            if (size < MinBlockSize || size%AlignSize != 0) {
+                return false;
+            }
+            if (_isPrevBlockFree(block) != prevFree) {
+                return false;
+            }
+
+            Block* next = _getNextBlock(block);
+            if ((char*)next + BlockDataOffset > (char*)pool + pool->numBytes) {
+                return false;
+            }
+
+            if (_isBlockFree(block)) {
+                // Free blocks are always merged with their neighbours
+                if (prevFree || next->prevPhysical != block) {
+                    return false;
+                }
+                numFreeBlocks++;
+            }
+
+            prevFree = _isBlockFree(block);
+            block = next;
+        }
+
+        if (_isPrevBlockFree(block) != prevFree) {
+            return false;
+        }
+        if ((char*)block + BlockDataOffset != (char*)pool + pool->numBytes) {
+            return false;
+        }
+    }
+
+    size_t numListedBlocks = 0;
+    for (size_t fl = 0; fl < FlIndexCount; ++fl) {
+        bool hasFirstLevel = (_flBitmap & (1u << fl)) != 0;
+        if (hasFirstLevel != (_slBitmap[fl] != 0)) {
+            return false;
+        }
+
+        for (size_t sl = 0; sl < SlIndexCount; ++sl) {
+            bool hasSecondLevel = (_slBitmap[fl] & (1u << sl)) != 0;
+            if (hasSecondLevel != (_blocks[fl][sl] != &_nullBlock)) {
+                return false;
+            }
+
+            for (Block* block = _blocks[fl][sl]; block != &_nullBlock; block = block->nextFree) {
+                size_t blockFl, blockSl;
+                _mapInsert(_getBlockSize(block), &blockFl, &blockSl);
+                if (!_isBlockFree(block) || blockFl != fl || blockSl != sl) {
+                    return false;
+                }
+                numListedBlocks++;
+            }
+        }
+    }
+
+    return numListedBlocks == numFreeBlocks;
+}
+
+TlsfAllocator::Stats TlsfAllocator::getStats() const
+{
+    Stats stats;
+    stats.allocatedBytes = 0;
+    stats.freeBytes = 0;
+    stats.allocatedBlocks = 0;
+    stats.freeBlocks = 0;
+    stats.numPools = 0;
+
+    for (Pool* pool = _pools; pool; pool = pool->next) {
+        stats.numPools++;
+        for (Block* block = _getPoolFirstBlock(pool); !_isBlockLast(block); block = _getNextBlock(block)) {
+            if (_isBlockFree(block)) {
+                stats.freeBytes += _getBlockSize(block);
+                stats.freeBlocks++;
+            } else {
+                stats.allocatedBytes += _getBlockSize(block);
+                stats.allocatedBlocks++;
+            }
+        }
+    }
+
+    return stats;
+}
+
+void TlsfAllocator::_mapInsert(size_t numBytes, size_t* fl, size_t* sl) const
+{
+    if (numBytes < SmallBlockSize) {
+        // Small blocks are linearly split over the first level
+        *fl = 0;
+        *sl = numBytes/(SmallBlockSize/SlIndexCount);
+    } else {
+        size_t bit = util::findLastSet(numBytes) - 1;
+        *sl = (numBytes >> (bit - SlIndexCountLog2)) ^ SlIndexCount;
+        *fl = bit - (FlIndexShift - 1);
+    }
+}
+
+void TlsfAllocator::_mapSearch(size_t numBytes, size_t* fl, size_t* sl) const
+{
+    if (numBytes >= SmallBlockSize) {
+        size_t bit = util::findLastSet(numBytes) - 1;
+        numBytes += (static_cast<size_t>(1) << (bit - SlIndexCountLog2)) - 1;
+    }
+    _mapInsert(numBytes, fl, sl);
+}
+
+TlsfAllocator::Block* TlsfAllocator::_findSuitableBlock(size_t* fl, size_t* sl) const
+{
+    // Anything in a larger class of the same range fits, otherwise the smallest class of
+    // the next non-empty range does
+    uint32_t slMap = _slBitmap[*fl] & (~0u << *sl);
+    if (!slMap) {
+        uint32_t flMap = *fl + 1 < FlIndexCount ? _flBitmap & (~0u << (*fl + 1)) : 0;
+        if (!flMap) {
+            return nullptr;
+        }
+
+        *fl = util::findFirstSet(flMap) - 1;
+        slMap = _slBitmap[*fl];
+        assert(slMap && "First level bitmap out of sync");
+    }
+
+    *sl = util::findFirstSet(slMap) - 1;
+    return _blocks[*fl][*sl];
+}
+
+TlsfAllocator::Block* TlsfAllocator::_locateFreeBlock(size_t numBytes)
+{
+    size_t fl, sl;
+    _mapSearch(numBytes, &fl, &sl);
+
+    // Rounding up the largest requests can go past the last range
+    if (fl >= FlIndexCount) {
+        return nullptr;
+    }
+
+    Block* block = _findSuitableBlock(&fl, &sl);
+    if (!block) {
+        return nullptr;
+    }
+
+    assert(_getBlockSize(block) >= numBytes);
+    _removeFreeBlock(block, fl, sl);
+    return block;
+}
+
+void TlsfAllocator::_insertFreeBlock(Block* block, size_t fl, size_t sl)
+{
+    Block* current = _blocks[fl][sl];
+    block->nextFree = current;
+    block->prevFree = &_nullBlock;
+    current->prevFree = block;
+
+    _blocks[fl][sl] = block;
+    _flBitmap |= 1u << fl;
+    _slBitmap[fl] |= 1u << sl;
+}
+
+void TlsfAllocator::_removeFreeBlock(Block* block, size_t fl, size_t sl)
+{
+    Block* prev = block->prevFree;
+    Block* next = block->nextFree;
+    next->prevFree = prev;
+    prev->nextFree = next;
+
+    if (_blocks[fl][sl] == block) {
+        _blocks[fl][sl] = next;
+        if (next == &_nullBlock) {
+            _slBitmap[fl] &= ~(1u << sl);
+            if (!_slBitmap[fl]) {
+                _flBitmap &= ~(1u << fl);
+            }
+        }
+    }
+}
+
+void TlsfAllocator::_insertBlock(Block* block)
+{
+    size_t fl, sl;
+    _mapInsert(_getBlockSize(block), &fl, &sl);
+    _insertFreeBlock(block, fl, sl);
+}
+
+void TlsfAllocator::_removeBlock(Block* block)
+{
+    size_t fl, sl;
+    _mapInsert(_getBlockSize(block), &fl, &sl);
+    _removeFreeBlock(block, fl, sl);
+}
+
+TlsfAllocator::Block* TlsfAllocator::_splitBlock(Block* block, size_t numBytes)
+{
+    size_t size = _getBlockSize(block);
+    if (size < numBytes + sizeof(Block)) {
+        return nullptr;
+    }
+
+    Block* remaining = (Block*)((char*)_getBlockData(block) + numBytes - BlockOverhead);
+    remaining->size = size - (numBytes + BlockOverhead);
+    _setBlockSize(block, numBytes);
+
+    _markBlockFree(remaining);
+    return remaining;
+}
+
+TlsfAllocator::Block* TlsfAllocator::_splitBlockHead(Block* block, size_t gap)
+{
+    Block* remaining = _splitBlock(block, gap - BlockOverhead);
+    assert(remaining && "Gap too small to be a block");
+
+    _setPrevBlockFree(remaining, true);
+    _linkNextBlock(block);
+    _insertBlock(block);
+    return remaining;
+}
+
+TlsfAllocator::Block* TlsfAllocator::_mergePrevBlock(Block* block)
+{
+    if (_isPrevBlockFree(block)) {
+        Block* prev = block->prevPhysical;
+        assert(prev && _isBlockFree(prev) && "Previous block should be free");
+
+        _removeBlock(prev);
+        _absorbBlock(prev, block);
+        block = prev;
+    }
+    return block;
+}
+
+TlsfAllocator::Block* TlsfAllocator::_mergeNextBlock(Block* block)
+{
+    Block* next = _getNextBlock(block);
+    if (_isBlockFree(next)) {
+        assert(!_isBlockLast(next));
+        _removeBlock(next);
+        _absorbBlock(block, next);
+    }
+    return block;
+}
+
+void TlsfAllocator::_absorbBlock(Block* block, Block* next)
+{
+    _setBlockSize(block, _getBlockSize(block) + _getBlockSize(next) + BlockOverhead);
+    _linkNextBlock(block);
+}
+
+void TlsfAllocator::_trimFreeBlock(Block* block, size_t numBytes)
+{
+    Block* remaining = _splitBlock(block, numBytes);
+    if (remaining) {
+        _linkNextBlock(block);
+        _setPrevBlockFree(remaining, true);
+        _insertBlock(remaining);
+    }
+}
+
+void TlsfAllocator::_trimUsedBlock(Block* block, size_t numBytes)
+{
+    Block* remaining = _splitBlock(block, numBytes);
+    if (remaining) {
+        _setPrevBlockFree(remaining, false);
+        remaining = _mergeNextBlock(remaining);
+        _insertBlock(remaining);
+    }
+}
+
+void* TlsfAllocator::_prepareUsedBlock(Block* block, size_t numBytes)
+{
+    _trimFreeBlock(block, numBytes);
+    _markBlockUsed(block);
+    return _getBlockData(block);
+}
+
+bool TlsfAllocator::_growPool(size_t numBytes)
+{
+    if (_growSize == 0) {
+        return false;
+    }
+
+    // The block added has to be in a list _locateFreeBlock() searches
+    size_t roundedBytes = numBytes;
+    if (numBytes >= SmallBlockSize) {
+        size_t bit = util::findLastSet(numBytes) - 1;
+        roundedBytes += static_cast<size_t>(1) << (bit - SlIndexCountLog2);
+    }
+
+    return _addPagePool(std::max(_growSize, roundedBytes + PoolOverhead));
+}
+
+bool TlsfAllocator::_addPagePool(size_t numBytes)
+{
+    void* mem = _pageAllocator.allocate(numBytes, AlignSize);
+    if (!mem) {
+        return false;
+    }
+
+    // The PageAllocator rounds up to whole pages, all of which can be used
+    addPool(mem, _pageAllocator.getAllocationSize(mem));
+    return true;
+}
+
+void TlsfAllocator::_initLists()
+{
+    static_assert(SlIndexCount <= sizeof(_slBitmap[0])*CHAR_BIT, "Second level doesn't fit its bitmap");
+    static_assert(FlIndexCount <= sizeof(_flBitmap)*CHAR_BIT, "First level doesn't fit its bitmap");
+
+    _nullBlock.prevPhysical = nullptr;
+    _nullBlock.size = 0;
+    _nullBlock.nextFree = &_nullBlock;
+    _nullBlock.prevFree = &_nullBlock;
+
+    for (size_t fl = 0; fl < FlIndexCount; ++fl) {
+        _slBitmap[fl] = 0;
+        for (size_t sl = 0; sl < SlIndexCount; ++sl) {
+            _blocks[fl][sl] = &_nullBlock;
+        }
+    }
+}
+
+size_t TlsfAllocator::_adjustRequestSize(size_t numBytes) const
+{
+    return std::max(mem::align(numBytes, AlignSize), MinBlockSize);
+}
+
+void TlsfAllocator::_setBlockFree(Block* block, bool isFree)
+{
+    block->size = isFree ? block->size | BlockFreeBit : block->size & ~BlockFreeBit;
+}
+
+void TlsfAllocator::_setPrevBlockFree(Block* block, bool isFree)
+{
+    block->size = isFree ? block->size | BlockPrevFreeBit : block->size & ~BlockPrevFreeBit;
+}
+
+TlsfAllocator::Block* TlsfAllocator::_getDataBlock(const void* data)
+{
+    // Allocations can start a few bytes into the block's data to meet an offset
+    uintptr_t blockData = (uintptr_t)data & ~(AlignSize - 1);
+    return (Block*)(blockData - BlockDataOffset);
+}
+
+TlsfAllocator::Block* TlsfAllocator::_getNextBlock(const Block* block)
+{
+    assert(!_isBlockLast(block));
+    return (Block*)((char*)_getBlockData(block) + _getBlockSize(block) - BlockOverhead);
+}
+
+TlsfAllocator::Block* TlsfAllocator::_linkNextBlock(Block* block)
+{
+    Block* next = _getNextBlock(block);
+    next->prevPhysical = block;
+    return next;
+}
+
+void TlsfAllocator::_markBlockFree(Block* block)
+{
+    Block* next = _linkNextBlock(block);
+    _setPrevBlockFree(next, true);
+    _setBlockFree(block, true);
+}
+
+void TlsfAllocator::_markBlockUsed(Block* block)
+{
+    Block* next = _getNextBlock(block);
+    _setPrevBlockFree(next, false);
+    _setBlockFree(block, false);
+}
+
+TlsfAllocator::Block* TlsfAllocator::_getPoolFirstBlock(const Pool* pool)
+{
+    return (Block*)((char*)pool + sizeof(Pool));
+}
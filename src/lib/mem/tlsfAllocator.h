@@ -0,0 +1,225 @@
+#ifndef MEM_TLSFALLOCATOR_H
+#define MEM_TLSFALLOCATOR_H
+
+#include <cassert>
+#include <climits>
+#include <cstdint>
+
+#include "util/units.h"
+#include "mem/alignment.h"
+#include "mem/allocator.h"
+#include "mem/pageAllocator.h"
+
+namespace mem {
+
+/**
+ * Two-Level Segregated Fit allocator, allocations and releases take a bounded number of
+ * steps no matter the state of the heap.
+ *
+ * Free blocks are kept in segregated lists indexed by two levels: the first level is the
+ * power of two range of the size and the second level splits each range into 32 linear
+ * classes. A bitmap per level records which lists are non-empty, so finding a free block
+ * at least as large as a request is two find-first-set operations. Requests are rounded
+ * up to the next class so any block in the list found fits without searching it.
+ * Released blocks are coalesced with their free neighbours using boundary tags.
+ *
+ * Memory is managed in pools. The allocator starts with a pool of initialPoolSize bytes
+ * and, if growSize isn't 0, adds pools of at least growSize bytes from a PageAllocator
+ * when it runs out. Adding a pool maps memory from the OS so it doesn't have the O(1)
+ * bound, latency-critical users should size the initial pool for their peak usage and
+ * disable growth, or give the allocator an area. Pools are held until the allocator is
+ * destroyed.
+ *
+ * Every block is aligned to 8 bytes. Stricter alignments are carved out of a larger free
+ * block with the slack in front of it returned to the lists.
+ *
+ * The allocator does no locking of its own.
+ *
+ * Implemented AllocatorPolicy.
+ */
+class TlsfAllocator : public mem::Allocator
+{
+public:
+    struct Stats
+    {
+        size_t allocatedBytes;
+        size_t freeBytes;
+        size_t allocatedBlocks;
+        size_t freeBlocks;
+        size_t numPools;
+    };
+
+public:
+    TlsfAllocator(
+            size_t initialPoolSize = util::kilobytes(64),
+            size_t growSize = util::kilobytes(64),
+            util::PageBacking pageBacking = util::RegularPages);
+
+    /**
+     * Manages the memory of an area as a single pool which never grows.
+     */
+    TlsfAllocator(void* start, void* end);
+    ~TlsfAllocator();
+
+    virtual void* allocate(size_t size, size_t alignment = DefaultAlignment, size_t offset = 0) override;
+    virtual void release(void* addr) override;
+    virtual size_t getAllocationSize(void* addr) const override;
+
+    /**
+     * Grows into a free block following the allocation, or gives the end of it back.
+     */
+    virtual bool tryExpandInPlace(void* addr, size_t size) override;
+    virtual void shrinkInPlace(void* addr, size_t size) override;
+
+    /**
+     * Hands memory owned by the caller to the allocator, it must stay valid for the
+     * lifetime of the allocator. This is how a pool with no OS involvement is set up,
+     * e.g. in a static buffer.
+     */
+    void addPool(void* mem, size_t numBytes);
+
+    /**
+     * Walks every block of every pool and validates the free lists against the bitmaps.
+     * This is a slow operation and only meant for debugging.
+     */
+    bool check() const;
+
+    /**
+     * Walks every block of every pool, don't call in a time-critical section.
+     */
+    Stats getStats() const;
+
+    // Larger requests fail, requests are rounded up so they need headroom below the
+    // largest block size
+    static const size_t MaxAllocationSize = static_cast<size_t>(1) << 31;
+
+protected:
+    struct Block
+    {
+        // Only valid if the previous block is free, it lives in the last word of the
+        // previous block's data
+        Block* prevPhysical;
+
+        // Size of the data, the low bits hold flags
+        size_t size;
+
+        // Only valid if this block is free
+        Block* nextFree;
+        Block* prevFree;
+    };
+
+    // The pool ends in a zero sized allocated block so the last real block never merges
+    // past the end of the pool
+    struct Pool
+    {
+        Pool* next;
+        size_t numBytes;
+    };
+
+    static const size_t AlignSizeLog2 = 3;
+    static const size_t AlignSize = static_cast<size_t>(1) << AlignSizeLog2;
+
+    static const size_t SlIndexCountLog2 = 5;
+    static const size_t SlIndexCount = static_cast<size_t>(1) << SlIndexCountLog2;
+    static const size_t FlIndexMax = 32;
+    static const size_t FlIndexShift = SlIndexCountLog2 + AlignSizeLog2;
+    static const size_t FlIndexCount = FlIndexMax - FlIndexShift + 1;
+    static const size_t SmallBlockSize = static_cast<size_t>(1) << FlIndexShift;
+
+    static const size_t BlockFreeBit = 1;
+    static const size_t BlockPrevFreeBit = 2;
+    static const size_t BlockSizeMask = ~(BlockFreeBit|BlockPrevFreeBit);
+
+    // Only the size word is overhead on an allocated block, the previous block link
+    // belongs to the block before it
+    static const size_t BlockOverhead = sizeof(size_t);
+    static const size_t BlockDataOffset = 2*sizeof(size_t);
+    static const size_t MinBlockSize = sizeof(Block) - sizeof(Block*);
+    static const size_t MaxBlockSize = static_cast<size_t>(1) << FlIndexMax;
+
+    // Bytes taken from a pool for its header, the unused link of its first block and the
+    // block ending it
+    static const size_t PoolOverhead = sizeof(Pool) + BlockDataOffset + BlockOverhead;
+
+    // Fit a block of numBytes to a free list, _mapSearch() rounds up so every block in
+    // the list it returns is large enough
+    void _mapInsert(size_t numBytes, size_t* fl, size_t* sl) const;
+    void _mapSearch(size_t numBytes, size_t* fl, size_t* sl) const;
+
+    // Returns nullptr if no list at or above fl/sl has a block, fl/sl are set to the
+    // list found
+    Block* _findSuitableBlock(size_t* fl, size_t* sl) const;
+    Block* _locateFreeBlock(size_t numBytes);
+
+    void _insertFreeBlock(Block* block, size_t fl, size_t sl);
+    void _removeFreeBlock(Block* block, size_t fl, size_t sl);
+    void _insertBlock(Block* block);
+    void _removeBlock(Block* block);
+
+    // Splits the tail past numBytes off block if it's large enough to be a block and
+    // returns it, nullptr otherwise
+    Block* _splitBlock(Block* block, size_t numBytes);
+
+    // Splits gap bytes off the front of a free block and links them, returns the rest
+    Block* _splitBlockHead(Block* block, size_t gap);
+
+    // Merge a free block with its free neighbours, which are unlinked
+    Block* _mergePrevBlock(Block* block);
+    Block* _mergeNextBlock(Block* block);
+    void _absorbBlock(Block* block, Block* next);
+
+    // Give the part of a block past numBytes back to the free lists
+    void _trimFreeBlock(Block* block, size_t numBytes);
+    void _trimUsedBlock(Block* block, size_t numBytes);
+
+    void* _prepareUsedBlock(Block* block, size_t numBytes);
+
+    // Adds a pool from the PageAllocator large enough to hold a block of numBytes
+    bool _growPool(size_t numBytes);
+    bool _addPagePool(size_t numBytes);
+
+    void _initLists();
+
+    size_t _adjustRequestSize(size_t numBytes) const;
+
+    static size_t _getBlockSize(const Block* block) { return block->size & BlockSizeMask; }
+    static void _setBlockSize(Block* block, size_t size) { block->size = size | (block->size & ~BlockSizeMask); }
+    static bool _isBlockLast(const Block* block) { return _getBlockSize(block) == 0; }
+    static bool _isBlockFree(const Block* block) { return (block->size & BlockFreeBit) != 0; }
+    static bool _isPrevBlockFree(const Block* block) { return (block->size & BlockPrevFreeBit) != 0; }
+    static void _setBlockFree(Block* block, bool isFree);
+    static void _setPrevBlockFree(Block* block, bool isFree);
+
+    static Block* _getDataBlock(const void* data);
+    static void* _getBlockData(const Block* block) { return (char*)block + BlockDataOffset; }
+    static Block* _getNextBlock(const Block* block);
+
+    // Sets the next block's link back to block and returns it
+    static Block* _linkNextBlock(Block* block);
+
+    // Marks the block free or used and updates the prev-free flag of the next block
+    static void _markBlockFree(Block* block);
+    static void _markBlockUsed(Block* block);
+
+    static Block* _getPoolFirstBlock(const Pool* pool);
+
+private:
+    TlsfAllocator(const TlsfAllocator&);
+    TlsfAllocator& operator=(const TlsfAllocator&);
+
+    // Terminates every free list, an empty list points at it instead of nullptr so
+    // unlinking never needs a branch
+    Block _nullBlock;
+
+    uint32_t _flBitmap;
+    uint32_t _slBitmap[FlIndexCount];
+    Block* _blocks[FlIndexCount][SlIndexCount];
+
+    Pool* _pools;
+    PageAllocator _pageAllocator;
+    const size_t _growSize;
+};
+
+} // namespace mem
+
+#endif
@@ -30,6 +30,7 @@ class NoTracking
 {
 public:
     inline void onAllocation(void* mem, size_t size, size_t alignment, SourceInfo sourceInfo) const { }
+    inline void onReallocation(void* oldMem, void* newMem, size_t size) const { }
     inline void onRelease(void* mem) const { }
 };
 
@@ -46,6 +47,11 @@ public:
         _count++;
     }
 
+    inline void onReallocation(void* oldMem, void* newMem, size_t size)
+    {
+        // Still the same allocation as far as counting goes
+    }
+
     inline void onRelease(void* mem)
     {
         assert(_count > 0 && "More release calls than allocations.");
@@ -65,7 +71,8 @@ class SourceTracking
 {
 public:
     SourceTracking() :
-        _allocList(nullptr)
+        _allocList(nullptr),
+        _cursor(nullptr)
     {
     }
 
@@ -103,11 +110,29 @@ public:
         entry->prev = ptr; 
     }
 
+    void onReallocation(void* oldMem, void* newMem, size_t size)
+    {
+        // Keeps where the allocation was originally made
+        TrackingInfo* ptr = _allocList; 
+        while (ptr) {
+            if (ptr->mem == oldMem) {
+                ptr->mem = newMem;
+                ptr->size = size;
+                return;
+            }
+            ptr = ptr->next;
+        }
+        assert(false && "onReallocation called before onAllocation");
+    }
+
     void onRelease(void* mem)
     {
         TrackingInfo* ptr = _allocList; 
         while (ptr) {
             if (ptr->mem == mem) {
+                if (ptr == _cursor) {
+                    _cursor = ptr->next;
+                }
                 if (ptr->prev) {
                     ptr->prev->next = ptr->next;
                 }
@@ -133,17 +158,42 @@ public:
         return _allocList;
     }
 
+    /**
+     * Walks the allocations a few at a time, carrying on across calls. Stores up to
+     * maxCount allocations following those returned by the last call in out and returns
+     * how many. isEnd is set once the last allocation has been returned, the next call
+     * starts over from the first.
+     */
+    size_t getNextAllocations(TrackingInfo** out, size_t maxCount, bool* isEnd)
+    {
+        TrackingInfo* ptr = _cursor ? _cursor : _allocList;
+        size_t count = 0;
+        while (ptr && count < maxCount) {
+            out[count++] = ptr;
+            ptr = ptr->next;
+        }
+        _cursor = ptr;
+
+        assert(isEnd);
+        *isEnd = !ptr;
+        return count;
+    }
+
 private: 
     // TODO: Replace with a global 'overhead' allocator
     mem::MallocAllocator _allocator;
     TrackingInfo* _allocList;
+
+    // Next allocation for getNextAllocations(), null to start from the first
+    TrackingInfo* _cursor;
 };
 
 class CallStackTracking
 {
 public:
     CallStackTracking() :
-        _allocList(nullptr)
+        _allocList(nullptr),
+        _cursor(nullptr)
     {
     }
 
@@ -196,11 +246,29 @@ public:
         entry->prev = ptr; 
     }
 
+    void onReallocation(void* oldMem, void* newMem, size_t size)
+    {
+        // Keeps where the allocation was originally made
+        TrackingInfo* ptr = _allocList; 
+        while (ptr) {
+            if (ptr->mem == oldMem) {
+                ptr->mem = newMem;
+                ptr->size = size;
+                return;
+            }
+            ptr = ptr->next;
+        }
+        assert(false && "onReallocation called before onAllocation");
+    }
+
     void onRelease(void* mem)
     {
         TrackingInfo* ptr = _allocList; 
         while (ptr) {
             if (ptr->mem == mem) {
+                if (ptr == _cursor) {
+                    _cursor = ptr->next;
+                }
                 if (ptr->prev) {
                     ptr->prev->next = ptr->next;
                 }
@@ -231,10 +299,34 @@ public:
         return _allocList;
     }
 
+    /**
+     * Walks the allocations a few at a time, carrying on across calls. Stores up to
+     * maxCount allocations following those returned by the last call in out and returns
+     * how many. isEnd is set once the last allocation has been returned, the next call
+     * starts over from the first.
+     */
+    size_t getNextAllocations(TrackingInfo** out, size_t maxCount, bool* isEnd)
+    {
+        TrackingInfo* ptr = _cursor ? _cursor : _allocList;
+        size_t count = 0;
+        while (ptr && count < maxCount) {
+            out[count++] = ptr;
+            ptr = ptr->next;
+        }
+        _cursor = ptr;
+
+        assert(isEnd);
+        *isEnd = !ptr;
+        return count;
+    }
+
 private:
     // TODO: Replace with a global 'overhead' allocator
     mem::MallocAllocator _allocator;
     TrackingInfo* _allocList;
+
+    // Next allocation for getNextAllocations(), null to start from the first
+    TrackingInfo* _cursor;
 };
 
 } // namespace mem
@@ -1,6 +1,10 @@
 #ifndef MEM_UTIL_H
 #define MEM_UTIL_H
 
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
 #include "util/math.h"
 
 namespace mem {
@@ -25,6 +29,26 @@ inline size_t align(size_t n, size_t alignment)
            ((n - 1)%alignment);
 }
 
+/**
+ * The linear allocators keep the size of each allocation in a header right in front of it.
+ * Allocations are only aligned as far as the caller asks, so the header is copied rather
+ * than dereferenced.
+ */
+const size_t SizeHeaderSize = sizeof(uint32_t);
+
+inline void setSizeHeader(void* addr, size_t size)
+{
+    uint32_t header = static_cast<uint32_t>(size);
+    memcpy((char*)addr - SizeHeaderSize, &header, SizeHeaderSize);
+}
+
+inline size_t getSizeHeader(const void* addr)
+{
+    uint32_t header;
+    memcpy(&header, (const char*)addr - SizeHeaderSize, SizeHeaderSize);
+    return header;
+}
+
 } // namespace mem
 
 #endif
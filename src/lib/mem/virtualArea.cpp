@@ -0,0 +1,75 @@
+#include "mem/virtualArea.h"
+using namespace mem;
+
+#include <sys/mman.h>
+
+#include "mem/util.h"
+#include "util/unused.h"
+
+VirtualArea::VirtualArea(size_t reserveSize, util::PageBacking pageBacking) :
+    _pageBacking(pageBacking),
+    _pageSize(util::getPageSize(pageBacking)),
+    _committedSize(0)
+{
+    _reservedSize = mem::align(reserveSize, _pageSize);
+
+    // mmap only guarantees alignment to the regular page size, reserve an extra huge page
+    // to align the start to
+    _mappingSize = _reservedSize + (_pageSize > util::getPageSize() ? _pageSize : 0);
+    _mapping = (char*)mmap(0, _mappingSize, PROT_NONE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    assert(_mapping != MAP_FAILED);
+    _start = (char*)mem::align(_mapping, _pageSize);
+
+#ifdef MADV_HUGEPAGE
+    if (pageBacking != util::RegularPages) {
+        // Only a hint, nothing to do if THP is disabled
+        madvise(_start, _reservedSize, MADV_HUGEPAGE);
+    }
+#endif
+}
+
+VirtualArea::~VirtualArea()
+{
+    int err = munmap(_mapping, _mappingSize);
+    assert(err == 0);
+    UNUSED(err);
+}
+
+bool VirtualArea::commit(size_t numBytes)
+{
+    if (numBytes > _reservedSize) {
+        return false;
+    }
+    if (numBytes <= _committedSize) {
+        return true;
+    }
+
+    size_t committedSize = mem::align(numBytes, _pageSize);
+    int err = mprotect(_start + _committedSize, committedSize - _committedSize, PROT_READ | PROT_WRITE);
+    if (err != 0) {
+        return false;
+    }
+
+    _committedSize = committedSize;
+    return true;
+}
+
+void VirtualArea::decommit(size_t numBytes)
+{
+    size_t committedSize = mem::align(numBytes, _pageSize);
+    if (committedSize >= _committedSize) {
+        return;
+    }
+
+    // Dropping the pages first releases them, making them inaccessible catches anything
+    // still using them
+    char* start = _start + committedSize;
+    size_t size = _committedSize - committedSize;
+    int err = madvise(start, size, MADV_DONTNEED);
+    assert(err == 0);
+    err = mprotect(start, size, PROT_NONE);
+    assert(err == 0);
+    UNUSED(err);
+
+    _committedSize = committedSize;
+}
@@ -0,0 +1,75 @@
+#ifndef MEM_VIRTUALAREA_H
+#define MEM_VIRTUALAREA_H
+
+#include <cassert>
+#include <cstddef>
+
+#include "util/memory.h"
+
+namespace mem {
+
+/**
+ * Reserves a contiguous range of address space and backs it with memory on demand.
+ *
+ * The whole range is mapped inaccessible up front, which costs no memory. commit() makes
+ * pages from the start of the range usable as far as asked for and decommit() hands the
+ * pages beyond a point back to the OS and makes them inaccessible again. The committed part
+ * always starts at the start of the range, so an allocator growing into it stays
+ * contiguous.
+ *
+ * Commits are rounded to the page size of the backing. With huge page backing the range is
+ * aligned to the huge page size and the kernel is asked to back it with transparent huge
+ * pages, explicit huge pages can't be reserved without being allocated so they are treated
+ * the same way.
+ *
+ * As an AreaPolicy start() and end() describe the committed part, so an allocator built on
+ * them with Region gets a fixed size. LinearAllocator and HeapAllocator take the area
+ * itself to grow into it.
+ */
+class VirtualArea
+{
+public:
+    explicit VirtualArea(size_t reserveSize, util::PageBacking pageBacking = util::RegularPages);
+    ~VirtualArea();
+
+    void* start() const { return _start; }
+    void* end() const { return _start + _committedSize; }
+
+    /**
+     * Makes at least the first numBytes of the range usable. Returns false if that's more
+     * than was reserved.
+     */
+    bool commit(size_t numBytes);
+
+    /**
+     * Releases the pages after the first numBytes, rounded up to the page size.
+     */
+    void decommit(size_t numBytes);
+
+    bool contains(const void* addr) const
+    {
+        return (const char*)addr >= _start && (const char*)addr < _start + _reservedSize;
+    }
+
+    size_t getReservedSize() const { return _reservedSize; }
+    size_t getCommittedSize() const { return _committedSize; }
+    size_t getPageSize() const { return _pageSize; }
+    util::PageBacking getPageBacking() const { return _pageBacking; }
+
+private:
+    VirtualArea(const VirtualArea&);
+    VirtualArea& operator=(const VirtualArea&);
+
+    char* _mapping;
+    size_t _mappingSize;
+
+    char* _start;
+    const util::PageBacking _pageBacking;
+    const size_t _pageSize;
+    size_t _reservedSize;
+    size_t _committedSize;
+};
+
+} // namespace mem
+
+#endif
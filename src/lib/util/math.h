@@ -15,12 +15,27 @@ inline constexpr bool isPowerOfTwo(int i)
     return (i > 0) && ((i & (i - 1)) == 0);
 }
 
+inline constexpr bool isPowerOfTwo(size_t i)
+{
+    return (i > 0) && ((i & (i - 1)) == 0);
+}
+
 inline size_t nextPowerOfTwoMultiple(size_t i, size_t multiple)
 {
     assert(util::isPowerOfTwo(multiple));
     return (i + multiple - 1) & ~(multiple- 1); 
 }
 
+// Smallest power of two which is at least i.
+inline size_t nextPowerOfTwo(size_t i)
+{
+    size_t power = 1;
+    while (power < i) {
+        power <<= 1;
+    }
+    return power;
+}
+
 bool feq(double a, double b);
 bool feq(double a, double b, double epsilon);
 bool fez(double a, double epsilon = Epsilon);
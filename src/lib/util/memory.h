@@ -2,6 +2,7 @@
 #define UTIL_MEMORY_H
 
 #include <cassert>
+#include <cstdint>
 #include <sys/mman.h>
 #include <unistd.h>
 
@@ -12,6 +13,30 @@ inline size_t getPageSize()
     return getpagesize();
 }
 
+/**
+ * Size of the huge pages used by hugePageAllocate(). 2 MiB is the smallest huge page size on
+ * x86-64 and on arm64 with 4 KiB base pages.
+ */
+inline size_t getHugePageSize()
+{
+    return 2*1024*1024;
+}
+
+/**
+ * How memory returned from the OS is backed.
+ *
+ * TransparentHugePages asks the kernel to back the memory with huge pages when it can
+ * (madvise(MADV_HUGEPAGE)). ExplicitHugePages allocates from the reserved huge page pool
+ * (MAP_HUGETLB) and falls back to TransparentHugePages when the pool is empty or
+ * unavailable. Either ends up as RegularPages on platforms without support.
+ */
+enum PageBacking
+{
+    RegularPages,
+    TransparentHugePages,
+    ExplicitHugePages
+};
+
 /**
  * Allocates one or more pages totalling the given size from the OS.
  *
@@ -26,6 +51,70 @@ inline void* pageAllocate(size_t size)
     return mem;
 }
 
+/**
+ * Allocates memory aligned to and a multiple of getHugePageSize() and attempts to back it with
+ * huge pages as requested by backing. Falls back to regular pages if huge pages are unavailable.
+ *
+ * _size_ must be a multiple of getHugePageSize(). The result of this call should be deallocated
+ * by calling the pageRelease function.
+ */
+inline void* hugePageAllocate(size_t size, PageBacking backing = TransparentHugePages)
+{
+    size_t hugePageSize = getHugePageSize();
+    assert(size > 0 && size%hugePageSize == 0);
+
+#ifdef MAP_HUGETLB
+    if (backing == ExplicitHugePages) {
+        void* mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            return mem;
+        }
+    }
+#endif
+
+    // mmap only guarantees page alignment. Over-allocate by a huge page and unmap whatever
+    // falls outside of the aligned range.
+    char* rawMem = (char*)mmap(0, size + hugePageSize, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    assert(rawMem != MAP_FAILED);
+
+    char* mem = (char*)(((uintptr_t)rawMem + hugePageSize - 1) & ~(uintptr_t)(hugePageSize - 1));
+    if (mem != rawMem) {
+        munmap(rawMem, mem - rawMem);
+    }
+    if (mem + size != rawMem + size + hugePageSize) {
+        munmap(mem + size, rawMem + hugePageSize - mem);
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (backing != RegularPages) {
+        // Only a hint, nothing to do if THP is disabled
+        madvise(mem, size, MADV_HUGEPAGE);
+    }
+#endif
+
+    return mem;
+}
+
+/**
+ * Allocates memory with the given backing, see hugePageAllocate(). RegularPages is the same as
+ * pageAllocate().
+ */
+inline void* pageAllocate(size_t size, PageBacking backing)
+{
+    if (backing == RegularPages) {
+        return pageAllocate(size);
+    }
+    return hugePageAllocate(size, backing);
+}
+
+/**
+ * Size allocations with the given backing are rounded to.
+ */
+inline size_t getPageSize(PageBacking backing)
+{
+    return backing == RegularPages ? getPageSize() : getHugePageSize();
+}
+
 inline void pageRelease(void* mem, size_t size)
 {
     assert(mem);
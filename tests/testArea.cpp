@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <vector>
+
+#include "mem/area.h"
+#include "mem/atomicLinearAllocator.h"
+#include "mem/boundsChecking.h"
+#include "mem/buddyAllocator.h"
+#include "mem/doubleEndedLinearAllocator.h"
+#include "mem/heapAllocator.h"
+#include "mem/linearAllocator.h"
+#include "mem/marking.h"
+#include "mem/region.h"
+#include "mem/threading.h"
+#include "mem/tracking.h"
+
+typedef mem::Region<
+    mem::LinearAllocator,
+    mem::SingleThreaded,
+    mem::NoBoundsChecking,
+    mem::NoTracking,
+    mem::NoMarking>
+        LinearRegion;
+
+typedef mem::Region<
+    mem::HeapAllocator,
+    mem::SingleThreaded,
+    mem::BoundsChecking,
+    mem::NoTracking,
+    mem::Marking>
+        HeapCheckedRegion;
+
+TEST(Area, StackArea)
+{
+    mem::StackArea<1000> area;
+    EXPECT_EQ(1000, (char*)area.end() - (char*)area.start());
+    EXPECT_EQ(0, (size_t)area.start()%alignof(std::max_align_t));
+
+    mem::StackArea<100, 64> alignedArea;
+    EXPECT_EQ(0, (size_t)alignedArea.start()%64);
+
+    LinearRegion region(area);
+    char* x = (char*)region.allocate(100, mem::DefaultAlignment, mem::SourceInfo());
+    EXPECT_TRUE(x >= area.start() && x + 100 <= area.end());
+    EXPECT_TRUE(region.allocate(1000, mem::DefaultAlignment, mem::SourceInfo()) == nullptr);
+}
+
+TEST(Area, StaticArea)
+{
+    static char buffer[4096];
+    mem::StaticArea area(buffer, sizeof(buffer));
+    EXPECT_EQ(buffer, area.start());
+    EXPECT_EQ(buffer + sizeof(buffer), area.end());
+
+    mem::StaticArea rangeArea(buffer + 16, buffer + 32);
+    EXPECT_EQ(buffer + 16, rangeArea.start());
+    EXPECT_EQ(buffer + 32, rangeArea.end());
+
+    LinearRegion region(area);
+    char* x = (char*)region.allocate(100, mem::DefaultAlignment, mem::SourceInfo());
+    EXPECT_TRUE(x >= buffer && x + 100 <= buffer + sizeof(buffer));
+}
+
+TEST(Area, HeapArea)
+{
+    mem::HeapArea area(util::kilobytes(4), 64);
+    EXPECT_EQ(util::kilobytes(4), (char*)area.end() - (char*)area.start());
+    EXPECT_EQ(0, (size_t)area.start()%64);
+    memset(area.start(), 0xfe, util::kilobytes(4));
+
+    LinearRegion region(area);
+    EXPECT_TRUE(region.allocate(util::kilobytes(2), mem::DefaultAlignment, mem::SourceInfo()) != nullptr);
+}
+
+TEST(Area, PageArea)
+{
+    mem::PageArea area(1);
+    EXPECT_EQ(util::getPageSize(), area.getSize());
+    EXPECT_EQ(0, (size_t)area.start()%util::getPageSize());
+    EXPECT_FALSE(area.isLocked());
+
+    // Locking may not be allowed, the memory is usable either way
+    mem::PageArea lockedArea(util::kilobytes(64), mem::PageArea::Prefault | mem::PageArea::Lock);
+    EXPECT_EQ(util::kilobytes(64), lockedArea.getSize());
+    memset(lockedArea.start(), 0xfe, lockedArea.getSize());
+}
+
+TEST(Area, HeapAllocator)
+{
+    mem::StackArea<util::kilobytes(16)> area;
+    {
+        HeapCheckedRegion region(area);
+
+        // Allocates from the area until it is full and maps segments after that
+        std::vector<void*> allocs;
+        for (int i = 0; i < 10; ++i) {
+            void* addr = region.allocate(1000, mem::DefaultAlignment, mem::SourceInfo());
+            EXPECT_TRUE(addr >= area.start() && addr < area.end());
+            allocs.push_back(addr);
+        }
+
+        void* outside = nullptr;
+        for (int i = 0; i < 20 && !outside; ++i) {
+            void* addr = region.allocate(1000, mem::DefaultAlignment, mem::SourceInfo());
+            allocs.push_back(addr);
+            if (addr < area.start() || addr >= area.end()) {
+                outside = addr;
+            }
+        }
+        EXPECT_TRUE(outside != nullptr);
+
+        for (void* addr : allocs) {
+            region.release(addr);
+        }
+    }
+
+    mem::HeapAllocator allocator(area.start(), area.end());
+    allocator.enableSystemAllocation(false);
+    EXPECT_EQ(1, allocator.getStats().numRegularSegments);
+
+    void* x = allocator.allocate(util::kilobytes(8));
+    EXPECT_TRUE(x >= area.start() && x < area.end());
+    EXPECT_TRUE(allocator.check());
+
+    // The area is never handed back
+    allocator.release(x);
+    allocator.trim();
+    EXPECT_EQ(1, allocator.getStats().numRegularSegments);
+    EXPECT_EQ(0, allocator.getStats().releasedBytes);
+    void* y = allocator.allocate(util::kilobytes(10));
+    EXPECT_TRUE(y >= area.start() && y < area.end());
+    EXPECT_TRUE(allocator.check());
+}
+
+TEST(Area, OtherAllocators)
+{
+    mem::StackArea<util::kilobytes(4), 1024> area;
+
+    mem::DoubleEndedLinearAllocator doubleEnded(area.start(), area.end());
+    EXPECT_EQ(util::kilobytes(4), doubleEnded.getStats().freeBytes);
+
+    mem::AtomicLinearAllocator atomic(area.start(), area.end());
+    EXPECT_EQ(util::kilobytes(4), atomic.getStats().freeBytes);
+
+    mem::AlignedLinearAllocator<16> aligned(area.start(), area.end());
+    EXPECT_EQ(util::kilobytes(4), aligned.getStats().freeBytes);
+
+    // The range is rounded down to a power of two and only aligned as well as its start
+    mem::BuddyAllocator buddy((char*)area.start() + 256, area.end(), 256);
+    EXPECT_EQ(util::kilobytes(2), buddy.getSize());
+    EXPECT_TRUE(buddy.allocate(256, 256) != nullptr);
+    EXPECT_TRUE(buddy.allocate(256, 512) == nullptr);
+    char* x = (char*)buddy.allocate(util::kilobytes(1));
+    EXPECT_TRUE(x >= (char*)area.start() + 256 && x + util::kilobytes(1) <= area.end());
+    EXPECT_TRUE(buddy.check());
+}
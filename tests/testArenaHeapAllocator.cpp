@@ -0,0 +1,170 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "mem/arenaHeapAllocator.h"
+#include "mem/boundsChecking.h"
+#include "mem/marking.h"
+#include "mem/region.h"
+#include "mem/threading.h"
+#include "mem/tracking.h"
+
+typedef mem::Region<
+    mem::ArenaHeapAllocator,
+    mem::SingleThreaded,
+    mem::NoBoundsChecking,
+    mem::NoTracking,
+    mem::NoMarking>
+        ArenaHeapRegion;
+
+TEST(ArenaHeapAllocator, Basic)
+{
+    mem::ArenaHeapAllocator allocator;
+    EXPECT_EQ(1, allocator.getNumArenas());
+
+    void* x = allocator.allocate(100);
+    EXPECT_TRUE(x != nullptr);
+    EXPECT_LE(100, allocator.getAllocationSize(x));
+
+    void* y = allocator.allocate(util::megabytes(40));
+    EXPECT_TRUE(y != nullptr);
+    EXPECT_EQ(1, allocator.getStats().heap.numExternalSegments);
+
+    allocator.release(x);
+    allocator.release(y);
+
+    mem::ArenaHeapAllocator::Stats stats = allocator.getStats();
+    EXPECT_EQ(0, stats.heap.allocatedBlocks);
+    EXPECT_EQ(0, stats.heap.numExternalSegments);
+}
+
+TEST(ArenaHeapAllocator, ThreadAssignment)
+{
+    mem::ArenaHeapAllocator allocator(util::kilobytes(64), util::bytes(4), 4, 4);
+    EXPECT_EQ(4, allocator.getNumArenas());
+
+    // Consecutive threads are handed consecutive arenas
+    std::vector<size_t> arenaIndices(4);
+    for (size_t i = 0; i < arenaIndices.size(); ++i) {
+        std::thread t([&allocator, &arenaIndices, i]() {
+            arenaIndices[i] = allocator.getThreadArenaIndex();
+        });
+        t.join();
+    }
+
+    for (size_t i = 1; i < arenaIndices.size(); ++i) {
+        EXPECT_EQ((arenaIndices[i - 1] + 1)%4, arenaIndices[i]);
+    }
+}
+
+TEST(ArenaHeapAllocator, ReleaseFromOtherThread)
+{
+    mem::ArenaHeapAllocator allocator(util::kilobytes(64), util::bytes(4), 2, 2);
+
+    // Allocate on two threads which map to different arenas and release everything
+    // from this thread
+    std::vector<void*> allocs[2];
+    for (size_t i = 0; i < 2; ++i) {
+        std::thread t([&allocator, &allocs, i]() {
+            for (int j = 0; j < 100; ++j) {
+                allocs[i].push_back(allocator.allocate(16 + j*8));
+            }
+        });
+        t.join();
+    }
+
+    EXPECT_EQ(200, allocator.getStats().heap.allocatedBlocks);
+
+    for (size_t i = 0; i < 2; ++i) {
+        for (void* ptr: allocs[i]) {
+            allocator.release(ptr);
+        }
+    }
+
+    EXPECT_EQ(0, allocator.getStats().heap.allocatedBlocks);
+}
+
+TEST(ArenaHeapAllocator, Growth)
+{
+    mem::ArenaHeapAllocator allocator(util::kilobytes(64), util::bytes(4), 1, 4);
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 8; ++t) {
+        threads.push_back(std::thread([&allocator]() {
+            for (int i = 0; i < 20000; ++i) {
+                allocator.release(allocator.allocate(64));
+            }
+        }));
+    }
+
+    for (std::thread& t: threads) {
+        t.join();
+    }
+
+    // Arenas are only ever added because of contention and never past the maximum
+    mem::ArenaHeapAllocator::Stats stats = allocator.getStats();
+    EXPECT_LE(stats.numArenas, 4);
+    EXPECT_LE(stats.numArenas - 1, stats.contentions/16);
+    EXPECT_EQ(0, stats.heap.allocatedBlocks);
+}
+
+TEST(ArenaHeapAllocator, Batch)
+{
+    mem::ArenaHeapAllocator allocator(util::kilobytes(64), util::bytes(4), 2);
+
+    // Release a batch allocated from both arenas
+    const size_t NumBlocks = 200;
+    void* blocks[2*NumBlocks];
+    EXPECT_EQ(NumBlocks, allocator.allocateBatch(32, mem::DefaultAlignment, NumBlocks, blocks));
+
+    std::thread t([&allocator, &blocks, NumBlocks]() {
+        EXPECT_EQ(NumBlocks, allocator.allocateBatch(32, mem::DefaultAlignment, NumBlocks, blocks + NumBlocks));
+    });
+    t.join();
+
+    EXPECT_EQ(2*NumBlocks, allocator.getStats().heap.allocatedBlocks);
+    allocator.releaseBatch(blocks, 2*NumBlocks);
+    EXPECT_EQ(0, allocator.getStats().heap.allocatedBlocks);
+}
+
+TEST(ArenaHeapAllocator, RegionStress)
+{
+    ArenaHeapRegion region;
+
+    const size_t NumThreads = 8;
+    const size_t NumEvents = 20000;
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < NumThreads; ++t) {
+        threads.push_back(std::thread([&region, t]() {
+            std::vector<unsigned char*> allocs;
+            unsigned int seed = static_cast<unsigned int>(t);
+
+            for (size_t i = 0; i < NumEvents; ++i) {
+                if (allocs.empty() || rand_r(&seed)%10 < 6) {
+                    size_t numBytes = 1 + rand_r(&seed)%2000;
+                    unsigned char* x = (unsigned char*)region.allocate(numBytes, 4, mem::SourceInfo());
+                    ASSERT_TRUE(x != nullptr);
+
+                    // Tag the memory with the owning thread to catch blocks handed out twice
+                    x[0] = static_cast<unsigned char>(t);
+                    allocs.push_back(x);
+                } else {
+                    size_t releaseIndex = rand_r(&seed)%allocs.size();
+                    ASSERT_EQ(static_cast<unsigned char>(t), allocs[releaseIndex][0]);
+                    region.release(allocs[releaseIndex]);
+                    allocs.erase(allocs.begin() + releaseIndex);
+                }
+            }
+
+            for (unsigned char* ptr: allocs) {
+                region.release(ptr);
+            }
+        }));
+    }
+
+    for (std::thread& t: threads) {
+        t.join();
+    }
+}
@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "mem/atomicLinearAllocator.h"
+#include "mem/linearAllocator.h"
+
+#include "util/stopwatch.h"
+#include "util/units.h"
+
+TEST(AtomicLinearAllocator, Alloc)
+{
+    alignas(8) char mem[1024];
+    mem::AtomicLinearAllocator allocator(mem, 1024, 8);
+
+    char* s = (char*)allocator.allocate(3);
+    char* t = (char*)allocator.allocate(3);
+    EXPECT_EQ(mem + 8, s);
+    EXPECT_EQ(mem + 24, t);
+    EXPECT_EQ(3, allocator.getAllocationSize(t));
+    EXPECT_EQ(32, allocator.getStats().allocatedBytes);
+
+    // The offset is placed in front of the aligned address
+    char* u = (char*)allocator.allocate(3, 8, 4);
+    EXPECT_EQ(0, (size_t)(u + 4)%8);
+
+    // Stricter alignments take the compare-and-swap path
+    char* v = (char*)allocator.allocate(100, 64);
+    EXPECT_EQ(0, (size_t)v%64);
+    EXPECT_EQ(100, allocator.getAllocationSize(v));
+    char* w = (char*)allocator.allocate(3, 64, 4);
+    EXPECT_EQ(0, (size_t)(w + 4)%64);
+    EXPECT_LE(v + 100, w);
+
+    allocator.clear();
+    EXPECT_EQ(0, allocator.getStats().allocatedBytes);
+    EXPECT_EQ(mem + 8, allocator.allocate(3));
+}
+
+TEST(AtomicLinearAllocator, OutOfMemory)
+{
+    alignas(8) char mem[64];
+    mem::AtomicLinearAllocator allocator(mem, 64, 8);
+
+    EXPECT_TRUE(allocator.allocate(40) != nullptr);
+    EXPECT_EQ(nullptr, allocator.allocate(40));
+    EXPECT_EQ(nullptr, allocator.allocate(1, 32));
+    EXPECT_EQ(0, allocator.getStats().freeBytes);
+
+    allocator.clear();
+    EXPECT_TRUE(allocator.allocate(40) != nullptr);
+}
+
+TEST(AtomicLinearAllocator, ConcurrentFill)
+{
+    // Every thread fills its blocks with its own byte, overlapping blocks show up as
+    // blocks with bytes of another thread
+    const size_t NumThreads = 8;
+    const size_t NumAllocations = 2000;
+    std::vector<char> mem(util::megabytes(4));
+    mem::AtomicLinearAllocator allocator(mem.data(), mem.size(), 8);
+
+    std::vector<std::vector<char*>> allocs(NumThreads);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < NumThreads; ++t) {
+        threads.push_back(std::thread([&allocator, &allocs, t]() {
+            for (size_t i = 0; i < NumAllocations; ++i) {
+                size_t size = 1 + (i*7)%100;
+                size_t alignment = i%5 == 0 ? 64 : mem::DefaultAlignment;
+                char* x = (char*)allocator.allocate(size, alignment);
+                ASSERT_TRUE(x != nullptr);
+                memset(x, (int)t, size);
+                allocs[t].push_back(x);
+            }
+        }));
+    }
+    for (std::thread& thread: threads) {
+        thread.join();
+    }
+
+    for (size_t t = 0; t < NumThreads; ++t) {
+        for (size_t i = 0; i < NumAllocations; ++i) {
+            char* x = allocs[t][i];
+            size_t size = 1 + (i*7)%100;
+            ASSERT_EQ(size, allocator.getAllocationSize(x));
+            for (size_t b = 0; b < size; ++b) {
+                ASSERT_EQ((char)t, x[b]);
+            }
+        }
+    }
+}
+
+namespace {
+
+const size_t BenchmarkAllocations = 1000000;
+const size_t BenchmarkSize = 32;
+
+// Returns millions of allocations per second over all threads
+template <typename Allocate>
+double contentionBenchmark(size_t numThreads, Allocate allocate)
+{
+    std::vector<std::thread> threads;
+    util::Stopwatch stopwatch;
+    stopwatch.start();
+
+    for (size_t t = 0; t < numThreads; ++t) {
+        threads.push_back(std::thread([t, &allocate]() {
+            for (size_t i = 0; i < BenchmarkAllocations; ++i) {
+                char* x = (char*)allocate(t);
+                *x = (char)i;
+            }
+        }));
+    }
+    for (std::thread& thread: threads) {
+        thread.join();
+    }
+
+    stopwatch.stop();
+    return numThreads*BenchmarkAllocations/stopwatch.getElapsed()/1e6;
+}
+
+}
+
+TEST(DISABLED_AtomicLinearAllocator, ContentionBenchmark)
+{
+    printf("%zu allocations of %zu bytes per thread, M allocations/s\n", BenchmarkAllocations, BenchmarkSize);
+    printf("  threads    shared atomic    per-thread linear\n");
+    for (size_t numThreads: {1, 2, 4, 8, 16, 32, 64}) {
+        size_t bytesPerThread = BenchmarkAllocations*(BenchmarkSize + 8);
+        std::vector<char> mem(numThreads*bytesPerThread);
+
+        mem::AtomicLinearAllocator shared(mem.data(), mem.size(), 8);
+        double sharedRate = contentionBenchmark(numThreads, [&shared](size_t) {
+            return shared.allocate(BenchmarkSize);
+        });
+
+        std::vector<mem::LinearAllocator*> perThread;
+        for (size_t t = 0; t < numThreads; ++t) {
+            perThread.push_back(new mem::LinearAllocator(mem.data() + t*bytesPerThread, bytesPerThread, 8));
+        }
+        double perThreadRate = contentionBenchmark(numThreads, [&perThread](size_t t) {
+            return perThread[t]->allocate(BenchmarkSize);
+        });
+        for (mem::LinearAllocator* allocator: perThread) {
+            delete allocator;
+        }
+
+        printf("  %7zu    %13.2f    %17.2f\n", numThreads, sharedRate, perThreadRate);
+    }
+}
@@ -3,6 +3,11 @@
 #include <gtest/gtest.h>
 
 #include "mem/boundsChecking.h"
+#include "mem/marking.h"
+#include "mem/pageAllocator.h"
+#include "mem/region.h"
+#include "mem/threading.h"
+#include "mem/tracking.h"
 
 TEST(BoundsChecking, NoBoundsChecking)
 {
@@ -54,3 +59,75 @@ TEST(BoundsChecking, BoundsChecking)
     EXPECT_FALSE(boundsChecker.checkBack(mem.data() + 1024 - mem::BoundsChecking::SizeBack));
 }
 
+
+TEST(BoundsChecking, CheckAll)
+{
+    // Enough allocations for the vectorised part and some left over
+    const size_t NumAllocs = 11;
+    const size_t AllocSize = 32;
+    std::array<char, NumAllocs*AllocSize> mem;
+
+    mem::BoundsChecking boundsChecker;
+    void* fronts[NumAllocs];
+    void* backs[NumAllocs];
+    for (size_t i = 0; i < NumAllocs; ++i) {
+        fronts[i] = mem.data() + i*AllocSize;
+        backs[i] = mem.data() + i*AllocSize + AllocSize - 1 - mem::BoundsChecking::SizeBack - i%3;
+        boundsChecker.guardFront(fronts[i]);
+        boundsChecker.guardBack(backs[i]);
+    }
+
+    bool isIntact[NumAllocs];
+    EXPECT_EQ(0, boundsChecker.checkAll(fronts, backs, NumAllocs, isIntact));
+    EXPECT_TRUE(std::all_of(isIntact, isIntact + NumAllocs, [](bool val){ return val; }));
+
+    ((char*)fronts[1])[2] = 0;
+    ((char*)backs[1])[0] = 0;
+    ((char*)backs[6])[3] = 0;
+    ((char*)fronts[10])[0] = 0;
+    EXPECT_EQ(3, boundsChecker.checkAll(fronts, backs, NumAllocs, isIntact));
+    for (size_t i = 0; i < NumAllocs; ++i) {
+        EXPECT_EQ(i != 1 && i != 6 && i != 10, isIntact[i]);
+    }
+
+    // Without back guards only the fronts matter
+    mem::GuardPageBoundsChecking guardPageChecker;
+    EXPECT_EQ(2, guardPageChecker.checkAll(fronts, backs, NumAllocs, isIntact));
+    EXPECT_TRUE(isIntact[6]);
+
+    mem::NoBoundsChecking noBoundsChecker;
+    EXPECT_EQ(0, noBoundsChecker.checkAll(fronts, backs, NumAllocs, isIntact));
+    EXPECT_TRUE(isIntact[1]);
+}
+
+TEST(BoundsChecking, GuardPageBoundsChecking)
+{
+    typedef mem::Region<
+        mem::GuardPageAllocator,
+        mem::SingleThreaded,
+        mem::GuardPageBoundsChecking,
+        mem::NoTracking,
+        mem::NoMarking>
+            GuardPageRegion;
+
+    EXPECT_EQ(0, mem::GuardPageBoundsChecking::SizeBack);
+
+    GuardPageRegion region;
+    volatile char* x = (char*)region.allocate(100, 1, mem::SourceInfo());
+    for (int i = 0; i < 100; ++i) {
+        x[i] = 13;
+    }
+
+    // Overruns fault right away, underruns are caught by the front sequence
+    EXPECT_DEATH(x[100] = 13, "");
+    char front = x[-1];
+    x[-1] = 13;
+    mem::GuardPageBoundsChecking boundsChecker;
+    EXPECT_FALSE(boundsChecker.checkFront((char*)x - mem::GuardPageBoundsChecking::SizeFront));
+    x[-1] = front;
+    EXPECT_TRUE(boundsChecker.checkFront((char*)x - mem::GuardPageBoundsChecking::SizeFront));
+    region.release((void*)x);
+
+    // Released memory is quarantined
+    EXPECT_DEATH(x[0] = 13, "");
+}
@@ -0,0 +1,193 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "mem/boundsChecking.h"
+#include "mem/buddyAllocator.h"
+#include "mem/marking.h"
+#include "mem/region.h"
+#include "mem/threading.h"
+#include "mem/tracking.h"
+
+typedef mem::Region<
+    mem::BuddyAllocator,
+    mem::SingleThreaded,
+    mem::BoundsChecking,
+    mem::NoTracking,
+    mem::Marking>
+        BuddyCheckedRegion;
+
+TEST(BuddyAllocator, AllocRelease)
+{
+    mem::BuddyAllocator allocator(util::kilobytes(64), 256);
+    EXPECT_EQ(util::kilobytes(64), allocator.getSize());
+    EXPECT_EQ(9, allocator.getNumOrders());
+
+    // Requests are rounded up to the next block size
+    char* x = (char*)allocator.allocate(1);
+    char* y = (char*)allocator.allocate(300);
+    char* z = (char*)allocator.allocate(util::kilobytes(4));
+    ASSERT_TRUE(x != nullptr);
+    ASSERT_TRUE(y != nullptr);
+    ASSERT_TRUE(z != nullptr);
+    EXPECT_EQ(256, allocator.getAllocationSize(x));
+    EXPECT_EQ(512, allocator.getAllocationSize(y));
+    EXPECT_EQ(util::kilobytes(4), allocator.getAllocationSize(z));
+    EXPECT_TRUE(allocator.check());
+
+    // Blocks are aligned to their size
+    EXPECT_EQ(0, (size_t)y%512);
+    EXPECT_EQ(0, (size_t)z%util::kilobytes(4));
+
+    memset(x, 1, 256);
+    memset(y, 2, 512);
+    memset(z, 3, util::kilobytes(4));
+
+    allocator.release(y);
+    allocator.release(x);
+    allocator.release(z);
+    EXPECT_TRUE(allocator.check());
+
+    EXPECT_TRUE(allocator.allocate(util::kilobytes(64) + 1) == nullptr);
+    EXPECT_TRUE(allocator.allocate(10, util::kilobytes(64)) == nullptr);
+}
+
+TEST(BuddyAllocator, SplitAndMerge)
+{
+    mem::BuddyAllocator allocator(util::kilobytes(64), 256);
+
+    // Fill the whole range with the smallest blocks, every larger block is split
+    std::vector<void*> allocs;
+    for (size_t i = 0; i < 256; ++i) {
+        void* x = allocator.allocate(256);
+        ASSERT_TRUE(x != nullptr);
+        allocs.push_back(x);
+    }
+    EXPECT_TRUE(allocator.allocate(1) == nullptr);
+    EXPECT_TRUE(allocator.check());
+
+    mem::BuddyAllocator::Stats stats = allocator.getStats();
+    EXPECT_EQ(util::kilobytes(64), stats.allocatedBytes);
+    EXPECT_EQ(0, stats.freeBytes);
+    EXPECT_EQ(256, stats.allocatedBlocks);
+    EXPECT_EQ(0, stats.freeBlocks);
+
+    // Releasing every other block leaves nothing to merge
+    for (size_t i = 0; i < allocs.size(); i += 2) {
+        allocator.release(allocs[i]);
+    }
+    EXPECT_TRUE(allocator.check());
+    stats = allocator.getStats();
+    EXPECT_EQ(128, stats.freeBlocks);
+    EXPECT_EQ(128, stats.freeBlocksPerOrder[0]);
+    EXPECT_TRUE(allocator.allocate(512) == nullptr);
+
+    // Releasing the rest merges everything back into one block
+    for (size_t i = 1; i < allocs.size(); i += 2) {
+        allocator.release(allocs[i]);
+    }
+    EXPECT_TRUE(allocator.check());
+    stats = allocator.getStats();
+    EXPECT_EQ(1, stats.freeBlocks);
+    EXPECT_EQ(1, stats.freeBlocksPerOrder[8]);
+    EXPECT_EQ(0, stats.allocatedBytes);
+
+    void* all = allocator.allocate(util::kilobytes(64));
+    EXPECT_TRUE(all != nullptr);
+    allocator.release(all);
+}
+
+TEST(BuddyAllocator, Alignment)
+{
+    mem::BuddyAllocator allocator(util::megabytes(1), 64);
+
+    for (size_t alignment = 4; alignment <= util::kilobytes(4); alignment *= 2) {
+        void* x = allocator.allocate(24, alignment);
+        ASSERT_TRUE(x != nullptr);
+        EXPECT_EQ(0, (size_t)x%alignment);
+
+        char* y = (char*)allocator.allocate(24, alignment, 4);
+        ASSERT_TRUE(y != nullptr);
+        EXPECT_EQ(0, (size_t)(y + 4)%alignment);
+        EXPECT_LE(24, allocator.getAllocationSize(y));
+        memset(y, 0xff, allocator.getAllocationSize(y));
+    }
+    EXPECT_TRUE(allocator.check());
+
+    // The range is only page aligned
+    EXPECT_TRUE(allocator.allocate(24, util::getPageSize(util::RegularPages)*2) == nullptr);
+}
+
+TEST(BuddyAllocator, Fragmentation)
+{
+    mem::BuddyAllocator allocator(util::kilobytes(64), 256);
+
+    EXPECT_EQ(util::kilobytes(64), allocator.getStats().largestFreeBlock);
+    EXPECT_EQ(0, allocator.getStats().fragmentedBytes);
+
+    // A single small block in the middle halves the largest block available
+    void* x = allocator.allocate(util::kilobytes(32));
+    void* y = allocator.allocate(256);
+    allocator.release(x);
+
+    mem::BuddyAllocator::Stats stats = allocator.getStats();
+    EXPECT_EQ(util::kilobytes(64) - 256, stats.freeBytes);
+    EXPECT_EQ(util::kilobytes(32), stats.largestFreeBlock);
+    EXPECT_EQ(util::kilobytes(32) - 256, stats.fragmentedBytes);
+    EXPECT_EQ(8, stats.freeBlocks);
+
+    allocator.release(y);
+    EXPECT_EQ(0, allocator.getStats().fragmentedBytes);
+}
+
+TEST(BuddyAllocator, RandomAllocRelease)
+{
+    mem::BuddyAllocator allocator(util::megabytes(4), 64);
+    std::vector<char*> allocs;
+
+    srand(1);
+    for (int i = 0; i < 20000; ++i) {
+        if (allocs.empty() || rand()%3 != 0) {
+            size_t size = 1 + rand()%util::kilobytes(16);
+            char* x = (char*)allocator.allocate(size);
+            if (x) {
+                ASSERT_LE(size, allocator.getAllocationSize(x));
+                memset(x, i%256, size);
+                allocs.push_back(x);
+            }
+        } else {
+            size_t j = rand()%allocs.size();
+            allocator.release(allocs[j]);
+            allocs[j] = allocs.back();
+            allocs.pop_back();
+        }
+    }
+    EXPECT_TRUE(allocator.check());
+
+    for (char* x: allocs) {
+        allocator.release(x);
+    }
+    EXPECT_TRUE(allocator.check());
+    EXPECT_EQ(1, allocator.getStats().freeBlocks);
+}
+
+TEST(BuddyAllocator, Region)
+{
+    size_t size = util::megabytes(1);
+    BuddyCheckedRegion region(size);
+
+    std::vector<void*> allocs;
+    for (int i = 0; i < 100; ++i) {
+        void* x = region.allocate(100 + i*10, 16, mem::SourceInfo());
+        ASSERT_TRUE(x != nullptr);
+        EXPECT_EQ(0, (size_t)x%16);
+        memset(x, 0xff, 100 + i*10);
+        allocs.push_back(x);
+    }
+
+    for (void* ptr: allocs) {
+        region.release(ptr);
+    }
+}
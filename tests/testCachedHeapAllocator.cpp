@@ -0,0 +1,150 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "mem/boundsChecking.h"
+#include "mem/cachedHeapAllocator.h"
+#include "mem/marking.h"
+#include "mem/region.h"
+#include "mem/threading.h"
+#include "mem/tracking.h"
+
+typedef mem::Region<
+    mem::CachedHeapAllocator,
+    mem::SingleThreaded,
+    mem::NoBoundsChecking,
+    mem::NoTracking,
+    mem::NoMarking>
+        CachedHeapRegion;
+
+TEST(CachedHeapAllocator, HitsAndMisses)
+{
+    mem::CachedHeapAllocator allocator(util::kilobytes(64), util::bytes(4), 64, 16);
+
+    // First allocation has to refill the cache, the rest of the batch are hits
+    std::vector<void*> allocs;
+    for (int i = 0; i < 16; ++i) {
+        void* x = allocator.allocate(24);
+        EXPECT_TRUE(x != nullptr);
+        EXPECT_LE(24, allocator.getAllocationSize(x));
+        allocs.push_back(x);
+    }
+
+    mem::CachedHeapAllocator::Stats stats = allocator.getStats();
+    EXPECT_EQ(1, stats.misses);
+    EXPECT_EQ(15, stats.hits);
+    EXPECT_EQ(0, stats.cachedBlocks);
+    EXPECT_EQ(1, stats.numThreadCaches);
+
+    for (void* ptr: allocs) {
+        allocator.release(ptr);
+    }
+
+    stats = allocator.getStats();
+    EXPECT_EQ(16, stats.cachedBlocks);
+
+    // Released blocks are handed right back out
+    void* x = allocator.allocate(30);
+    EXPECT_EQ(allocs.back(), x);
+    EXPECT_EQ(16, allocator.getStats().hits);
+    allocator.release(x);
+}
+
+TEST(CachedHeapAllocator, Flush)
+{
+    mem::CachedHeapAllocator allocator(util::kilobytes(64), util::bytes(4), 8, 4);
+
+    std::vector<void*> allocs;
+    for (int i = 0; i < 16; ++i) {
+        allocs.push_back(allocator.allocate(64));
+    }
+    EXPECT_EQ(4, allocator.getStats().misses);
+
+    for (void* ptr: allocs) {
+        allocator.release(ptr);
+    }
+
+    // The cache never grows past its maximum depth
+    mem::CachedHeapAllocator::Stats stats = allocator.getStats();
+    EXPECT_LT(0, stats.flushes);
+    EXPECT_GE(8, stats.cachedBlocks);
+
+    allocator.flushThreadCache();
+    EXPECT_EQ(0, allocator.getStats().cachedBlocks);
+}
+
+TEST(CachedHeapAllocator, Uncached)
+{
+    mem::CachedHeapAllocator allocator;
+
+    // Large allocations go straight to the heap
+    void* x = allocator.allocate(util::kilobytes(4));
+    EXPECT_TRUE(x != nullptr);
+    EXPECT_LE(util::kilobytes(4), allocator.getAllocationSize(x));
+    allocator.release(x);
+
+    mem::CachedHeapAllocator::Stats stats = allocator.getStats();
+    EXPECT_EQ(0, stats.hits);
+    EXPECT_EQ(0, stats.misses);
+    EXPECT_EQ(0, stats.cachedBlocks);
+}
+
+TEST(CachedHeapAllocator, ExitedThreads)
+{
+    mem::CachedHeapAllocator allocator;
+
+    std::thread t([&allocator]() {
+        allocator.release(allocator.allocate(32));
+    });
+    t.join();
+
+    // The exited thread's cache is reclaimed on the next refill
+    EXPECT_EQ(1, allocator.getStats().numThreadCaches);
+    allocator.release(allocator.allocate(32));
+
+    mem::CachedHeapAllocator::Stats stats = allocator.getStats();
+    EXPECT_EQ(1, stats.numThreadCaches);
+    EXPECT_EQ(2, stats.misses);
+}
+
+TEST(CachedHeapAllocator, RegionStress)
+{
+    CachedHeapRegion region;
+
+    const size_t NumThreads = 8;
+    const size_t NumEvents = 20000;
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < NumThreads; ++t) {
+        threads.push_back(std::thread([&region, t]() {
+            std::vector<unsigned char*> allocs;
+            unsigned int seed = static_cast<unsigned int>(t);
+
+            for (size_t i = 0; i < NumEvents; ++i) {
+                if (allocs.empty() || rand_r(&seed)%10 < 6) {
+                    size_t numBytes = 1 + rand_r(&seed)%300;
+                    unsigned char* x = (unsigned char*)region.allocate(numBytes, 4, mem::SourceInfo());
+                    ASSERT_TRUE(x != nullptr);
+
+                    // Tag the memory with the owning thread to catch blocks handed out twice
+                    x[0] = static_cast<unsigned char>(t);
+                    allocs.push_back(x);
+                } else {
+                    size_t releaseIndex = rand_r(&seed)%allocs.size();
+                    ASSERT_EQ(static_cast<unsigned char>(t), allocs[releaseIndex][0]);
+                    region.release(allocs[releaseIndex]);
+                    allocs.erase(allocs.begin() + releaseIndex);
+                }
+            }
+
+            for (unsigned char* ptr: allocs) {
+                region.release(ptr);
+            }
+        }));
+    }
+
+    for (std::thread& t: threads) {
+        t.join();
+    }
+}
@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+
+#include "mem/doubleEndedLinearAllocator.h"
+#include "mem/linearAllocator.h"
+
+// Every allocation is preceded by its size
+const size_t HeaderSize = sizeof(uint32_t);
+
+TEST(DoubleEndedLinearAllocator, Alloc)
+{
+    char mem[1024];
+    mem::DoubleEndedLinearAllocator allocator(mem, 1024, 1);
+
+    char* bottom = (char*)allocator.allocate(10);
+    char* top = (char*)allocator.allocateTop(10);
+    EXPECT_EQ(mem + HeaderSize, bottom);
+    EXPECT_EQ(mem + 1024 - 10, top);
+    EXPECT_EQ(mem + 10 + 2*HeaderSize, allocator.allocate(10));
+    EXPECT_EQ(mem + 1024 - 20 - HeaderSize, allocator.allocateTop(10));
+    EXPECT_EQ(10, allocator.getAllocationSize(bottom));
+    EXPECT_EQ(10, allocator.getAllocationSize(top));
+
+    mem::DoubleEndedLinearAllocator::Stats stats = allocator.getStats();
+    EXPECT_EQ(40 + 4*HeaderSize, stats.allocatedBytes);
+    EXPECT_EQ(20 + 2*HeaderSize, stats.topAllocatedBytes);
+    EXPECT_EQ(1024 - 40 - 4*HeaderSize, stats.freeBytes);
+}
+
+TEST(DoubleEndedLinearAllocator, AllocAlign)
+{
+    alignas(8) char mem[1024];
+    mem::DoubleEndedLinearAllocator allocator(mem, 1020, 8);
+
+    char* bottom = (char*)allocator.allocate(3);
+    char* top = (char*)allocator.allocateTop(3);
+    EXPECT_EQ(mem + 8, bottom);
+    EXPECT_EQ(mem + 1016, top);
+    EXPECT_EQ(mem + 16, allocator.allocate(3));
+    EXPECT_EQ(top - 8, allocator.allocateTop(3));
+
+    char* offset = (char*)allocator.allocateTop(3, 64, 4);
+    EXPECT_EQ(0, (size_t)(offset + 4)%64);
+    EXPECT_EQ(3, allocator.getAllocationSize(offset));
+}
+
+TEST(DoubleEndedLinearAllocator, OutOfMemory)
+{
+    char mem[100];
+    mem::DoubleEndedLinearAllocator allocator(mem, 100, 1);
+
+    // The two ends meet, each allocation needs room for its size as well
+    EXPECT_TRUE(allocator.allocate(60) != nullptr);
+    EXPECT_EQ(nullptr, allocator.allocateTop(36));
+    EXPECT_TRUE(allocator.allocateTop(32) != nullptr);
+    EXPECT_EQ(nullptr, allocator.allocate(1));
+    EXPECT_EQ(nullptr, allocator.allocateTop(1));
+    EXPECT_EQ(0, allocator.getStats().freeBytes);
+
+    allocator.clearTop();
+    EXPECT_EQ(36, allocator.getStats().freeBytes);
+    allocator.clear();
+    EXPECT_EQ(100, allocator.getStats().freeBytes);
+}
+
+TEST(DoubleEndedLinearAllocator, Markers)
+{
+    char mem[1024];
+    mem::DoubleEndedLinearAllocator allocator(mem, 1024, 1);
+
+    allocator.allocate(10);
+    allocator.allocateTop(10);
+    mem::DoubleEndedLinearAllocator::Marker bottom = allocator.getMarker();
+    mem::DoubleEndedLinearAllocator::Marker top = allocator.getTopMarker();
+
+    allocator.allocate(100);
+    allocator.allocateTop(200);
+    EXPECT_EQ(320 + 4*HeaderSize, allocator.getStats().allocatedBytes);
+
+    // Each end rewinds independently
+    allocator.rewind(top);
+    EXPECT_EQ(120 + 3*HeaderSize, allocator.getStats().allocatedBytes);
+    EXPECT_EQ(10 + HeaderSize, allocator.getStats().topAllocatedBytes);
+    allocator.rewind(bottom);
+    EXPECT_EQ(20 + 2*HeaderSize, allocator.getStats().allocatedBytes);
+
+    {
+        mem::ScopedMarker<mem::DoubleEndedLinearAllocator> scratch(allocator, allocator.getTopMarker());
+        allocator.allocateTop(500);
+        allocator.allocate(5);
+    }
+    EXPECT_EQ(10 + HeaderSize, allocator.getStats().topAllocatedBytes);
+    EXPECT_EQ(25 + 3*HeaderSize, allocator.getStats().allocatedBytes);
+}
@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#include "mem/frameAllocator.h"
+#include "util/units.h"
+
+TEST(FrameAllocator, Rotation)
+{
+    mem::FrameAllocator allocator(util::kilobytes(4), 2);
+    EXPECT_EQ(0, allocator.getCurrentFrame());
+    EXPECT_EQ(1, allocator.getStats().numLiveFrames);
+
+    char* frame0 = (char*)allocator.allocate(100);
+    memset(frame0, 0xaa, 100);
+
+    // Frame 0 stays live while frame 1 allocates from the other buffer
+    EXPECT_TRUE(allocator.beginFrame());
+    EXPECT_EQ(1, allocator.getCurrentFrame());
+    EXPECT_EQ(2, allocator.getStats().numLiveFrames);
+    char* frame1 = (char*)allocator.allocate(100);
+    memset(frame1, 0xbb, 100);
+    EXPECT_EQ((char)0xaa, frame0[99]);
+
+    // Frame 0's buffer can't be recycled until it is retired
+    EXPECT_FALSE(allocator.beginFrame());
+    EXPECT_EQ(1, allocator.getCurrentFrame());
+    EXPECT_EQ(100, allocator.getAllocationSize(frame1));
+
+    allocator.retireFrame(0);
+    EXPECT_TRUE(allocator.beginFrame());
+    EXPECT_EQ(2, allocator.getCurrentFrame());
+    EXPECT_EQ(frame0, allocator.allocate(100));
+    EXPECT_EQ((char)0xbb, frame1[99]);
+}
+
+TEST(FrameAllocator, SingleBuffer)
+{
+    // With one buffer the current frame has to be retired before the next begins
+    mem::FrameAllocator allocator(util::kilobytes(4), 1);
+    void* x = allocator.allocate(100);
+    EXPECT_FALSE(allocator.beginFrame());
+
+    allocator.retireFrame(0);
+    EXPECT_TRUE(allocator.beginFrame());
+    EXPECT_EQ(x, allocator.allocate(100));
+}
+
+TEST(FrameAllocator, History)
+{
+    mem::FrameAllocator allocator(util::kilobytes(4), 2);
+
+    for (size_t frame = 0; frame < 100; ++frame) {
+        for (size_t i = 0; i <= frame%10; ++i) {
+            allocator.allocate(96);
+        }
+        if (frame > 0) {
+            allocator.retireFrame(frame - 1);
+        }
+        ASSERT_TRUE(allocator.beginFrame());
+    }
+
+    // Newest first, only the last HistorySize frames are kept
+    mem::FrameAllocator::FrameStats history[200];
+    size_t numFrames = allocator.getFrameHistory(history, 200);
+    EXPECT_EQ(mem::FrameAllocator::HistorySize, numFrames);
+    EXPECT_EQ(99, history[0].frame);
+    EXPECT_EQ(10*100, history[0].allocatedBytes);
+    EXPECT_EQ(98, history[1].frame);
+    EXPECT_EQ(9*100, history[1].allocatedBytes);
+    EXPECT_EQ(0, history[0].failedBytes);
+
+    EXPECT_EQ(2, allocator.getFrameHistory(history, 2));
+    EXPECT_EQ(util::kilobytes(4), allocator.getSuggestedBufferSize());
+}
+
+TEST(FrameAllocator, AutoTuning)
+{
+    mem::FrameAllocator allocator(util::kilobytes(4), 2);
+    allocator.setAutoTuning(true);
+
+    // A frame which outgrows its buffer counts what didn't fit
+    for (int i = 0; i < 100; ++i) {
+        allocator.allocate(96);
+    }
+    allocator.retireFrame(0);
+    EXPECT_TRUE(allocator.beginFrame());
+
+    mem::FrameAllocator::FrameStats history[1];
+    allocator.getFrameHistory(history, 1);
+    EXPECT_LT(0, history[0].failedBytes);
+    EXPECT_LE(100*96, history[0].allocatedBytes + history[0].failedBytes);
+
+    // The next buffer is sized for it
+    EXPECT_LE(100*96, allocator.getBufferSize());
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_TRUE(allocator.allocate(96) != nullptr);
+    }
+}
+
+TEST(FrameAllocator, RetireFromOtherThread)
+{
+    // A consumer thread checks each frame's data and retires it
+    const size_t NumFrames = 1000;
+    mem::FrameAllocator allocator(util::kilobytes(4), 3);
+
+    std::atomic<size_t> produced(0);
+    std::atomic<size_t> numCorrupt(0);
+    std::atomic<char*> frameData[NumFrames];
+
+    std::thread consumer([&]() {
+        for (size_t frame = 0; frame < NumFrames; ++frame) {
+            while (produced.load(std::memory_order_acquire) <= frame) {
+                std::this_thread::yield();
+            }
+            char* data = frameData[frame].load(std::memory_order_relaxed);
+            for (size_t i = 0; i < 256; ++i) {
+                if (data[i] != (char)frame) {
+                    numCorrupt++;
+                }
+            }
+            allocator.retireFrame(frame);
+        }
+    });
+
+    for (size_t frame = 0; frame < NumFrames; ++frame) {
+        char* data = (char*)allocator.allocate(256);
+        memset(data, (char)frame, 256);
+        frameData[frame].store(data, std::memory_order_relaxed);
+        produced.store(frame + 1, std::memory_order_release);
+
+        if (frame + 1 < NumFrames) {
+            while (!allocator.beginFrame()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    consumer.join();
+    EXPECT_EQ(0, numCorrupt.load());
+}
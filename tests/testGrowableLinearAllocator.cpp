@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "mem/growableLinearAllocator.h"
+
+TEST(GrowableLinearAllocator, Alloc)
+{
+    mem::GrowableLinearAllocator allocator(util::kilobytes(4), util::kilobytes(16), 8);
+    EXPECT_EQ(0, allocator.getStats().numChunks);
+
+    char* x = (char*)allocator.allocate(3);
+    char* y = (char*)allocator.allocate(3);
+    ASSERT_TRUE(x != nullptr);
+    EXPECT_EQ(x + 8, y);
+    EXPECT_EQ(0, (size_t)x%8);
+
+    mem::GrowableLinearAllocator::Stats stats = allocator.getStats();
+    EXPECT_EQ(1, stats.numChunks);
+    EXPECT_EQ(19, stats.allocatedBytes);
+    EXPECT_EQ(3, allocator.getAllocationSize(y));
+
+    // Alignments beyond the allocator's are honoured
+    char* z = (char*)allocator.allocate(8, 64);
+    EXPECT_EQ(0, (size_t)z%64);
+    char* w = (char*)allocator.allocate(8, 64, 4);
+    EXPECT_EQ(0, (size_t)(w + 4)%64);
+}
+
+TEST(GrowableLinearAllocator, Growth)
+{
+    mem::GrowableLinearAllocator allocator(util::kilobytes(4), util::kilobytes(16));
+
+    // Chunks double in size until they reach the cap
+    std::vector<char*> allocs;
+    size_t numChunks = 0;
+    std::vector<size_t> chunkSizes;
+    for (int i = 0; i < 1000; ++i) {
+        char* x = (char*)allocator.allocate(256);
+        ASSERT_TRUE(x != nullptr);
+        memset(x, i%256, 256);
+        allocs.push_back(x);
+
+        mem::GrowableLinearAllocator::Stats stats = allocator.getStats();
+        if (stats.numChunks != numChunks) {
+            chunkSizes.push_back(stats.freeBytes + 256);
+            numChunks = stats.numChunks;
+        }
+    }
+
+    ASSERT_LT(4, chunkSizes.size());
+    EXPECT_GE(util::kilobytes(4), chunkSizes[0]);
+    EXPECT_LT(util::kilobytes(4), chunkSizes[1]);
+    EXPECT_LT(util::kilobytes(8), chunkSizes[2]);
+    EXPECT_GE(util::kilobytes(16), chunkSizes.back());
+
+    EXPECT_EQ(1000*(256 + sizeof(uint32_t)), allocator.getStats().allocatedBytes);
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_EQ(i%256, (unsigned char)allocs[i][0]);
+        EXPECT_EQ(i%256, (unsigned char)allocs[i][255]);
+    }
+}
+
+TEST(GrowableLinearAllocator, LargeAllocation)
+{
+    mem::GrowableLinearAllocator allocator(util::kilobytes(4), util::kilobytes(16));
+
+    // A request larger than the cap gets its own chunk
+    char* x = (char*)allocator.allocate(util::kilobytes(100));
+    ASSERT_TRUE(x != nullptr);
+    memset(x, 0xff, util::kilobytes(100));
+    EXPECT_EQ(1, allocator.getStats().numChunks);
+
+    char* y = (char*)allocator.allocate(util::kilobytes(100), 4096);
+    ASSERT_TRUE(y != nullptr);
+    EXPECT_EQ(0, (size_t)y%4096);
+    memset(y, 0xff, util::kilobytes(100));
+    EXPECT_EQ(2, allocator.getStats().numChunks);
+}
+
+TEST(GrowableLinearAllocator, Clear)
+{
+    mem::GrowableLinearAllocator allocator(util::kilobytes(4), util::kilobytes(64));
+    for (int i = 0; i < 1000; ++i) {
+        allocator.allocate(100);
+    }
+
+    mem::GrowableLinearAllocator::Stats stats = allocator.getStats();
+    EXPECT_LT(1, stats.numChunks);
+
+    // Only the largest chunk is kept and allocation starts over in it
+    allocator.clear();
+    mem::GrowableLinearAllocator::Stats cleared = allocator.getStats();
+    EXPECT_EQ(1, cleared.numChunks);
+    EXPECT_EQ(0, cleared.allocatedBytes);
+    EXPECT_LT(util::kilobytes(32), cleared.chunkBytes);
+    EXPECT_GE(util::kilobytes(64), cleared.chunkBytes);
+    EXPECT_EQ(cleared.chunkBytes - cleared.freeBytes, 16);
+
+    // The same workload again needs fewer chunks
+    for (int i = 0; i < 1000; ++i) {
+        allocator.allocate(100);
+    }
+    EXPECT_GT(stats.numChunks, allocator.getStats().numChunks);
+}
@@ -1,13 +1,47 @@
 #include <cstdlib>
+#include <cstring>
 
 #include <gtest/gtest.h>
 #include <string>
+#include <thread>
 
+#include "mem/boundsChecking.h"
 #include "mem/heapAllocator.h"
+#include "mem/marking.h"
+#include "mem/region.h"
+#include "mem/threading.h"
+#include "mem/tracking.h"
 
 #include "util/unused.h"
 #include "util/stopwatch.h"
 
+typedef mem::Region<
+    mem::HeapAllocator,
+    mem::SingleThreaded,
+    mem::BoundsChecking,
+    mem::NoTracking,
+    mem::Marking>
+        HeapCheckedRegion;
+
+namespace {
+
+// The counters behind getStats() have to agree with a full walk of the heap
+void expectStatsMatch(const mem::HeapAllocator& allocator)
+{
+    mem::HeapAllocator::Stats stats = allocator.getStats();
+    mem::HeapAllocator::Stats slowStats = allocator.computeStatsSlow();
+
+    EXPECT_EQ(slowStats.allocatedBytes, stats.allocatedBytes);
+    EXPECT_EQ(slowStats.freeBytes, stats.freeBytes);
+    EXPECT_EQ(slowStats.overheadBytes, stats.overheadBytes);
+    EXPECT_EQ(slowStats.allocatedBlocks, stats.allocatedBlocks);
+    EXPECT_EQ(slowStats.freeBlocks, stats.freeBlocks);
+    EXPECT_EQ(slowStats.numRegularSegments, stats.numRegularSegments);
+    EXPECT_EQ(slowStats.numExternalSegments, stats.numExternalSegments);
+}
+
+}
+
 TEST(HeapAllocator, ZeroSizeAlloc)
 {
     mem::HeapAllocator allocator;
@@ -24,11 +58,14 @@ TEST(HeapAllocator, BufferOverflowCheck)
     char* x = (char*)allocator.allocate(16);
     x[0] = 5;
 
-    // Buffer overflow!
+    // The footer is part of the allocation
+    size_t allocSize = allocator.getAllocationSize(x);
+    memset(x, 0, allocSize);
     EXPECT_TRUE(allocator.check());
-    x[16] = 0;
-    x[15] = 0;
-    x[17] = 0;
+
+    // Buffer overflow into the header of the next block!
+    x[allocSize] = 0x55;
+    x[allocSize + 1] = 0x55;
     EXPECT_FALSE(allocator.check());
 }
 
@@ -99,8 +136,8 @@ TEST(HeapAllocator, GetStats)
     stats = allocator.getStats();
 
     EXPECT_EQ(1024, stats.allocatedBytes);
-    EXPECT_EQ(68504, stats.freeBytes);
-    EXPECT_EQ(72, stats.overheadBytes);
+    EXPECT_EQ(68512, stats.freeBytes);
+    EXPECT_EQ(64, stats.overheadBytes);
     EXPECT_EQ(1, stats.allocatedBlocks);
     EXPECT_EQ(1, stats.freeBlocks);
     EXPECT_EQ(1, stats.numRegularSegments);
@@ -110,8 +147,8 @@ TEST(HeapAllocator, GetStats)
     stats = allocator.getStats();
 
     EXPECT_EQ(2048, stats.allocatedBytes);
-    EXPECT_EQ(67464, stats.freeBytes);
-    EXPECT_EQ(88, stats.overheadBytes);
+    EXPECT_EQ(67480, stats.freeBytes);
+    EXPECT_EQ(72, stats.overheadBytes);
     EXPECT_EQ(2, stats.allocatedBlocks);
     EXPECT_EQ(1, stats.freeBlocks);
     EXPECT_EQ(1, stats.numRegularSegments);
@@ -121,8 +158,8 @@ TEST(HeapAllocator, GetStats)
     stats = allocator.getStats();
 
     EXPECT_EQ(2148, stats.allocatedBytes);
-    EXPECT_EQ(67348, stats.freeBytes);
-    EXPECT_EQ(104, stats.overheadBytes);
+    EXPECT_EQ(67372, stats.freeBytes);
+    EXPECT_EQ(80, stats.overheadBytes);
     EXPECT_EQ(3, stats.allocatedBlocks);
     EXPECT_EQ(1, stats.freeBlocks);
     EXPECT_EQ(1, stats.numRegularSegments);
@@ -132,8 +169,8 @@ TEST(HeapAllocator, GetStats)
     stats = allocator.getStats();
 
     EXPECT_EQ(1124, stats.allocatedBytes);
-    EXPECT_EQ(68372, stats.freeBytes);
-    EXPECT_EQ(104, stats.overheadBytes);
+    EXPECT_EQ(68388, stats.freeBytes);
+    EXPECT_EQ(88, stats.overheadBytes);
     EXPECT_EQ(2, stats.allocatedBlocks);
     EXPECT_EQ(2, stats.freeBlocks);
     EXPECT_EQ(1, stats.numRegularSegments);
@@ -144,8 +181,8 @@ TEST(HeapAllocator, GetStats)
     stats = allocator.getStats();
 
     EXPECT_EQ(1024, stats.allocatedBytes);
-    EXPECT_EQ(68472, stats.freeBytes);
-    EXPECT_EQ(104, stats.overheadBytes);
+    EXPECT_EQ(68480, stats.freeBytes);
+    EXPECT_EQ(96, stats.overheadBytes);
     EXPECT_EQ(1, stats.allocatedBlocks);
     EXPECT_EQ(3, stats.freeBlocks);
     EXPECT_EQ(1, stats.numRegularSegments);
@@ -161,6 +198,35 @@ TEST(HeapAllocator, GetStats)
     EXPECT_EQ(2, stats.freeBlocks);
     EXPECT_EQ(1, stats.numRegularSegments);
     EXPECT_EQ(0, stats.numExternalSegments);
+    expectStatsMatch(allocator);
+}
+
+TEST(HeapAllocator, Clear)
+{
+    mem::HeapAllocator allocator(util::kilobytes(4));
+
+    // Spread over a few segments, one of them external
+    for (size_t i = 0; i < 100; ++i) {
+        allocator.allocate(util::bytes(16 + i*8));
+        allocator.allocate(util::kilobytes(1));
+    }
+    allocator.allocate(util::megabytes(40));
+    mem::HeapAllocator::Stats stats = allocator.getStats();
+    EXPECT_LT(1, stats.numRegularSegments);
+    expectStatsMatch(allocator);
+
+    // Every segment is left as a single free block
+    allocator.clear();
+    EXPECT_TRUE(allocator.check());
+    expectStatsMatch(allocator);
+    EXPECT_EQ(0, allocator.getStats().allocatedBlocks);
+    EXPECT_EQ(0, allocator.getStats().numExternalSegments);
+    EXPECT_EQ(stats.numRegularSegments, allocator.getStats().freeBlocks);
+
+    void* x = allocator.allocate(util::kilobytes(1));
+    EXPECT_TRUE(x != nullptr);
+    EXPECT_TRUE(allocator.check());
+    expectStatsMatch(allocator);
 }
 
 TEST(HeapAllocator, GetBlocks)
@@ -310,11 +376,13 @@ TEST(HeapAllocator, SmallBinStress)
             void* x = allocator.allocate(numBytes);
             allocs.push_back(x);
             EXPECT_TRUE(allocator.check());
+            expectStatsMatch(allocator);
         } else {
             size_t releaseIndex = rand()%allocs.size();
             allocator.release(allocs[releaseIndex]);
             allocs.erase(allocs.begin() + releaseIndex);
             EXPECT_TRUE(allocator.check());
+            expectStatsMatch(allocator);
         }
     }
     
@@ -324,6 +392,7 @@ TEST(HeapAllocator, SmallBinStress)
         allocator.release(ptr);
     }
     EXPECT_TRUE(allocator.check());
+    expectStatsMatch(allocator);
 }
 
 TEST(HeapAllocator, TreeBinAlloc)
@@ -457,11 +526,13 @@ TEST(HeapAllocator, TreeBinStress)
             void* x = allocator.allocate(numBytes);
             allocs.push_back(x);
             EXPECT_TRUE(allocator.check());
+            expectStatsMatch(allocator);
         } else {
             size_t releaseIndex = rand()%allocs.size();
             allocator.release(allocs[releaseIndex]);
             allocs.erase(allocs.begin() + releaseIndex);
             EXPECT_TRUE(allocator.check());
+            expectStatsMatch(allocator);
         }
     }
     
@@ -471,6 +542,7 @@ TEST(HeapAllocator, TreeBinStress)
         allocator.release(ptr);
     }
     EXPECT_TRUE(allocator.check());
+    expectStatsMatch(allocator);
 }
 
 TEST(HeapAllocator, LargeAlloc)
@@ -490,6 +562,134 @@ TEST(HeapAllocator, LargeAlloc)
     EXPECT_EQ(1, allocator.getStats().numExternalSegments);
 }
 
+TEST(HeapAllocator, ExternalSegmentCache)
+{
+    mem::HeapAllocator allocator;
+
+    // A released external segment is handed back out to the next large allocation of
+    // about the same size
+    void* x = allocator.allocate(util::megabytes(48));
+    allocator.release(x);
+    mem::HeapAllocator::Stats stats = allocator.getStats();
+    EXPECT_EQ(0, stats.numExternalSegments);
+    EXPECT_LT(util::megabytes(48), stats.externalCacheBytes);
+    EXPECT_LE(stats.externalCacheBytes, allocator.getResidentFreeBytes());
+
+    void* y = allocator.allocate(util::megabytes(40));
+    EXPECT_EQ(x, y);
+    stats = allocator.getStats();
+    EXPECT_EQ(1, stats.externalCacheHits);
+    EXPECT_EQ(0, stats.externalCacheBytes);
+    EXPECT_EQ(1, stats.numExternalSegments);
+    memset(y, 0xab, util::megabytes(40));
+    EXPECT_TRUE(allocator.check());
+    expectStatsMatch(allocator);
+
+    // Too much larger than the request to be reused
+    allocator.release(y);
+    void* z = allocator.allocate(util::megabytes(34));
+    EXPECT_EQ(1, allocator.getStats().externalCacheHits);
+    allocator.release(z);
+
+    // The byte cap evicts the oldest segments
+    allocator.setExternalSegmentCache(util::megabytes(60), std::chrono::milliseconds(10000));
+    stats = allocator.getStats();
+    EXPECT_LT(util::megabytes(34), stats.externalCacheBytes);
+    EXPECT_GE(util::megabytes(60), stats.externalCacheBytes);
+
+    // Trimming empties the cache
+    EXPECT_LE(stats.externalCacheBytes, allocator.trim());
+    EXPECT_EQ(0, allocator.getStats().externalCacheBytes);
+
+    // Segments expire once they've been cached for longer than the maximum age
+    allocator.setExternalSegmentCache(util::megabytes(50), std::chrono::milliseconds(0));
+    allocator.release(allocator.allocate(util::megabytes(40)));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    allocator.release(allocator.allocate(util::megabytes(40)));
+    EXPECT_EQ(1, allocator.getStats().externalCacheHits);
+
+    // Disabled
+    allocator.setExternalSegmentCache(0, std::chrono::milliseconds(10000));
+    EXPECT_EQ(0, allocator.getStats().externalCacheBytes);
+    allocator.release(allocator.allocate(util::megabytes(40)));
+    EXPECT_EQ(0, allocator.getStats().externalCacheBytes);
+}
+
+TEST(HeapAllocator, Trim)
+{
+    mem::HeapAllocator allocator;
+
+    // Keep a small block around so the first segment can't be unmapped
+    void* small = allocator.allocate(100);
+    void* x = allocator.allocate(util::kilobytes(48));
+    allocator.release(x);
+
+    size_t residentBytes = allocator.getResidentFreeBytes();
+    EXPECT_EQ(0, allocator.trim(residentBytes));
+    EXPECT_EQ(0, allocator.getStats().releasedBytes);
+
+    size_t releasedBytes = allocator.trim();
+    EXPECT_LT(util::kilobytes(40), releasedBytes);
+    EXPECT_EQ(releasedBytes, allocator.getStats().releasedBytes);
+    EXPECT_EQ(residentBytes - releasedBytes, allocator.getResidentFreeBytes());
+    EXPECT_EQ(1, allocator.getStats().numRegularSegments);
+    EXPECT_TRUE(allocator.check());
+
+    // Already released
+    EXPECT_EQ(0, allocator.trim());
+
+    // Released pages are usable again
+    x = allocator.allocate(util::kilobytes(48));
+    memset(x, 0xff, util::kilobytes(48));
+    EXPECT_EQ(0, allocator.getStats().releasedBytes);
+    EXPECT_TRUE(allocator.check());
+
+    allocator.release(x);
+    allocator.release(small);
+}
+
+TEST(HeapAllocator, TrimSegments)
+{
+    mem::HeapAllocator allocator;
+
+    void* x = allocator.allocate(util::megabytes(1));
+    EXPECT_EQ(2, allocator.getStats().numRegularSegments);
+    allocator.release(x);
+
+    // Both segments are entirely free and get unmapped
+    EXPECT_LT(util::megabytes(1), allocator.trim());
+    EXPECT_EQ(0, allocator.getStats().numRegularSegments);
+    EXPECT_EQ(0, allocator.getStats().releasedBytes);
+
+    x = allocator.allocate(util::kilobytes(1));
+    EXPECT_TRUE(x != nullptr);
+    EXPECT_TRUE(allocator.check());
+    allocator.release(x);
+}
+
+TEST(HeapAllocator, HugePages)
+{
+    const size_t HugePageSize = util::getHugePageSize();
+    mem::HeapAllocator allocator(util::kilobytes(64), util::bytes(4), util::TransparentHugePages);
+
+    // Segments are rounded up to and aligned on huge pages
+    std::vector<mem::HeapAllocator::Block> blocks = allocator.getBlocks();
+    EXPECT_EQ(1, blocks.size());
+    EXPECT_EQ(0, (size_t)blocks[0].segment%HugePageSize);
+    EXPECT_LT(HugePageSize - util::kilobytes(1), allocator.getStats().freeBytes);
+
+    void* x = allocator.allocate(util::megabytes(3));
+    void* y = allocator.allocate(util::megabytes(40));
+    memset(x, 0xff, util::megabytes(3));
+    memset(y, 0xff, util::megabytes(40));
+    EXPECT_EQ(1, allocator.getStats().numExternalSegments);
+    EXPECT_TRUE(allocator.check());
+
+    allocator.release(x);
+    allocator.release(y);
+    EXPECT_TRUE(allocator.check());
+}
+
 TEST(HeapAllocator, Alignment)
 {
     const size_t NumEvents = 10000;
@@ -564,3 +764,218 @@ TEST(HeapAllocator, Alignment)
     EXPECT_TRUE((size_t)big3%16 == 0);
 }
 
+
+TEST(HeapAllocator, AlignedAlloc)
+{
+    mem::HeapAllocator allocator;
+    std::vector<void*> allocs;
+
+    const size_t Alignments[] = {8, 16, 32, 64, 4096};
+    for (size_t alignment: Alignments) {
+        for (size_t offset = 0; offset < 3*sizeof(int); offset += sizeof(int)) {
+            char* x = (char*)allocator.allocate(100, alignment, offset);
+            EXPECT_EQ(0, (size_t)(x + offset)%alignment);
+            EXPECT_LE(100, allocator.getAllocationSize(x));
+            memset(x, 0xff, 100);
+            allocs.push_back(x);
+            EXPECT_TRUE(allocator.check());
+        }
+    }
+
+    // The slack around the aligned blocks is returned, only a little waste is expected
+    mem::HeapAllocator::Stats stats = allocator.getStats();
+    EXPECT_GT(allocs.size()*200, stats.allocatedBytes);
+
+    for (void* ptr: allocs) {
+        allocator.release(ptr);
+        EXPECT_TRUE(allocator.check());
+    }
+    EXPECT_EQ(0, allocator.getStats().allocatedBlocks);
+
+    // External segments are aligned too
+    char* big = (char*)allocator.allocate(util::megabytes(33), 64, 4);
+    EXPECT_EQ(0, (size_t)(big + 4)%64);
+    EXPECT_EQ(1, allocator.getStats().numExternalSegments);
+    allocator.release(big);
+    EXPECT_EQ(0, allocator.getStats().numExternalSegments);
+}
+
+TEST(HeapAllocator, AlignedStress)
+{
+    // An offset which isn't a multiple of the allocator alignment leaves blocks which
+    // have to be realigned when they're released
+    mem::HeapAllocator allocator(util::kilobytes(64), 8);
+    std::vector<void*> allocs;
+
+    unsigned int seed = 17;
+    const size_t NumEvents = 20000;
+    for (size_t i = 0; i < NumEvents; ++i) {
+        if (allocs.empty() || rand_r(&seed)%10 < 6) {
+            size_t numBytes = rand_r(&seed)%util::kilobytes(2);
+            size_t alignment = static_cast<size_t>(1) << (rand_r(&seed)%8);
+            size_t offset = (rand_r(&seed)%4)*sizeof(int);
+
+            char* x = (char*)allocator.allocate(numBytes, alignment, offset);
+            EXPECT_EQ(0, (size_t)(x + offset)%alignment);
+            memset(x, 0xff, numBytes);
+            allocs.push_back(x);
+        } else {
+            size_t releaseIndex = rand_r(&seed)%allocs.size();
+            allocator.release(allocs[releaseIndex]);
+            allocs.erase(allocs.begin() + releaseIndex);
+        }
+
+        if (i%100 == 0) {
+            ASSERT_TRUE(allocator.check());
+            expectStatsMatch(allocator);
+        }
+    }
+
+    for (void* ptr: allocs) {
+        allocator.release(ptr);
+    }
+    EXPECT_TRUE(allocator.check());
+    expectStatsMatch(allocator);
+
+    // Regular allocations still get the allocator alignment
+    for (size_t i = 0; i < 100; ++i) {
+        void* x = allocator.allocate(1 + i*8);
+        EXPECT_EQ(0, (size_t)x%8);
+    }
+}
+
+TEST(HeapAllocator, AlignedRegion)
+{
+    HeapCheckedRegion region;
+
+    // SIMD types with a guard in front of them
+    char* x = (char*)region.allocate(util::bytes(48), 32, mem::SourceInfo());
+    char* y = (char*)region.allocate(util::bytes(256), 64, mem::SourceInfo());
+    EXPECT_EQ(0, (size_t)x%32);
+    EXPECT_EQ(0, (size_t)y%64);
+
+    memset(x, 0xff, util::bytes(48));
+    memset(y, 0xff, util::bytes(256));
+    region.release(x);
+    region.release(y);
+}
+
+TEST(HeapAllocator, AllocateBatch)
+{
+    mem::HeapAllocator allocator;
+
+    const size_t NumBlocks = 1000;
+    void* blocks[NumBlocks];
+    EXPECT_EQ(NumBlocks, allocator.allocateBatch(util::bytes(40), mem::DefaultAlignment, NumBlocks, blocks));
+    EXPECT_TRUE(allocator.check());
+    EXPECT_EQ(NumBlocks, allocator.getStats().allocatedBlocks);
+    expectStatsMatch(allocator);
+
+    // Carved one after another from a single free block
+    for (size_t i = 0; i < NumBlocks; ++i) {
+        EXPECT_LE(util::bytes(40), allocator.getAllocationSize(blocks[i]));
+        if (i > 0) {
+            EXPECT_EQ((char*)blocks[i - 1] + 40 + 8, blocks[i]);
+        }
+        memset(blocks[i], 0xff, util::bytes(40));
+    }
+    EXPECT_TRUE(allocator.check());
+
+    allocator.releaseBatch(blocks, NumBlocks);
+    EXPECT_TRUE(allocator.check());
+    EXPECT_EQ(0, allocator.getStats().allocatedBlocks);
+
+    // Aligned batches fall back to allocating one block at a time
+    EXPECT_EQ(10, allocator.allocateBatch(util::bytes(40), 64, 10, blocks));
+    for (size_t i = 0; i < 10; ++i) {
+        EXPECT_EQ(0, (size_t)blocks[i]%64);
+    }
+    allocator.releaseBatch(blocks, 10);
+    EXPECT_TRUE(allocator.check());
+    expectStatsMatch(allocator);
+}
+
+TEST(HeapAllocator, Reallocate)
+{
+    mem::HeapAllocator allocator;
+
+    char* x = (char*)allocator.allocate(util::bytes(1000));
+    char* y = (char*)allocator.allocate(util::bytes(1000));
+    char* z = (char*)allocator.allocate(util::bytes(1000));
+    memset(x, 1, util::bytes(1000));
+
+    // Blocks are carved from the end of the free space so y follows z
+    ASSERT_EQ(z + 1000 + 8, y);
+    allocator.release(y);
+
+    // Grows into the free block after it
+    EXPECT_TRUE(allocator.tryExpandInPlace(z, util::bytes(1500)));
+    EXPECT_LE(util::bytes(1500), allocator.getAllocationSize(z));
+    EXPECT_GT(util::bytes(1600), allocator.getAllocationSize(z));
+    EXPECT_TRUE(allocator.check());
+
+    // Giving the end back makes room again
+    allocator.shrinkInPlace(z, util::bytes(100));
+    EXPECT_GT(util::bytes(200), allocator.getAllocationSize(z));
+    EXPECT_EQ(z, allocator.reallocate(z, util::bytes(1800)));
+    EXPECT_TRUE(allocator.check());
+    expectStatsMatch(allocator);
+
+    // There's nothing free after x, it has to move
+    EXPECT_FALSE(allocator.tryExpandInPlace(x, util::bytes(2000)));
+    char* moved = (char*)allocator.reallocate(x, util::bytes(4000));
+    EXPECT_NE(x, moved);
+    for (size_t i = 0; i < 1000; ++i) {
+        ASSERT_EQ(1, moved[i]);
+    }
+    EXPECT_TRUE(allocator.check());
+
+    allocator.release(moved);
+    allocator.release(z);
+    EXPECT_EQ(0, allocator.getStats().allocatedBlocks);
+    expectStatsMatch(allocator);
+}
+
+TEST(HeapAllocator, ReallocateExternal)
+{
+    mem::HeapAllocator allocator;
+
+    char* x = (char*)allocator.allocate(util::megabytes(40));
+    x[0] = 1;
+    x[util::megabytes(40) - 1] = 2;
+
+    x = (char*)allocator.reallocate(x, util::megabytes(80));
+    EXPECT_LE(util::megabytes(80), allocator.getAllocationSize(x));
+    EXPECT_EQ(1, x[0]);
+    EXPECT_EQ(2, x[util::megabytes(40) - 1]);
+    x[util::megabytes(80) - 1] = 3;
+    EXPECT_EQ(1, allocator.getStats().numExternalSegments);
+    EXPECT_TRUE(allocator.check());
+    expectStatsMatch(allocator);
+
+    allocator.shrinkInPlace(x, util::megabytes(35));
+    EXPECT_GT(util::megabytes(36), allocator.getAllocationSize(x));
+    EXPECT_EQ(1, x[0]);
+    EXPECT_TRUE(allocator.check());
+
+    allocator.release(x);
+    EXPECT_EQ(0, allocator.getStats().numExternalSegments);
+    expectStatsMatch(allocator);
+}
+
+TEST(HeapAllocator, ReallocateRegion)
+{
+    HeapCheckedRegion region;
+
+    char* x = (char*)region.allocate(util::bytes(100), 4, mem::SourceInfo());
+    memset(x, 7, util::bytes(100));
+
+    x = (char*)region.reallocate(x, util::bytes(5000), 4, mem::SourceInfo());
+    for (size_t i = 0; i < 100; ++i) {
+        ASSERT_EQ(7, x[i]);
+    }
+    memset(x, 7, util::bytes(5000));
+
+    region.shrinkInPlace(x, util::bytes(10));
+    region.release(x);
+}
@@ -1,4 +1,5 @@
 #include <gtest/gtest.h>
+#include <cstdint>
 #include <string>
 
 #include "mem/linearAllocator.h"
@@ -8,6 +9,9 @@ struct SomeStruct
     char a,b,c;
 };
 
+// Every allocation is preceded by its size
+const size_t HeaderSize = sizeof(uint32_t);
+
 TEST(LinearAllocator, Alloc)
 {
     char mem[1024];
@@ -19,17 +23,17 @@ TEST(LinearAllocator, Alloc)
 
     SomeStruct* s = (SomeStruct*)allocator.allocate(sizeof(SomeStruct));
     SomeStruct* t = (SomeStruct*)allocator.allocate(sizeof(SomeStruct));
-    EXPECT_EQ((char*)(s), mem);
-    EXPECT_EQ((char*)(t), mem + sizeof(SomeStruct));
+    EXPECT_EQ((char*)(s), mem + HeaderSize);
+    EXPECT_EQ((char*)(t), mem + 2*HeaderSize + sizeof(SomeStruct));
 
     mem::LinearAllocator::Stats info2 = allocator.getStats();
-    EXPECT_EQ(2*sizeof(SomeStruct), info2.allocatedBytes);
-    EXPECT_EQ(1024 - 2*sizeof(SomeStruct), info2.freeBytes);
+    EXPECT_EQ(2*(HeaderSize + sizeof(SomeStruct)), info2.allocatedBytes);
+    EXPECT_EQ(1024 - 2*(HeaderSize + sizeof(SomeStruct)), info2.freeBytes);
 }
 
 TEST(LinearAllocator, AllocAlign)
 {
-    char mem[1024];
+    alignas(8) char mem[1024];
     mem::LinearAllocator allocator(mem, 1024, 8);
 
     mem::LinearAllocator::Stats info1 = allocator.getStats();
@@ -38,12 +42,12 @@ TEST(LinearAllocator, AllocAlign)
 
     SomeStruct* s = (SomeStruct*)allocator.allocate(sizeof(SomeStruct));
     SomeStruct* t = (SomeStruct*)allocator.allocate(sizeof(SomeStruct));
-    EXPECT_EQ(mem, (char*)(s));
+    EXPECT_EQ(mem + 8, (char*)(s));
     EXPECT_EQ((char*)s + 8, (char*)(t));
 
     mem::LinearAllocator::Stats info2 = allocator.getStats();
-    EXPECT_EQ(2*8, info2.allocatedBytes);
-    EXPECT_EQ(1024 - 2*8, info2.freeBytes);
+    EXPECT_EQ(2*8 + sizeof(SomeStruct), info2.allocatedBytes);
+    EXPECT_EQ(1024 - 2*8 - sizeof(SomeStruct), info2.freeBytes);
 }
 
 TEST(LinearAllocator, Release)
@@ -57,7 +61,7 @@ TEST(LinearAllocator, Release)
     allocator.release(s);
 
     SomeStruct* u = (SomeStruct*)allocator.allocate(sizeof(SomeStruct));
-    EXPECT_EQ((char*)u, mem + sizeof(SomeStruct));
+    EXPECT_EQ((char*)u, mem + 2*HeaderSize + sizeof(SomeStruct));
 }
 
 TEST(LinearAllocator, OutOfMemory)
@@ -83,3 +87,107 @@ TEST(LinearAllocator, Clear)
     EXPECT_EQ(1024, info1.freeBytes);
 }
 
+
+TEST(LinearAllocator, Rewind)
+{
+    char mem[1024];
+    mem::LinearAllocator allocator(mem, 1024, 1);
+
+    allocator.allocate(10);
+    mem::LinearAllocator::Marker marker = allocator.getMarker();
+    char* s = (char*)allocator.allocate(20);
+    allocator.allocate(30);
+    EXPECT_EQ(60 + 3*HeaderSize, allocator.getStats().allocatedBytes);
+
+    allocator.rewind(marker);
+    EXPECT_EQ(10 + HeaderSize, allocator.getStats().allocatedBytes);
+    EXPECT_EQ(s, allocator.allocate(20));
+}
+
+TEST(LinearAllocator, ScopedMarker)
+{
+    char mem[1024];
+    mem::LinearAllocator allocator(mem, 1024, 1);
+
+    allocator.allocate(10);
+    {
+        mem::ScopedMarker<mem::LinearAllocator> outer(allocator);
+        allocator.allocate(20);
+        {
+            // The inner phase's temporaries go without touching the outer phase's
+            mem::ScopedMarker<mem::LinearAllocator> inner(allocator);
+            allocator.allocate(100);
+            EXPECT_EQ(130 + 3*HeaderSize, allocator.getStats().allocatedBytes);
+        }
+        EXPECT_EQ(30 + 2*HeaderSize, allocator.getStats().allocatedBytes);
+    }
+    EXPECT_EQ(10 + HeaderSize, allocator.getStats().allocatedBytes);
+}
+
+TEST(LinearAllocator, PerCallAlignment)
+{
+    char mem[1024];
+    mem::LinearAllocator allocator(mem, 1024, 1);
+
+    // DefaultAlignment stands for the allocator's own alignment
+    for (size_t alignment: {2, 8, 16, 32, 64}) {
+        char* s = (char*)allocator.allocate(3, alignment);
+        EXPECT_EQ(0, (size_t)s%alignment);
+
+        // The offset is placed in front of the aligned address
+        char* t = (char*)allocator.allocate(3, alignment, 4);
+        EXPECT_EQ(0, (size_t)(t + 4)%alignment);
+    }
+
+    // The allocator's alignment is a minimum
+    alignas(16) char aligned[1024];
+    mem::LinearAllocator allocator16(aligned, 1024, 16);
+    EXPECT_EQ(0, (size_t)allocator16.allocate(3, 2)%16);
+    EXPECT_EQ(0, (size_t)allocator16.allocate(3, 64)%64);
+}
+
+TEST(LinearAllocator, AllocationSize)
+{
+    char mem[1024];
+    mem::LinearAllocator allocator(mem, 1024);
+
+    void* s = allocator.allocate(3);
+    void* t = allocator.allocate(100, 64, 4);
+    void* u = allocator.allocate(0);
+    EXPECT_EQ(3, allocator.getAllocationSize(s));
+    EXPECT_EQ(100, allocator.getAllocationSize(t));
+    EXPECT_EQ(0, allocator.getAllocationSize(u));
+
+    // Padding and headers count against the space left
+    EXPECT_EQ(nullptr, allocator.allocate(1024 - allocator.getStats().allocatedBytes));
+}
+
+TEST(LinearAllocator, AlignedLinearAllocator)
+{
+    alignas(16) char mem[1024];
+    mem::AlignedLinearAllocator<16> allocator(mem, 1024);
+
+    char* s = (char*)allocator.allocate(3);
+    char* t = (char*)allocator.allocate(3);
+    EXPECT_EQ(mem + 16, s);
+    EXPECT_EQ(mem + 32, t);
+    EXPECT_EQ(3, allocator.getAllocationSize(t));
+
+    char* u = (char*)allocator.allocate(3, 16, 4);
+    EXPECT_EQ(0, (size_t)(u + 4)%16);
+
+    // Stricter alignments still work
+    char* v = (char*)allocator.allocate(3, 128);
+    EXPECT_EQ(0, (size_t)v%128);
+
+    mem::LinearAllocator::Marker marker = allocator.getMarker();
+    allocator.allocate(100);
+    allocator.rewind(marker);
+    EXPECT_EQ(marker, allocator.getMarker());
+
+    EXPECT_EQ(nullptr, allocator.allocate(1024));
+
+    // Sizes which would overflow the address or the size header
+    EXPECT_EQ(nullptr, allocator.allocate(SIZE_MAX - 8));
+    EXPECT_EQ(nullptr, allocator.allocate(mem::LinearAllocator::MaxAllocationSize + 1));
+}
@@ -0,0 +1,298 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "mem/boundsChecking.h"
+#include "mem/lockFreePoolAllocator.h"
+#include "mem/marking.h"
+#include "mem/poolAllocator.h"
+#include "mem/region.h"
+#include "mem/threading.h"
+#include "mem/tracking.h"
+
+#include "util/stopwatch.h"
+
+typedef mem::Region<
+    mem::LockFreePoolAllocator,
+    mem::SingleThreaded,
+    mem::NoBoundsChecking,
+    mem::NoTracking,
+    mem::NoMarking>
+        LockFreePoolRegion;
+
+typedef mem::Region<
+    mem::PoolAllocator,
+    mem::MultiThreaded<std::mutex>,
+    mem::NoBoundsChecking,
+    mem::NoTracking,
+    mem::NoMarking>
+        LockedPoolRegion;
+
+TEST(LockFreePoolAllocator, AllocRelease)
+{
+    mem::LockFreePoolAllocator allocator(24, 8, util::kilobytes(4));
+    EXPECT_EQ(24, allocator.getElementSize());
+    EXPECT_EQ(0, allocator.getNumChunks());
+
+    void* x = allocator.allocate(24);
+    void* y = allocator.allocate(10);
+    EXPECT_TRUE(x != nullptr);
+    EXPECT_TRUE(y != nullptr);
+    EXPECT_NE(x, y);
+    EXPECT_EQ(24, allocator.getAllocationSize(x));
+    EXPECT_EQ(1, allocator.getNumChunks());
+
+    // The most recently released element is handed out first
+    allocator.release(x);
+    allocator.release(y);
+    EXPECT_EQ(y, allocator.allocate(24));
+    EXPECT_EQ(x, allocator.allocate(24));
+
+    EXPECT_TRUE(allocator.allocate(25) == nullptr);
+    EXPECT_TRUE(allocator.allocate(8, 16) == nullptr);
+
+    allocator.release(x);
+    allocator.release(y);
+}
+
+TEST(LockFreePoolAllocator, Chunks)
+{
+    mem::LockFreePoolAllocator allocator(100, 4, util::kilobytes(4));
+
+    std::vector<char*> allocs;
+    for (int i = 0; i < 1000; ++i) {
+        char* x = (char*)allocator.allocate(100);
+        ASSERT_TRUE(x != nullptr);
+        memset(x, i%256, 100);
+        allocs.push_back(x);
+    }
+    size_t numChunks = allocator.getNumChunks();
+    EXPECT_LT(1, numChunks);
+
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_EQ(i%256, (unsigned char)allocs[i][0]);
+        EXPECT_EQ(i%256, (unsigned char)allocs[i][99]);
+        allocator.release(allocs[i]);
+    }
+
+    // Everything is reused before another chunk is needed
+    size_t numFree = allocator.getNumFreeElements();
+    EXPECT_LE(1000, numFree);
+    for (int i = 0; i < 1000; ++i) {
+        allocator.allocate(100);
+    }
+    EXPECT_EQ(numChunks, allocator.getNumChunks());
+    EXPECT_EQ(numFree - 1000, allocator.getNumFreeElements());
+}
+
+TEST(LockFreePoolAllocator, ProducerConsumerStress)
+{
+    // Every thread allocates batches and swaps them with batches other threads allocated,
+    // which it checks and releases. Elements are written in full so one handed out to
+    // two threads at once shows up as a torn batch.
+    const size_t NumThreads = 8;
+    const size_t NumRounds = 5000;
+    const size_t BatchSize = 32;
+    const size_t NumWords = 4;
+
+    mem::LockFreePoolAllocator allocator(NumWords*sizeof(uint64_t), 8, util::kilobytes(4));
+
+    std::mutex exchangeLock;
+    std::vector<std::vector<uint64_t*>> exchange;
+    std::atomic<size_t> numTorn(0);
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < NumThreads; ++t) {
+        threads.push_back(std::thread([&, t]() {
+            for (size_t round = 0; round < NumRounds; ++round) {
+                uint64_t tag = (static_cast<uint64_t>(t) << 32) | round;
+
+                std::vector<uint64_t*> batch;
+                for (size_t i = 0; i < BatchSize; ++i) {
+                    uint64_t* x = (uint64_t*)allocator.allocate(NumWords*sizeof(uint64_t));
+                    for (size_t w = 0; w < NumWords; ++w) {
+                        x[w] = tag;
+                    }
+                    batch.push_back(x);
+                }
+
+                std::vector<uint64_t*> other;
+                {
+                    std::lock_guard<std::mutex> guard(exchangeLock);
+                    exchange.push_back(std::move(batch));
+                    if (exchange.size() > NumThreads) {
+                        other = std::move(exchange.front());
+                        exchange.erase(exchange.begin());
+                    }
+                }
+
+                if (!other.empty()) {
+                    uint64_t otherTag = other[0][0];
+                    for (uint64_t* x: other) {
+                        for (size_t w = 0; w < NumWords; ++w) {
+                            if (x[w] != otherTag) {
+                                numTorn++;
+                            }
+                        }
+                        allocator.release(x);
+                    }
+                }
+            }
+        }));
+    }
+
+    for (std::thread& thread: threads) {
+        thread.join();
+    }
+    EXPECT_EQ(0, numTorn.load());
+
+    size_t numOutstanding = 0;
+    for (std::vector<uint64_t*>& batch: exchange) {
+        for (uint64_t* x: batch) {
+            allocator.release(x);
+            numOutstanding++;
+        }
+    }
+    EXPECT_EQ(NumThreads*BatchSize, numOutstanding);
+
+    // Nothing was lost or pushed twice, every element of every chunk is free
+    std::vector<void*> allocs;
+    size_t numFree = allocator.getNumFreeElements();
+    for (size_t i = 0; i < numFree; ++i) {
+        allocs.push_back(allocator.allocate(8));
+    }
+    std::sort(allocs.begin(), allocs.end());
+    EXPECT_TRUE(std::adjacent_find(allocs.begin(), allocs.end()) == allocs.end());
+    EXPECT_EQ(0, allocator.getNumFreeElements());
+}
+
+TEST(LockFreePoolAllocator, Region)
+{
+    const size_t ElementSize = 64;
+    LockFreePoolRegion region(ElementSize);
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 4; ++t) {
+        threads.push_back(std::thread([&region]() {
+            std::vector<void*> allocs;
+            for (int i = 0; i < 10000; ++i) {
+                void* x = region.allocate(ElementSize, 8, mem::SourceInfo());
+                ASSERT_TRUE(x != nullptr);
+                allocs.push_back(x);
+            }
+            for (void* ptr: allocs) {
+                region.release(ptr);
+            }
+        }));
+    }
+
+    for (std::thread& thread: threads) {
+        thread.join();
+    }
+}
+
+namespace {
+
+// Single producer, single consumer ring of pointers so handing objects between threads
+// costs next to nothing compared to the allocator
+class PointerRing
+{
+public:
+    PointerRing() : _head(0), _tail(0) {}
+
+    bool push(void* ptr)
+    {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) == Size) {
+            return false;
+        }
+        _slots[tail%Size] = ptr;
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    void* pop()
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        void* ptr = _slots[head%Size];
+        _head.store(head + 1, std::memory_order_release);
+        return ptr;
+    }
+
+private:
+    static const size_t Size = 1024;
+    void* _slots[Size];
+
+    // Keep the two ends on separate cache lines
+    std::atomic<size_t> _head;
+    char _padding[64];
+    std::atomic<size_t> _tail;
+};
+
+// Pairs of threads, one allocating objects and handing them to the other which releases
+// them. Returns millions of objects passed per second.
+double producerConsumerBenchmark(mem::RegionBase& region, size_t numPairs, size_t numObjects)
+{
+    std::vector<PointerRing> rings(numPairs);
+    std::vector<std::thread> threads;
+
+    util::Stopwatch stopwatch;
+    stopwatch.start();
+
+    for (size_t p = 0; p < numPairs; ++p) {
+        PointerRing& ring = rings[p];
+        threads.push_back(std::thread([&region, &ring, numObjects]() {
+            for (size_t i = 0; i < numObjects; ++i) {
+                void* x = region.allocate(64, 8, mem::SourceInfo());
+                *(size_t*)x = i;
+                while (!ring.push(x)) {
+                    std::this_thread::yield();
+                }
+            }
+        }));
+        threads.push_back(std::thread([&region, &ring, numObjects]() {
+            for (size_t i = 0; i < numObjects; ++i) {
+                void* x;
+                while (!(x = ring.pop())) {
+                    std::this_thread::yield();
+                }
+                region.release(x);
+            }
+        }));
+    }
+
+    for (std::thread& thread: threads) {
+        thread.join();
+    }
+
+    stopwatch.stop();
+    return numPairs*numObjects/stopwatch.getElapsed()/1e6;
+}
+
+}
+
+TEST(DISABLED_LockFreePoolAllocator, ProducerConsumerBenchmark)
+{
+    const size_t NumObjects = 2000000;
+    const size_t ElementSize = 64;
+
+    printf("Objects allocated on one thread and released on another, M objects/s\n");
+    printf("  pairs    lock-free    mutex-guarded\n");
+    for (size_t numPairs: {1, 2, 4, 8}) {
+        LockFreePoolRegion lockFree(ElementSize);
+        LockedPoolRegion locked(ElementSize);
+
+        double lockFreeRate = producerConsumerBenchmark(lockFree, numPairs, NumObjects);
+        double lockedRate = producerConsumerBenchmark(locked, numPairs, NumObjects);
+        printf("  %5zu    %9.2f    %13.2f\n", numPairs, lockFreeRate, lockedRate);
+    }
+}
@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 
+#include <cstring>
+
 #include "mem/mallocAllocator.h"
 #include "util/units.h"
 
@@ -101,3 +103,13 @@ TEST(MallocAllocator, GetAllocationSize)
     EXPECT_LE(Overhead + 3, diff);
 }
 
+TEST(MallocAllocator, ReallocateOutOfMemory)
+{
+    mem::MallocAllocator alloc;
+    char* x = (char*)alloc.allocate(16);
+    strcpy(x, "unchanged");
+    EXPECT_TRUE(alloc.allocate((size_t)1 << 62) == nullptr);
+    EXPECT_TRUE(alloc.reallocate(x, (size_t)1 << 62) == nullptr);
+    EXPECT_STREQ("unchanged", x);
+    alloc.release(x);
+}
@@ -1,6 +1,12 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
 #include <gtest/gtest.h>
 
 #include "mem/pageAllocator.h"
+#include "util/memory.h"
+#include "util/stopwatch.h"
 #include "util/units.h"
 
 TEST(PageAllocator, ZeroSizeAlloc)
@@ -143,3 +149,129 @@ TEST(PageAllocator, GetAllocationSize)
     EXPECT_EQ(8152, alloc.getAllocationSize(x));
 }
 
+
+TEST(PageAllocator, HugePages)
+{
+    const size_t HugePageSize = util::getHugePageSize();
+
+    // Falls back to regular pages if huge pages aren't available, either way the
+    // allocation is rounded to a huge page
+    util::PageBacking backings[] = {util::TransparentHugePages, util::ExplicitHugePages};
+    for (util::PageBacking backing: backings) {
+        mem::PageAllocator alloc(backing);
+
+        void* x = alloc.allocate(12, 1);
+        EXPECT_EQ(HugePageSize - 40, alloc.getAllocationSize(x));
+        EXPECT_EQ(0, ((size_t)x - 40)%HugePageSize);
+        memset(x, 0xff, alloc.getAllocationSize(x));
+
+        void* y = alloc.allocate(HugePageSize + 1, 16);
+        EXPECT_EQ(0, (size_t)y%16);
+        EXPECT_LE(HugePageSize + 1, alloc.getAllocationSize(y));
+        memset(y, 0xff, alloc.getAllocationSize(y));
+
+        alloc.release(x);
+        alloc.release(y);
+    }
+}
+
+TEST(PageAllocator, GuardPages)
+{
+    const size_t PageSize = util::getPageSize();
+    mem::PageAllocator alloc(util::RegularPages, mem::PageAllocator::GuardPages);
+
+    // The memory ends right at a page boundary, or as close as the alignment allows
+    const size_t sizes[] = {0, 1, 13, 100, PageSize - 1, PageSize, 5000};
+    std::vector<void*> allocs;
+    for (size_t size: sizes) {
+        char* x = (char*)alloc.allocate(size, 1);
+        EXPECT_EQ(0, (size_t)(x + size)%PageSize);
+        EXPECT_EQ(size, alloc.getAllocationSize(x));
+        memset(x, 0xff, size);
+        allocs.push_back(x);
+
+        char* y = (char*)alloc.allocate(size, 16, 4);
+        EXPECT_EQ(0, ((size_t)y + 4)%16);
+        EXPECT_LT(PageSize - 16, (size_t)(y + size - 1)%PageSize);
+        allocs.push_back(y);
+    }
+
+    volatile char* z = (char*)alloc.allocate(100, 1);
+    z[99] = 1;
+    EXPECT_DEATH(z[100] = 1, "");
+
+    for (void* ptr: allocs) {
+        alloc.release(ptr);
+    }
+}
+
+TEST(PageAllocator, Quarantine)
+{
+    mem::PageAllocator alloc(util::RegularPages, mem::PageAllocator::Quarantine);
+
+    volatile char* x = (char*)alloc.allocate(100, 1);
+    x[0] = 1;
+    alloc.release((void*)x);
+    EXPECT_DEATH(x[0] = 1, "");
+
+    // The oldest released pages are unmapped once the quarantine is full, new allocations
+    // never reuse quarantined addresses
+    std::vector<void*> released;
+    for (size_t i = 0; i < mem::PageAllocator::QuarantineSize*2; ++i) {
+        void* y = alloc.allocate(100, 1);
+        EXPECT_TRUE(std::find(released.end() - std::min(released.size(), mem::PageAllocator::QuarantineSize), 
+                    released.end(), y) == released.end());
+        alloc.release(y);
+        released.push_back(y);
+    }
+
+    mem::GuardPageAllocator guardAlloc;
+    EXPECT_EQ(mem::PageAllocator::GuardPages | mem::PageAllocator::Quarantine, guardAlloc.getFlags());
+    void* z = guardAlloc.allocate(10, 1);
+    guardAlloc.release(z);
+}
+
+namespace {
+
+double randomAccessBenchmark(util::PageBacking backing, size_t numBytes, size_t numAccesses)
+{
+    mem::PageAllocator alloc(backing);
+    size_t* data = (size_t*)alloc.allocate(numBytes, sizeof(size_t));
+    size_t numElements = numBytes/sizeof(size_t);
+    memset(data, 0, numBytes);
+
+    util::Stopwatch stopwatch;
+    stopwatch.start();
+
+    // xorshift keeps the index generation cheap compared to the TLB misses
+    size_t x = 88172645463325252ull;
+    for (size_t i = 0; i < numAccesses; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        data[x%numElements] += i;
+    }
+
+    stopwatch.stop();
+    alloc.release(data);
+    return stopwatch.getElapsed();
+}
+
+}
+
+TEST(DISABLED_PageAllocator, HugePageBenchmark)
+{
+    // Random access over a buffer much larger than the TLB reach of regular pages. Run with
+    // perf stat -e dTLB-load-misses to see the TLB side of things.
+    const size_t NumBytes = util::megabytes(1024);
+    const size_t NumAccesses = 50000000;
+
+    double regular = randomAccessBenchmark(util::RegularPages, NumBytes, NumAccesses);
+    double transparent = randomAccessBenchmark(util::TransparentHugePages, NumBytes, NumAccesses);
+    double explicitHuge = randomAccessBenchmark(util::ExplicitHugePages, NumBytes, NumAccesses);
+
+    printf("Random access over %zu MB, %zu accesses\n", NumBytes/util::megabytes(1), NumAccesses);
+    printf("  regular pages:          %.3fs (%.1f M accesses/s)\n", regular, NumAccesses/regular/1e6);
+    printf("  transparent huge pages: %.3fs (%.1f M accesses/s)\n", transparent, NumAccesses/transparent/1e6);
+    printf("  explicit huge pages:    %.3fs (%.1f M accesses/s)\n", explicitHuge, NumAccesses/explicitHuge/1e6);
+}
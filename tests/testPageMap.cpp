@@ -0,0 +1,54 @@
+#include <gtest/gtest.h>
+
+#include "mem/pageMap.h"
+#include "util/memory.h"
+#include "util/units.h"
+
+TEST(PageMap, SetGetClear)
+{
+    mem::PageMap<int> pageMap;
+    int a = 1;
+    int b = 2;
+
+    const size_t Size = util::megabytes(1);
+    char* mem = (char*)util::pageAllocate(Size);
+    EXPECT_EQ(nullptr, pageMap.get(mem));
+
+    // First half maps to a, second to b
+    pageMap.set(mem, Size/2, &a);
+    pageMap.set(mem + Size/2, Size/2, &b);
+
+    EXPECT_EQ(&a, pageMap.get(mem));
+    EXPECT_EQ(&a, pageMap.get(mem + Size/2 - 1));
+    EXPECT_EQ(&b, pageMap.get(mem + Size/2));
+    EXPECT_EQ(&b, pageMap.get(mem + Size - 1));
+    EXPECT_EQ(nullptr, pageMap.get(mem + Size));
+
+    pageMap.clear(mem, Size/2);
+    EXPECT_EQ(nullptr, pageMap.get(mem));
+    EXPECT_EQ(&b, pageMap.get(mem + Size/2));
+
+    pageMap.clear(mem + Size/2, Size/2);
+    EXPECT_EQ(nullptr, pageMap.get(mem + Size - 1));
+
+    util::pageRelease(mem, Size);
+}
+
+TEST(PageMap, LargeRange)
+{
+    mem::PageMap<int> pageMap;
+    int a = 1;
+
+    // Spans multiple leaves
+    const size_t Size = util::megabytes(64);
+    char* mem = (char*)util::pageAllocate(Size);
+
+    pageMap.set(mem, Size, &a);
+    for (size_t offset = 0; offset < Size; offset += util::kilobytes(4)) {
+        EXPECT_EQ(&a, pageMap.get(mem + offset));
+    }
+    pageMap.clear(mem, Size);
+    EXPECT_EQ(nullptr, pageMap.get(mem + Size/2));
+
+    util::pageRelease(mem, Size);
+}
@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <list>
+#include <map>
+#include <vector>
+
+#include "mem/boundsChecking.h"
+#include "mem/marking.h"
+#include "mem/poolAllocator.h"
+#include "mem/region.h"
+#include "mem/stlAdapter.h"
+#include "mem/threading.h"
+#include "mem/tracking.h"
+
+typedef mem::Region<
+    mem::FixedPoolAllocator<64>,
+    mem::SingleThreaded,
+    mem::NoBoundsChecking,
+    mem::NoTracking,
+    mem::NoMarking>
+        NodePoolRegion;
+
+typedef mem::Region<
+    mem::PoolAllocator,
+    mem::SingleThreaded,
+    mem::BoundsChecking,
+    mem::NoTracking,
+    mem::Marking>
+        PoolCheckedRegion;
+
+TEST(PoolAllocator, AllocRelease)
+{
+    mem::PoolAllocator allocator(24);
+    EXPECT_EQ(24, allocator.getElementSize());
+
+    void* x = allocator.allocate(24);
+    void* y = allocator.allocate(10);
+    EXPECT_TRUE(x != nullptr);
+    EXPECT_TRUE(y != nullptr);
+    EXPECT_EQ(24, (char*)y - (char*)x);
+    EXPECT_EQ(24, allocator.getAllocationSize(y));
+
+    mem::PoolAllocator::Stats stats = allocator.getStats();
+    EXPECT_EQ(2, stats.allocatedElements);
+    EXPECT_EQ(1, stats.numChunks);
+
+    // The most recently released element is handed out first
+    allocator.release(x);
+    allocator.release(y);
+    EXPECT_EQ(y, allocator.allocate(24));
+    EXPECT_EQ(x, allocator.allocate(24));
+
+    allocator.release(x);
+    allocator.release(y);
+    EXPECT_EQ(0, allocator.getStats().allocatedElements);
+}
+
+TEST(PoolAllocator, ElementSize)
+{
+    // Elements are large enough to hold the free list and are padded to their alignment
+    mem::PoolAllocator tiny(1);
+    EXPECT_EQ(sizeof(void*), tiny.getElementSize());
+
+    mem::PoolAllocator padded(20, 16);
+    EXPECT_EQ(32, padded.getElementSize());
+    EXPECT_EQ(16, padded.getElementAlignment());
+
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_EQ(0, (size_t)padded.allocate(20, 16)%16);
+    }
+
+    // Requests the elements can't hold fail
+    EXPECT_TRUE(padded.allocate(33) == nullptr);
+    EXPECT_TRUE(padded.allocate(16, 64) == nullptr);
+    EXPECT_TRUE(padded.allocate(16, 16, 4) == nullptr);
+    EXPECT_TRUE(padded.allocate(16, 4, 4) != nullptr);
+}
+
+TEST(PoolAllocator, Chunks)
+{
+    mem::PoolAllocator allocator(100, 4, util::kilobytes(4));
+    EXPECT_EQ(0, allocator.getStats().numChunks);
+
+    std::vector<char*> allocs;
+    for (int i = 0; i < 1000; ++i) {
+        char* x = (char*)allocator.allocate(100);
+        ASSERT_TRUE(x != nullptr);
+        memset(x, i%256, 100);
+        allocs.push_back(x);
+    }
+
+    mem::PoolAllocator::Stats stats = allocator.getStats();
+    EXPECT_LT(1, stats.numChunks);
+    EXPECT_EQ(1000, stats.allocatedElements);
+
+    // No element was handed out twice
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_EQ(i%256, (unsigned char)allocs[i][0]);
+        EXPECT_EQ(i%256, (unsigned char)allocs[i][99]);
+    }
+
+    for (char* ptr: allocs) {
+        allocator.release(ptr);
+    }
+
+    // Everything is reused before another chunk is needed
+    for (int i = 0; i < 1000; ++i) {
+        allocator.allocate(100);
+    }
+    EXPECT_EQ(stats.numChunks, allocator.getStats().numChunks);
+}
+
+TEST(PoolAllocator, Region)
+{
+    PoolCheckedRegion region(32 + mem::BoundsChecking::SizeFront + mem::BoundsChecking::SizeBack);
+
+    std::vector<void*> allocs;
+    for (int i = 0; i < 100; ++i) {
+        void* x = region.allocate(32, 4, mem::SourceInfo());
+        ASSERT_TRUE(x != nullptr);
+        memset(x, 0xff, 32);
+        allocs.push_back(x);
+    }
+
+    for (void* ptr: allocs) {
+        region.release(ptr);
+    }
+}
+
+TEST(PoolAllocator, StlNodeContainers)
+{
+    NodePoolRegion region;
+
+    std::list<int, mem::StlAdapter<int>> list((mem::StlAdapter<int>(region)));
+    for (int i = 0; i < 1000; ++i) {
+        list.push_back(i);
+    }
+    EXPECT_EQ(1000, list.size());
+    EXPECT_EQ(999, list.back());
+
+    typedef std::pair<const int, int> Value;
+    std::map<int, int, std::less<int>, mem::StlAdapter<Value>> map(
+            (std::less<int>()), mem::StlAdapter<Value>(region));
+    for (int i = 0; i < 1000; ++i) {
+        map[i] = i*2;
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        map.erase(i);
+    }
+    EXPECT_EQ(500, map.size());
+    EXPECT_EQ(2, map[1]);
+    EXPECT_EQ(1998, map[999]);
+}
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <cstdlib>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -67,3 +69,157 @@ TEST_F(RegionF, Default)
 }
 
 
+
+TEST_F(RegionF, Batch)
+{
+    mem::Region<
+        mem::MallocAllocator,
+        mem::SingleThreaded,
+        mem::NoBoundsChecking,
+        mem::CountTracking,
+        mem::NoMarking> 
+            region;
+
+    void* blocks[100];
+    EXPECT_EQ(100, region.allocateBatch(24, 16, 100, blocks, mem::SourceInfo("test_file.cpp", 123)));
+    EXPECT_EQ(100, region.trackingPolicy().getNumberOfAllocations());
+
+    for (size_t i = 0; i < 100; ++i) {
+        EXPECT_EQ(0, (size_t)(blocks[i])%16);
+    }
+
+    region.releaseBatch(blocks, 100);
+    EXPECT_EQ(0, region.trackingPolicy().getNumberOfAllocations());
+}
+
+TEST_F(RegionF, ReleaseChecksGuards)
+{
+    typedef mem::Region<
+        mem::MallocAllocator,
+        mem::SingleThreaded,
+        mem::BoundsChecking,
+        mem::NoTracking,
+        mem::NoMarking> 
+            CheckedMallocRegion;
+    CheckedMallocRegion region;
+
+    // The allocator's size includes its bookkeeping, the back guard is found without it
+    char* x = (char*)region.allocate(13, 4, mem::SourceInfo());
+    std::fill(x, x + 13, 1);
+    x = (char*)region.reallocate(x, 29, 4, mem::SourceInfo());
+    std::fill(x, x + 29, 1);
+    region.shrinkInPlace(x, 7);
+    std::fill(x, x + 7, 1);
+
+    // A failed reallocation leaves the block and its guards as they were
+    EXPECT_TRUE(region.reallocate(x, (size_t)1 << 62, 4, mem::SourceInfo()) == nullptr);
+    region.release(x);
+
+    char* y = (char*)region.allocate(13, 4, mem::SourceInfo());
+    char back = y[13];
+    y[13] = 0;
+    EXPECT_DEATH(region.release(y), "Bounds check failed");
+    EXPECT_DEATH(region.releaseBatch((void**)&y, 1), "Bounds check failed");
+    y[13] = back;
+
+    char front = y[-1];
+    y[-1] = 0;
+    EXPECT_DEATH(region.release(y), "Bounds check failed");
+    y[-1] = front;
+    region.releaseBatch((void**)&y, 1);
+}
+
+TEST_F(RegionF, VerifyGuards)
+{
+    mem::Region<
+        mem::MallocAllocator,
+        mem::SingleThreaded,
+        mem::BoundsChecking,
+        mem::SourceTracking,
+        mem::NoMarking> 
+            region;
+
+    std::vector<char*> allocs;
+    for (size_t i = 0; i < 200; ++i) {
+        allocs.push_back((char*)region.allocate(i + 1, 4, mem::SourceInfo("test_file.cpp", 123)));
+    }
+    EXPECT_EQ(0, region.verifyAllGuards());
+
+    // One past the end, one before the start
+    char back = allocs[17][18];
+    char front = allocs[150][-1];
+    allocs[17][18] = 0;
+    allocs[150][-1] = 0;
+
+    void* corrupted[4];
+    EXPECT_EQ(2, region.verifyAllGuards(corrupted, 4));
+    EXPECT_TRUE(std::find(corrupted, corrupted + 2, allocs[17]) != corrupted + 2);
+    EXPECT_TRUE(std::find(corrupted, corrupted + 2, allocs[150]) != corrupted + 2);
+    EXPECT_EQ(2, region.verifyAllGuards(corrupted, 1));
+
+    // Incrementally, one pass over all 200 takes 4 calls
+    size_t numCorrupted = 0;
+    for (int i = 0; i < 4; ++i) {
+        numCorrupted += region.verifyGuards(60);
+    }
+    EXPECT_EQ(2, numCorrupted);
+    numCorrupted = 0;
+    for (int i = 0; i < 4; ++i) {
+        numCorrupted += region.verifyGuards(60);
+    }
+    EXPECT_EQ(2, numCorrupted);
+
+    // Releases in the middle of a pass don't lose its place
+    EXPECT_EQ(0, region.verifyGuards(10));
+    region.release(allocs[10]);
+    region.release(allocs[11]);
+    allocs.erase(allocs.begin() + 10, allocs.begin() + 12);
+    EXPECT_EQ(1, region.verifyGuards(10));
+
+    allocs[17 - 2][18] = back;
+    allocs[150 - 2][-1] = front;
+    EXPECT_EQ(0, region.verifyAllGuards());
+
+    for (char* addr: allocs) {
+        region.release(addr);
+    }
+    EXPECT_EQ(0, region.verifyGuards(10));
+}
+
+TEST_F(RegionF, VerifyGuardsWholeChunks)
+{
+    mem::Region<
+        mem::MallocAllocator,
+        mem::SingleThreaded,
+        mem::BoundsChecking,
+        mem::SourceTracking,
+        mem::NoMarking> 
+            region;
+
+    // The end of the list falls exactly on the end of a chunk, which mustn't start over
+    std::vector<char*> allocs;
+    for (size_t i = 0; i < 128; ++i) {
+        allocs.push_back((char*)region.allocate(16, 4, mem::SourceInfo("test_file.cpp", 123)));
+    }
+    char back = allocs[3][16];
+    allocs[3][16] = 0;
+
+    void* corrupted[4];
+    EXPECT_EQ(1, region.verifyAllGuards(corrupted, 4));
+    EXPECT_EQ(1, region.verifyGuards(200, corrupted, 4));
+    EXPECT_EQ(allocs[3], corrupted[0]);
+    EXPECT_EQ(1, region.verifyGuards(200));
+
+    for (size_t i = 64; i < 128; ++i) {
+        region.release(allocs[i]);
+    }
+    allocs.resize(64);
+    EXPECT_EQ(1, region.verifyGuards(100, corrupted, 4));
+    EXPECT_EQ(1, region.verifyGuards(64));
+    EXPECT_EQ(1, region.verifyGuards(100));
+
+    allocs[3][16] = back;
+    for (char* addr: allocs) {
+        region.release(addr);
+    }
+}
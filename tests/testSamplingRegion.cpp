@@ -0,0 +1,254 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <vector>
+
+#include "mem/area.h"
+#include "mem/boundsChecking.h"
+#include "mem/guardedSlotPool.h"
+#include "mem/heapAllocator.h"
+#include "mem/linearAllocator.h"
+#include "mem/marking.h"
+#include "mem/region.h"
+#include "mem/samplingRegion.h"
+#include "mem/threading.h"
+#include "mem/tracking.h"
+#include "util/memory.h"
+
+typedef mem::Region<
+    mem::HeapAllocator,
+    mem::SingleThreaded,
+    mem::NoBoundsChecking,
+    mem::NoTracking,
+    mem::NoMarking>
+        HeapRegion;
+
+typedef mem::Region<
+    mem::LinearAllocator,
+    mem::SingleThreaded,
+    mem::NoBoundsChecking,
+    mem::NoTracking,
+    mem::NoMarking>
+        LinearRegion;
+
+namespace {
+
+/**
+ * The countdown is shared with earlier regions of the same type, runs it down so the
+ * next allocation samples with a rate of 1.
+ */
+template <class RegionType>
+void runDownCountdown(mem::SamplingRegion<RegionType>& region)
+{
+    bool isSampled = false;
+    while (!isSampled) {
+        void* x = region.allocate(1, mem::DefaultAlignment, mem::SourceInfo());
+        isSampled = region.getPool().contains(x);
+        region.release(x);
+    }
+}
+
+}
+
+TEST(GuardedSlotPool, AllocRelease)
+{
+    const size_t PageSize = util::getPageSize();
+    mem::GuardedSlotPool pool(4);
+    EXPECT_EQ(4, pool.getNumSlots());
+    EXPECT_EQ(PageSize, pool.getSlotSize());
+
+    // Alternates between the end and the start of a slot
+    char* x = (char*)pool.allocate(100, 1, mem::SourceInfo());
+    EXPECT_TRUE(pool.contains(x));
+    EXPECT_EQ(0, (size_t)(x + 100)%PageSize);
+    char* y = (char*)pool.allocate(100, 16, mem::SourceInfo());
+    EXPECT_EQ(0, (size_t)y%PageSize);
+    char* z = (char*)pool.allocate(100, 16, mem::SourceInfo());
+    EXPECT_EQ(0, (size_t)z%16);
+    EXPECT_LT(PageSize - 16, (size_t)(z + 99)%PageSize);
+    memset(x, 0xff, 100);
+    memset(y, 0xff, 100);
+    memset(z, 0xff, 100);
+    EXPECT_EQ(100, pool.getAllocationSize(x));
+    EXPECT_EQ(3, pool.getNumAllocated());
+
+    // Too large, then out of slots
+    EXPECT_TRUE(pool.allocate(PageSize + 1, 1, mem::SourceInfo()) == nullptr);
+    void* w = pool.allocate(PageSize, 1, mem::SourceInfo());
+    EXPECT_TRUE(w != nullptr);
+    EXPECT_TRUE(pool.allocate(1, 1, mem::SourceInfo()) == nullptr);
+
+    pool.release(x);
+    pool.release(y);
+    pool.release(z);
+    pool.release(w);
+    EXPECT_EQ(0, pool.getNumAllocated());
+    EXPECT_FALSE(pool.contains(&pool));
+}
+
+TEST(GuardedSlotPool, DelayedReuse)
+{
+    const size_t PageSize = util::getPageSize();
+    mem::GuardedSlotPool pool(4);
+
+    // Slots are reused in the order they were released
+    std::vector<size_t> pages;
+    for (int i = 0; i < 8; ++i) {
+        char* x = (char*)pool.allocate(8, 8, mem::SourceInfo());
+        pages.push_back((size_t)x/PageSize);
+        pool.release(x);
+    }
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(pages[i], pages[i + 4]);
+        for (int j = i + 1; j < 4; ++j) {
+            EXPECT_NE(pages[i], pages[j]);
+        }
+    }
+}
+
+TEST(GuardedSlotPool, Faults)
+{
+    mem::GuardedSlotPool pool(4);
+
+    volatile char* x = (char*)pool.allocate(100, 1, mem::SourceInfo("overflow.cpp", 12));
+    EXPECT_DEATH(x[100] = 1, "Buffer overflow.*0 bytes after the 100 byte allocation.*\n"
+            "Allocated at overflow.cpp:12");
+
+    volatile char* y = (char*)pool.allocate(100, 1, mem::SourceInfo("underflow.cpp", 34));
+    EXPECT_DEATH(y[-3] = 1, "Buffer underflow.*3 bytes before.*underflow.cpp:34");
+
+    pool.release((void*)x);
+    EXPECT_DEATH(x[0] = 1, "Use after free.*overflow.cpp:12(.|\n)*Released by");
+    EXPECT_DEATH(pool.release((void*)x), "Double free");
+    EXPECT_DEATH(pool.release((void*)(y + 1)), "Invalid free");
+
+    pool.release((void*)y);
+}
+
+TEST(GuardedSlotPool, SampleInterval)
+{
+    EXPECT_EQ(1, mem::GuardedSlotPool::getSampleInterval(1));
+
+    size_t total = 0;
+    for (int i = 0; i < 10000; ++i) {
+        int interval = mem::GuardedSlotPool::getSampleInterval(100);
+        EXPECT_TRUE(interval >= 1 && interval < 200);
+        total += interval;
+    }
+    EXPECT_NEAR(100, total/10000.0, 10);
+}
+
+TEST(SamplingRegion, AllocRelease)
+{
+    mem::SamplingRegion<HeapRegion> region(1, 4);
+    EXPECT_EQ(1, region.getSampleRate());
+    runDownCountdown(region);
+
+    // Every allocation is sampled until the slots run out
+    std::vector<void*> allocs;
+    for (int i = 0; i < 6; ++i) {
+        void* x = region.allocate(100, mem::DefaultAlignment, mem::SourceInfo());
+        memset(x, 0xff, 100);
+        allocs.push_back(x);
+    }
+    EXPECT_EQ(4, region.getPool().getNumAllocated());
+
+    // Large allocations don't fit a slot
+    void* large = region.allocate(util::kilobytes(64), mem::DefaultAlignment, mem::SourceInfo());
+    EXPECT_FALSE(region.getPool().contains(large));
+    region.release(large);
+
+    for (void* addr: allocs) {
+        region.release(addr);
+    }
+    EXPECT_EQ(0, region.getPool().getNumAllocated());
+
+    // Batches mix sampled and regular blocks
+    void* batch[8];
+    EXPECT_EQ(4, region.allocateBatch(32, mem::DefaultAlignment, 4, batch, mem::SourceInfo()));
+    batch[4] = region.allocate(32, mem::DefaultAlignment, mem::SourceInfo());
+    batch[5] = region.allocate(32, mem::DefaultAlignment, mem::SourceInfo());
+    std::swap(batch[1], batch[4]);
+    EXPECT_EQ(2, region.getPool().getNumAllocated());
+    region.releaseBatch(batch, 6);
+    EXPECT_EQ(0, region.getPool().getNumAllocated());
+}
+
+TEST(SamplingRegion, ZeroSize)
+{
+    mem::SamplingRegion<HeapRegion> region(1, 4);
+    runDownCountdown(region);
+
+    // Both ends of a slot
+    void* x = region.allocate(0, mem::DefaultAlignment, mem::SourceInfo());
+    void* y = region.allocate(0, mem::DefaultAlignment, mem::SourceInfo());
+    EXPECT_TRUE(region.getPool().contains(x));
+    EXPECT_TRUE(region.getPool().contains(y));
+    EXPECT_EQ(0, region.getPool().getAllocationSize(x));
+    EXPECT_EQ(0, region.getPool().getAllocationSize(y));
+    region.release(x);
+    region.release(y);
+    EXPECT_EQ(0, region.getPool().getNumAllocated());
+}
+
+TEST(SamplingRegion, Reallocate)
+{
+    mem::SamplingRegion<HeapRegion> region(1, 4);
+    runDownCountdown(region);
+
+    char* x = (char*)region.allocate(16, mem::DefaultAlignment, mem::SourceInfo());
+    EXPECT_TRUE(region.getPool().contains(x));
+    strcpy(x, "sampled");
+    EXPECT_FALSE(region.tryExpandInPlace(x, 32));
+
+    char* y = (char*)region.reallocate(x, 1000, mem::DefaultAlignment, mem::SourceInfo());
+    EXPECT_TRUE(region.getPool().contains(y));
+    EXPECT_STREQ("sampled", y);
+    EXPECT_EQ(1, region.getPool().getNumAllocated());
+
+    char* z = (char*)region.reallocate(y, util::kilobytes(16), mem::DefaultAlignment, mem::SourceInfo());
+    EXPECT_FALSE(region.getPool().contains(z));
+    EXPECT_STREQ("sampled", z);
+    EXPECT_EQ(0, region.getPool().getNumAllocated());
+    region.release(z);
+}
+
+TEST(SamplingRegion, ReallocateOutOfMemory)
+{
+    mem::StackArea<1024> area;
+    mem::SamplingRegion<LinearRegion> region(1, 4, area);
+    runDownCountdown(region);
+
+    // Too large for a slot and the region, the sampled block stays allocated
+    char* x = (char*)region.allocate(16, mem::DefaultAlignment, mem::SourceInfo());
+    EXPECT_TRUE(region.getPool().contains(x));
+    strcpy(x, "sampled");
+    EXPECT_TRUE(region.reallocate(x, util::kilobytes(8), mem::DefaultAlignment, mem::SourceInfo()) == nullptr);
+    EXPECT_EQ(1, region.getPool().getNumAllocated());
+    EXPECT_STREQ("sampled", x);
+    region.release(x);
+}
+
+TEST(SamplingRegion, SampleRate)
+{
+    mem::SamplingRegion<HeapRegion> region(20, 4);
+
+    size_t numSampled = 0;
+    for (int i = 0; i < 20000; ++i) {
+        void* x = region.allocate(64, mem::DefaultAlignment, mem::SourceInfo());
+        numSampled += region.getPool().contains(x) ? 1 : 0;
+        region.release(x);
+    }
+    EXPECT_NEAR(1000, numSampled, 200);
+}
+
+TEST(SamplingRegion, Fault)
+{
+    mem::SamplingRegion<HeapRegion> region(1, 4);
+    runDownCountdown(region);
+
+    volatile char* x = (char*)region.allocate(
+            24, mem::DefaultAlignment, mem::SourceInfo("sampled.cpp", 7));
+    region.release((void*)x);
+    EXPECT_DEATH(x[0] = 1, "Use after free.*\nAllocated at sampled.cpp:7");
+}
@@ -0,0 +1,41 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+#include "mem/arenaHeapAllocator.h"
+#include "mem/scavenger.h"
+
+TEST(Scavenger, Decay)
+{
+    mem::ArenaHeapAllocator allocator;
+    mem::Scavenger<mem::ArenaHeapAllocator> scavenger(allocator, std::chrono::milliseconds(10000), 0.5);
+
+    void* small = allocator.allocate(100);
+    allocator.release(allocator.allocate(util::megabytes(2)));
+
+    // Each tick releases about half of what's left
+    size_t residentBytes = allocator.getResidentFreeBytes();
+    EXPECT_LT(0, scavenger.scavenge());
+    EXPECT_GE(residentBytes/2 + util::kilobytes(64), allocator.getResidentFreeBytes());
+
+    // Unmapped segments release their overhead as well
+    EXPECT_LE(residentBytes - allocator.getResidentFreeBytes(), scavenger.getReleasedBytes());
+
+    allocator.release(small);
+}
+
+TEST(Scavenger, Background)
+{
+    mem::ArenaHeapAllocator allocator;
+    void* small = allocator.allocate(100);
+    allocator.release(allocator.allocate(util::megabytes(2)));
+
+    mem::Scavenger<mem::ArenaHeapAllocator> scavenger(allocator, std::chrono::milliseconds(1), 1.0);
+    for (int i = 0; i < 1000 && scavenger.getReleasedBytes() == 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_LT(util::megabytes(1), scavenger.getReleasedBytes());
+
+    allocator.release(small);
+}
@@ -106,3 +106,26 @@ TEST(StlAdapter, StlMap)
     EXPECT_EQ(3, m1["three"]);
 }
 
+
+TEST(StlAdapter, Reallocate)
+{
+    mem::StlAdapter<int> adapter(mallocRegion);
+
+    int* x = adapter.allocate(4);
+    for (int i = 0; i < 4; ++i) {
+        x[i] = i;
+    }
+
+    x = adapter.reallocate(x, 1000);
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(i, x[i]);
+    }
+    x[999] = 5;
+
+    // Malloc can't resize in place
+    EXPECT_FALSE(adapter.tryExpandInPlace(x, 2000));
+    adapter.shrinkInPlace(x, 10);
+    EXPECT_EQ(3, x[3]);
+
+    adapter.deallocate(x, 10);
+}
@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "mem/boundsChecking.h"
+#include "mem/heapAllocator.h"
+#include "mem/marking.h"
+#include "mem/region.h"
+#include "mem/threading.h"
+#include "mem/tlsfAllocator.h"
+#include "mem/tracking.h"
+
+typedef mem::Region<
+    mem::TlsfAllocator,
+    mem::SingleThreaded,
+    mem::BoundsChecking,
+    mem::NoTracking,
+    mem::Marking>
+        TlsfCheckedRegion;
+
+TEST(TlsfAllocator, AllocRelease)
+{
+    mem::TlsfAllocator allocator;
+
+    void* x = allocator.allocate(0);
+    EXPECT_TRUE(x != nullptr);
+
+    char* y = (char*)allocator.allocate(100);
+    EXPECT_TRUE(y != nullptr);
+    EXPECT_EQ(0, (size_t)y%8);
+    EXPECT_LE(100, allocator.getAllocationSize(y));
+    memset(y, 0xff, allocator.getAllocationSize(y));
+    EXPECT_TRUE(allocator.check());
+
+    mem::TlsfAllocator::Stats stats = allocator.getStats();
+    EXPECT_EQ(2, stats.allocatedBlocks);
+    EXPECT_EQ(1, stats.freeBlocks);
+    EXPECT_EQ(1, stats.numPools);
+
+    allocator.release(x);
+    allocator.release(y);
+    EXPECT_TRUE(allocator.check());
+
+    stats = allocator.getStats();
+    EXPECT_EQ(0, stats.allocatedBlocks);
+    EXPECT_EQ(0, stats.allocatedBytes);
+    EXPECT_EQ(1, stats.freeBlocks);
+}
+
+TEST(TlsfAllocator, Coalescing)
+{
+    mem::TlsfAllocator allocator(util::kilobytes(64), 0);
+    const size_t FreeBytes = allocator.getStats().freeBytes;
+
+    void* allocs[5];
+    for (int i = 0; i < 5; ++i) {
+        allocs[i] = allocator.allocate(64 + i*100);
+    }
+
+    // Free neighbours on either side are merged no matter the order of release
+    allocator.release(allocs[1]);
+    allocator.release(allocs[3]);
+    EXPECT_EQ(3, allocator.getStats().freeBlocks);
+    allocator.release(allocs[2]);
+    EXPECT_EQ(2, allocator.getStats().freeBlocks);
+    EXPECT_TRUE(allocator.check());
+
+    allocator.release(allocs[4]);
+    allocator.release(allocs[0]);
+    EXPECT_TRUE(allocator.check());
+
+    mem::TlsfAllocator::Stats stats = allocator.getStats();
+    EXPECT_EQ(1, stats.freeBlocks);
+    EXPECT_EQ(FreeBytes, stats.freeBytes);
+
+    // The pool is a single block again, requests are rounded up to the next size class
+    // so one a little smaller than it is needed to find it
+    void* x = allocator.allocate(FreeBytes - util::kilobytes(4));
+    EXPECT_TRUE(x != nullptr);
+    allocator.release(x);
+}
+
+TEST(TlsfAllocator, Area)
+{
+    char area[util::kilobytes(4)];
+    mem::TlsfAllocator allocator(area, area + sizeof(area));
+
+    std::vector<void*> allocs;
+    while (void* x = allocator.allocate(100)) {
+        EXPECT_TRUE(x >= area && (char*)x + 100 <= area + sizeof(area));
+        allocs.push_back(x);
+    }
+    EXPECT_LT(30, allocs.size());
+
+    // An area never grows
+    mem::TlsfAllocator::Stats stats = allocator.getStats();
+    EXPECT_EQ(1, stats.numPools);
+    EXPECT_TRUE(allocator.check());
+
+    for (void* ptr: allocs) {
+        allocator.release(ptr);
+    }
+    EXPECT_EQ(1, allocator.getStats().freeBlocks);
+}
+
+TEST(TlsfAllocator, Growth)
+{
+    mem::TlsfAllocator allocator(util::kilobytes(4), util::kilobytes(16));
+
+    std::vector<void*> allocs;
+    for (int i = 0; i < 100; ++i) {
+        allocs.push_back(allocator.allocate(1000));
+        EXPECT_TRUE(allocs.back() != nullptr);
+    }
+    EXPECT_LT(1, allocator.getStats().numPools);
+
+    // Requests larger than growSize get a pool of their own
+    void* x = allocator.allocate(util::kilobytes(100));
+    EXPECT_TRUE(x != nullptr);
+    memset(x, 0xff, util::kilobytes(100));
+    allocs.push_back(x);
+    EXPECT_TRUE(allocator.check());
+
+    for (void* ptr: allocs) {
+        allocator.release(ptr);
+    }
+    EXPECT_TRUE(allocator.check());
+    EXPECT_EQ(0, allocator.getStats().allocatedBlocks);
+
+    mem::TlsfAllocator fixed(util::kilobytes(4), 0);
+    EXPECT_TRUE(fixed.allocate(util::kilobytes(8)) == nullptr);
+    EXPECT_TRUE(fixed.allocate(mem::TlsfAllocator::MaxAllocationSize + 1) == nullptr);
+}
+
+TEST(TlsfAllocator, Alignment)
+{
+    mem::TlsfAllocator allocator(util::kilobytes(64), 0);
+
+    std::vector<void*> allocs;
+    size_t alignments[] = {4, 8, 16, 64, 256, 4096};
+    size_t offsets[] = {0, 4, 12, 32};
+    for (size_t alignment: alignments) {
+        for (size_t offset: offsets) {
+            char* x = (char*)allocator.allocate(offset + 50, alignment, offset);
+            ASSERT_TRUE(x != nullptr);
+            EXPECT_EQ(0, (size_t)(x + offset)%alignment);
+            EXPECT_LE(offset + 50, allocator.getAllocationSize(x));
+            memset(x, 0xff, allocator.getAllocationSize(x));
+            allocs.push_back(x);
+        }
+    }
+    EXPECT_TRUE(allocator.check());
+
+    for (void* ptr: allocs) {
+        allocator.release(ptr);
+    }
+    EXPECT_TRUE(allocator.check());
+    EXPECT_EQ(1, allocator.getStats().freeBlocks);
+}
+
+TEST(TlsfAllocator, ResizeInPlace)
+{
+    mem::TlsfAllocator allocator(util::kilobytes(64), 0);
+
+    char* x = (char*)allocator.allocate(100);
+    char* y = (char*)allocator.allocate(100);
+    memset(x, 0x55, 100);
+
+    // Nothing free follows x
+    EXPECT_FALSE(allocator.tryExpandInPlace(x, 200));
+    EXPECT_TRUE(allocator.tryExpandInPlace(x, 100));
+
+    allocator.release(y);
+    EXPECT_TRUE(allocator.tryExpandInPlace(x, 1000));
+    EXPECT_LE(1000, allocator.getAllocationSize(x));
+    EXPECT_TRUE(allocator.check());
+
+    allocator.shrinkInPlace(x, 50);
+    EXPECT_GT(100, allocator.getAllocationSize(x));
+    EXPECT_EQ(0x55, (unsigned char)x[49]);
+    EXPECT_TRUE(allocator.check());
+
+    char* z = (char*)allocator.reallocate(x, 300);
+    EXPECT_EQ(x, z);
+    EXPECT_EQ(0x55, (unsigned char)z[49]);
+
+    allocator.release(z);
+    EXPECT_TRUE(allocator.check());
+    EXPECT_EQ(1, allocator.getStats().freeBlocks);
+}
+
+TEST(TlsfAllocator, Stress)
+{
+    mem::TlsfAllocator allocator(util::kilobytes(256), util::kilobytes(64));
+    std::vector<std::pair<unsigned char*, size_t>> allocs;
+    unsigned int seed = 1;
+
+    for (int i = 0; i < 20000; ++i) {
+        if (allocs.empty() || rand_r(&seed)%10 < 6) {
+            size_t numBytes = 1 + rand_r(&seed)%(rand_r(&seed)%8 ? 256 : 16384);
+            size_t alignment = static_cast<size_t>(4) << rand_r(&seed)%5;
+            unsigned char* x = (unsigned char*)allocator.allocate(numBytes, alignment);
+            ASSERT_TRUE(x != nullptr);
+            ASSERT_EQ(0, (size_t)x%alignment);
+
+            // Tag every byte to catch blocks which overlap
+            memset(x, i%256, numBytes);
+            allocs.push_back(std::make_pair(x, numBytes));
+        } else {
+            size_t releaseIndex = rand_r(&seed)%allocs.size();
+            unsigned char* x = allocs[releaseIndex].first;
+            size_t numBytes = allocs[releaseIndex].second;
+            ASSERT_EQ(0, memcmp(x, x + 1, numBytes - 1));
+
+            allocator.release(x);
+            allocs[releaseIndex] = allocs.back();
+            allocs.pop_back();
+        }
+
+        if (i%1000 == 0) {
+            ASSERT_TRUE(allocator.check());
+        }
+    }
+
+    for (auto& alloc: allocs) {
+        allocator.release(alloc.first);
+    }
+    EXPECT_TRUE(allocator.check());
+    EXPECT_EQ(0, allocator.getStats().allocatedBlocks);
+}
+
+TEST(TlsfAllocator, Region)
+{
+    TlsfCheckedRegion region(util::kilobytes(64));
+
+    std::vector<void*> allocs;
+    for (size_t i = 0; i < 100; ++i) {
+        void* x = region.allocate(1 + i*7, 16, mem::SourceInfo());
+        ASSERT_TRUE(x != nullptr);
+        EXPECT_EQ(0, (size_t)x%16);
+        memset(x, 0xff, 1 + i*7);
+        allocs.push_back(x);
+    }
+
+    for (void* ptr: allocs) {
+        region.release(ptr);
+    }
+}
+
+namespace {
+
+struct Latency
+{
+    double mean;
+    double percentile;
+    double worst;
+};
+
+// Mean, 99.99th percentile and worst of the samples. The worst case includes preemption
+// and page faults, the percentile shows the allocator's own tail.
+Latency summarizeLatency(std::vector<double>& samples)
+{
+    std::sort(samples.begin(), samples.end());
+
+    Latency latency;
+    latency.mean = 0;
+    for (double sample: samples) {
+        latency.mean += sample;
+    }
+    latency.mean /= samples.size();
+    latency.percentile = samples[samples.size()*9999/10000];
+    latency.worst = samples.back();
+    return latency;
+}
+
+// Times every single operation of a random workload which keeps a number of blocks live,
+// the tail is what bounded-latency callers care about
+template <class Allocator>
+void latencyBenchmark(Allocator& allocator, size_t numEvents, size_t numLive, Latency* allocLatency, Latency* releaseLatency)
+{
+    typedef std::chrono::steady_clock Clock;
+    std::vector<double> allocSamples;
+    std::vector<double> releaseSamples;
+    allocSamples.reserve(numEvents);
+    releaseSamples.reserve(numEvents);
+
+    std::vector<void*> allocs(numLive, nullptr);
+    unsigned int seed = 1;
+
+    for (size_t i = 0; i < numEvents; ++i) {
+        size_t index = rand_r(&seed)%numLive;
+        size_t numBytes = 16 + rand_r(&seed)%(rand_r(&seed)%16 ? 512 : 64*1024);
+
+        if (allocs[index]) {
+            Clock::time_point start = Clock::now();
+            allocator.release(allocs[index]);
+            releaseSamples.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+        }
+
+        Clock::time_point start = Clock::now();
+        allocs[index] = allocator.allocate(numBytes);
+        allocSamples.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+
+    for (void* ptr: allocs) {
+        allocator.release(ptr);
+    }
+
+    if (allocLatency && releaseLatency) {
+        *allocLatency = summarizeLatency(allocSamples);
+        *releaseLatency = summarizeLatency(releaseSamples);
+    }
+}
+
+void printLatency(const char* name, const Latency& allocLatency, const Latency& releaseLatency)
+{
+    printf("  %s  alloc %6.3f / %7.3f / %9.3f us   release %6.3f / %7.3f / %9.3f us\n", name,
+            allocLatency.mean, allocLatency.percentile, allocLatency.worst,
+            releaseLatency.mean, releaseLatency.percentile, releaseLatency.worst);
+}
+
+}
+
+TEST(DISABLED_TlsfAllocator, LatencyBenchmark)
+{
+    const size_t NumEvents = 2000000;
+    const size_t NumLive = 10000;
+
+    // Both allocators get enough memory up front so neither has to go to the OS
+    mem::TlsfAllocator tlsf(util::megabytes(512), 0);
+    mem::HeapAllocator heap(util::megabytes(512));
+
+    // Warm up so page faults on first touch aren't counted against either
+    latencyBenchmark(tlsf, NumEvents/4, NumLive, nullptr, nullptr);
+    latencyBenchmark(heap, NumEvents/4, NumLive, nullptr, nullptr);
+
+    Latency tlsfAlloc, tlsfRelease, heapAlloc, heapRelease;
+    latencyBenchmark(tlsf, NumEvents, NumLive, &tlsfAlloc, &tlsfRelease);
+    latencyBenchmark(heap, NumEvents, NumLive, &heapAlloc, &heapRelease);
+
+    printf("%zu random allocations/releases of 16 B - 64 KB, %zu live blocks\n", NumEvents, NumLive);
+    printf("Mean / 99.99th percentile / worst\n");
+    printLatency("TlsfAllocator", tlsfAlloc, tlsfRelease);
+    printLatency("HeapAllocator", heapAlloc, heapRelease);
+}
@@ -13,3 +13,21 @@ TEST(UtilTest, NextAlignedAddress)
     EXPECT_EQ((void*)1000, mem::align((void*)999, 4));
 }
 
+
+TEST(UtilTest, NextPowerOfTwo)
+{
+    EXPECT_EQ(1, util::nextPowerOfTwo(0));
+    EXPECT_EQ(1, util::nextPowerOfTwo(1));
+    EXPECT_EQ(4, util::nextPowerOfTwo(3));
+    EXPECT_EQ(4096, util::nextPowerOfTwo(4096));
+    EXPECT_EQ(8192, util::nextPowerOfTwo(4097));
+}
+
+TEST(UtilTest, IsPowerOfTwo)
+{
+    EXPECT_FALSE(util::isPowerOfTwo(0));
+    EXPECT_TRUE(util::isPowerOfTwo(1));
+    EXPECT_FALSE(util::isPowerOfTwo(12));
+    EXPECT_TRUE(util::isPowerOfTwo(static_cast<size_t>(1) << 40));
+    EXPECT_FALSE(util::isPowerOfTwo((static_cast<size_t>(1) << 40) + 4));
+}
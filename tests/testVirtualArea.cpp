@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <vector>
+
+#include "mem/heapAllocator.h"
+#include "mem/linearAllocator.h"
+#include "mem/virtualArea.h"
+#include "util/units.h"
+
+TEST(VirtualArea, CommitDecommit)
+{
+    mem::VirtualArea area(util::megabytes(1) + 1);
+    size_t pageSize = area.getPageSize();
+    EXPECT_EQ(util::megabytes(1) + pageSize, area.getReservedSize());
+    EXPECT_EQ(0, area.getCommittedSize());
+    EXPECT_EQ(area.start(), area.end());
+    EXPECT_EQ(0, (size_t)area.start()%pageSize);
+
+    // Commits are rounded up to whole pages
+    ASSERT_TRUE(area.commit(1));
+    EXPECT_EQ(pageSize, area.getCommittedSize());
+    ASSERT_TRUE(area.commit(3*pageSize));
+    EXPECT_EQ(3*pageSize, area.getCommittedSize());
+    EXPECT_EQ((char*)area.start() + 3*pageSize, area.end());
+
+    // Committing less doesn't shrink it
+    ASSERT_TRUE(area.commit(pageSize));
+    EXPECT_EQ(3*pageSize, area.getCommittedSize());
+
+    memset(area.start(), 0xfe, 3*pageSize);
+
+    area.decommit(pageSize + 1);
+    EXPECT_EQ(2*pageSize, area.getCommittedSize());
+    EXPECT_EQ((char)0xfe, ((char*)area.start())[2*pageSize - 1]);
+
+    // Decommitted pages come back zeroed
+    ASSERT_TRUE(area.commit(3*pageSize));
+    EXPECT_EQ(0, ((char*)area.start())[2*pageSize]);
+
+    EXPECT_FALSE(area.commit(area.getReservedSize() + 1));
+    ASSERT_TRUE(area.commit(area.getReservedSize()));
+    EXPECT_EQ(area.getReservedSize(), area.getCommittedSize());
+
+    EXPECT_TRUE(area.contains(area.start()));
+    EXPECT_TRUE(area.contains((char*)area.start() + area.getReservedSize() - 1));
+    EXPECT_FALSE(area.contains((char*)area.start() + area.getReservedSize()));
+
+    area.decommit(0);
+    EXPECT_EQ(0, area.getCommittedSize());
+}
+
+TEST(VirtualArea, LinearAllocator)
+{
+    mem::VirtualArea area(util::megabytes(1));
+    mem::LinearAllocator allocator(area, 8);
+    EXPECT_EQ(0, area.getCommittedSize());
+
+    // Grows in place one commit at a time
+    std::vector<char*> allocs;
+    for (int i = 0; i < 1000; ++i) {
+        char* addr = (char*)allocator.allocate(100);
+        ASSERT_TRUE(addr != nullptr);
+        memset(addr, i, 100);
+        if (!allocs.empty()) {
+            EXPECT_EQ(allocs.back() + 104, addr);
+        }
+        allocs.push_back(addr);
+    }
+    EXPECT_GE(area.getCommittedSize(), 1000*104);
+    EXPECT_LT(area.getCommittedSize(), 2*1000*104 + area.getPageSize());
+    EXPECT_EQ(area.getCommittedSize() - allocator.getStats().allocatedBytes, allocator.getStats().freeBytes);
+
+    // Up to the reserved size but no further
+    EXPECT_TRUE(allocator.allocate(util::megabytes(1) - 2*1000*104) != nullptr);
+    EXPECT_TRUE(allocator.allocate(util::megabytes(1)) == nullptr);
+
+    // Clearing keeps the memory committed, trimming hands it back
+    allocator.clear();
+    size_t committedSize = area.getCommittedSize();
+    EXPECT_EQ(committedSize, allocator.getStats().freeBytes);
+    allocator.trim(util::kilobytes(16));
+    EXPECT_EQ(util::kilobytes(16), area.getCommittedSize());
+    EXPECT_EQ(util::kilobytes(16), allocator.getStats().freeBytes);
+
+    allocator.allocate(util::kilobytes(8));
+    allocator.trim();
+    EXPECT_EQ(util::kilobytes(8) + area.getPageSize(), area.getCommittedSize());
+
+    // And grows again afterwards
+    EXPECT_TRUE(allocator.allocate(util::kilobytes(64)) != nullptr);
+
+    mem::AlignedLinearAllocator<16> aligned(area);
+    EXPECT_TRUE(aligned.allocate(util::kilobytes(256)) != nullptr);
+    EXPECT_GE(area.getCommittedSize(), util::kilobytes(256));
+}
+
+TEST(VirtualArea, HeapAllocator)
+{
+    mem::VirtualArea area(util::megabytes(1));
+    {
+        mem::HeapAllocator allocator(area, util::kilobytes(4));
+        EXPECT_EQ(util::kilobytes(4) + area.getPageSize(), area.getCommittedSize());
+
+        // Every new segment follows the last one in the area and is merged into it
+        std::vector<void*> allocs;
+        for (int i = 0; i < 200; ++i) {
+            void* addr = allocator.allocate(1000);
+            ASSERT_TRUE(addr != nullptr);
+            EXPECT_TRUE(area.contains(addr));
+            allocs.push_back(addr);
+        }
+        EXPECT_EQ(1, allocator.getStats().numRegularSegments);
+        EXPECT_GE(area.getCommittedSize(), 200*1000);
+        EXPECT_TRUE(allocator.check());
+
+        // Segments are mapped separately once the area runs out
+        std::vector<void*> largeAllocs;
+        for (int i = 0; i < 20; ++i) {
+            void* addr = allocator.allocate(util::kilobytes(100));
+            ASSERT_TRUE(addr != nullptr);
+            largeAllocs.push_back(addr);
+        }
+        EXPECT_FALSE(area.contains(largeAllocs.back()));
+        EXPECT_LT(1, allocator.getStats().numRegularSegments);
+        EXPECT_TRUE(allocator.check());
+
+        for (void* addr : largeAllocs) {
+            allocator.release(addr);
+        }
+        for (void* addr : allocs) {
+            allocator.release(addr);
+        }
+        EXPECT_TRUE(allocator.check());
+    }
+
+    // Whatever the allocator committed is handed back with it
+    EXPECT_EQ(0, area.getCommittedSize());
+}
+
+TEST(VirtualArea, HeapAllocatorInteriorSegments)
+{
+    mem::VirtualArea area(util::megabytes(1));
+    {
+        mem::HeapAllocator allocator(area, util::kilobytes(4));
+        allocator.enableSegmentMerging(false);
+
+        void* x = allocator.allocate(util::kilobytes(8));
+        void* y = allocator.allocate(util::kilobytes(8));
+        EXPECT_EQ(3, allocator.getStats().numRegularSegments);
+        size_t committedSize = area.getCommittedSize();
+
+        // The emptied segment is in the middle of the area, it stays to be reused rather than
+        // leaving a hole which is never committed again
+        allocator.release(x);
+        allocator.trim();
+        EXPECT_EQ(3, allocator.getStats().numRegularSegments);
+        x = allocator.allocate(util::kilobytes(8));
+        EXPECT_TRUE(area.contains(x));
+        EXPECT_EQ(committedSize, area.getCommittedSize());
+        EXPECT_TRUE(allocator.check());
+
+        // The last one is decommitted
+        allocator.release(y);
+        allocator.trim();
+        EXPECT_EQ(2, allocator.getStats().numRegularSegments);
+        EXPECT_GT(committedSize, area.getCommittedSize());
+        allocator.release(x);
+    }
+    EXPECT_EQ(0, area.getCommittedSize());
+}